@@ -0,0 +1,93 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8_aot.h"
+#include "chip8_cache.h"
+#include "chip8_emulator.h"
+#include "chip8_util.h"
+
+struct aot *aot_create(const struct chip8_aot_program *program)
+{
+    struct aot *aot = calloc(1, sizeof(*aot));
+    if (aot == NULL) {
+        return NULL;
+    }
+
+    aot->program = program;
+
+    return aot;
+}
+
+void aot_destroy(struct aot *aot)
+{
+    free(aot);
+}
+
+uint32_t aot_run(chip8_ctx *ctx, uint32_t num_cycles)
+{
+    struct emulator *em = &ctx->em;
+
+    uint32_t executed = 0;
+
+    while (executed < num_cycles && em->PC < MEMORY_SIZE - 1) {
+        uint32_t ran = ctx->aot->program->run(ctx, num_cycles - executed);
+        if (ran > 0) {
+            executed += ran;
+            continue;
+        }
+
+        // No block here (or it no longer fits the budget), one instruction
+        // through the decode cache and try again
+        ran = cache_run(ctx, 1);
+        if (ran == 0) {
+            break;
+        }
+
+        executed += ran;
+
+        // Same as every other engine, FX0A ends the batch
+        if ((em->opcode & 0xF0FF) == 0xF00A) {
+            break;
+        }
+    }
+
+    return executed;
+}
+
+void aot_invalidate(struct aot *aot, uint16_t addr, uint32_t len)
+{
+    const uint8_t *block_length = aot->program->block_length;
+
+    // Blocks start at most AOT_MAX_BLOCK_LEN instructions before the store,
+    // and one byte earlier still for a misaligned one
+    uint32_t first = addr > 2 * AOT_MAX_BLOCK_LEN + 1 ?
+                     addr - (2 * AOT_MAX_BLOCK_LEN + 1) : 0;
+    uint32_t end   = (uint32_t)addr + len;
+
+    for (uint32_t start = first; start < end && start < MEMORY_SIZE; start++) {
+        if (block_length[start] != 0 &&
+            start + 2u * block_length[start] > addr) {
+            aot->stale[start] = true;
+        }
+    }
+}
+
+void aot_revalidate(struct aot *aot, const uint8_t memory[MEMORY_SIZE])
+{
+    const struct chip8_aot_program *program = aot->program;
+
+    for (uint32_t start = 0; start < MEMORY_SIZE; start++) {
+        if (program->block_length[start] == 0) {
+            continue;
+        }
+
+        // Blocks only ever start inside the ROM image
+        uint32_t offset = start - PROG_START;
+        uint32_t len    = 2u * program->block_length[start];
+
+        aot->stale[start] = offset + len > program->rom_size ||
+                            memcmp(&memory[start], &program->rom[offset], len) != 0;
+    }
+}
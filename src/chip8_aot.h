@@ -0,0 +1,57 @@
+#ifndef CHIP8_AOT_H
+#define CHIP8_AOT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "chip8_emulator.h"
+#include "chip8_quirks.h"
+#include "chip8_util.h"
+
+// Longest block chip8_aotc emits, bounds how far back a store has to look
+// for blocks it overlaps
+#define AOT_MAX_BLOCK_LEN 64
+
+// What chip8_aotc generates for one ROM
+struct chip8_aot_program {
+    const char *name;           // ROM the code was generated from
+    const uint8_t *rom;
+    uint16_t rom_size;
+
+    // Instructions in the block starting at each address, 0 when none
+    const uint8_t *block_length;
+
+    // Profile the code was generated for, enum chip8_quirks_profile
+    uint8_t quirks;
+
+    // Runs compiled blocks from em.PC for up to num_cycles instructions,
+    // returns how many ran (0 when there's no usable block at em.PC)
+    uint32_t (*run)(chip8_ctx *ctx, uint32_t num_cycles);
+};
+
+struct aot {
+    const struct chip8_aot_program *program;
+
+    // Set once a store hits a block's bytes, from then on that block is left
+    // to the interpreter
+    bool stale[MEMORY_SIZE];
+};
+
+// Defined by the generated translation unit of AOT builds
+extern const struct chip8_aot_program chip8_aot_program;
+
+struct aot *aot_create(const struct chip8_aot_program *program);
+void aot_destroy(struct aot *aot);
+
+// Same contract as jit_run(): compiled blocks where possible, the decode
+// cache for everything else (indirect jump targets, FX0A, modified code)
+uint32_t aot_run(chip8_ctx *ctx, uint32_t num_cycles);
+
+// Marks every block overlapping [addr, addr + len) stale
+void aot_invalidate(struct aot *aot, uint16_t addr, uint32_t len);
+
+// Un-stales every block whose bytes in memory match the ROM again, for when
+// memory got replaced as a whole (loading a saved state)
+void aot_revalidate(struct aot *aot, const uint8_t memory[MEMORY_SIZE]);
+
+#endif
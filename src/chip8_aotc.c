@@ -0,0 +1,621 @@
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8_aot.h"
+#include "chip8_decode.h"
+#include "chip8_quirks.h"
+#include "chip8_util.h"
+
+// Static recompiler: reads a ROM, follows every statically known path from
+// 0x200 and writes a C file with one label per basic block. The result gets
+// linked into chip8_main (built with CHIP8_AOT) in place of loading a ROM.
+
+struct block {
+    uint16_t start;
+    uint16_t length;
+
+    // Jump / call / return / skip last, otherwise execution continues at
+    // next (compiled or not)
+    bool terminated;
+    uint16_t next;
+};
+
+struct program {
+    uint8_t memory[MEMORY_SIZE];
+    uint16_t rom_end;
+
+    // Baked into the generated code, the binary can't run any other
+    enum chip8_quirks_profile quirks;
+
+    bool leader[MEMORY_SIZE];
+    uint16_t worklist[MEMORY_SIZE];
+    int worklist_len;
+
+    struct block *block_at[MEMORY_SIZE];
+    struct block blocks[MEMORY_SIZE];
+    int num_blocks;
+};
+
+static void print_usage(const char *prog_name);
+static bool read_rom(struct program *prog, const char *filename);
+static void add_leader(struct program *prog, uint32_t addr);
+static void find_blocks(struct program *prog);
+static void build_block(struct program *prog, uint16_t start);
+static bool fetch(const struct program *prog, uint32_t pc,
+                  struct chip8_instr *instr);
+static bool is_compilable(const struct chip8_instr *instr);
+static bool is_terminator(const struct chip8_instr *instr);
+static bool is_store(const struct chip8_instr *instr);
+static void emit_program(FILE *out, const struct program *prog,
+                         const char *rom_name);
+static void emit_block(FILE *out, const struct program *prog,
+                       const struct block *block);
+static void emit_instr(FILE *out, const struct program *prog,
+                       const struct chip8_instr *instr, uint16_t pc);
+static void emit_goto(FILE *out, const struct program *prog, uint32_t target,
+                      const char *indent);
+static bool uses_op(const struct program *prog, uint8_t op);
+
+int main(int argc, char *argv[])
+{
+    static const struct option long_options[] = {
+        { "output", required_argument, NULL, 'o' },
+        { "quirks", required_argument, NULL, 'q' },
+        { "help",   no_argument,       NULL, 'h' },
+        { NULL,     0,                 NULL, 0   }
+    };
+
+    static struct program prog;
+
+    const char *output = NULL;
+    int opt;
+
+    prog.quirks = CHIP8_QUIRKS_VIP;
+
+    while ((opt = getopt_long(argc, argv, "o:q:h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'o':
+                output = optarg;
+                break;
+            case 'q':
+                if (!chip8_quirks_parse(optarg, &prog.quirks)) {
+                    printf("ERROR: Unknown quirk profile '%s'!\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                return 0;
+            default:
+                print_usage(argv[0]);
+                return -1;
+        }
+    }
+
+    if (optind != argc - 1) {
+        print_usage(argv[0]);
+        return -1;
+    }
+
+    if (!read_rom(&prog, argv[optind])) {
+        return -1;
+    }
+
+    find_blocks(&prog);
+
+    FILE *out = stdout;
+    if (output != NULL) {
+        out = fopen(output, "w");
+        if (out == NULL) {
+            printf("ERROR: Unable to create %s!\n", output);
+            return -1;
+        }
+    }
+
+    // Only the file name goes into the generated code, keeps builds
+    // reproducible no matter where the tree lives
+    const char *rom_name = strrchr(argv[optind], '/');
+    rom_name = rom_name != NULL ? rom_name + 1 : argv[optind];
+
+    emit_program(out, &prog, rom_name);
+
+    if (out != stdout && fclose(out) != 0) {
+        printf("ERROR: Unable to write %s!\n", output);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void print_usage(const char *prog_name)
+{
+    printf("Usage: %s [options] path_to_ROM.ch8\n"
+           "  -o, --output FILE  write the generated C here instead of stdout\n"
+           "  -q, --quirks P     vip (default), chip48, schip or xochip\n"
+           "  -h, --help         show this message\n",
+           prog_name);
+}
+
+static bool read_rom(struct program *prog, const char *filename)
+{
+    FILE *rom_file = fopen(filename, "rb");
+    if (rom_file == NULL) {
+        printf("ERROR: Unable to open ROM file %s!\n", filename);
+        return false;
+    }
+
+    // One byte more than fits, to tell a full ROM from an oversized one
+    size_t size = fread(&prog->memory[PROG_START], 1, PROG_SIZE, rom_file);
+    bool too_big = fgetc(rom_file) != EOF;
+
+    fclose(rom_file);
+
+    if (too_big) {
+        printf("ERROR: ROM size is larger than max capacity of %d bytes!\n", PROG_SIZE);
+        return false;
+    }
+
+    prog->rom_end = PROG_START + size;
+
+    return true;
+}
+
+static void add_leader(struct program *prog, uint32_t addr)
+{
+    // Anything outside the ROM is left to the interpreter at run time
+    if (addr < PROG_START || addr >= prog->rom_end || prog->leader[addr]) {
+        return;
+    }
+
+    prog->leader[addr] = true;
+    prog->worklist[prog->worklist_len++] = addr;
+}
+
+static void find_blocks(struct program *prog)
+{
+    add_leader(prog, PROG_START);
+
+    while (prog->worklist_len > 0) {
+        build_block(prog, prog->worklist[--prog->worklist_len]);
+    }
+}
+
+static void build_block(struct program *prog, uint16_t start)
+{
+    struct block block = {
+        .start  = start,
+        .length = 0,
+    };
+    struct chip8_instr instr;
+
+    uint32_t pc = start;
+
+    for (;;) {
+        // A block that runs into another one just continues there
+        if (pc != start && pc < MEMORY_SIZE && prog->leader[pc]) {
+            block.next = pc;
+            break;
+        }
+
+        if (block.length == AOT_MAX_BLOCK_LEN) {
+            add_leader(prog, pc);
+            block.next = pc;
+            break;
+        }
+
+        if (!fetch(prog, pc, &instr) || !is_compilable(&instr)) {
+            // FX0A runs in the interpreter, compiled code picks up after it
+            if (instr.op == OP_LD_VX_K) {
+                add_leader(prog, pc + 2);
+            }
+
+            block.next = pc;
+            break;
+        }
+
+        block.length++;
+
+        if (is_terminator(&instr)) {
+            switch (instr.op) {
+                case OP_JP:
+                    add_leader(prog, instr.nnn);
+                    break;
+                case OP_CALL:
+                    add_leader(prog, instr.nnn);
+                    add_leader(prog, pc + 2);
+                    break;
+                case OP_RET:
+                case OP_JP_V0:
+                    // Target only known at run time, found through dispatch
+                    break;
+                default:
+                    // Skips
+                    add_leader(prog, pc + 2);
+                    add_leader(prog, pc + 4);
+                    break;
+            }
+
+            block.terminated = true;
+            break;
+        }
+
+        pc += 2;
+
+        // Stores may have changed what follows, continue through the
+        // stale check at the start of the next block
+        if (is_store(&instr)) {
+            add_leader(prog, pc);
+            block.next = pc;
+            break;
+        }
+    }
+
+    if (block.length == 0) {
+        return;
+    }
+
+    prog->blocks[prog->num_blocks] = block;
+    prog->block_at[start] = &prog->blocks[prog->num_blocks];
+    prog->num_blocks++;
+}
+
+static bool fetch(const struct program *prog, uint32_t pc,
+                  struct chip8_instr *instr)
+{
+    instr->op = OP_INVALID;
+
+    if (pc + 1 >= prog->rom_end) {
+        return false;
+    }
+
+    // Compiled programs are always plain CHIP-8
+    decode_instr(prog->memory[pc] << 8 | prog->memory[pc + 1], CHIP8_MODE_CHIP8, instr);
+
+    return true;
+}
+
+static bool is_compilable(const struct chip8_instr *instr)
+{
+    // Waiting on a key ends a batch, invalid opcodes only print an error
+    return instr->op != OP_LD_VX_K && instr->op != OP_INVALID &&
+           instr->op != OP_UNDECODED;
+}
+
+static bool is_terminator(const struct chip8_instr *instr)
+{
+    switch (instr->op) {
+        case OP_RET:
+        case OP_JP:
+        case OP_CALL:
+        case OP_SE_IMM:
+        case OP_SNE_IMM:
+        case OP_SE_REG:
+        case OP_SNE_REG:
+        case OP_JP_V0:
+        case OP_SKP:
+        case OP_SKNP:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool is_store(const struct chip8_instr *instr)
+{
+    return instr->op == OP_LD_B || instr->op == OP_LD_MEM_VX;
+}
+
+static void emit_program(FILE *out, const struct program *prog,
+                         const char *rom_name)
+{
+    fprintf(out,
+            "// Generated by chip8_aotc from %s, do not edit\n"
+            "#include <stdbool.h>\n"
+            "#include <stdint.h>\n"
+            "#include <stdlib.h>\n"
+            "#include <string.h>\n"
+            "\n"
+            "#include \"chip8_aot.h\"\n"
+            "#include \"chip8_emulator.h\"\n"
+            "#include \"chip8_graphics.h\"\n"
+            "#include \"chip8_ops.h\"\n"
+            "#include \"chip8_util.h\"\n"
+            "\n",
+            rom_name);
+
+    fprintf(out, "static const uint8_t rom[] = {");
+    for (uint32_t addr = PROG_START; addr < prog->rom_end; addr++) {
+        if ((addr - PROG_START) % 12 == 0) {
+            fprintf(out, "\n   ");
+        }
+        fprintf(out, " 0x%02X,", prog->memory[addr]);
+    }
+    fprintf(out, "\n};\n\n");
+
+    fprintf(out, "static const uint8_t block_length[MEMORY_SIZE] = {\n");
+    for (uint32_t addr = 0; addr < MEMORY_SIZE; addr++) {
+        if (prog->block_at[addr] != NULL) {
+            fprintf(out, "    [0x%03X] = %d,\n", addr, prog->block_at[addr]->length);
+        }
+    }
+    fprintf(out, "};\n\n");
+
+    bool uses_dispatch = uses_op(prog, OP_RET) || uses_op(prog, OP_JP_V0);
+    bool uses_sum = uses_op(prog, OP_ADD_REG) || uses_op(prog, OP_SUB) ||
+                    uses_op(prog, OP_SUBN);
+
+    fprintf(out,
+            "static uint32_t run(chip8_ctx *ctx, uint32_t num_cycles)\n"
+            "{\n"
+            "    struct emulator *em = &ctx->em;\n");
+    if (prog->num_blocks > 0) {
+        fprintf(out, "    const bool *stale = ctx->aot->stale;\n");
+    }
+    fprintf(out,
+            "\n"
+            "    uint32_t executed = 0;\n"
+            "    uint16_t pc = em->PC;\n");
+    if (uses_sum) {
+        fprintf(out, "    uint16_t sum;\n");
+    }
+    fprintf(out, "\n");
+
+    if (uses_dispatch) {
+        fprintf(out, "dispatch:\n");
+    }
+
+    fprintf(out, "    switch (pc) {\n");
+    for (uint32_t addr = 0; addr < MEMORY_SIZE; addr++) {
+        if (prog->block_at[addr] != NULL) {
+            fprintf(out, "        case 0x%03X: goto block_%03X;\n", addr, addr);
+        }
+    }
+    fprintf(out,
+            "        default: goto out;\n"
+            "    }\n");
+
+    for (uint32_t addr = 0; addr < MEMORY_SIZE; addr++) {
+        if (prog->block_at[addr] != NULL) {
+            emit_block(out, prog, prog->block_at[addr]);
+        }
+    }
+
+    fprintf(out,
+            "\n"
+            "out:\n"
+            "    em->PC = pc;\n"
+            "\n"
+            "    return executed;\n"
+            "}\n"
+            "\n"
+            "const struct chip8_aot_program chip8_aot_program = {\n"
+            "    .name         = \"%s\",\n"
+            "    .rom          = rom,\n"
+            "    .rom_size     = sizeof(rom),\n"
+            "    .block_length = block_length,\n"
+            "    .quirks       = %d, // %s\n"
+            "    .run          = run,\n"
+            "};\n",
+            rom_name, prog->quirks, chip8_quirks[prog->quirks].label);
+}
+
+static void emit_block(FILE *out, const struct program *prog,
+                       const struct block *block)
+{
+    struct chip8_instr instr;
+
+    fprintf(out,
+            "\n"
+            "block_%03X:\n"
+            "    if (stale[0x%03X] || executed + %d > num_cycles) {\n"
+            "        pc = 0x%03X;\n"
+            "        goto out;\n"
+            "    }\n"
+            "    executed += %d;\n",
+            block->start, block->start, block->length, block->start,
+            block->length);
+
+    uint16_t pc = block->start;
+
+    for (int i = 0; i < block->length; i++, pc += 2) {
+        fetch(prog, pc, &instr);
+
+        // Only the last instruction's opcode is ever visible
+        if (i == block->length - 1) {
+            fprintf(out, "    em->opcode = 0x%04X;\n", instr.opcode);
+        }
+
+        emit_instr(out, prog, &instr, pc);
+    }
+
+    if (!block->terminated) {
+        emit_goto(out, prog, block->next, "    ");
+    }
+}
+
+static void emit_instr(FILE *out, const struct program *prog,
+                       const struct chip8_instr *instr, uint16_t pc)
+{
+    uint8_t x = instr->x;
+    uint8_t y = instr->y;
+
+    const struct chip8_quirks *quirks = &chip8_quirks[prog->quirks];
+    uint8_t src = quirks->shift_vx ? x : y;
+    int i_inc = CHIP8_I_INC_AMOUNT(quirks->i_inc, x);
+
+    fprintf(out, "    // 0x%03X: %04X\n", pc, instr->opcode);
+
+    switch (instr->op) {
+        case OP_CLS:
+            fprintf(out, "    graphics_clear_screen(&ctx->gfx);\n"
+                         "    em->draw_flag = 1;\n");
+            break;
+        case OP_RET:
+            fprintf(out, "    em->SP = (em->SP - 1) & OPS_STACK_MASK;\n"
+                         "    pc = em->stack[em->SP];\n"
+                         "    goto dispatch;\n");
+            break;
+        case OP_JP:
+            emit_goto(out, prog, instr->nnn, "    ");
+            break;
+        case OP_CALL:
+            fprintf(out, "    em->stack[em->SP & OPS_STACK_MASK] = 0x%03X;\n"
+                         "    em->SP = (em->SP + 1) & OPS_STACK_MASK;\n", pc + 2);
+            emit_goto(out, prog, instr->nnn, "    ");
+            break;
+        case OP_SE_IMM:
+        case OP_SNE_IMM:
+        case OP_SE_REG:
+        case OP_SNE_REG:
+        case OP_SKP:
+        case OP_SKNP:
+            if (instr->op == OP_SE_IMM) {
+                fprintf(out, "    if (em->V[0x%X] == 0x%02X) {\n", x, instr->nn);
+            } else if (instr->op == OP_SNE_IMM) {
+                fprintf(out, "    if (em->V[0x%X] != 0x%02X) {\n", x, instr->nn);
+            } else if (instr->op == OP_SE_REG) {
+                fprintf(out, "    if (em->V[0x%X] == em->V[0x%X]) {\n", x, y);
+            } else if (instr->op == OP_SNE_REG) {
+                fprintf(out, "    if (em->V[0x%X] != em->V[0x%X]) {\n", x, y);
+            } else if (instr->op == OP_SKP) {
+                fprintf(out, "    if (em->keypad & (1 << (em->V[0x%X] & 0x0F))) {\n", x);
+            } else {
+                fprintf(out, "    if (!(em->keypad & (1 << (em->V[0x%X] & 0x0F)))) {\n", x);
+            }
+            emit_goto(out, prog, pc + 4, "        ");
+            fprintf(out, "    }\n");
+            emit_goto(out, prog, pc + 2, "    ");
+            break;
+        case OP_LD_IMM:
+            fprintf(out, "    em->V[0x%X] = 0x%02X;\n", x, instr->nn);
+            break;
+        case OP_ADD_IMM:
+            fprintf(out, "    em->V[0x%X] += 0x%02X;\n", x, instr->nn);
+            break;
+        case OP_LD_REG:
+            fprintf(out, "    em->V[0x%X] = em->V[0x%X];\n", x, y);
+            break;
+        case OP_OR:
+            fprintf(out, "    em->V[0x%X] |= em->V[0x%X];\n", x, y);
+            if (quirks->vf_reset) {
+                fprintf(out, "    em->V[0xF] = 0;\n");
+            }
+            break;
+        case OP_AND:
+            fprintf(out, "    em->V[0x%X] &= em->V[0x%X];\n", x, y);
+            if (quirks->vf_reset) {
+                fprintf(out, "    em->V[0xF] = 0;\n");
+            }
+            break;
+        case OP_XOR:
+            fprintf(out, "    em->V[0x%X] ^= em->V[0x%X];\n", x, y);
+            if (quirks->vf_reset) {
+                fprintf(out, "    em->V[0xF] = 0;\n");
+            }
+            break;
+        case OP_ADD_REG:
+            fprintf(out, "    sum = em->V[0x%X] + em->V[0x%X];\n"
+                         "    em->V[0x%X] = (uint8_t)sum;\n"
+                         "    em->V[0xF] = sum > 0xFF;\n", x, y, x);
+            break;
+        case OP_SUB:
+            fprintf(out, "    sum = em->V[0x%X] >= em->V[0x%X];\n"
+                         "    em->V[0x%X] -= em->V[0x%X];\n"
+                         "    em->V[0xF] = (uint8_t)sum;\n", x, y, x, y);
+            break;
+        case OP_SHR:
+            // VF first, matters when X or Y is F
+            fprintf(out, "    em->V[0xF] = em->V[0x%X] & 0x01;\n"
+                         "    em->V[0x%X] = em->V[0x%X] >> 1;\n", src, x, src);
+            break;
+        case OP_SUBN:
+            fprintf(out, "    sum = em->V[0x%X] >= em->V[0x%X];\n"
+                         "    em->V[0x%X] = em->V[0x%X] - em->V[0x%X];\n"
+                         "    em->V[0xF] = (uint8_t)sum;\n", y, x, x, y, x);
+            break;
+        case OP_SHL:
+            fprintf(out, "    em->V[0xF] = em->V[0x%X] >> 7;\n"
+                         "    em->V[0x%X] = em->V[0x%X] << 1;\n", src, x, src);
+            break;
+        case OP_LD_I:
+            fprintf(out, "    em->I = 0x%03X;\n", instr->nnn);
+            break;
+        case OP_JP_V0:
+            fprintf(out, "    pc = em->V[0x%X] + 0x%03X;\n"
+                         "    goto dispatch;\n", quirks->jump_vx ? x : 0, instr->nnn);
+            break;
+        case OP_RND:
+            fprintf(out, "    em->V[0x%X] = util_random_byte(&ctx->rng_state) & 0x%02X;\n",
+                    x, instr->nn);
+            break;
+        case OP_DRW:
+            fprintf(out, "    ops_draw_sprite(ctx, 0x%X, 0x%X, %d);\n",
+                    x, y, instr->nn & 0x0F);
+            break;
+        case OP_LD_VX_DT:
+            fprintf(out, "    em->V[0x%X] = em->delay;\n", x);
+            break;
+        case OP_LD_DT_VX:
+            fprintf(out, "    em->delay = em->V[0x%X];\n", x);
+            break;
+        case OP_LD_ST_VX:
+            fprintf(out, "    em->sound = em->V[0x%X];\n", x);
+            break;
+        case OP_ADD_I:
+            fprintf(out, "    em->I += em->V[0x%X];\n", x);
+            break;
+        case OP_LD_F:
+            fprintf(out, "    em->I = ops_sprite_addr(em->V[0x%X]);\n", x);
+            break;
+        case OP_LD_B:
+            fprintf(out, "    ops_store_bcd(ctx, 0x%X);\n", x);
+            break;
+        case OP_LD_MEM_VX:
+            fprintf(out, "    ops_store_regs(ctx, 0x%X);\n", x);
+            if (i_inc != 0) {
+                fprintf(out, "    em->I += %d;\n", i_inc);
+            }
+            break;
+        case OP_LD_VX_MEM:
+            fprintf(out, "    ops_load_regs(ctx, 0x%X);\n", x);
+            if (i_inc != 0) {
+                fprintf(out, "    em->I += %d;\n", i_inc);
+            }
+            break;
+        default:
+            // is_compilable() keeps everything else out of blocks
+            break;
+    }
+}
+
+static void emit_goto(FILE *out, const struct program *prog, uint32_t target,
+                      const char *indent)
+{
+    if (target < MEMORY_SIZE && prog->block_at[target] != NULL) {
+        fprintf(out, "%sgoto block_%03X;\n", indent, target);
+    } else {
+        fprintf(out, "%spc = 0x%03X;\n%sgoto out;\n", indent, target, indent);
+    }
+}
+
+static bool uses_op(const struct program *prog, uint8_t op)
+{
+    struct chip8_instr instr;
+
+    for (int b = 0; b < prog->num_blocks; b++) {
+        const struct block *block = &prog->blocks[b];
+
+        for (int i = 0; i < block->length; i++) {
+            fetch(prog, block->start + 2 * i, &instr);
+            if (instr.op == op) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
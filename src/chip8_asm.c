@@ -0,0 +1,875 @@
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8_asm.h"
+#include "chip8_util.h"
+
+// Nesting of loop / if blocks, and whiles per loop
+#define MAX_DEPTH  32
+#define MAX_WHILES 16
+
+// Editors like to start files with one
+#define UTF8_BOM "\xEF\xBB\xBF"
+
+struct token {
+    const char *text;
+    uint32_t line;
+};
+
+enum symbol_kind {
+    SYMBOL_LABEL,
+    SYMBOL_CONST,
+    SYMBOL_ALIAS,               // a name for a register
+};
+
+struct symbol {
+    const char *name;
+    enum symbol_kind kind;
+    int32_t value;
+};
+
+// An instruction whose NNN is a label that wasn't defined yet
+struct fixup {
+    uint32_t addr;
+    const char *label;
+    uint32_t line;
+};
+
+enum block_kind {
+    BLOCK_LOOP,
+    BLOCK_IF,
+    BLOCK_ELSE,
+};
+
+struct block {
+    enum block_kind kind;
+    uint32_t addr;              // loop: its start, if / else: jump to patch
+    uint32_t whiles[MAX_WHILES];
+    uint32_t num_whiles;
+};
+
+struct assembler {
+    uint8_t *rom;
+    size_t max_size;
+    uint32_t here;              // address the next byte goes to
+    size_t size;
+
+    struct token *tokens;
+    uint32_t num_tokens;
+    uint32_t pos;
+
+    struct symbol *symbols;
+    uint32_t num_symbols;
+    uint32_t symbols_capacity;
+
+    struct fixup *fixups;
+    uint32_t num_fixups;
+    uint32_t fixups_capacity;
+
+    struct block blocks[MAX_DEPTH];
+    uint32_t depth;
+
+    uint32_t line;              // of the statement being assembled
+    struct asm_error *error;
+};
+
+static bool assemble_8mct(struct assembler *as, char *source);
+static bool assemble_octo(struct assembler *as, char *source);
+static bool tokenize(struct assembler *as, char *source);
+static bool statement(struct assembler *as);
+static bool register_statement(struct assembler *as, uint8_t x);
+static bool i_statement(struct assembler *as);
+static bool if_statement(struct assembler *as);
+static bool condition(struct assembler *as, uint16_t *skip);
+static bool block_end(struct assembler *as, const char *word);
+static bool emit_byte(struct assembler *as, uint8_t byte);
+static bool emit(struct assembler *as, uint16_t opcode);
+static bool emit_addr(struct assembler *as, uint16_t opcode, const char *target);
+static void patch_addr(struct assembler *as, uint32_t at, uint32_t target);
+static bool define(struct assembler *as, const char *name,
+                   enum symbol_kind kind, int32_t value);
+static const struct symbol *lookup(const struct assembler *as, const char *name);
+static const char *next(struct assembler *as);
+static bool expect(struct assembler *as, const char *word);
+static bool reg_arg(struct assembler *as, uint8_t *x);
+static bool reg(struct assembler *as, const char *text, uint8_t *x);
+static bool number(struct assembler *as, const char *text, int32_t *value);
+static bool byte_value(struct assembler *as, const char *text, uint8_t *byte);
+static uint16_t invert_skip(uint16_t skip);
+static bool fail(struct assembler *as, const char *format, ...);
+
+enum asm_syntax asm_syntax_for_file(const char *filename)
+{
+    const char *ext = strrchr(filename, '.');
+
+    if (ext != NULL && strcmp(ext, ".8mct") == 0) {
+        return ASM_SYNTAX_8MCT;
+    } else if (ext != NULL && strcmp(ext, ".8o") == 0) {
+        return ASM_SYNTAX_OCTO;
+    }
+
+    return ASM_SYNTAX_NONE;
+}
+
+bool asm_assemble(enum asm_syntax syntax, const char *source, size_t length,
+                  uint8_t *rom, size_t max_size, size_t *size,
+                  struct asm_error *error)
+{
+    struct asm_error ignored;
+
+    if (error == NULL) {
+        error = &ignored;
+    }
+    memset(error, 0, sizeof(*error));
+
+    struct assembler as = {
+        .rom      = rom,
+        .max_size = max_size,
+        .here     = PROG_START,
+        .error    = error,
+    };
+
+    // Tokens point into a copy, terminated in place
+    char *copy = malloc(length + 1);
+    if (copy == NULL) {
+        return fail(&as, "out of memory");
+    }
+
+    memcpy(copy, source, length);
+    copy[length] = '\0';
+
+    char *text = copy;
+    if (strncmp(text, UTF8_BOM, strlen(UTF8_BOM)) == 0) {
+        text += strlen(UTF8_BOM);
+    }
+
+    bool ok = syntax == ASM_SYNTAX_8MCT ? assemble_8mct(&as, text) :
+              syntax == ASM_SYNTAX_OCTO ? assemble_octo(&as, text) :
+              fail(&as, "not a source file");
+
+    free(copy);
+    free(as.tokens);
+    free(as.symbols);
+    free(as.fixups);
+
+    *size = ok ? as.size : 0;
+
+    return ok;
+}
+
+static bool assemble_8mct(struct assembler *as, char *source)
+{
+    char *save;
+    char *line = source;
+
+    // strtok_r() would skip empty lines and throw the count off
+    for (as->line = 1; line != NULL; as->line++) {
+        char *end = strchr(line, '\n');
+        if (end != NULL) {
+            *end = '\0';
+        }
+
+        line[strcspn(line, "#")] = '\0';
+
+        // Hex digits in pairs, spaces anywhere between bytes
+        uint32_t digits = 0;
+        uint8_t byte = 0;
+
+        for (char *word = strtok_r(line, " \t\r", &save); word != NULL;
+             word = strtok_r(NULL, " \t\r", &save)) {
+            for (char *c = word; *c != '\0'; c++) {
+                if (!isxdigit((unsigned char)*c)) {
+                    return fail(as, "'%s' isn't hex", word);
+                }
+
+                byte = byte << 4 | (isdigit((unsigned char)*c) ? *c - '0' :
+                                    tolower((unsigned char)*c) - 'a' + 10);
+
+                if (++digits % 2 == 0 && !emit_byte(as, byte)) {
+                    return false;
+                }
+            }
+
+            if (digits % 2 != 0) {
+                return fail(as, "odd number of hex digits");
+            }
+        }
+
+        line = end != NULL ? end + 1 : NULL;
+    }
+
+    return true;
+}
+
+static bool assemble_octo(struct assembler *as, char *source)
+{
+    if (!tokenize(as, source)) {
+        return false;
+    }
+
+    // Execution starts at PROG_START, so unless main is there already it
+    // starts with a jump to it
+    bool has_main = false;
+    for (uint32_t i = 0; i + 1 < as->num_tokens; i++) {
+        has_main |= strcmp(as->tokens[i].text, ":") == 0 &&
+                    strcmp(as->tokens[i + 1].text, "main") == 0;
+    }
+
+    bool main_first = as->num_tokens >= 2 &&
+                      strcmp(as->tokens[0].text, ":") == 0 &&
+                      strcmp(as->tokens[1].text, "main") == 0;
+
+    if (has_main && !main_first && !emit_addr(as, 0x1000, "main")) {
+        return false;
+    }
+
+    while (as->pos < as->num_tokens) {
+        as->line = as->tokens[as->pos].line;
+
+        if (!statement(as)) {
+            return false;
+        }
+    }
+
+    if (as->depth > 0) {
+        return fail(as, "%s without %s",
+                    as->blocks[as->depth - 1].kind == BLOCK_LOOP ? "loop" : "if",
+                    as->blocks[as->depth - 1].kind == BLOCK_LOOP ? "again" : "end");
+    }
+
+    for (uint32_t i = 0; i < as->num_fixups; i++) {
+        const struct fixup *fixup = &as->fixups[i];
+        const struct symbol *symbol = lookup(as, fixup->label);
+
+        if (symbol == NULL || symbol->kind == SYMBOL_ALIAS) {
+            as->line = fixup->line;
+            return fail(as, "undefined label '%s'", fixup->label);
+        }
+
+        patch_addr(as, fixup->addr, symbol->value);
+    }
+
+    return true;
+}
+
+static bool tokenize(struct assembler *as, char *source)
+{
+    uint32_t capacity = 0;
+    uint32_t line = 1;
+    char *c = source;
+
+    for (;;) {
+        // Whitespace and comments
+        while (*c != '\0' && (isspace((unsigned char)*c) || *c == '#')) {
+            if (*c == '#') {
+                c += strcspn(c, "\n");
+                continue;
+            }
+            line += *c == '\n';
+            c++;
+        }
+
+        if (*c == '\0') {
+            return true;
+        }
+
+        if (as->num_tokens == capacity) {
+            capacity = capacity == 0 ? 256 : capacity * 2;
+
+            struct token *tokens = realloc(as->tokens, capacity * sizeof(*tokens));
+            if (tokens == NULL) {
+                return fail(as, "out of memory");
+            }
+            as->tokens = tokens;
+        }
+
+        as->tokens[as->num_tokens++] = (struct token){ .text = c, .line = line };
+
+        while (*c != '\0' && !isspace((unsigned char)*c)) {
+            c++;
+        }
+
+        if (*c != '\0') {
+            line += *c == '\n';
+            *c++ = '\0';
+        }
+    }
+}
+
+static bool statement(struct assembler *as)
+{
+    const char *word = next(as);
+    uint8_t x, y, n;
+    int32_t value;
+
+    if (strcmp(word, ":") == 0) {
+        const char *name = next(as);
+        return name != NULL && define(as, name, SYMBOL_LABEL, as->here);
+    } else if (strcmp(word, ":const") == 0) {
+        const char *name = next(as);
+        return name != NULL && number(as, next(as), &value) &&
+               define(as, name, SYMBOL_CONST, value);
+    } else if (strcmp(word, ":alias") == 0) {
+        const char *name = next(as);
+        return name != NULL && reg_arg(as, &x) &&
+               define(as, name, SYMBOL_ALIAS, x);
+    } else if (strcmp(word, ":byte") == 0) {
+        return byte_value(as, next(as), &n) && emit_byte(as, n);
+    } else if (strcmp(word, ";") == 0 || strcmp(word, "return") == 0) {
+        return emit(as, 0x00EE);
+    } else if (strcmp(word, "clear") == 0) {
+        return emit(as, 0x00E0);
+    } else if (strcmp(word, "exit") == 0) {
+        return emit(as, 0x00FD);
+    } else if (strcmp(word, "lores") == 0) {
+        return emit(as, 0x00FE);
+    } else if (strcmp(word, "hires") == 0) {
+        return emit(as, 0x00FF);
+    } else if (strcmp(word, "scroll-right") == 0) {
+        return emit(as, 0x00FB);
+    } else if (strcmp(word, "scroll-left") == 0) {
+        return emit(as, 0x00FC);
+    } else if (strcmp(word, "scroll-down") == 0) {
+        return byte_value(as, next(as), &n) &&
+               (n < 16 || fail(as, "scrolls are 0-15 rows")) &&
+               emit(as, 0x00C0 | n);
+    } else if (strcmp(word, "jump") == 0) {
+        return emit_addr(as, 0x1000, next(as));
+    } else if (strcmp(word, "jump0") == 0) {
+        return emit_addr(as, 0xB000, next(as));
+    } else if (strcmp(word, "sprite") == 0) {
+        return reg_arg(as, &x) && reg_arg(as, &y) &&
+               byte_value(as, next(as), &n) &&
+               (n < 16 || fail(as, "sprites are 0-15 rows")) &&
+               emit(as, 0xD000 | x << 8 | y << 4 | n);
+    } else if (strcmp(word, "bcd") == 0) {
+        return reg_arg(as, &x) && emit(as, 0xF033 | x << 8);
+    } else if (strcmp(word, "save") == 0) {
+        return reg_arg(as, &x) && emit(as, 0xF055 | x << 8);
+    } else if (strcmp(word, "load") == 0) {
+        return reg_arg(as, &x) && emit(as, 0xF065 | x << 8);
+    } else if (strcmp(word, "saveflags") == 0) {
+        return reg_arg(as, &x) && emit(as, 0xF075 | x << 8);
+    } else if (strcmp(word, "loadflags") == 0) {
+        return reg_arg(as, &x) && emit(as, 0xF085 | x << 8);
+    } else if (strcmp(word, "delay") == 0 || strcmp(word, "buzzer") == 0) {
+        uint16_t opcode = strcmp(word, "delay") == 0 ? 0xF015 : 0xF018;
+        return expect(as, ":=") && reg_arg(as, &x) &&
+               emit(as, opcode | x << 8);
+    } else if (strcmp(word, "i") == 0) {
+        return i_statement(as);
+    } else if (strcmp(word, "if") == 0) {
+        return if_statement(as);
+    } else if (strcmp(word, "loop") == 0) {
+        if (as->depth == MAX_DEPTH) {
+            return fail(as, "blocks nested too deep");
+        }
+        as->blocks[as->depth++] = (struct block){ .kind = BLOCK_LOOP, .addr = as->here };
+        return true;
+    } else if (strcmp(word, "while") == 0) {
+        // Out of the innermost loop unless the condition holds
+        uint16_t skip;
+        struct block *loop = NULL;
+
+        for (uint32_t i = as->depth; i > 0 && loop == NULL; i--) {
+            loop = as->blocks[i - 1].kind == BLOCK_LOOP ? &as->blocks[i - 1] : NULL;
+        }
+
+        if (loop == NULL) {
+            return fail(as, "while outside a loop");
+        }
+        if (loop->num_whiles == MAX_WHILES) {
+            return fail(as, "too many whiles in one loop");
+        }
+        if (!condition(as, &skip) || !emit(as, invert_skip(skip))) {
+            return false;
+        }
+        loop->whiles[loop->num_whiles++] = as->here;
+        return emit(as, 0x1000);
+    } else if (strcmp(word, "again") == 0 || strcmp(word, "else") == 0 ||
+               strcmp(word, "end") == 0) {
+        return block_end(as, word);
+    } else if (reg(as, word, &x)) {
+        return register_statement(as, x);
+    }
+
+    const struct symbol *symbol = lookup(as, word);
+
+    // A number on its own is data, a name is a call
+    if (isdigit((unsigned char)word[0]) || word[0] == '-' ||
+        (symbol != NULL && symbol->kind == SYMBOL_CONST)) {
+        return byte_value(as, word, &n) && emit_byte(as, n);
+    }
+
+    return emit_addr(as, 0x2000, word);
+}
+
+static bool register_statement(struct assembler *as, uint8_t x)
+{
+    const char *op = next(as);
+    const char *rhs = next(as);
+    uint8_t y, n;
+
+    if (op == NULL || rhs == NULL) {
+        return false;
+    }
+
+    if (strcmp(op, ":=") == 0) {
+        if (strcmp(rhs, "delay") == 0) {
+            return emit(as, 0xF007 | x << 8);
+        } else if (strcmp(rhs, "key") == 0) {
+            return emit(as, 0xF00A | x << 8);
+        } else if (strcmp(rhs, "random") == 0) {
+            return byte_value(as, next(as), &n) && emit(as, 0xC000 | x << 8 | n);
+        } else if (reg(as, rhs, &y)) {
+            return emit(as, 0x8000 | x << 8 | y << 4);
+        }
+        return byte_value(as, rhs, &n) && emit(as, 0x6000 | x << 8 | n);
+    }
+
+    if (strcmp(op, "+=") == 0 || strcmp(op, "-=") == 0) {
+        bool add = op[0] == '+';
+
+        if (reg(as, rhs, &y)) {
+            return emit(as, (add ? 0x8004 : 0x8005) | x << 8 | y << 4);
+        }
+
+        // Subtracting a constant is adding its negation
+        if (!byte_value(as, rhs, &n)) {
+            return false;
+        }
+        return emit(as, 0x7000 | x << 8 | (uint8_t)(add ? n : -n));
+    }
+
+    static const struct {
+        const char *op;
+        uint16_t opcode;
+    } alu_ops[] = {
+        { "|=",  0x8001 },
+        { "&=",  0x8002 },
+        { "^=",  0x8003 },
+        { ">>=", 0x8006 },
+        { "=-",  0x8007 },
+        { "<<=", 0x800E },
+    };
+
+    for (size_t i = 0; i < sizeof(alu_ops) / sizeof(alu_ops[0]); i++) {
+        if (strcmp(op, alu_ops[i].op) == 0) {
+            return (reg(as, rhs, &y) || fail(as, "'%s' needs a register", op)) &&
+                   emit(as, alu_ops[i].opcode | x << 8 | y << 4);
+        }
+    }
+
+    return fail(as, "unknown operator '%s'", op);
+}
+
+static bool i_statement(struct assembler *as)
+{
+    const char *op = next(as);
+    const char *rhs = next(as);
+    uint8_t x;
+
+    if (op == NULL || rhs == NULL) {
+        return false;
+    }
+
+    if (strcmp(op, "+=") == 0) {
+        return reg(as, rhs, &x) && emit(as, 0xF01E | x << 8);
+    }
+    if (strcmp(op, ":=") != 0) {
+        return fail(as, "unknown operator '%s'", op);
+    }
+
+    if (strcmp(rhs, "hex") == 0) {
+        return reg_arg(as, &x) && emit(as, 0xF029 | x << 8);
+    } else if (strcmp(rhs, "bighex") == 0) {
+        return reg_arg(as, &x) && emit(as, 0xF030 | x << 8);
+    }
+
+    return emit_addr(as, 0xA000, rhs);
+}
+
+// if <condition> then <statement>, or if <condition> begin ... [else ...] end
+static bool if_statement(struct assembler *as)
+{
+    uint16_t skip;
+
+    if (!condition(as, &skip)) {
+        return false;
+    }
+
+    const char *word = next(as);
+
+    if (word != NULL && strcmp(word, "then") == 0) {
+        if (as->pos == as->num_tokens) {
+            return fail(as, "then without a statement");
+        }
+        return emit(as, skip) && statement(as);
+    }
+
+    if (word == NULL || strcmp(word, "begin") != 0) {
+        return fail(as, "if needs then or begin");
+    }
+
+    if (as->depth == MAX_DEPTH) {
+        return fail(as, "blocks nested too deep");
+    }
+
+    // Past the jump to else when the condition holds
+    as->blocks[as->depth++] = (struct block){ .kind = BLOCK_IF, .addr = as->here + 2 };
+
+    return emit(as, invert_skip(skip)) && emit(as, 0x1000);
+}
+
+// <reg> == / != <reg or byte>, <reg> key / -key. *skip is the instruction
+// that skips the next one unless the condition holds.
+static bool condition(struct assembler *as, uint16_t *skip)
+{
+    uint8_t x, y, n;
+
+    if (!reg_arg(as, &x)) {
+        return false;
+    }
+
+    const char *op = next(as);
+    if (op == NULL) {
+        return false;
+    }
+
+    if (strcmp(op, "key") == 0) {
+        *skip = 0xE0A1 | x << 8;
+        return true;
+    } else if (strcmp(op, "-key") == 0) {
+        *skip = 0xE09E | x << 8;
+        return true;
+    }
+
+    bool equal = strcmp(op, "==") == 0;
+    if (!equal && strcmp(op, "!=") != 0) {
+        return fail(as, "unsupported condition '%s'", op);
+    }
+
+    const char *rhs = next(as);
+    if (rhs == NULL) {
+        return false;
+    }
+
+    if (reg(as, rhs, &y)) {
+        *skip = (equal ? 0x9000 : 0x5000) | x << 8 | y << 4;
+        return true;
+    }
+
+    if (!byte_value(as, rhs, &n)) {
+        return false;
+    }
+
+    *skip = (equal ? 0x4000 : 0x3000) | x << 8 | n;
+
+    return true;
+}
+
+static bool block_end(struct assembler *as, const char *word)
+{
+    bool again = strcmp(word, "again") == 0;
+    bool is_else = strcmp(word, "else") == 0;
+
+    if (as->depth == 0) {
+        return fail(as, "'%s' without a block", word);
+    }
+
+    struct block *block = &as->blocks[as->depth - 1];
+
+    if (again != (block->kind == BLOCK_LOOP) ||
+        (is_else && block->kind != BLOCK_IF)) {
+        return fail(as, "'%s' doesn't close this block", word);
+    }
+
+    if (again) {
+        if (!emit(as, 0x1000 | block->addr)) {
+            return false;
+        }
+
+        for (uint32_t i = 0; i < block->num_whiles; i++) {
+            patch_addr(as, block->whiles[i], as->here);
+        }
+
+        as->depth--;
+        return true;
+    }
+
+    if (is_else) {
+        // The if part jumps over the else part
+        uint32_t jump = as->here;
+
+        if (!emit(as, 0x1000)) {
+            return false;
+        }
+
+        patch_addr(as, block->addr, as->here);
+        *block = (struct block){ .kind = BLOCK_ELSE, .addr = jump };
+        return true;
+    }
+
+    patch_addr(as, block->addr, as->here);
+    as->depth--;
+
+    return true;
+}
+
+static bool emit_byte(struct assembler *as, uint8_t byte)
+{
+    if (as->here - PROG_START >= as->max_size) {
+        return fail(as, "program larger than %zu bytes", as->max_size);
+    }
+
+    as->rom[as->here++ - PROG_START] = byte;
+
+    if (as->here - PROG_START > as->size) {
+        as->size = as->here - PROG_START;
+    }
+
+    return true;
+}
+
+static bool emit(struct assembler *as, uint16_t opcode)
+{
+    return emit_byte(as, opcode >> 8) && emit_byte(as, opcode & 0xFF);
+}
+
+// opcode with target's address as NNN, a number, a label or a label that
+// comes later
+static bool emit_addr(struct assembler *as, uint16_t opcode, const char *target)
+{
+    int32_t value;
+
+    if (target == NULL) {
+        return false;
+    }
+
+    const struct symbol *symbol = lookup(as, target);
+
+    if (symbol == NULL && !isdigit((unsigned char)target[0])) {
+        if (as->num_fixups == as->fixups_capacity) {
+            as->fixups_capacity = as->fixups_capacity == 0 ? 64 : as->fixups_capacity * 2;
+
+            struct fixup *fixups = realloc(as->fixups,
+                                           as->fixups_capacity * sizeof(*fixups));
+            if (fixups == NULL) {
+                return fail(as, "out of memory");
+            }
+            as->fixups = fixups;
+        }
+
+        as->fixups[as->num_fixups++] = (struct fixup){
+            .addr = as->here, .label = target, .line = as->line,
+        };
+        return emit(as, opcode);
+    }
+
+    if (!number(as, target, &value)) {
+        return false;
+    }
+    if (value < 0 || value > 0xFFF) {
+        return fail(as, "address %d out of range", value);
+    }
+
+    return emit(as, opcode | value);
+}
+
+static void patch_addr(struct assembler *as, uint32_t at, uint32_t target)
+{
+    uint8_t *opcode = &as->rom[at - PROG_START];
+
+    opcode[0] = (opcode[0] & 0xF0) | ((target >> 8) & 0x0F);
+    opcode[1] = target & 0xFF;
+}
+
+static bool define(struct assembler *as, const char *name,
+                   enum symbol_kind kind, int32_t value)
+{
+    if (lookup(as, name) != NULL) {
+        return fail(as, "'%s' is already defined", name);
+    }
+
+    if (kind == SYMBOL_LABEL && value > 0xFFF) {
+        return fail(as, "label '%s' beyond 4 KB", name);
+    }
+
+    if (as->num_symbols == as->symbols_capacity) {
+        as->symbols_capacity = as->symbols_capacity == 0 ? 64 : as->symbols_capacity * 2;
+
+        struct symbol *symbols = realloc(as->symbols,
+                                         as->symbols_capacity * sizeof(*symbols));
+        if (symbols == NULL) {
+            return fail(as, "out of memory");
+        }
+        as->symbols = symbols;
+    }
+
+    as->symbols[as->num_symbols++] = (struct symbol){
+        .name = name, .kind = kind, .value = value,
+    };
+
+    return true;
+}
+
+static const struct symbol *lookup(const struct assembler *as, const char *name)
+{
+    for (uint32_t i = 0; i < as->num_symbols; i++) {
+        if (strcmp(as->symbols[i].name, name) == 0) {
+            return &as->symbols[i];
+        }
+    }
+
+    return NULL;
+}
+
+static const char *next(struct assembler *as)
+{
+    if (as->pos == as->num_tokens) {
+        fail(as, "unexpected end of file");
+        return NULL;
+    }
+
+    as->line = as->tokens[as->pos].line;
+
+    return as->tokens[as->pos++].text;
+}
+
+static bool expect(struct assembler *as, const char *word)
+{
+    const char *text = next(as);
+
+    return text != NULL &&
+           (strcmp(text, word) == 0 || fail(as, "expected '%s'", word));
+}
+
+static bool reg_arg(struct assembler *as, uint8_t *x)
+{
+    const char *text = next(as);
+
+    return text != NULL &&
+           (reg(as, text, x) || fail(as, "'%s' isn't a register", text));
+}
+
+// v0-vF in either case, or an alias. Doesn't complain, callers that
+// need a register do.
+static bool reg(struct assembler *as, const char *text, uint8_t *x)
+{
+    if (text == NULL) {
+        return false;
+    }
+
+    if ((text[0] == 'v' || text[0] == 'V') && isxdigit((unsigned char)text[1]) &&
+        text[2] == '\0') {
+        *x = isdigit((unsigned char)text[1]) ? text[1] - '0' :
+             tolower((unsigned char)text[1]) - 'a' + 10;
+        return true;
+    }
+
+    const struct symbol *symbol = lookup(as, text);
+
+    if (symbol != NULL && symbol->kind == SYMBOL_ALIAS) {
+        *x = symbol->value;
+        return true;
+    }
+
+    return false;
+}
+
+// Decimal, 0x hex, 0b binary, optionally negative, or a constant / label
+static bool number(struct assembler *as, const char *text, int32_t *value)
+{
+    if (text == NULL) {
+        return false;
+    }
+
+    const struct symbol *symbol = lookup(as, text);
+    if (symbol != NULL && symbol->kind != SYMBOL_ALIAS) {
+        *value = symbol->value;
+        return true;
+    }
+
+    bool negative = text[0] == '-';
+    const char *digits = negative ? text + 1 : text;
+    int base = 10;
+
+    if (digits[0] == '0' && (digits[1] == 'x' || digits[1] == 'X')) {
+        base = 16;
+        digits += 2;
+    } else if (digits[0] == '0' && (digits[1] == 'b' || digits[1] == 'B')) {
+        base = 2;
+        digits += 2;
+    }
+
+    char *end;
+    long parsed = strtol(digits, &end, base);
+
+    if (*digits == '\0' || *end != '\0' || !isalnum((unsigned char)*digits) ||
+        parsed > 0xFFFF) {
+        return fail(as, "'%s' isn't a number", text);
+    }
+
+    *value = negative ? -parsed : parsed;
+
+    return true;
+}
+
+// Anything from -128 to 255, negative numbers as two's complement
+static bool byte_value(struct assembler *as, const char *text, uint8_t *byte)
+{
+    int32_t value;
+
+    if (!number(as, text, &value)) {
+        return false;
+    }
+    if (value < -128 || value > 255) {
+        return fail(as, "%d doesn't fit in a byte", value);
+    }
+
+    *byte = (uint8_t)value;
+
+    return true;
+}
+
+// The skip for the opposite condition: 3XNN <-> 4XNN, 5XY0 <-> 9XY0 and
+// EX9E <-> EXA1
+static uint16_t invert_skip(uint16_t skip)
+{
+    switch (skip & 0xF000) {
+        case 0x3000:
+            return (skip & 0x0FFF) | 0x4000;
+        case 0x4000:
+            return (skip & 0x0FFF) | 0x3000;
+        case 0x5000:
+            return (skip & 0x0FFF) | 0x9000;
+        case 0x9000:
+            return (skip & 0x0FFF) | 0x5000;
+        default:
+            return (skip & 0xFF00) | ((skip & 0xFF) == 0x9E ? 0xA1 : 0x9E);
+    }
+}
+
+// Always false, so callers can return it
+static bool fail(struct assembler *as, const char *format, ...)
+{
+    // Only the first one counts, later ones follow from it
+    if (as->error->message[0] != '\0') {
+        return false;
+    }
+
+    va_list args;
+    va_start(args, format);
+
+    as->error->line = as->line;
+    vsnprintf(as->error->message, sizeof(as->error->message), format, args);
+
+    va_end(args);
+
+    return false;
+}
@@ -0,0 +1,42 @@
+#ifndef CHIP8_ASM_H
+#define CHIP8_ASM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Assembler for the two source formats in example_progs/:
+//
+// .8mct  hex bytes, one instruction per line ("62 08" or "6208"), '#'
+//        starts a comment
+// .8o    the basic subset of Octo: labels (: name), :const, :alias, :byte,
+//        register / I / timer assignments and arithmetic (:= += -= =- |= &=
+//        ^= >>= <<=), if ... then, if ... begin ... else ... end with ==,
+//        !=, key and -key, loop / while / again, calls by name, and clear,
+//        return / ;, jump, jump0, sprite, bcd, save, load plus the
+//        SUPER-CHIP ones. Numbers on their own are emitted as bytes. A
+//        program with a main label starts with a jump to it unless main
+//        comes first.
+
+// By file extension
+enum asm_syntax {
+    ASM_SYNTAX_NONE,            // not a source file, a binary ROM
+    ASM_SYNTAX_8MCT,
+    ASM_SYNTAX_OCTO,
+};
+
+struct asm_error {
+    uint32_t line;              // 1 based
+    char message[96];
+};
+
+enum asm_syntax asm_syntax_for_file(const char *filename);
+
+// Assembles length bytes of source into rom, which holds what goes at
+// PROG_START on, up to max_size bytes. False with *error filled in when
+// the source has a mistake or doesn't fit.
+bool asm_assemble(enum asm_syntax syntax, const char *source, size_t length,
+                  uint8_t *rom, size_t max_size, size_t *size,
+                  struct asm_error *error);
+
+#endif
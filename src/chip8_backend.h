@@ -0,0 +1,59 @@
+#ifndef CHIP8_BACKEND_H
+#define CHIP8_BACKEND_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "chip8_graphics.h"
+#include "chip8_util.h"
+
+// Display + input hooks used by the emulator core. The core never touches the
+// terminal itself, so picking a backend decides whether we need a TTY at all.
+struct chip8_backend {
+    const char *name;
+
+    void    (*init)(void);
+    void    (*deinit)(void);
+
+    // Display
+    void    (*refresh_screen)(const struct graphics *gfx);
+    void    (*draw_program_state)(struct emulator *em);
+    void    (*clear_program_state)(void);
+
+    // Input
+    uint8_t (*get_char)(void);
+    bool    (*is_key_pressed)(uint8_t key, bool consume_key);
+    uint8_t (*get_hex_key)(void);
+
+    // Drains everything pending without blocking, returns a bit per hex key
+    // pressed since the last call. Other keys stay for is_key_pressed().
+    uint16_t (*poll_hex_keys)(void);
+
+    // Descriptor that turns readable when input arrives, for frontends that
+    // sleep in poll / epoll. -1 when there's never any.
+    int     (*input_fd)(void);
+
+    // Keyboard key for each hex key 0-F
+    void    (*set_keymap)(const char keys[NUM_KEYS]);
+
+    // refresh_screen() may run on a thread of its own (see chip8_render.h)
+    // while input and the program state hooks are called on another
+    bool    threaded_display;
+};
+
+// Interactive terminal frontend (what chip8_main has always used)
+extern const struct chip8_backend chip8_backend_ncurses;
+
+// Raw ANSI escapes instead of ncurses: each frame only writes the cells that
+// changed since the last one, in a single write(). Two pixels per cell with
+// half blocks, eight with braille, so hi-res fits small terminals (128x32
+// and 64x16 cells).
+extern const struct chip8_backend chip8_backend_half_block;
+extern const struct chip8_backend chip8_backend_braille;
+
+// No terminal at all: the framebuffer only lives in memory and no keys are
+// ever pressed. get_char() reports 'k' and get_hex_key() reports "end" so
+// anything waiting on input stops instead of hanging a batch job.
+extern const struct chip8_backend chip8_backend_null;
+
+#endif
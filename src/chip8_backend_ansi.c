@@ -0,0 +1,488 @@
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "chip8_backend.h"
+#include "chip8_keys.h"
+
+// Cells are laid out for hi-res, a lo-res pixel covers 2x2 hi-res ones so
+// the picture keeps its size when the resolution switches. Half blocks put
+// 1x2 pixels in a cell (128x32 cells), braille 2x4 (64x16).
+#define MAX_CELL_ROWS (HIRES_ROW_COUNT / 2)
+#define MAX_CELL_COLS HIRES_COL_COUNT
+
+// Never a real cell, so the next frame writes it whatever it holds
+#define CELL_UNKNOWN 0xFFFF
+
+// Unchanged cells up to this many between two changed ones are written
+// again, that's shorter than the escape moving the cursor past them
+#define MAX_REWRITE_GAP 4
+
+// A frame with every cell changing colors and glyph, plus a cursor move per
+// row. Debug output is less.
+#define OUTPUT_SIZE (MAX_CELL_ROWS * (MAX_CELL_COLS * 16 + 16))
+
+enum glyphs {
+    GLYPHS_HALF_BLOCK,
+    GLYPHS_BRAILLE,
+};
+
+// ANSI color per plane bits: off, first plane, second plane, both
+static const uint8_t plane_colors[4] = { 4, 7, 1, 3 };
+
+static void half_block_init(void);
+static void braille_init(void);
+static void ansi_deinit(void);
+static void ansi_refresh_screen(const struct graphics *gfx);
+static void ansi_draw_program_state(struct emulator *em);
+static void ansi_clear_program_state(void);
+static uint8_t ansi_get_char(void);
+static bool ansi_is_key_pressed(uint8_t key, bool consume_key);
+static uint8_t ansi_get_hex_key(void);
+static uint16_t ansi_poll_hex_keys(void);
+static int ansi_input_fd(void);
+static void ansi_set_keymap(const char keys[NUM_KEYS]);
+
+static void init_terminal(enum glyphs new_glyphs);
+static uint8_t pixel_color(const struct graphics *gfx, int row, int col);
+static uint16_t half_block_cell(const struct graphics *gfx, int row, int col);
+static uint16_t braille_cell(const struct graphics *gfx, int row, int col);
+static void put_cell(uint16_t cell);
+static void put_colors(int fg, int bg);
+static void put_move(int row, int col);
+static void put(const char *text);
+static void put_format(const char *format, ...);
+static void flush_output(void);
+static void drain_input(void);
+
+static enum glyphs glyphs;
+static int cell_rows;
+static int cell_cols;
+
+// What the terminal shows, frames only write the cells that differ
+static uint16_t shown[MAX_CELL_ROWS][MAX_CELL_COLS];
+
+// Colors last set, -1 when not known
+static int current_fg = -1;
+static int current_bg = -1;
+
+// Everything for the terminal goes out with one write(). Frames may come
+// from a render thread, the program state from the main one.
+static char output[OUTPUT_SIZE];
+static size_t output_length;
+static pthread_mutex_t output_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct termios saved_termios;
+
+// Input read by drain_input() that hasn't been asked for yet
+static struct key_queue pending = KEY_QUEUE_INIT;
+
+const struct chip8_backend chip8_backend_half_block = {
+    .name                = "half",
+    .init                = half_block_init,
+    .deinit              = ansi_deinit,
+    .refresh_screen      = ansi_refresh_screen,
+    .draw_program_state  = ansi_draw_program_state,
+    .clear_program_state = ansi_clear_program_state,
+    .get_char            = ansi_get_char,
+    .is_key_pressed      = ansi_is_key_pressed,
+    .get_hex_key         = ansi_get_hex_key,
+    .poll_hex_keys       = ansi_poll_hex_keys,
+    .input_fd            = ansi_input_fd,
+    .set_keymap          = ansi_set_keymap,
+    .threaded_display    = true,
+};
+
+const struct chip8_backend chip8_backend_braille = {
+    .name                = "braille",
+    .init                = braille_init,
+    .deinit              = ansi_deinit,
+    .refresh_screen      = ansi_refresh_screen,
+    .draw_program_state  = ansi_draw_program_state,
+    .clear_program_state = ansi_clear_program_state,
+    .get_char            = ansi_get_char,
+    .is_key_pressed      = ansi_is_key_pressed,
+    .get_hex_key         = ansi_get_hex_key,
+    .poll_hex_keys       = ansi_poll_hex_keys,
+    .input_fd            = ansi_input_fd,
+    .set_keymap          = ansi_set_keymap,
+    .threaded_display    = true,
+};
+
+static void half_block_init(void)
+{
+    init_terminal(GLYPHS_HALF_BLOCK);
+}
+
+static void braille_init(void)
+{
+    init_terminal(GLYPHS_BRAILLE);
+}
+
+static void ansi_deinit(void)
+{
+    // Default colors, cursor back, off the alternate screen
+    put("\x1b[0m\x1b[?25h\x1b[?1049l");
+    flush_output();
+
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &saved_termios);
+}
+
+static void ansi_refresh_screen(const struct graphics *gfx)
+{
+    pthread_mutex_lock(&output_lock);
+
+    for (int row = 0; row < cell_rows; row++) {
+        int cursor = -1;            // column the cursor is at, -1 if elsewhere
+
+        for (int col = 0; col < cell_cols; col++) {
+            uint16_t cell = glyphs == GLYPHS_BRAILLE ? braille_cell(gfx, row, col) :
+                                                       half_block_cell(gfx, row, col);
+
+            if (cell == shown[row][col]) {
+                continue;
+            }
+
+            if (cursor >= 0 && col - cursor <= MAX_REWRITE_GAP) {
+                for (; cursor < col; cursor++) {
+                    put_cell(shown[row][cursor]);
+                }
+            } else {
+                put_move(row, col);
+            }
+
+            put_cell(cell);
+            shown[row][col] = cell;
+            cursor = col + 1;
+        }
+    }
+
+    flush_output();
+
+    pthread_mutex_unlock(&output_lock);
+}
+
+static void ansi_draw_program_state(struct emulator *em)
+{
+    pthread_mutex_lock(&output_lock);
+
+    // Below the screen, whatever debug text was there goes first
+    put_move(cell_rows, 0);
+    put("\x1b[0m\x1b[J");
+
+    current_fg = -1;
+    current_bg = -1;
+
+    // Raw mode, newlines don't return the carriage by themselves
+    put_format("PC: 0x%03X\tI: 0x%03X\tDelay: %d\tSound: %d\tSP: 0x%X\r\n",
+               em->PC, em->I, em->delay, em->sound, em->SP);
+
+    for (int i = 0; i < NUM_REGS; i++) {
+        put_format("V[%X]: 0x%02X\t", i, em->V[i]);
+
+        if ((i + 1) % 8 == 0) {
+            put("\r\n");
+        }
+    }
+
+    put_format("Memory:\r\n");
+    for (uint16_t addr = em->PC - 4; addr < em->PC + 10; addr += 2) {
+        // Next instruction in bold
+        if (addr > 0 && addr + 1 < MEMORY_SIZE) {
+            put_format("%s0x%03X: %02X %02X%s\t", addr == em->PC ? "\x1b[1m" : "",
+                       addr, em->memory[addr], em->memory[addr + 1],
+                       addr == em->PC ? "\x1b[22m" : "");
+        }
+    }
+
+    put("\r\n");
+
+    for (int i = 0; i < em->SP && i < STACK_SIZE; i++) {
+        put_format("Stack[0x%X]: 0x%03X\t", i, em->stack[i]);
+
+        if ((i + 1) % 4 == 0) {
+            put("\r\n");
+        }
+    }
+
+    flush_output();
+
+    pthread_mutex_unlock(&output_lock);
+}
+
+static void ansi_clear_program_state(void)
+{
+    pthread_mutex_lock(&output_lock);
+
+    put_move(cell_rows, 0);
+    put("\x1b[0m\x1b[J");
+    put_format("Resuming...");
+
+    current_fg = -1;
+    current_bg = -1;
+
+    flush_output();
+
+    pthread_mutex_unlock(&output_lock);
+}
+
+static uint8_t ansi_get_char(void)
+{
+    // Whatever was drained earlier comes first, in order
+    uint8_t ch;
+    if (key_queue_pop_char(&pending, &ch)) {
+        return ch;
+    }
+
+    ssize_t length;
+
+    do {
+        length = read(STDIN_FILENO, &ch, 1);
+    } while (length < 0 && errno == EINTR);
+
+    // Nothing will ever be typed again, end instead of waiting forever
+    return length == 1 ? key_queue_translate(ch) : 'k';
+}
+
+static bool ansi_is_key_pressed(uint8_t key, bool consume_key)
+{
+    drain_input();
+
+    return key_queue_find(&pending, key, consume_key);
+}
+
+static uint8_t ansi_get_hex_key(void)
+{
+    // A press drained but not polled yet counts
+    uint8_t key;
+    if (key_queue_pop_hex_key(&pending, &key)) {
+        return key;
+    }
+
+    int hex_key;
+
+    do {
+        uint8_t pressed_key = ansi_get_char();
+
+        if (pressed_key == 'k') {
+            return (uint8_t)-1;
+        } else if (pressed_key == 'p') {
+            return (uint8_t)-2;
+        }
+
+        hex_key = key_queue_hex_key(&pending, pressed_key);
+    } while (hex_key < 0);
+
+    return hex_key;
+}
+
+static uint16_t ansi_poll_hex_keys(void)
+{
+    drain_input();
+
+    return key_queue_take_hex_keys(&pending);
+}
+
+static int ansi_input_fd(void)
+{
+    return STDIN_FILENO;
+}
+
+static void ansi_set_keymap(const char keys[NUM_KEYS])
+{
+    key_queue_set_keymap(&pending, keys);
+}
+
+static void init_terminal(enum glyphs new_glyphs)
+{
+    if (!isatty(STDIN_FILENO) || !isatty(STDOUT_FILENO) ||
+        tcgetattr(STDIN_FILENO, &saved_termios) != 0) {
+        printf("ERROR: need a terminal atm!\n");
+        exit(-1);
+    }
+
+    // Keys as they're typed, ^C included, and output exactly as written
+    struct termios raw = saved_termios;
+    cfmakeraw(&raw);
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw);
+
+    glyphs    = new_glyphs;
+    cell_rows = glyphs == GLYPHS_BRAILLE ? HIRES_ROW_COUNT / 4 : HIRES_ROW_COUNT / 2;
+    cell_cols = glyphs == GLYPHS_BRAILLE ? HIRES_COL_COUNT / 2 : HIRES_COL_COUNT;
+
+    for (int row = 0; row < MAX_CELL_ROWS; row++) {
+        for (int col = 0; col < MAX_CELL_COLS; col++) {
+            shown[row][col] = CELL_UNKNOWN;
+        }
+    }
+
+    // Alternate screen, no cursor, cleared
+    put("\x1b[?1049h\x1b[?25l\x1b[0m\x1b[2J");
+    flush_output();
+}
+
+static uint8_t pixel_color(const struct graphics *gfx, int row, int col)
+{
+    if (!gfx->hires) {
+        row /= 2;
+        col /= 2;
+    }
+
+    return GRAPHICS_PIXEL(gfx, 0, row, col) | GRAPHICS_PIXEL(gfx, 1, row, col) << 1;
+}
+
+// Top pixel's color in bits 0-1, bottom one's in 2-3
+static uint16_t half_block_cell(const struct graphics *gfx, int row, int col)
+{
+    return pixel_color(gfx, row * 2, col) | pixel_color(gfx, row * 2 + 1, col) << 2;
+}
+
+// Dots lit in bits 0-7 (U+2800 + those is the glyph), the planes of any of
+// them in 8-9: a cell only has one foreground color
+static uint16_t braille_cell(const struct graphics *gfx, int row, int col)
+{
+    static const uint8_t dots[4][2] = {
+        { 0x01, 0x08 },
+        { 0x02, 0x10 },
+        { 0x04, 0x20 },
+        { 0x40, 0x80 },
+    };
+
+    uint16_t cell = 0;
+
+    for (int y = 0; y < 4; y++) {
+        for (int x = 0; x < 2; x++) {
+            uint8_t color = pixel_color(gfx, row * 4 + y, col * 2 + x);
+
+            if (color != 0) {
+                cell |= dots[y][x] | color << 8;
+            }
+        }
+    }
+
+    return cell;
+}
+
+static void put_cell(uint16_t cell)
+{
+    if (glyphs == GLYPHS_HALF_BLOCK) {
+        int top = plane_colors[cell & 3];
+        int bottom = plane_colors[cell >> 2 & 3];
+
+        // Both halves alike, a blank in the background color will do
+        if (top == bottom) {
+            put_colors(current_fg, bottom);
+            put(" ");
+        } else {
+            put_colors(top, bottom);
+            put("\xE2\x96\x80");         // U+2580 upper half block
+        }
+        return;
+    }
+
+    uint8_t lit = cell & 0xFF;
+
+    if (lit == 0) {
+        put_colors(current_fg, plane_colors[0]);
+        put(" ");
+        return;
+    }
+
+    char glyph[4] = {
+        (char)0xE2, (char)(0xA0 | lit >> 6), (char)(0x80 | (lit & 0x3F)), '\0',
+    };
+
+    put_colors(plane_colors[cell >> 8], plane_colors[0]);
+    put(glyph);
+}
+
+// SGR for whichever of the two changed
+static void put_colors(int fg, int bg)
+{
+    bool set_fg = fg != current_fg && fg >= 0;
+    bool set_bg = bg != current_bg;
+
+    if (set_fg && set_bg) {
+        put_format("\x1b[%d;%dm", 30 + fg, 40 + bg);
+    } else if (set_fg) {
+        put_format("\x1b[%dm", 30 + fg);
+    } else if (set_bg) {
+        put_format("\x1b[%dm", 40 + bg);
+    }
+
+    current_fg = set_fg ? fg : current_fg;
+    current_bg = bg;
+}
+
+static void put_move(int row, int col)
+{
+    put_format("\x1b[%d;%dH", row + 1, col + 1);
+}
+
+static void put(const char *text)
+{
+    size_t length = strlen(text);
+
+    if (output_length + length > sizeof(output)) {
+        flush_output();
+    }
+
+    memcpy(&output[output_length], text, length);
+    output_length += length;
+}
+
+static void put_format(const char *format, ...)
+{
+    char text[128];
+    va_list args;
+
+    va_start(args, format);
+    int length = vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+
+    if (length > 0) {
+        put(text);
+    }
+}
+
+static void flush_output(void)
+{
+    size_t written = 0;
+
+    // One write() unless the terminal takes less than everything
+    while (written < output_length) {
+        ssize_t length = write(STDOUT_FILENO, &output[written], output_length - written);
+
+        if (length < 0 && errno == EINTR) {
+            continue;
+        } else if (length <= 0) {
+            break;
+        }
+
+        written += length;
+    }
+
+    output_length = 0;
+}
+
+static void drain_input(void)
+{
+    struct pollfd input = { .fd = STDIN_FILENO, .events = POLLIN };
+    uint8_t buffer[64];
+    ssize_t length;
+
+    while (poll(&input, 1, 0) > 0 && (input.revents & POLLIN) &&
+           (length = read(STDIN_FILENO, buffer, sizeof(buffer))) > 0) {
+        for (ssize_t i = 0; i < length; i++) {
+            key_queue_add(&pending, buffer[i]);
+        }
+    }
+}
@@ -0,0 +1,313 @@
+#include <ncurses.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "chip8_backend.h"
+#include "chip8_keys.h"
+
+// Lo-res pixels are two spaces wide, hi-res ones one: both fill the same
+// 128 columns
+#define SPACES_PER_PIXEL 2
+#define SCREEN_COLS      (COL_COUNT * SPACES_PER_PIXEL)
+
+static void ncurses_init(void);
+static void ncurses_deinit(void);
+static void ncurses_refresh_screen(const struct graphics *gfx);
+static void ncurses_draw_program_state(struct emulator *em);
+static void ncurses_clear_program_state(void);
+static uint8_t ncurses_get_char(void);
+static bool ncurses_is_key_pressed(uint8_t key, bool consume_key);
+static uint8_t ncurses_get_hex_key(void);
+static uint16_t ncurses_poll_hex_keys(void);
+static int ncurses_input_fd(void);
+static void ncurses_set_keymap(const char keys[NUM_KEYS]);
+
+static void init_colors(void);
+static void set_pixel(uint8_t color, int width);
+static void clear_debug_row(uint8_t row, uint8_t num_rows);
+static void drain_input(void);
+
+// Rows the last frame took up, debug output goes below them
+static int screen_rows = ROW_COUNT;
+
+// Input read by drain_input() that hasn't been asked for yet
+static struct key_queue pending = KEY_QUEUE_INIT;
+
+const struct chip8_backend chip8_backend_ncurses = {
+    .name                = "ncurses",
+    .init                = ncurses_init,
+    .deinit              = ncurses_deinit,
+    .refresh_screen      = ncurses_refresh_screen,
+    .draw_program_state  = ncurses_draw_program_state,
+    .clear_program_state = ncurses_clear_program_state,
+    .get_char            = ncurses_get_char,
+    .is_key_pressed      = ncurses_is_key_pressed,
+    .get_hex_key         = ncurses_get_hex_key,
+    .poll_hex_keys       = ncurses_poll_hex_keys,
+    .input_fd            = ncurses_input_fd,
+    .set_keymap          = ncurses_set_keymap,
+    .threaded_display    = false,
+};
+
+static void ncurses_init(void)
+{
+    initscr();
+    init_colors();
+    raw();
+    keypad(stdscr, TRUE);
+    noecho();
+    curs_set(0);
+}
+
+static void ncurses_deinit(void)
+{
+    endwin();
+}
+
+static void ncurses_refresh_screen(const struct graphics *gfx)
+{
+    int rows = gfx->hires ? HIRES_ROW_COUNT : ROW_COUNT;
+    int cols = gfx->hires ? HIRES_COL_COUNT : COL_COUNT;
+    int width = SCREEN_COLS / cols;
+
+    // Switching back to lo-res leaves the bottom half of hi-res behind
+    if (rows != screen_rows) {
+        clear();
+        screen_rows = rows;
+    }
+
+    for (int row = 0; row < rows; row++) {
+        move(row, 0);
+
+        // Blank rows are common, draw them as one run of background
+        bool blank = true;
+        for (int plane = 0; plane < GRAPHICS_PLANES; plane++) {
+            for (int word = 0; word < ROW_WORDS; word++) {
+                blank &= gfx->screen[plane][row][word] == 0;
+            }
+        }
+
+        if (blank) {
+            hline(' ' | COLOR_PAIR(2), SCREEN_COLS);
+            continue;
+        }
+
+        for (int col = 0; col < cols; col++) {
+            set_pixel(GRAPHICS_PIXEL(gfx, 0, row, col) |
+                      GRAPHICS_PIXEL(gfx, 1, row, col) << 1, width);
+        }
+    }
+
+    refresh();
+}
+
+static void ncurses_draw_program_state(struct emulator *em)
+{
+    // Clear any previous debug text in debug window
+    clear_debug_row(screen_rows, 32);
+
+    // Move below output window
+    move(screen_rows, 0);
+
+    attrset(COLOR_PAIR(3));
+
+    // PC, opcode, memory register, delay, sound, SP
+    printw("PC: 0x%03X\tI: 0x%03X\t"
+           "Delay: %d\tSound: %d\tSP: 0x%X\n",
+           em->PC, em->I, em->delay, em->sound, em->SP);
+
+    // Program registers
+    for (int i = 0; i < NUM_REGS; i++) {
+        printw("V[%X]: 0x%02X\t", i, em->V[i]);
+
+        // Add a newline every 8 registers
+        if ((i + 1) % 8 == 0) {
+            addch('\n');
+        }
+    }
+
+    // Memory
+    printw("Memory:\n");
+    for (uint16_t addr = em->PC - 4; addr < em->PC + 10; addr += 2) {
+        // Print next instruction in bold
+        if (addr == em->PC) {
+            attrset(A_BOLD);
+        }
+
+        // Don't print if beyond edge of memory
+        if (addr > 0 && addr + 1 < MEMORY_SIZE) {
+            printw("0x%03X: %02X %02X\t",
+                   addr, em->memory[addr], em->memory[addr + 1]);
+        }
+
+        // Disable bold printing
+        if (addr == em->PC) {
+            attroff(A_BOLD);
+        }
+    }
+
+    addch('\n');
+
+    // Stack trace
+    for (int i = 0; i < em->SP; i++) {
+        // Don't print if beyond stack's end
+        if (i < STACK_SIZE) {
+            printw("Stack[0x%X]: 0x%03X\t", i, em->stack[i]);
+        }
+
+        if ((i + 1) % 4 == 0) {
+            addch('\n');
+        }
+    }
+
+    addch('\n');
+
+    attroff(COLOR_PAIR(3));
+}
+
+static void ncurses_clear_program_state(void)
+{
+    // Clear all debug info
+    clear_debug_row(screen_rows, 32);
+
+    // Move outside output window
+    move(screen_rows, 0);
+
+    // Print resuming then overwrite other info
+    attrset(COLOR_PAIR(3));
+
+    printw("Resuming...");
+
+    attroff(COLOR_PAIR(3));
+}
+
+static uint8_t ncurses_get_char(void)
+{
+    // Whatever was drained earlier comes first, in order
+    uint8_t ch;
+    if (key_queue_pop_char(&pending, &ch)) {
+        return ch;
+    }
+
+    return key_queue_translate(getch());
+}
+
+static bool ncurses_is_key_pressed(uint8_t key, bool consume_key)
+{
+    drain_input();
+
+    return key_queue_find(&pending, key, consume_key);
+}
+
+static uint8_t ncurses_get_hex_key(void)
+{
+    // A press drained but not polled yet counts
+    uint8_t key;
+    if (key_queue_pop_hex_key(&pending, &key)) {
+        return key;
+    }
+
+    int hex_key;
+
+    do {
+        uint8_t pressed_key = ncurses_get_char();
+
+        if (pressed_key == 'k') {
+            return (uint8_t)-1;
+        } else if (pressed_key == 'p') {
+            return (uint8_t)-2;
+        }
+
+        hex_key = key_queue_hex_key(&pending, pressed_key);
+    } while (hex_key < 0);
+
+    return hex_key;
+}
+
+static uint16_t ncurses_poll_hex_keys(void)
+{
+    drain_input();
+
+    return key_queue_take_hex_keys(&pending);
+}
+
+static int ncurses_input_fd(void)
+{
+    // initscr() reads the terminal on stdin
+    return STDIN_FILENO;
+}
+
+static void ncurses_set_keymap(const char keys[NUM_KEYS])
+{
+    key_queue_set_keymap(&pending, keys);
+}
+
+static void init_colors(void)
+{
+    if (has_colors()) {
+        if (start_color() == OK) {
+            // Pixel = 1
+            init_pair(1, COLOR_WHITE, COLOR_WHITE);
+            // Pixel = 0
+            init_pair(2, COLOR_BLUE, COLOR_BLUE);
+            // Debug info
+            init_pair(3, COLOR_WHITE, COLOR_BLACK);
+            // Cleared info
+            init_pair(4, COLOR_BLACK, COLOR_BLACK);
+            // XO-CHIP: pixel only in the second plane / in both
+            init_pair(5, COLOR_RED, COLOR_RED);
+            init_pair(6, COLOR_YELLOW, COLOR_YELLOW);
+        }
+    } else {
+        printf("ERROR: need colors atm!\n");
+        exit(-1);
+    }
+}
+
+static void set_pixel(uint8_t color, int width)
+{
+    // Plane bits -> color pair: off, first plane, second plane, both
+    static const short pairs[4] = { 2, 1, 5, 6 };
+
+    // Set right color
+    attrset(COLOR_PAIR(pairs[color]));
+
+    // Two spaces -> more square-like
+    for (int i = 0; i < width; i++) {
+        addch(' ');
+    }
+
+    // Clear for setting next pixels
+    attroff(COLOR_PAIR(pairs[color]));
+}
+
+static void clear_debug_row(uint8_t row, uint8_t num_rows)
+{
+    attrset(COLOR_PAIR(4));
+
+    for (int r = row; r < row + num_rows; r++) {
+        move(r, 0);
+
+        // Overwrite debug text with black spaces
+        for (int c = 0; c < SCREEN_COLS; c++) {
+            addch(' ');
+        }
+    }
+
+    attroff(COLOR_PAIR(4));
+}
+
+static void drain_input(void)
+{
+    nodelay(stdscr, TRUE);
+
+    int ch;
+    while ((ch = getch()) != ERR) {
+        key_queue_add(&pending, ch);
+    }
+
+    nodelay(stdscr, FALSE);
+}
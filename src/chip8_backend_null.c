@@ -0,0 +1,89 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "chip8_backend.h"
+
+static void null_init(void);
+static void null_deinit(void);
+static void null_refresh_screen(const struct graphics *gfx);
+static void null_draw_program_state(struct emulator *em);
+static void null_clear_program_state(void);
+static uint8_t null_get_char(void);
+static bool null_is_key_pressed(uint8_t key, bool consume_key);
+static uint8_t null_get_hex_key(void);
+static uint16_t null_poll_hex_keys(void);
+static int null_input_fd(void);
+static void null_set_keymap(const char keys[NUM_KEYS]);
+
+const struct chip8_backend chip8_backend_null = {
+    .name                = "null",
+    .init                = null_init,
+    .deinit              = null_deinit,
+    .refresh_screen      = null_refresh_screen,
+    .draw_program_state  = null_draw_program_state,
+    .clear_program_state = null_clear_program_state,
+    .get_char            = null_get_char,
+    .is_key_pressed      = null_is_key_pressed,
+    .get_hex_key         = null_get_hex_key,
+    .poll_hex_keys       = null_poll_hex_keys,
+    .input_fd            = null_input_fd,
+    .set_keymap          = null_set_keymap,
+    .threaded_display    = false,
+};
+
+static void null_init(void)
+{
+}
+
+static void null_deinit(void)
+{
+}
+
+static void null_refresh_screen(const struct graphics *gfx)
+{
+    (void)gfx;
+}
+
+static void null_draw_program_state(struct emulator *em)
+{
+    (void)em;
+}
+
+static void null_clear_program_state(void)
+{
+}
+
+static uint8_t null_get_char(void)
+{
+    // Nobody is there to press anything, act as if the exit key was hit
+    return 'k';
+}
+
+static bool null_is_key_pressed(uint8_t key, bool consume_key)
+{
+    (void)key;
+    (void)consume_key;
+
+    return false;
+}
+
+static uint8_t null_get_hex_key(void)
+{
+    // Same convention as the ncurses backend: -1 -> end emulation
+    return (uint8_t)-1;
+}
+
+static uint16_t null_poll_hex_keys(void)
+{
+    return 0;
+}
+
+static int null_input_fd(void)
+{
+    return -1;
+}
+
+static void null_set_keymap(const char keys[NUM_KEYS])
+{
+    (void)keys;
+}
@@ -0,0 +1,765 @@
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "chip8_backend.h"
+#include "chip8_emulator.h"
+#include "chip8_input.h"
+#include "chip8_rom.h"
+#include "chip8_sched.h"
+#include "chip8_util.h"
+
+// Headless batch runner: every job of a manifest (ROM, input log, cycle
+// budget) on a pool of worker threads, one row of results per job in
+// manifest order. Every worker starts with an even share of the jobs and,
+// once done with them, steals from whoever has the most left.
+
+#define DEFAULT_CYCLES 10000000
+
+#define MAX_LINE   1024
+#define NS_PER_SEC 1000000000.0
+
+// Keeps each worker's queue on a cache line of its own
+#define CACHE_LINE 64
+
+struct batch_config {
+    enum chip8_engine engine;
+    uint64_t cycles;            // budget of jobs that don't give one
+    uint32_t ipf;
+    bool ipf_given;             // over what the index says
+    uint32_t seed;
+    bool idle_skip;
+};
+
+struct batch_job {
+    char *rom;
+    char *replay;               // NULL runs without input
+    uint64_t cycles;            // 0: until the log ends, else the default
+    int line;
+
+    // Opened before the workers start, jobs on the same file share it
+    const struct rom_image *image;
+    enum rom_error rom_error;
+
+    // From the index, for runs without a log
+    struct rom_settings settings;
+};
+
+enum batch_status {
+    BATCH_DONE,                 // ran the whole budget
+    BATCH_ENDED,                // stopped early, waiting for a key
+    BATCH_ERROR,
+};
+
+struct batch_result {
+    enum batch_status status;
+    const char *error;
+    uint64_t budget;
+    uint64_t cycles;
+    uint64_t frames;
+    uint64_t ns;
+    uint64_t state_hash;
+};
+
+// Jobs a worker has left, indices [first, end) packed into one word as
+// first << 32 | end. The owner takes from the front and thieves from the
+// back, both with a compare-and-swap, so neither ever waits on the other.
+struct batch_queue {
+    _Alignas(CACHE_LINE) _Atomic uint64_t range;
+};
+
+struct batch_pool {
+    const struct batch_config *config;
+    const struct batch_job *jobs;
+    struct batch_result *results;
+    uint32_t num_jobs;
+    struct batch_queue *queues;
+    uint32_t num_workers;
+    _Atomic uint32_t stolen;
+
+    // CPU time the workers got between them, unlike the wall time of each
+    // job it doesn't grow when more threads than cores share the time
+    _Atomic uint64_t cpu_ns;
+};
+
+struct batch_worker {
+    struct batch_pool *pool;
+    uint32_t id;
+    pthread_t thread;
+};
+
+static void print_usage(const char *prog_name);
+static bool parse_engine(const char *name, enum chip8_engine *engine);
+static struct batch_job *load_manifest(const char *filename, uint32_t *count);
+static void free_jobs(struct batch_job *jobs, uint32_t count);
+static bool open_roms(struct batch_job *jobs, uint32_t count,
+                      const char *index_file);
+static bool run_pool(struct batch_pool *pool);
+static void *worker_main(void *arg);
+static uint64_t thread_cpu_ns(void);
+static bool queue_take(struct batch_queue *queue, bool front, uint32_t *job);
+static bool steal(struct batch_pool *pool, uint32_t thief, uint32_t *job);
+static void run_job(const struct batch_config *config,
+                    const struct batch_job *job, struct batch_result *result);
+static const char *open_replay(const char *replay, chip8_ctx *ctx,
+                               struct input_log **input_log,
+                               struct input_log_info *info);
+static void write_results(FILE *out, bool json, const struct batch_job *jobs,
+                          const struct batch_result *results, uint32_t count,
+                          const char *engine, uint32_t threads);
+static void write_string(FILE *out, bool json, const char *str);
+
+static const char *const status_names[] = {
+    [BATCH_DONE]  = "done",
+    [BATCH_ENDED] = "ended",
+    [BATCH_ERROR] = "error",
+};
+
+int main(int argc, char *argv[])
+{
+    static const struct option long_options[] = {
+        { "threads",   required_argument, NULL, 'j' },
+        { "engine",    required_argument, NULL, 'e' },
+        { "cycles",    required_argument, NULL, 'c' },
+        { "ipf",       required_argument, NULL, 'i' },
+        { "seed",      required_argument, NULL, 's' },
+        { "output",    required_argument, NULL, 'o' },
+        { "format",    required_argument, NULL, 'f' },
+        { "no-idle-skip", no_argument,    NULL, 'I' },
+        { "index",     required_argument, NULL, 'x' },
+        { "help",      no_argument,       NULL, 'h' },
+        { NULL,        0,                 NULL, 0   }
+    };
+
+    struct batch_config config = {
+        .engine    = CHIP8_ENGINE_CACHED,
+        .cycles    = DEFAULT_CYCLES,
+        .ipf       = SCHED_DEFAULT_IPF,
+        .seed      = CHIP8_DEFAULT_SEED,
+        .idle_skip = true,
+    };
+    const char *engine_name = "cached";
+    const char *output = NULL;
+    const char *format = NULL;
+    const char *index_file = NULL;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "j:e:c:i:s:o:f:Ix:h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'j':
+                threads = strtol(optarg, NULL, 0);
+                break;
+            case 'e':
+                if (!parse_engine(optarg, &config.engine)) {
+                    printf("ERROR: Unknown engine '%s'!\n", optarg);
+                    return -1;
+                }
+                engine_name = optarg;
+                break;
+            case 'c':
+                config.cycles = strtoull(optarg, NULL, 0);
+                break;
+            case 'i':
+                config.ipf = strtoul(optarg, NULL, 0);
+                config.ipf_given = true;
+                break;
+            case 's':
+                config.seed = strtoul(optarg, NULL, 0);
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            case 'f':
+                format = optarg;
+                break;
+            case 'I':
+                config.idle_skip = false;
+                break;
+            case 'x':
+                index_file = optarg;
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                return 0;
+            default:
+                print_usage(argv[0]);
+                return -1;
+        }
+    }
+
+    // Without --format, a .json output file says which
+    if (format == NULL) {
+        size_t len = output != NULL ? strlen(output) : 0;
+        format = len > 5 && strcmp(&output[len - 5], ".json") == 0 ? "json" : "csv";
+    }
+
+    if (optind != argc - 1 || threads < 1 || config.cycles == 0 ||
+        config.ipf == 0 ||
+        (strcmp(format, "csv") != 0 && strcmp(format, "json") != 0)) {
+        print_usage(argv[0]);
+        return -1;
+    }
+
+    uint32_t num_jobs;
+    struct batch_job *jobs = load_manifest(argv[optind], &num_jobs);
+    if (jobs == NULL) {
+        printf("ERROR: Unable to read manifest %s!\n", argv[optind]);
+        return -1;
+    }
+
+    if (!open_roms(jobs, num_jobs, index_file)) {
+        free_jobs(jobs, num_jobs);
+        printf("ERROR: Unable to read ROM index %s!\n", index_file);
+        return -1;
+    }
+
+    struct batch_result *results = calloc(num_jobs > 0 ? num_jobs : 1, sizeof(*results));
+    struct batch_pool pool = {
+        .config      = &config,
+        .jobs        = jobs,
+        .results     = results,
+        .num_jobs    = num_jobs,
+        .num_workers = (uint32_t)threads < num_jobs ? (uint32_t)threads : num_jobs,
+    };
+
+    if (pool.num_workers == 0) {
+        pool.num_workers = 1;
+    }
+
+    uint64_t start = util_time_ns();
+
+    if (results == NULL || !run_pool(&pool)) {
+        free(results);
+        free_jobs(jobs, num_jobs);
+        printf("ERROR: Unable to start worker threads! Aborting...\n");
+        return -1;
+    }
+
+    uint64_t wall_ns = util_time_ns() - start;
+
+    FILE *out = stdout;
+    if (output != NULL) {
+        out = fopen(output, "w");
+        if (out == NULL) {
+            free(results);
+            free_jobs(jobs, num_jobs);
+            printf("ERROR: Unable to create %s!\n", output);
+            return -1;
+        }
+    }
+
+    write_results(out, strcmp(format, "json") == 0, jobs, results, num_jobs,
+                  engine_name, pool.num_workers);
+
+    if (out != stdout && fclose(out) != 0) {
+        free(results);
+        free_jobs(jobs, num_jobs);
+        printf("ERROR: Unable to write %s!\n", output);
+        return -1;
+    }
+
+    uint64_t cycles = 0;
+    uint32_t failed = 0;
+
+    for (uint32_t i = 0; i < num_jobs; i++) {
+        cycles += results[i].cycles;
+
+        if (results[i].status == BATCH_ERROR) {
+            fprintf(stderr, "%s (line %d): %s\n", jobs[i].rom, jobs[i].line,
+                    results[i].error);
+            failed++;
+        }
+    }
+
+    // Cores kept busy on average: close to the thread count when the pool
+    // scales, never past the cores there are
+    double seconds = wall_ns / NS_PER_SEC;
+    fprintf(stderr, "%" PRIu32 " jobs on %" PRIu32 " threads in %.2f s: "
+                    "%.1f Minstr/s, %.2fx parallel, %" PRIu32 " stolen, %" PRIu32 " failed\n",
+            num_jobs, pool.num_workers, seconds, cycles / seconds / 1e6,
+            wall_ns > 0 ? (double)atomic_load(&pool.cpu_ns) / wall_ns : 0,
+            atomic_load(&pool.stolen),
+            failed);
+
+    free(results);
+    free_jobs(jobs, num_jobs);
+
+    return failed > 0 ? 1 : 0;
+}
+
+static void print_usage(const char *prog_name)
+{
+    printf("Usage: %s [options] MANIFEST\n"
+           "  MANIFEST holds one job per line: ROM [LOG|-] [CYCLES], '#' starts a\n"
+           "  comment. LOG is replayed like chip8_main --replay, CYCLES defaults\n"
+           "  to where the log ends, or --cycles without one.\n"
+           "  -j, --threads N     worker threads (default: one per core)\n"
+           "  -e, --engine E      interp, cached (default) or jit\n"
+           "  -c, --cycles N      budget of jobs without one (default %d)\n"
+           "  -i, --ipf N         instructions per frame without a log (default: the\n"
+           "                      index's, or %d)\n"
+           "  -s, --seed N        random seed without a log (default %d)\n"
+           "  -o, --output F      write results here instead of stdout\n"
+           "  -f, --format F      csv or json (default: json for a .json output)\n"
+           "  -I, --no-idle-skip  run busy-wait loops out instead of skipping them\n"
+           "  -x, --index F       quirks and ipf by ROM for jobs without a log, see\n"
+           "                      chip8_main --index\n"
+           "  -h, --help          show this message\n",
+           prog_name, DEFAULT_CYCLES, SCHED_DEFAULT_IPF, CHIP8_DEFAULT_SEED);
+}
+
+static bool parse_engine(const char *name, enum chip8_engine *engine)
+{
+    if (strcmp(name, "interp") == 0) {
+        *engine = CHIP8_ENGINE_INTERPRETER;
+    } else if (strcmp(name, "cached") == 0) {
+        *engine = CHIP8_ENGINE_CACHED;
+    } else if (strcmp(name, "jit") == 0) {
+        *engine = CHIP8_ENGINE_JIT;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+static struct batch_job *load_manifest(const char *filename, uint32_t *count)
+{
+    FILE *in = fopen(filename, "r");
+    if (in == NULL) {
+        return NULL;
+    }
+
+    struct batch_job *jobs = malloc(sizeof(*jobs));
+    uint32_t capacity = 1;
+    char line[MAX_LINE];
+    int line_number = 0;
+
+    *count = 0;
+
+    while (jobs != NULL && fgets(line, sizeof(line), in) != NULL) {
+        line_number++;
+
+        char *comment = strchr(line, '#');
+        if (comment != NULL) {
+            *comment = '\0';
+        }
+
+        char *save;
+        char *rom = strtok_r(line, " \t\r\n", &save);
+        char *replay = strtok_r(NULL, " \t\r\n", &save);
+        char *cycles = strtok_r(NULL, " \t\r\n", &save);
+
+        if (rom == NULL) {
+            continue;
+        }
+
+        if (*count == capacity) {
+            capacity *= 2;
+
+            struct batch_job *grown = realloc(jobs, capacity * sizeof(*jobs));
+            if (grown == NULL) {
+                break;
+            }
+            jobs = grown;
+        }
+
+        struct batch_job *job = &jobs[*count];
+
+        memset(job, 0, sizeof(*job));
+        job->rom    = strdup(rom);
+        job->replay = replay != NULL && strcmp(replay, "-") != 0 ? strdup(replay) : NULL;
+        job->cycles = cycles != NULL ? strtoull(cycles, NULL, 0) : 0;
+        job->line   = line_number;
+
+        (*count)++;
+
+        if (job->rom == NULL || (replay != NULL && strcmp(replay, "-") != 0 &&
+                                 job->replay == NULL)) {
+            break;
+        }
+    }
+
+    bool ok = jobs != NULL && !ferror(in) && feof(in);
+    fclose(in);
+
+    if (!ok) {
+        free_jobs(jobs, *count);
+        return NULL;
+    }
+
+    return jobs;
+}
+
+static void free_jobs(struct batch_job *jobs, uint32_t count)
+{
+    for (uint32_t i = 0; jobs != NULL && i < count; i++) {
+        free(jobs[i].rom);
+        free(jobs[i].replay);
+        rom_release(jobs[i].image);
+    }
+
+    free(jobs);
+}
+
+// Every ROM is mapped once and looked up in the index once, however many
+// jobs run it
+static bool open_roms(struct batch_job *jobs, uint32_t count,
+                      const char *index_file)
+{
+    struct rom_index *index = NULL;
+
+    if (index_file != NULL) {
+        index = rom_index_load(index_file);
+        if (index == NULL) {
+            return false;
+        }
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        struct batch_job *job = &jobs[i];
+
+        job->rom_error = rom_open(job->rom, &job->image, NULL);
+
+        if (job->rom_error == ROM_OK && index != NULL) {
+            rom_index_find(index, job->image->hash, &job->settings);
+        }
+    }
+
+    rom_index_destroy(index);
+
+    return true;
+}
+
+static bool run_pool(struct batch_pool *pool)
+{
+    struct batch_worker *workers = calloc(pool->num_workers, sizeof(*workers));
+    pool->queues = aligned_alloc(CACHE_LINE, pool->num_workers * sizeof(*pool->queues));
+
+    if (workers == NULL || pool->queues == NULL) {
+        free(workers);
+        free(pool->queues);
+        return false;
+    }
+
+    // Neighbouring lines of a manifest tend to cost about the same, so
+    // consecutive shares start out about even
+    for (uint32_t i = 0; i < pool->num_workers; i++) {
+        uint64_t first = (uint64_t)pool->num_jobs * i / pool->num_workers;
+        uint64_t end = (uint64_t)pool->num_jobs * (i + 1) / pool->num_workers;
+
+        atomic_init(&pool->queues[i].range, first << 32 | end);
+        workers[i].pool = pool;
+        workers[i].id = i;
+    }
+
+    atomic_init(&pool->stolen, 0);
+    atomic_init(&pool->cpu_ns, 0);
+
+    // The calling thread is worker 0. Workers that fail to start only
+    // leave their share to be stolen by the others.
+    uint32_t started = 1;
+    while (started < pool->num_workers &&
+           pthread_create(&workers[started].thread, NULL, worker_main,
+                          &workers[started]) == 0) {
+        started++;
+    }
+
+    worker_main(&workers[0]);
+
+    for (uint32_t i = 1; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+
+    free(workers);
+    free(pool->queues);
+    pool->queues = NULL;
+
+    return true;
+}
+
+static void *worker_main(void *arg)
+{
+    struct batch_worker *worker = arg;
+    struct batch_pool *pool = worker->pool;
+    uint64_t start = thread_cpu_ns();
+    uint32_t job;
+
+    while (queue_take(&pool->queues[worker->id], true, &job) ||
+           steal(pool, worker->id, &job)) {
+        run_job(pool->config, &pool->jobs[job], &pool->results[job]);
+    }
+
+    atomic_fetch_add(&pool->cpu_ns, thread_cpu_ns() - start);
+
+    return NULL;
+}
+
+static uint64_t thread_cpu_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static bool queue_take(struct batch_queue *queue, bool front, uint32_t *job)
+{
+    uint64_t range = atomic_load(&queue->range);
+    uint64_t next;
+
+    do {
+        uint32_t first = range >> 32;
+        uint32_t end = (uint32_t)range;
+
+        if (first == end) {
+            return false;
+        }
+
+        *job = front ? first : end - 1;
+        next = front ? (uint64_t)(first + 1) << 32 | end :
+                       (uint64_t)first << 32 | (end - 1);
+    } while (!atomic_compare_exchange_weak(&queue->range, &range, next));
+
+    return true;
+}
+
+// One job off the back of the longest queue, the one that would otherwise
+// finish last. Jobs take milliseconds at least, looking at every queue for
+// each steal costs nothing next to that.
+static bool steal(struct batch_pool *pool, uint32_t thief, uint32_t *job)
+{
+    for (;;) {
+        uint32_t victim = thief;
+        uint32_t most = 0;
+
+        for (uint32_t i = 0; i < pool->num_workers; i++) {
+            uint64_t range = atomic_load(&pool->queues[i].range);
+            uint32_t left = (uint32_t)range - (uint32_t)(range >> 32);
+
+            if (i != thief && left > most) {
+                victim = i;
+                most = left;
+            }
+        }
+
+        // Jobs never come back once taken, so empty everywhere means done
+        if (most == 0) {
+            return false;
+        }
+
+        if (queue_take(&pool->queues[victim], false, job)) {
+            atomic_fetch_add(&pool->stolen, 1);
+            return true;
+        }
+    }
+}
+
+static void run_job(const struct batch_config *config,
+                    const struct batch_job *job, struct batch_result *result)
+{
+    uint64_t start = util_time_ns();
+
+    result->status = BATCH_ERROR;
+    if (job->rom_error != ROM_OK) {
+        result->error = rom_error_string(job->rom_error);
+        return;
+    }
+
+    chip8_ctx *ctx = chip8_create(&chip8_backend_null);
+    if (ctx == NULL) {
+        result->error = "unable to allocate emulator";
+        return;
+    }
+
+    chip8_set_mode(ctx, chip8_mode_for_rom(job->rom));
+
+    enum rom_error error = chip8_load_image(ctx, job->image);
+    if (error != ROM_OK) {
+        chip8_destroy(ctx);
+        result->error = rom_error_string(error);
+        return;
+    }
+
+    // A log brings its own, set up in open_replay()
+    if (job->settings.has_quirks) {
+        chip8_set_quirks(ctx, job->settings.quirks);
+    }
+
+    if (!chip8_set_engine(ctx, config->engine)) {
+        chip8_destroy(ctx);
+        result->error = "engine not available on this host";
+        return;
+    }
+
+    struct input_log_info info = {
+        .seed = config->seed,
+        .ipf  = config->ipf_given || job->settings.ipf == 0 ? config->ipf :
+                job->settings.ipf,
+    };
+    struct input_log *input_log = NULL;
+    uint64_t max_cycles = job->cycles != 0 ? job->cycles : config->cycles;
+
+    if (job->replay != NULL) {
+        result->error = open_replay(job->replay, ctx, &input_log, &info);
+        if (result->error != NULL) {
+            chip8_destroy(ctx);
+            return;
+        }
+
+        // Same as chip8_main --replay: no further than the recording went
+        uint64_t end = input_log_end_cycles(input_log);
+        if (end != 0 && (job->cycles == 0 || end < job->cycles)) {
+            max_cycles = end;
+        }
+    }
+
+    chip8_seed_random(ctx, info.seed);
+    ctx->input_log = input_log;
+    ctx->idle_skip = config->idle_skip;
+
+    struct sched sched;
+    sched_init(&sched, info.ipf, 1, true);
+
+    uint64_t cycles = 0;
+
+    while (cycles < max_cycles && !chip8_emulation_end_detected(ctx)) {
+        uint64_t budget = max_cycles - cycles;
+
+        cycles += sched_run(&sched, ctx, budget > UINT32_MAX ? UINT32_MAX : budget);
+
+        if (sched_frame_done(&sched)) {
+            sched_end_frame(&sched, ctx);
+        }
+    }
+
+    result->status = cycles < max_cycles ? BATCH_ENDED : BATCH_DONE;
+    result->budget = max_cycles;
+    result->cycles = cycles;
+    result->frames = sched.frames;
+    result->state_hash = chip8_state_hash(ctx);
+
+    sched_deinit(&sched);
+    ctx->input_log = NULL;
+    input_log_close(input_log, cycles);
+    chip8_destroy(ctx);
+
+    result->ns = util_time_ns() - start;
+}
+
+// The log, checked against the loaded ROM, with the mode and quirks it was
+// recorded with set up. NULL on success, what's wrong otherwise.
+static const char *open_replay(const char *replay, chip8_ctx *ctx,
+                               struct input_log **input_log,
+                               struct input_log_info *info)
+{
+    *input_log = input_log_replay(replay, info);
+    if (*input_log == NULL) {
+        return "unable to read input log";
+    }
+
+    if (info->mode > CHIP8_MODE_XOCHIP || !chip8_set_mode(ctx, info->mode) ||
+        info->rom_hash != chip8_rom_hash(ctx)) {
+        input_log_close(*input_log, 0);
+        return "input log recorded with another ROM";
+    }
+
+    if (!chip8_set_quirks(ctx, info->quirks)) {
+        input_log_close(*input_log, 0);
+        return "input log recorded with other quirks";
+    }
+
+    return NULL;
+}
+
+static void write_results(FILE *out, bool json, const struct batch_job *jobs,
+                          const struct batch_result *results, uint32_t count,
+                          const char *engine, uint32_t threads)
+{
+    if (json) {
+        fprintf(out, "{\"engine\": \"%s\", \"threads\": %" PRIu32 ", \"results\": [\n",
+                engine, threads);
+    } else {
+        fprintf(out, "rom,log,budget,status,cycles,frames,seconds,state,error\n");
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        const struct batch_result *result = &results[i];
+        bool ok = result->status != BATCH_ERROR;
+        char state[17] = "";
+
+        if (ok) {
+            snprintf(state, sizeof(state), "%016" PRIx64, result->state_hash);
+        }
+
+        if (json) {
+            fprintf(out, "%s{\"rom\": ", i == 0 ? "  " : ", ");
+            write_string(out, json, jobs[i].rom);
+            fprintf(out, ", \"log\": ");
+            write_string(out, json, jobs[i].replay);
+            fprintf(out, ", \"budget\": %" PRIu64 ", \"status\": \"%s\""
+                         ", \"cycles\": %" PRIu64 ", \"frames\": %" PRIu64
+                         ", \"seconds\": %.6f, \"state\": ",
+                    result->budget, status_names[result->status],
+                    result->cycles, result->frames, result->ns / NS_PER_SEC);
+            write_string(out, json, ok ? state : NULL);
+            fprintf(out, ", \"error\": ");
+            write_string(out, json, result->error);
+            fprintf(out, "}\n");
+        } else {
+            write_string(out, json, jobs[i].rom);
+            fputc(',', out);
+            write_string(out, json, jobs[i].replay);
+            fprintf(out, ",%" PRIu64 ",%s,%" PRIu64 ",%" PRIu64 ",%.6f,%s,",
+                    result->budget, status_names[result->status],
+                    result->cycles, result->frames, result->ns / NS_PER_SEC,
+                    state);
+            write_string(out, json, result->error);
+            fputc('\n', out);
+        }
+    }
+
+    if (json) {
+        fprintf(out, "]}\n");
+    }
+}
+
+// Quoted and escaped, NULL as null in JSON and an empty field in CSV
+static void write_string(FILE *out, bool json, const char *str)
+{
+    if (str == NULL) {
+        if (json) {
+            fputs("null", out);
+        }
+        return;
+    }
+
+    fputc('"', out);
+
+    for (const char *c = str; *c != '\0'; c++) {
+        if (!json) {
+            // Quotes double up
+            if (*c == '"') {
+                fputc('"', out);
+            }
+            fputc(*c, out);
+        } else if (*c == '"' || *c == '\\') {
+            fprintf(out, "\\%c", *c);
+        } else if ((unsigned char)*c < 0x20) {
+            fprintf(out, "\\u%04x", *c);
+        } else {
+            fputc(*c, out);
+        }
+    }
+
+    fputc('"', out);
+}
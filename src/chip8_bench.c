@@ -0,0 +1,771 @@
+#include <dirent.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "chip8_backend.h"
+#include "chip8_emulator.h"
+#include "chip8_input.h"
+#include "chip8_lanes.h"
+#include "chip8_sched.h"
+#include "chip8_util.h"
+
+// Headless throughput suite: every ROM in example_progs/ plus any given on
+// the command line, on every engine, unthrottled. One JSON object per line
+// so a saved run doubles as a baseline for --baseline. The lanes engines run
+// many machines at once and count all of their instructions.
+
+#define DEFAULT_CYCLES    10000000
+#define DEFAULT_REPEATS   3
+#define DEFAULT_THRESHOLD 10        // percent slower than baseline that fails
+#define DEFAULT_ENGINES   "interp,cached,jit"
+#define DEFAULT_LANES     256
+
+#define MAX_ROMS      256
+#define MAX_LINE      1024
+#define NS_PER_SEC    1000000000.0
+
+struct bench_config {
+    uint64_t cycles;
+    uint32_t ipf;
+    int repeats;
+    const char *replay;
+    bool idle_skip;
+
+    // Set for the lanes engines, which run lanes machines at once
+    bool lockstep;
+    enum lanes_isa isa;
+    uint32_t lanes;
+};
+
+struct bench_result {
+    bool ok;
+
+    // Fastest of the timed repeats
+    uint64_t cycles;
+    uint64_t frames;
+    uint64_t ns;
+
+    // From one extra run with ctx->stats set, clock overhead taken out
+    uint64_t profiled_ns;
+    uint64_t draw_ns;
+    uint64_t decode_ns;
+    uint64_t idle_skipped;
+
+    long peak_rss_kb;
+    uint64_t state_hash;
+};
+
+struct baseline {
+    char (*keys)[MAX_LINE];
+    double *instr_per_sec;
+    char (*states)[17];
+    int count;
+};
+
+static void print_usage(const char *prog_name);
+static int add_example_roms(const char **roms, int num_roms);
+static bool parse_engine(const char *name, enum chip8_engine *engine);
+static bool engines_valid(const char *engines);
+static bool bench_rom(const struct bench_config *config, const char *rom,
+                      enum chip8_engine engine, struct bench_result *result);
+static void bench_child(const struct bench_config *config, const char *rom,
+                        enum chip8_engine engine, struct bench_result *result);
+static bool run_once(const struct bench_config *config, const char *rom,
+                     enum chip8_engine engine, struct chip8_stats *stats,
+                     struct bench_result *result);
+static bool run_lanes(const struct bench_config *config, const char *rom,
+                      struct bench_result *result);
+static bool open_replay(const struct bench_config *config, chip8_ctx *ctx,
+                        struct input_log **input_log, uint32_t *ipf,
+                        uint64_t *max_cycles);
+static uint64_t clock_overhead_ns(void);
+static bool load_baseline(const char *filename, struct baseline *baseline);
+static bool json_string(const char *line, const char *key, char *out,
+                        size_t size);
+static bool json_number(const char *line, const char *key, double *out);
+static const char *base_name(const char *path);
+
+int main(int argc, char *argv[])
+{
+    static const struct option long_options[] = {
+        { "cycles",    required_argument, NULL, 'c' },
+        { "engines",   required_argument, NULL, 'e' },
+        { "ipf",       required_argument, NULL, 'i' },
+        { "repeats",   required_argument, NULL, 'n' },
+        { "replay",    required_argument, NULL, 'p' },
+        { "output",    required_argument, NULL, 'o' },
+        { "baseline",  required_argument, NULL, 'b' },
+        { "threshold", required_argument, NULL, 't' },
+        { "no-idle-skip", no_argument,    NULL, 'I' },
+        { "lanes",     required_argument, NULL, 'L' },
+        { "help",      no_argument,       NULL, 'h' },
+        { NULL,        0,                 NULL, 0   }
+    };
+
+    struct bench_config config = {
+        .cycles  = DEFAULT_CYCLES,
+        .ipf     = SCHED_DEFAULT_IPF,
+        .repeats = DEFAULT_REPEATS,
+        .replay  = NULL,
+        .idle_skip = true,
+        .lanes   = DEFAULT_LANES,
+    };
+    char engines[MAX_LINE] = DEFAULT_ENGINES;
+    const char *output = NULL;
+    const char *baseline_file = NULL;
+    double threshold = DEFAULT_THRESHOLD;
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "c:e:i:n:p:o:b:t:IL:h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'c':
+                config.cycles = strtoull(optarg, NULL, 0);
+                break;
+            case 'e':
+                snprintf(engines, sizeof(engines), "%s", optarg);
+                break;
+            case 'i':
+                config.ipf = strtoul(optarg, NULL, 0);
+                break;
+            case 'n':
+                config.repeats = atoi(optarg);
+                break;
+            case 'p':
+                config.replay = optarg;
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            case 'b':
+                baseline_file = optarg;
+                break;
+            case 't':
+                threshold = strtod(optarg, NULL);
+                break;
+            case 'I':
+                config.idle_skip = false;
+                break;
+            case 'L':
+                config.lanes = strtoul(optarg, NULL, 0);
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                return 0;
+            default:
+                print_usage(argv[0]);
+                return -1;
+        }
+    }
+
+    if (config.repeats < 1 || config.ipf == 0 || config.lanes == 0) {
+        print_usage(argv[0]);
+        return -1;
+    }
+
+    // Before anything runs, a typo shouldn't cost the engines ahead of it
+    if (!engines_valid(engines)) {
+        return -1;
+    }
+
+    static const char *roms[MAX_ROMS];
+    int num_roms = add_example_roms(roms, 0);
+
+    for (int i = optind; i < argc && num_roms < MAX_ROMS; i++) {
+        roms[num_roms++] = argv[i];
+    }
+
+    struct baseline baseline = { 0 };
+    if (baseline_file != NULL && !load_baseline(baseline_file, &baseline)) {
+        printf("ERROR: Unable to read baseline %s!\n", baseline_file);
+        free(baseline.keys);
+        free(baseline.instr_per_sec);
+        free(baseline.states);
+        return -1;
+    }
+
+    FILE *out = stdout;
+    if (output != NULL) {
+        out = fopen(output, "w");
+        if (out == NULL) {
+            printf("ERROR: Unable to create %s!\n", output);
+            return -1;
+        }
+    }
+
+    bool failed = false;
+    bool first = true;
+
+    fprintf(out, "{\"cycles\": %" PRIu64 ", \"ipf\": %" PRIu32 ", \"results\": [\n",
+            config.cycles, config.ipf);
+
+    for (char *name = strtok(engines, ","); name != NULL; name = strtok(NULL, ",")) {
+        enum chip8_engine engine = CHIP8_ENGINE_INTERPRETER;
+        struct bench_config run_config = config;
+
+        // engines_valid() has seen every name
+        if (lanes_isa_parse(name, &run_config.isa)) {
+            run_config.lockstep = true;
+        } else {
+            parse_engine(name, &engine);
+        }
+
+        for (int r = 0; r < num_roms; r++) {
+            struct bench_result result;
+
+            if (!bench_rom(&run_config, roms[r], engine, &result)) {
+                fprintf(stderr, "%s on %s: skipped\n", base_name(roms[r]), name);
+                continue;
+            }
+
+            double seconds = result.ns / NS_PER_SEC;
+            double ips = result.cycles / seconds;
+            double fps = result.frames / seconds;
+            double draw_share = result.profiled_ns > 0 ?
+                                (double)result.draw_ns / result.profiled_ns : 0;
+            double decode_share = result.profiled_ns > 0 ?
+                                  (double)result.decode_ns / result.profiled_ns : 0;
+            double idle_share = result.cycles > 0 ?
+                                (double)result.idle_skipped / result.cycles : 0;
+
+            fprintf(out,
+                    "%s{\"rom\": \"%s\", \"engine\": \"%s\", \"cycles\": %" PRIu64
+                    ", \"frames\": %" PRIu64 ", \"seconds\": %.6f"
+                    ", \"instr_per_sec\": %.0f, \"frames_per_sec\": %.0f"
+                    ", \"draw_share\": %.4f, \"decode_share\": %.4f"
+                    ", \"idle_share\": %.4f"
+                    ", \"peak_rss_kb\": %ld, \"state\": \"%016" PRIx64 "\"",
+                    first ? "  " : ", ", base_name(roms[r]), name,
+                    result.cycles, result.frames, seconds, ips, fps,
+                    draw_share, decode_share, idle_share, result.peak_rss_kb,
+                    result.state_hash);
+            first = false;
+
+            if (run_config.lockstep) {
+                fprintf(out, ", \"lanes\": %" PRIu32, run_config.lanes);
+            }
+
+            fprintf(stderr, "%s on %s: %.1f Minstr/s, %.0f frames/s\n",
+                    base_name(roms[r]), name, ips / 1e6, fps);
+
+            char key[MAX_LINE];
+            snprintf(key, sizeof(key), "%s/%s", base_name(roms[r]), name);
+
+            for (int b = 0; b < baseline.count; b++) {
+                if (strcmp(baseline.keys[b], key) != 0) {
+                    continue;
+                }
+
+                char state[17];
+                snprintf(state, sizeof(state), "%016" PRIx64, result.state_hash);
+
+                double change = (ips / baseline.instr_per_sec[b] - 1) * 100;
+                bool regression = change < -threshold;
+                bool state_changed = strcmp(state, baseline.states[b]) != 0;
+
+                fprintf(out, ", \"baseline_instr_per_sec\": %.0f, \"change_pct\": %.1f"
+                             ", \"regression\": %s, \"state_changed\": %s",
+                        baseline.instr_per_sec[b], change,
+                        regression ? "true" : "false",
+                        state_changed ? "true" : "false");
+
+                // Same cycles and input must give the same machine
+                if (regression) {
+                    fprintf(stderr, "REGRESSION: %s %.1f%% slower than baseline\n",
+                            key, -change);
+                }
+                if (state_changed) {
+                    fprintf(stderr, "REGRESSION: %s ends in a different state\n", key);
+                }
+
+                failed |= regression || state_changed;
+                break;
+            }
+
+            fprintf(out, "}\n");
+        }
+    }
+
+    fprintf(out, "]}\n");
+
+    if (out != stdout && fclose(out) != 0) {
+        printf("ERROR: Unable to write %s!\n", output);
+        return -1;
+    }
+
+    free(baseline.keys);
+    free(baseline.instr_per_sec);
+    free(baseline.states);
+
+    return failed ? 1 : 0;
+}
+
+static void print_usage(const char *prog_name)
+{
+    printf("Usage: %s [options] [extra_ROM.ch8 ...]\n"
+           "  -c, --cycles N      instructions per run (default %d)\n"
+           "  -e, --engines LIST  comma separated (default " DEFAULT_ENGINES ")\n"
+           "  -i, --ipf N         instructions per frame (default %d)\n"
+           "  -n, --repeats N     timed runs per ROM, the fastest counts (default %d)\n"
+           "  -p, --replay F      feed input recorded by chip8_main --record, runs\n"
+           "                      only the ROM it was recorded with\n"
+           "  -o, --output F      write the JSON here instead of stdout\n"
+           "  -b, --baseline F    compare against an earlier --output, exit 1 on\n"
+           "                      regressions\n"
+           "  -t, --threshold P   percent slower than baseline that counts as a\n"
+           "                      regression (default %d)\n"
+           "  -I, --no-idle-skip  run busy-wait loops out instead of skipping them\n"
+           "  -L, --lanes N       machines the lanes engines (lanes, lanes-avx2,\n"
+           "                      lanes-sse2, lanes-scalar) run at once, seeds\n"
+           "                      counting up from the default (default %d)\n"
+           "  -h, --help          show this message\n",
+           prog_name, DEFAULT_CYCLES, SCHED_DEFAULT_IPF, DEFAULT_REPEATS,
+           DEFAULT_THRESHOLD, DEFAULT_LANES);
+}
+
+static int add_example_roms(const char **roms, int num_roms)
+{
+    struct dirent **entries;
+    int count = scandir(CHIP8_EXAMPLE_PROGS, &entries, NULL, alphasort);
+    if (count < 0) {
+        return num_roms;
+    }
+
+    for (int i = 0; i < count; i++) {
+        const char *name = entries[i]->d_name;
+        size_t len = strlen(name);
+
+        if (num_roms < MAX_ROMS && len > 4 && strcmp(&name[len - 4], ".ch8") == 0) {
+            char *path = malloc(sizeof(CHIP8_EXAMPLE_PROGS "/") + len);
+            if (path != NULL) {
+                sprintf(path, "%s/%s", CHIP8_EXAMPLE_PROGS, name);
+                roms[num_roms++] = path;
+            }
+        }
+
+        free(entries[i]);
+    }
+
+    free(entries);
+
+    return num_roms;
+}
+
+static bool parse_engine(const char *name, enum chip8_engine *engine)
+{
+    if (strcmp(name, "interp") == 0) {
+        *engine = CHIP8_ENGINE_INTERPRETER;
+    } else if (strcmp(name, "cached") == 0) {
+        *engine = CHIP8_ENGINE_CACHED;
+    } else if (strcmp(name, "jit") == 0) {
+        *engine = CHIP8_ENGINE_JIT;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+static bool engines_valid(const char *engines)
+{
+    char list[MAX_LINE];
+    snprintf(list, sizeof(list), "%s", engines);
+
+    bool valid = true;
+
+    for (char *name = strtok(list, ","); name != NULL; name = strtok(NULL, ",")) {
+        enum lanes_isa isa;
+        enum chip8_engine engine;
+
+        if (!lanes_isa_parse(name, &isa) && !parse_engine(name, &engine)) {
+            printf("ERROR: Unknown engine '%s'!\n", name);
+            valid = false;
+        }
+    }
+
+    return valid;
+}
+
+static bool bench_rom(const struct bench_config *config, const char *rom,
+                      enum chip8_engine engine, struct bench_result *result)
+{
+    // Every ROM gets its own process: peak RSS is its own and a ROM that
+    // takes the emulator down only loses its own row
+    int fds[2];
+    if (pipe(fds) != 0) {
+        return false;
+    }
+
+    fflush(NULL);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+
+    if (pid == 0) {
+        close(fds[0]);
+
+        // Emulator error messages would end up in the middle of the JSON
+        if (freopen("/dev/null", "w", stdout) == NULL) {
+            _exit(1);
+        }
+
+        bench_child(config, rom, engine, result);
+
+        bool written = write(fds[1], result, sizeof(*result)) == sizeof(*result);
+        _exit(written ? 0 : 1);
+    }
+
+    close(fds[1]);
+
+    bool ok = read(fds[0], result, sizeof(*result)) == sizeof(*result);
+    close(fds[0]);
+
+    int status;
+    waitpid(pid, &status, 0);
+
+    return ok && result->ok && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static void bench_child(const struct bench_config *config, const char *rom,
+                        enum chip8_engine engine, struct bench_result *result)
+{
+    struct bench_result run;
+
+    memset(result, 0, sizeof(*result));
+
+    // Untimed warm-up, then the fastest repeat counts
+    if (!run_once(config, rom, engine, NULL, result)) {
+        return;
+    }
+    result->ns = UINT64_MAX;
+
+    for (int i = 0; i < config->repeats; i++) {
+        if (!run_once(config, rom, engine, NULL, &run)) {
+            return;
+        }
+        if (run.ns < result->ns) {
+            result->ns = run.ns;
+        }
+    }
+
+    // Timing every draw and decode slows things down, so the breakdown
+    // comes from a run of its own
+    struct chip8_stats stats = { 0 };
+    if (!run_once(config, rom, engine, &stats, &run)) {
+        return;
+    }
+
+    uint64_t overhead = clock_overhead_ns();
+    uint64_t draw_overhead = stats.draws * overhead;
+    uint64_t decode_overhead = stats.decodes * overhead;
+
+    result->profiled_ns = run.ns;
+    result->draw_ns = stats.draw_ns > draw_overhead ? stats.draw_ns - draw_overhead : 0;
+    result->decode_ns = stats.decode_ns > decode_overhead ?
+                        stats.decode_ns - decode_overhead : 0;
+    result->idle_skipped = stats.idle_skipped;
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    result->peak_rss_kb = usage.ru_maxrss;
+
+    result->ok = true;
+}
+
+static bool run_once(const struct bench_config *config, const char *rom,
+                     enum chip8_engine engine, struct chip8_stats *stats,
+                     struct bench_result *result)
+{
+    if (config->lockstep) {
+        return run_lanes(config, rom, result);
+    }
+
+    chip8_ctx *ctx = chip8_create(&chip8_backend_null);
+    if (ctx == NULL) {
+        return false;
+    }
+
+    chip8_set_mode(ctx, chip8_mode_for_rom(rom));
+    if (chip8_load(ctx, rom) != ROM_OK) {
+        chip8_destroy(ctx);
+        return false;
+    }
+
+    if (!chip8_set_engine(ctx, engine)) {
+        chip8_destroy(ctx);
+        return false;
+    }
+
+    uint32_t ipf = config->ipf;
+    uint64_t max_cycles = config->cycles;
+    struct input_log *input_log = NULL;
+
+    if (!open_replay(config, ctx, &input_log, &ipf, &max_cycles)) {
+        chip8_destroy(ctx);
+        return false;
+    }
+
+    ctx->input_log = input_log;
+    ctx->stats = stats;
+    ctx->idle_skip = config->idle_skip;
+
+    struct sched sched;
+    sched_init(&sched, ipf, 1, true);
+
+    uint64_t cycles = 0;
+    uint64_t start = util_time_ns();
+
+    while (cycles < max_cycles && !chip8_emulation_end_detected(ctx)) {
+        uint64_t budget = max_cycles - cycles;
+
+        cycles += sched_run(&sched, ctx, budget > UINT32_MAX ? UINT32_MAX : budget);
+
+        if (sched_frame_done(&sched)) {
+            sched_end_frame(&sched, ctx);
+        }
+    }
+
+    result->ns = util_time_ns() - start;
+    result->cycles = cycles;
+    result->frames = sched.frames;
+    result->state_hash = chip8_state_hash(ctx);
+
+    input_log_close(input_log, cycles);
+    chip8_destroy(ctx);
+
+    // A ROM that stops right away (waiting on a key without a replay)
+    // measures nothing useful
+    return cycles > 0 && result->ns > 0;
+}
+
+static bool run_lanes(const struct bench_config *config, const char *rom,
+                      struct bench_result *result)
+{
+    chip8_ctx *ctx = chip8_create(&chip8_backend_null);
+    if (ctx == NULL) {
+        return false;
+    }
+
+    chip8_set_mode(ctx, chip8_mode_for_rom(rom));
+    if (chip8_load(ctx, rom) != ROM_OK) {
+        chip8_destroy(ctx);
+        return false;
+    }
+
+    uint32_t ipf = config->ipf;
+    uint64_t max_cycles = config->cycles;
+    struct input_log **input_logs = calloc(config->lanes, sizeof(*input_logs));
+    struct lanes *lanes = NULL;
+    bool ok = false;
+
+    // Every lane replays a log of its own, the first one checks it fits
+    if (input_logs != NULL &&
+        open_replay(config, ctx, &input_logs[0], &ipf, &max_cycles)) {
+        lanes = lanes_create(ctx, config->lanes, ipf, config->isa);
+    }
+
+    for (uint32_t i = 0; lanes != NULL && i < config->lanes; i++) {
+        if (config->replay == NULL) {
+            // The first lane ends up where the other engines do
+            lanes_seed_random(lanes, i, CHIP8_DEFAULT_SEED + i);
+            continue;
+        }
+
+        struct input_log_info info;
+
+        if (i > 0) {
+            input_logs[i] = input_log_replay(config->replay, &info);
+        }
+        if (input_logs[i] == NULL) {
+            lanes_destroy(lanes);
+            lanes = NULL;
+            break;
+        }
+        lanes_set_input_log(lanes, i, input_logs[i]);
+    }
+
+    if (lanes != NULL) {
+        uint64_t start = util_time_ns();
+        uint64_t cycles = lanes_run(lanes, max_cycles);
+
+        result->ns = util_time_ns() - start;
+        result->cycles = cycles;
+        result->frames = lanes_frames(lanes) * config->lanes;
+
+        lanes_export(lanes, 0, ctx);
+        result->state_hash = chip8_state_hash(ctx);
+
+        ok = cycles > 0 && result->ns > 0;
+    }
+
+    for (uint32_t i = 0; input_logs != NULL && i < config->lanes; i++) {
+        input_log_close(input_logs[i], 0);
+    }
+    free(input_logs);
+    lanes_destroy(lanes);
+    chip8_destroy(ctx);
+
+    return ok;
+}
+
+// With a replay configured: the log, checked against the loaded ROM, and the
+// seed, quirks, ipf and length it was recorded with. Nothing to do without.
+static bool open_replay(const struct bench_config *config, chip8_ctx *ctx,
+                        struct input_log **input_log, uint32_t *ipf,
+                        uint64_t *max_cycles)
+{
+    struct input_log_info info;
+
+    if (config->replay == NULL) {
+        return true;
+    }
+
+    *input_log = input_log_replay(config->replay, &info);
+    if (*input_log == NULL ||
+        info.mode > CHIP8_MODE_XOCHIP || !chip8_set_mode(ctx, info.mode) ||
+        info.rom_hash != chip8_rom_hash(ctx) ||
+        !chip8_set_quirks(ctx, info.quirks)) {
+        input_log_close(*input_log, 0);
+        *input_log = NULL;
+        return false;
+    }
+
+    chip8_seed_random(ctx, info.seed);
+    *ipf = info.ipf;
+
+    if (input_log_end_cycles(*input_log) != 0) {
+        *max_cycles = input_log_end_cycles(*input_log);
+    }
+
+    return true;
+}
+
+static uint64_t clock_overhead_ns(void)
+{
+    enum { SAMPLES = 10000 };
+
+    uint64_t start = util_time_ns();
+    for (int i = 0; i < SAMPLES; i++) {
+        util_time_ns();
+    }
+
+    // Two reads per sample
+    return 2 * (util_time_ns() - start) / SAMPLES;
+}
+
+static bool load_baseline(const char *filename, struct baseline *baseline)
+{
+    FILE *in = fopen(filename, "r");
+    if (in == NULL) {
+        return false;
+    }
+
+    char line[MAX_LINE];
+    int capacity = 0;
+
+    while (fgets(line, sizeof(line), in) != NULL) {
+        char rom[MAX_LINE / 2], engine[MAX_LINE / 2], state[17];
+        double ips;
+
+        if (!json_string(line, "rom", rom, sizeof(rom)) ||
+            !json_string(line, "engine", engine, sizeof(engine)) ||
+            !json_string(line, "state", state, sizeof(state)) ||
+            !json_number(line, "instr_per_sec", &ips)) {
+            continue;
+        }
+
+        if (baseline->count == capacity) {
+            capacity = capacity == 0 ? 64 : capacity * 2;
+
+            // A failed realloc leaves the old buffer in place for the caller
+            // to free
+            char (*keys)[MAX_LINE] = realloc(baseline->keys,
+                                             capacity * sizeof(*baseline->keys));
+            if (keys != NULL) {
+                baseline->keys = keys;
+            }
+            double *instr_per_sec = realloc(baseline->instr_per_sec,
+                                            capacity * sizeof(*baseline->instr_per_sec));
+            if (instr_per_sec != NULL) {
+                baseline->instr_per_sec = instr_per_sec;
+            }
+            char (*states)[17] = realloc(baseline->states,
+                                         capacity * sizeof(*baseline->states));
+            if (states != NULL) {
+                baseline->states = states;
+            }
+
+            if (keys == NULL || instr_per_sec == NULL || states == NULL) {
+                fclose(in);
+                return false;
+            }
+        }
+
+        snprintf(baseline->keys[baseline->count], MAX_LINE, "%s/%s", rom, engine);
+        memcpy(baseline->states[baseline->count], state, sizeof(state));
+        baseline->instr_per_sec[baseline->count] = ips;
+        baseline->count++;
+    }
+
+    fclose(in);
+
+    return true;
+}
+
+// Just enough JSON to read back what main() writes, one result per line
+static bool json_string(const char *line, const char *key, char *out,
+                        size_t size)
+{
+    char pattern[64];
+    snprintf(pattern, sizeof(pattern), "\"%s\": \"", key);
+
+    const char *start = strstr(line, pattern);
+    if (start == NULL) {
+        return false;
+    }
+    start += strlen(pattern);
+
+    const char *end = strchr(start, '"');
+    if (end == NULL || (size_t)(end - start) >= size) {
+        return false;
+    }
+
+    memcpy(out, start, end - start);
+    out[end - start] = '\0';
+
+    return true;
+}
+
+static bool json_number(const char *line, const char *key, double *out)
+{
+    char pattern[64];
+    snprintf(pattern, sizeof(pattern), "\"%s\": ", key);
+
+    const char *start = strstr(line, pattern);
+    if (start == NULL) {
+        return false;
+    }
+
+    char *end;
+    *out = strtod(start + strlen(pattern), &end);
+
+    return end != start + strlen(pattern);
+}
+
+static const char *base_name(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+
+    return slash != NULL ? slash + 1 : path;
+}
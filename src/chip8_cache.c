@@ -0,0 +1,76 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8_cache.h"
+#include "chip8_decode.h"
+#include "chip8_emulator.h"
+#include "chip8_graphics.h"
+#include "chip8_ops.h"
+#include "chip8_quirks.h"
+#include "chip8_util.h"
+
+// GCC/Clang get direct threading through a table of label addresses, every
+// handler jumping straight to the next one. Anything else falls back to a
+// plain switch over the same handler bodies.
+#if defined(__GNUC__)
+#define CACHE_THREADED 1
+#else
+#define CACHE_THREADED 0
+#endif
+
+#define CACHE_FETCH()                                   \
+    do {                                                \
+        if (executed == num_cycles ||                   \
+            pc >= cache_end) {                          \
+            goto done;                                  \
+        }                                               \
+        instr = &ctx->cache[pc];                        \
+        executed++;                                     \
+    } while (0)
+
+#if CACHE_THREADED
+#define CACHE_OP(name)  handle_##name:
+#define CACHE_REDISPATCH() goto *handlers[instr->op]
+#define CACHE_NEXT()    do { CACHE_FETCH(); CACHE_REDISPATCH(); } while (0)
+#else
+#define CACHE_OP(name)  case OP_##name:
+#define CACHE_REDISPATCH() goto redispatch
+#define CACHE_NEXT()    goto dispatch
+#endif
+
+
+// One loop per quirk profile, cache_run_VIP() etc.
+#define CACHE_PROFILE VIP
+#include "chip8_cache_run.h"
+#undef CACHE_PROFILE
+
+#define CACHE_PROFILE CHIP48
+#include "chip8_cache_run.h"
+#undef CACHE_PROFILE
+
+#define CACHE_PROFILE SCHIP
+#include "chip8_cache_run.h"
+#undef CACHE_PROFILE
+
+#define CACHE_PROFILE XOCHIP
+#include "chip8_cache_run.h"
+#undef CACHE_PROFILE
+
+#define CACHE_RUN_ENTRY(name, label, shift_vx, i_inc, jump_vx, vf_reset, clip) \
+    [CHIP8_QUIRKS_##name] = cache_run_##name,
+
+static uint32_t (*const cache_runs[CHIP8_QUIRKS_COUNT])(chip8_ctx *, uint32_t) = {
+    CHIP8_QUIRKS_LIST(CACHE_RUN_ENTRY)
+};
+
+#undef CACHE_RUN_ENTRY
+
+uint32_t cache_run(chip8_ctx *ctx, uint32_t num_cycles)
+{
+    // The profile only changes between runs, so which loop is picked once
+    // per batch rather than per instruction
+    return cache_runs[ctx->em.quirks](ctx, num_cycles);
+}
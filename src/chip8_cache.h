@@ -0,0 +1,14 @@
+#ifndef CHIP8_CACHE_H
+#define CHIP8_CACHE_H
+
+#include <stdint.h>
+
+#include "chip8_emulator.h"
+
+// Runs up to num_cycles instructions out of the per-address decode cache
+// (ctx->cache), stopping early right after an FX0A.
+// Returns how many instructions actually ran, 0 means the caller has to step
+// the reference interpreter once (e.g. PC ran off the end of memory).
+uint32_t cache_run(chip8_ctx *ctx, uint32_t num_cycles);
+
+#endif
@@ -0,0 +1,347 @@
+// Body of cache_run(), included by chip8_cache.c once per quirk profile with
+// CACHE_PROFILE set to the profile's name. Quirks are compile time constants
+// here, so every profile gets its own loop without a branch on them.
+
+#define CACHE_CAT3_(a, b, c) a##b##c
+#define CACHE_CAT3(a, b, c)  CACHE_CAT3_(a, b, c)
+#define CACHE_RUN            CACHE_CAT3(cache_run_, CACHE_PROFILE, )
+#define CACHE_QUIRK(field)   CACHE_CAT3(QUIRKS_, CACHE_PROFILE, _##field)
+
+static uint32_t CACHE_RUN(chip8_ctx *ctx, uint32_t num_cycles)
+{
+#if CACHE_THREADED
+#define CACHE_HANDLER(name, pattern) [OP_##name] = &&handle_##name,
+    static const void *const handlers[OP_COUNT] = {
+        CHIP8_OP_LIST(CACHE_HANDLER)
+    };
+#undef CACHE_HANDLER
+#endif
+
+    struct emulator *em = &ctx->em;
+    struct chip8_instr *instr = NULL;
+    uint32_t executed = 0;
+    uint16_t sum;
+    uint8_t src;
+
+    // PC lives in a local for the whole run, only written back at the end
+    uint16_t pc = em->PC;
+
+    // Past the mode's memory, or an instruction straddling its end, is left
+    // to the reference interpreter
+    const uint32_t cache_end = ctx->cache_size - 1;
+
+#if CACHE_THREADED
+    CACHE_NEXT();
+#else
+dispatch:
+    CACHE_FETCH();
+redispatch:
+    switch (instr->op) {
+#endif
+
+    CACHE_OP(UNDECODED)
+        ops_decode(ctx, pc, instr);
+        CACHE_REDISPATCH();
+
+    CACHE_OP(INVALID)
+        printf("ERROR: Unrecognized opcode!\n");
+        CACHE_NEXT();
+
+    CACHE_OP(CLS)
+        graphics_clear_screen(&ctx->gfx);
+        em->draw_flag = 1;
+        pc += 2;
+        CACHE_NEXT();
+
+    CACHE_OP(RET)
+        em->SP = (em->SP - 1) & OPS_STACK_MASK;
+        pc = em->stack[em->SP];
+        CACHE_NEXT();
+
+    CACHE_OP(JP)
+        pc = instr->nnn;
+        CACHE_NEXT();
+
+    CACHE_OP(CALL)
+        em->stack[em->SP & OPS_STACK_MASK] = pc + 2;
+        em->SP = (em->SP + 1) & OPS_STACK_MASK;
+        pc = instr->nnn;
+        CACHE_NEXT();
+
+    CACHE_OP(SE_IMM)
+        pc = (em->V[instr->x] == instr->nn) ? OPS_SKIP_TARGET(em, pc) : pc + 2;
+        CACHE_NEXT();
+
+    CACHE_OP(SNE_IMM)
+        pc = (em->V[instr->x] != instr->nn) ? OPS_SKIP_TARGET(em, pc) : pc + 2;
+        CACHE_NEXT();
+
+    CACHE_OP(SE_REG)
+        pc = (em->V[instr->x] == em->V[instr->y]) ? OPS_SKIP_TARGET(em, pc) : pc + 2;
+        CACHE_NEXT();
+
+    CACHE_OP(LD_IMM)
+        em->V[instr->x] = instr->nn;
+        pc += 2;
+        CACHE_NEXT();
+
+    CACHE_OP(ADD_IMM)
+        em->V[instr->x] += instr->nn;
+        pc += 2;
+        CACHE_NEXT();
+
+    CACHE_OP(LD_REG)
+        em->V[instr->x] = em->V[instr->y];
+        pc += 2;
+        CACHE_NEXT();
+
+    CACHE_OP(OR)
+        em->V[instr->x] |= em->V[instr->y];
+        if (CACHE_QUIRK(VF_RESET)) {
+            em->V[0xF] = 0;
+        }
+        pc += 2;
+        CACHE_NEXT();
+
+    CACHE_OP(AND)
+        em->V[instr->x] &= em->V[instr->y];
+        if (CACHE_QUIRK(VF_RESET)) {
+            em->V[0xF] = 0;
+        }
+        pc += 2;
+        CACHE_NEXT();
+
+    CACHE_OP(XOR)
+        em->V[instr->x] ^= em->V[instr->y];
+        if (CACHE_QUIRK(VF_RESET)) {
+            em->V[0xF] = 0;
+        }
+        pc += 2;
+        CACHE_NEXT();
+
+    CACHE_OP(ADD_REG)
+        sum = em->V[instr->x] + em->V[instr->y];
+        em->V[instr->x] = (uint8_t)sum;
+        em->V[0xF] = sum > 0xFF;
+        pc += 2;
+        CACHE_NEXT();
+
+    CACHE_OP(SUB)
+        sum = em->V[instr->x] >= em->V[instr->y];
+        em->V[instr->x] -= em->V[instr->y];
+        em->V[0xF] = (uint8_t)sum;
+        pc += 2;
+        CACHE_NEXT();
+
+    CACHE_OP(SHR)
+        // VF goes first here, matters when X or Y is F
+        src = CACHE_QUIRK(SHIFT_VX) ? instr->x : instr->y;
+        em->V[0xF] = em->V[src] & 0x01;
+        em->V[instr->x] = em->V[src] >> 1;
+        pc += 2;
+        CACHE_NEXT();
+
+    CACHE_OP(SUBN)
+        sum = em->V[instr->y] >= em->V[instr->x];
+        em->V[instr->x] = em->V[instr->y] - em->V[instr->x];
+        em->V[0xF] = (uint8_t)sum;
+        pc += 2;
+        CACHE_NEXT();
+
+    CACHE_OP(SHL)
+        src = CACHE_QUIRK(SHIFT_VX) ? instr->x : instr->y;
+        em->V[0xF] = em->V[src] >> 7;
+        em->V[instr->x] = em->V[src] << 1;
+        pc += 2;
+        CACHE_NEXT();
+
+    CACHE_OP(SNE_REG)
+        pc = (em->V[instr->x] != em->V[instr->y]) ? OPS_SKIP_TARGET(em, pc) : pc + 2;
+        CACHE_NEXT();
+
+    CACHE_OP(LD_I)
+        em->I = instr->nnn;
+        pc += 2;
+        CACHE_NEXT();
+
+    CACHE_OP(JP_V0)
+        pc = em->V[CACHE_QUIRK(JUMP_VX) ? instr->x : 0] + instr->nnn;
+        CACHE_NEXT();
+
+    CACHE_OP(RND)
+        em->V[instr->x] = util_random_byte(&ctx->rng_state) & instr->nn;
+        pc += 2;
+        CACHE_NEXT();
+
+    CACHE_OP(DRW)
+        ops_draw_sprite(ctx, instr->x, instr->y, instr->nn & 0x0F);
+        pc += 2;
+        CACHE_NEXT();
+
+    CACHE_OP(SKP)
+        pc = (em->keypad & (1 << (em->V[instr->x] & 0x0F))) ? OPS_SKIP_TARGET(em, pc) : pc + 2;
+        CACHE_NEXT();
+
+    CACHE_OP(SKNP)
+        pc = (em->keypad & (1 << (em->V[instr->x] & 0x0F))) ? pc + 2 : OPS_SKIP_TARGET(em, pc);
+        CACHE_NEXT();
+
+    CACHE_OP(LD_VX_DT)
+        em->V[instr->x] = em->delay;
+        pc += 2;
+        CACHE_NEXT();
+
+    CACHE_OP(LD_VX_K)
+        if (ops_next_hex_key(ctx, &em->V[instr->x])) {
+            pc += 2;
+        }
+
+        // Waiting on a key may have ended the emulation / toggled single
+        // step / suspended, hand control back so the frontend can react
+        goto done;
+
+    CACHE_OP(LD_DT_VX)
+        em->delay = em->V[instr->x];
+        pc += 2;
+        CACHE_NEXT();
+
+    CACHE_OP(LD_ST_VX)
+        em->sound = em->V[instr->x];
+        pc += 2;
+        CACHE_NEXT();
+
+    CACHE_OP(ADD_I)
+        em->I += em->V[instr->x];
+        pc += 2;
+        CACHE_NEXT();
+
+    CACHE_OP(LD_F)
+        em->I = ops_sprite_addr(em->V[instr->x]);
+        pc += 2;
+        CACHE_NEXT();
+
+    CACHE_OP(LD_B)
+        ops_store_bcd(ctx, instr->x);
+        pc += 2;
+        CACHE_NEXT();
+
+    CACHE_OP(LD_MEM_VX)
+        ops_store_regs(ctx, instr->x);
+        em->I += CHIP8_I_INC_AMOUNT(CACHE_QUIRK(I_INC), instr->x);
+        pc += 2;
+        CACHE_NEXT();
+
+    CACHE_OP(LD_VX_MEM)
+        ops_load_regs(ctx, instr->x);
+        em->I += CHIP8_I_INC_AMOUNT(CACHE_QUIRK(I_INC), instr->x);
+        pc += 2;
+        CACHE_NEXT();
+
+    CACHE_OP(SCD)
+        graphics_scroll_down(&ctx->gfx, instr->nn & 0x0F);
+        em->draw_flag = 1;
+        pc += 2;
+        CACHE_NEXT();
+
+    CACHE_OP(SCU)
+        graphics_scroll_up(&ctx->gfx, instr->nn & 0x0F);
+        em->draw_flag = 1;
+        pc += 2;
+        CACHE_NEXT();
+
+    CACHE_OP(SCR)
+        graphics_scroll_right(&ctx->gfx, 4);
+        em->draw_flag = 1;
+        pc += 2;
+        CACHE_NEXT();
+
+    CACHE_OP(SCL)
+        graphics_scroll_left(&ctx->gfx, 4);
+        em->draw_flag = 1;
+        pc += 2;
+        CACHE_NEXT();
+
+    CACHE_OP(EXIT)
+        em->emulation_end_flag = 1;
+        pc += 2;
+        goto done;
+
+    CACHE_OP(LOW)
+        graphics_set_hires(&ctx->gfx, false);
+        em->draw_flag = 1;
+        pc += 2;
+        CACHE_NEXT();
+
+    CACHE_OP(HIGH)
+        graphics_set_hires(&ctx->gfx, true);
+        em->draw_flag = 1;
+        pc += 2;
+        CACHE_NEXT();
+
+    CACHE_OP(LD_MEM_XY)
+        ops_store_reg_range(ctx, instr->x, instr->y);
+        pc += 2;
+        CACHE_NEXT();
+
+    CACHE_OP(LD_XY_MEM)
+        ops_load_reg_range(ctx, instr->x, instr->y);
+        pc += 2;
+        CACHE_NEXT();
+
+    CACHE_OP(LD_I_LONG)
+        // The second word is data, read live so stores into it need no
+        // invalidation
+        em->I = em->memory[(uint16_t)(pc + 2)] << 8 |
+                em->memory[(uint16_t)(pc + 3)];
+        pc += 4;
+        CACHE_NEXT();
+
+    CACHE_OP(PLANE)
+        ctx->gfx.planes = instr->x & 0x03;
+        pc += 2;
+        CACHE_NEXT();
+
+    CACHE_OP(AUDIO)
+        ops_load_audio_pattern(ctx);
+        pc += 2;
+        CACHE_NEXT();
+
+    CACHE_OP(LD_HF)
+        em->I = ops_large_sprite_addr(em->V[instr->x]);
+        pc += 2;
+        CACHE_NEXT();
+
+    CACHE_OP(PITCH)
+        em->pitch = em->V[instr->x];
+        pc += 2;
+        CACHE_NEXT();
+
+    CACHE_OP(LD_R_VX)
+        memcpy(em->user_flags, em->V, instr->x + 1);
+        pc += 2;
+        CACHE_NEXT();
+
+    CACHE_OP(LD_VX_R)
+        memcpy(em->V, em->user_flags, instr->x + 1);
+        pc += 2;
+        CACHE_NEXT();
+
+#if !CACHE_THREADED
+    }
+#endif
+
+done:
+    em->PC = pc;
+
+    // Leave the last opcode visible like the reference interpreter does
+    if (instr != NULL) {
+        em->opcode = instr->opcode;
+    }
+
+    return executed;
+}
+
+#undef CACHE_QUIRK
+#undef CACHE_RUN
+#undef CACHE_CAT3
+#undef CACHE_CAT3_
@@ -0,0 +1,210 @@
+#include <stdint.h>
+
+#include "chip8_decode.h"
+
+#define CHIP8_OP_PATTERN(name, pattern) [OP_##name] = pattern,
+
+const char *const decode_op_patterns[OP_COUNT] = {
+    CHIP8_OP_LIST(CHIP8_OP_PATTERN)
+};
+
+#undef CHIP8_OP_PATTERN
+
+static uint8_t decode_leading_0(uint16_t opcode, uint8_t mode);
+static uint8_t decode_leading_5(uint16_t opcode, uint8_t mode);
+static uint8_t decode_leading_8(uint16_t opcode);
+static uint8_t decode_leading_E(uint16_t opcode);
+static uint8_t decode_leading_F(uint16_t opcode, uint8_t mode);
+static uint8_t only_in(uint8_t op, uint8_t mode, uint8_t first_mode);
+
+void decode_instr(uint16_t opcode, uint8_t mode, struct chip8_instr *instr)
+{
+    instr->x      = (opcode & 0x0F00) >> 8;
+    instr->y      = (opcode & 0x00F0) >> 4;
+    instr->nn     = (opcode & 0x00FF);
+    instr->nnn    = (opcode & 0x0FFF);
+    instr->opcode = opcode;
+
+    // Mirrors the masks process_leading_X uses in the reference interpreter
+    switch (opcode & 0xF000) {
+        case 0x0000:
+            instr->op = decode_leading_0(opcode, mode);
+            break;
+        case 0x1000:
+            instr->op = OP_JP;
+            break;
+        case 0x2000:
+            instr->op = OP_CALL;
+            break;
+        case 0x3000:
+            instr->op = OP_SE_IMM;
+            break;
+        case 0x4000:
+            instr->op = OP_SNE_IMM;
+            break;
+        case 0x5000:
+            instr->op = decode_leading_5(opcode, mode);
+            break;
+        case 0x6000:
+            instr->op = OP_LD_IMM;
+            break;
+        case 0x7000:
+            instr->op = OP_ADD_IMM;
+            break;
+        case 0x8000:
+            instr->op = decode_leading_8(opcode);
+            break;
+        case 0x9000:
+            instr->op = (opcode & 0x000F) == 0 ? OP_SNE_REG : OP_INVALID;
+            break;
+        case 0xA000:
+            instr->op = OP_LD_I;
+            break;
+        case 0xB000:
+            instr->op = OP_JP_V0;
+            break;
+        case 0xC000:
+            instr->op = OP_RND;
+            break;
+        case 0xD000:
+            instr->op = OP_DRW;
+            break;
+        case 0xE000:
+            instr->op = decode_leading_E(opcode);
+            break;
+        case 0xF000:
+            instr->op = decode_leading_F(opcode, mode);
+            break;
+    }
+}
+
+static uint8_t decode_leading_0(uint16_t opcode, uint8_t mode)
+{
+    switch (opcode & 0x00FF) {
+        case 0x00E0:
+            return OP_CLS;
+        case 0x00EE:
+            return OP_RET;
+        case 0x00FB:
+            return only_in(OP_SCR, mode, CHIP8_MODE_SCHIP);
+        case 0x00FC:
+            return only_in(OP_SCL, mode, CHIP8_MODE_SCHIP);
+        case 0x00FD:
+            return only_in(OP_EXIT, mode, CHIP8_MODE_SCHIP);
+        case 0x00FE:
+            return only_in(OP_LOW, mode, CHIP8_MODE_SCHIP);
+        case 0x00FF:
+            return only_in(OP_HIGH, mode, CHIP8_MODE_SCHIP);
+    }
+
+    switch (opcode & 0x00F0) {
+        case 0x00C0:
+            return only_in(OP_SCD, mode, CHIP8_MODE_SCHIP);
+        case 0x00D0:
+            return only_in(OP_SCU, mode, CHIP8_MODE_XOCHIP);
+        default:
+            return OP_INVALID;
+    }
+}
+
+static uint8_t decode_leading_5(uint16_t opcode, uint8_t mode)
+{
+    switch (opcode & 0x000F) {
+        case 0x0000:
+            return OP_SE_REG;
+        case 0x0002:
+            return only_in(OP_LD_MEM_XY, mode, CHIP8_MODE_XOCHIP);
+        case 0x0003:
+            return only_in(OP_LD_XY_MEM, mode, CHIP8_MODE_XOCHIP);
+        default:
+            return OP_INVALID;
+    }
+}
+
+static uint8_t decode_leading_8(uint16_t opcode)
+{
+    switch (opcode & 0x000F) {
+        case 0x0000:
+            return OP_LD_REG;
+        case 0x0001:
+            return OP_OR;
+        case 0x0002:
+            return OP_AND;
+        case 0x0003:
+            return OP_XOR;
+        case 0x0004:
+            return OP_ADD_REG;
+        case 0x0005:
+            return OP_SUB;
+        case 0x0006:
+            return OP_SHR;
+        case 0x0007:
+            return OP_SUBN;
+        case 0x000E:
+            return OP_SHL;
+        default:
+            return OP_INVALID;
+    }
+}
+
+static uint8_t decode_leading_E(uint16_t opcode)
+{
+    switch (opcode & 0x00FF) {
+        case 0x009E:
+            return OP_SKP;
+        case 0x00A1:
+            return OP_SKNP;
+        default:
+            return OP_INVALID;
+    }
+}
+
+static uint8_t decode_leading_F(uint16_t opcode, uint8_t mode)
+{
+    // Full opcodes, X is part of them
+    switch (opcode) {
+        case 0xF000:
+            return only_in(OP_LD_I_LONG, mode, CHIP8_MODE_XOCHIP);
+        case 0xF002:
+            return only_in(OP_AUDIO, mode, CHIP8_MODE_XOCHIP);
+    }
+
+    switch (opcode & 0x00FF) {
+        case 0x0007:
+            return OP_LD_VX_DT;
+        case 0x000A:
+            return OP_LD_VX_K;
+        case 0x0015:
+            return OP_LD_DT_VX;
+        case 0x0018:
+            return OP_LD_ST_VX;
+        case 0x001E:
+            return OP_ADD_I;
+        case 0x0029:
+            return OP_LD_F;
+        case 0x0033:
+            return OP_LD_B;
+        case 0x0055:
+            return OP_LD_MEM_VX;
+        case 0x0065:
+            return OP_LD_VX_MEM;
+        case 0x0001:
+            return only_in(OP_PLANE, mode, CHIP8_MODE_XOCHIP);
+        case 0x0030:
+            return only_in(OP_LD_HF, mode, CHIP8_MODE_SCHIP);
+        case 0x003A:
+            return only_in(OP_PITCH, mode, CHIP8_MODE_XOCHIP);
+        case 0x0075:
+            return only_in(OP_LD_R_VX, mode, CHIP8_MODE_SCHIP);
+        case 0x0085:
+            return only_in(OP_LD_VX_R, mode, CHIP8_MODE_SCHIP);
+        default:
+            return OP_INVALID;
+    }
+}
+
+static uint8_t only_in(uint8_t op, uint8_t mode, uint8_t first_mode)
+{
+    // Every mode has all the opcodes of the ones before it
+    return mode >= first_mode ? op : OP_INVALID;
+}
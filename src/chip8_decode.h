@@ -0,0 +1,90 @@
+#ifndef CHIP8_DECODE_H
+#define CHIP8_DECODE_H
+
+#include <stdint.h>
+
+#include "chip8_util.h"
+
+// Every instruction the emulator understands, in one place so the decoder,
+// the execution engines and anything reporting on opcodes agree on the list.
+// X(name, pattern)
+#define CHIP8_OP_LIST(X)         \
+    X(UNDECODED, "----")         \
+    X(INVALID,   "????")         \
+    X(CLS,       "00E0")         \
+    X(RET,       "00EE")         \
+    X(JP,        "1NNN")         \
+    X(CALL,      "2NNN")         \
+    X(SE_IMM,    "3XNN")         \
+    X(SNE_IMM,   "4XNN")         \
+    X(SE_REG,    "5XY0")         \
+    X(LD_IMM,    "6XNN")         \
+    X(ADD_IMM,   "7XNN")         \
+    X(LD_REG,    "8XY0")         \
+    X(OR,        "8XY1")         \
+    X(AND,       "8XY2")         \
+    X(XOR,       "8XY3")         \
+    X(ADD_REG,   "8XY4")         \
+    X(SUB,       "8XY5")         \
+    X(SHR,       "8XY6")         \
+    X(SUBN,      "8XY7")         \
+    X(SHL,       "8XYE")         \
+    X(SNE_REG,   "9XY0")         \
+    X(LD_I,      "ANNN")         \
+    X(JP_V0,     "BNNN")         \
+    X(RND,       "CXNN")         \
+    X(DRW,       "DXYN")         \
+    X(SKP,       "EX9E")         \
+    X(SKNP,      "EXA1")         \
+    X(LD_VX_DT,  "FX07")         \
+    X(LD_VX_K,   "FX0A")         \
+    X(LD_DT_VX,  "FX15")         \
+    X(LD_ST_VX,  "FX18")         \
+    X(ADD_I,     "FX1E")         \
+    X(LD_F,      "FX29")         \
+    X(LD_B,      "FX33")         \
+    X(LD_MEM_VX, "FX55")         \
+    X(LD_VX_MEM, "FX65")         \
+    X(SCD,       "00CN")         \
+    X(SCU,       "00DN")         \
+    X(SCR,       "00FB")         \
+    X(SCL,       "00FC")         \
+    X(EXIT,      "00FD")         \
+    X(LOW,       "00FE")         \
+    X(HIGH,      "00FF")         \
+    X(LD_MEM_XY, "5XY2")         \
+    X(LD_XY_MEM, "5XY3")         \
+    X(LD_I_LONG, "F000")         \
+    X(PLANE,     "FN01")         \
+    X(AUDIO,     "F002")         \
+    X(LD_HF,     "FX30")         \
+    X(PITCH,     "FX3A")         \
+    X(LD_R_VX,   "FX75")         \
+    X(LD_VX_R,   "FX85")
+
+#define CHIP8_OP_ENUM(name, pattern) OP_##name,
+
+enum chip8_op {
+    CHIP8_OP_LIST(CHIP8_OP_ENUM)
+    OP_COUNT
+};
+
+#undef CHIP8_OP_ENUM
+
+// One instruction with its operands already pulled out of the opcode
+struct chip8_instr {
+    uint8_t  op;
+    uint8_t  x;
+    uint8_t  y;
+    uint8_t  nn;
+    uint16_t nnn;
+    uint16_t opcode;
+};
+
+// Opcodes mode (enum chip8_mode) doesn't have decode to OP_INVALID
+void decode_instr(uint16_t opcode, uint8_t mode, struct chip8_instr *instr);
+
+// "8XY4" etc, indexed by enum chip8_op
+extern const char *const decode_op_patterns[OP_COUNT];
+
+#endif
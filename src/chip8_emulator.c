@@ -4,207 +4,493 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "chip8_aot.h"
+#include "chip8_backend.h"
+#include "chip8_cache.h"
+#include "chip8_decode.h"
 #include "chip8_emulator.h"
 #include "chip8_graphics.h"
+#include "chip8_idle.h"
+#include "chip8_input.h"
+#include "chip8_jit.h"
+#include "chip8_ops.h"
+#include "chip8_profile.h"
+#include "chip8_quirks.h"
+#include "chip8_rom.h"
+#include "chip8_trace.h"
 #include "chip8_util.h"
 
-#define MEMORY_SIZE 4096
-#define PROG_START  512
-#define PROG_SIZE   (MEMORY_SIZE - PROG_START)
-#define STACK_SIZE  16
-#define NUM_REGS    16
-#define NUM_KEYS    16
-
-// Container for memory, registers, flags, keyboard, etc.
-struct emulator em;
-
 // Built-in sprite management
-static void setup_sprite_memory(void);
-static uint16_t get_sprite_for(uint8_t sprite_val);
+static void setup_sprite_memory(struct emulator *em);
 
 // Manage key inputs!
-static void update_key_input(void);
-static uint8_t get_next_hex_key(void);
+
+// Reference interpreter, one instruction per call
+static void interpret_cycle(chip8_ctx *ctx);
 
 // Handling various opcodes
-static void process_leading_0(void);
-static void process_leading_1(void);
-static void process_leading_2(void);
-static void process_leading_3(void);
-static void process_leading_4(void);
-static void process_leading_5(void);
-static void process_leading_6(void);
-static void process_leading_7(void);
-static void process_leading_8(void);
-static void process_leading_9(void);
-static void process_leading_A(void);
-static void process_leading_B(void);
-static void process_leading_C(void);
-static void process_leading_D(void);
-static void process_leading_E(void);
-static void process_leading_F(void);
-
-void chip8_init(void)
+static void process_leading_0(chip8_ctx *ctx);
+static void process_leading_1(chip8_ctx *ctx);
+static void process_leading_2(chip8_ctx *ctx);
+static void process_leading_3(chip8_ctx *ctx);
+static void process_leading_4(chip8_ctx *ctx);
+static void process_leading_5(chip8_ctx *ctx);
+static void process_leading_6(chip8_ctx *ctx);
+static void process_leading_7(chip8_ctx *ctx);
+static void process_leading_8(chip8_ctx *ctx);
+static void process_leading_9(chip8_ctx *ctx);
+static void process_leading_A(chip8_ctx *ctx);
+static void process_leading_B(chip8_ctx *ctx);
+static void process_leading_C(chip8_ctx *ctx);
+static void process_leading_D(chip8_ctx *ctx);
+static void process_leading_E(chip8_ctx *ctx);
+static void process_leading_F(chip8_ctx *ctx);
+
+chip8_ctx *chip8_create(const struct chip8_backend *backend)
 {
     // Zero out all of our emulator's state
-    memset(&em, 0, sizeof(em));
+    chip8_ctx *ctx = calloc(1, sizeof(*ctx));
+    if (ctx == NULL) {
+        return NULL;
+    }
 
     // PC starts at 0x200
-    em.PC = 0x200;
+    ctx->em.PC = 0x200;
+
+    chip8_seed_random(ctx, CHIP8_DEFAULT_SEED);
+
+    ctx->backend   = backend;
+    ctx->engine    = CHIP8_ENGINE_CACHED;
+    ctx->idle_skip = true;
+
+    setup_sprite_memory(&ctx->em);
+    graphics_init(&ctx->gfx, backend);
+
+    if (!chip8_set_mode(ctx, CHIP8_MODE_CHIP8)) {
+        chip8_destroy(ctx);
+        return NULL;
+    }
+
+    graphics_draw_startup(&ctx->gfx);
+
+    return ctx;
+}
+
+enum rom_error chip8_load(chip8_ctx *ctx, const char *filename)
+{
+    const struct rom_image *image;
+    enum rom_error error = rom_open(filename, &image, NULL);
+
+    if (error == ROM_OK) {
+        error = chip8_load_image(ctx, image);
+        rom_release(image);
+    }
 
-    setup_sprite_memory();
-    graphics_init();
-    graphics_draw_startup();
+    return error;
 }
 
-void chip8_load(const char *filename)
+enum rom_error chip8_load_image(chip8_ctx *ctx, const struct rom_image *image)
 {
-    FILE *prog_file = fopen(filename, "rb");
-    if (prog_file == NULL) {
-        graphics_deinit();
-        printf("ERROR: Unable to open ROM file! Aborting...\n");
-        exit(-1);
+    struct emulator *em = &ctx->em;
+
+    // Only XO-CHIP can address past 4 KB
+    size_t max_size = em->mode == CHIP8_MODE_XOCHIP ? XO_PROG_SIZE : PROG_SIZE;
+
+    if (image->size > max_size) {
+        return ROM_ERROR_TOO_LARGE;
+    }
+
+    if (image->size > 0) {
+        memcpy(&em->memory[PROG_START], image->data, image->size);
     }
 
-    if (0 != fseek(prog_file, 0, SEEK_END)) {
-        fclose(prog_file);
-        graphics_deinit();
-        printf("ERROR: Unable to determine ROM file size! Aborting...\n");
-        exit(-1);
+    // Whatever was decoded before belongs to another program
+    ops_invalidate_code(ctx, 0, MEMORY_SIZE);
+
+    graphics_clear_screen(&ctx->gfx);
+    graphics_refresh_screen(&ctx->gfx);
+
+    return ROM_OK;
+}
+
+enum rom_error chip8_reload_image(chip8_ctx *ctx, const struct rom_image *old,
+                                  const struct rom_image *new)
+{
+    struct emulator *em = &ctx->em;
+    size_t max_size = em->mode == CHIP8_MODE_XOCHIP ? XO_PROG_SIZE : PROG_SIZE;
+
+    if (new->size > max_size) {
+        return ROM_ERROR_TOO_LARGE;
     }
 
-    long int size = ftell(prog_file);
+    // Past its end an image is the zeroes it left in memory
+    size_t size = old->size > new->size ? old->size : new->size;
+    size_t first = size;
+    size_t last = 0;
 
-    fseek(prog_file, 0, SEEK_SET);
+    for (size_t i = 0; i < size; i++) {
+        uint8_t before = i < old->size ? old->data[i] : 0;
+        uint8_t after = i < new->size ? new->data[i] : 0;
 
-    if (size > PROG_SIZE) {
-        fclose(prog_file);
-        graphics_deinit();
-        printf("ERROR: ROM size is larger than max capacity of %d bytes! Aborting...\n", PROG_SIZE);
-        exit(-1);
+        if (before != after) {
+            em->memory[PROG_START + i] = after;
+            first = i < first ? i : first;
+            last = i;
+        }
     }
 
-    if (size != fread(&em.memory[PROG_START], 1, size, prog_file)) {
-        fclose(prog_file);
-        graphics_deinit();
-        printf("ERROR: Unable to read %ld bytes from file! Aborting...\n", size);
-        exit(-1);
+    if (first < size) {
+        ops_invalidate_code(ctx, PROG_START + first, last - first + 1);
     }
 
-    graphics_clear_screen();
-    graphics_refresh_screen();
+    return ROM_OK;
 }
 
-void chip8_display_program_status(void)
+bool chip8_load_aot(chip8_ctx *ctx, const struct chip8_aot_program *program)
 {
-    graphics_draw_program_state(&em);
+    struct emulator *em = &ctx->em;
+
+    memcpy(&em->memory[PROG_START], program->rom, program->rom_size);
+    ops_invalidate_code(ctx, 0, MEMORY_SIZE);
+
+    // Fresh state, the blocks match memory again
+    aot_destroy(ctx->aot);
+    ctx->aot = aot_create(program);
+    if (ctx->aot == NULL) {
+        return false;
+    }
+
+    // The generated code only knows the profile it was compiled for
+    chip8_set_quirks(ctx, program->quirks);
+
+    graphics_clear_screen(&ctx->gfx);
+    graphics_refresh_screen(&ctx->gfx);
+
+    return true;
 }
 
-void chip8_clear_program_status(void)
+bool chip8_set_mode(chip8_ctx *ctx, enum chip8_mode mode)
 {
-    graphics_clear_program_state();
+    // Compiled programs only know the CHIP-8 instruction set
+    if (ctx->aot != NULL && mode != CHIP8_MODE_CHIP8) {
+        return false;
+    }
+
+    // Decoded with the old instruction set
+    if (!ops_size_cache(ctx, mode)) {
+        return false;
+    }
+
+    ctx->em.mode = mode;
+
+    // Out of reach now, and snapshots leave it out
+    uint32_t size = UTIL_MEMORY_SIZE(mode);
+    memset(&ctx->em.memory[size], 0, MEMORY_SIZE - size);
+
+    // Every machine starts in lo-res
+    ctx->gfx.hires  = false;
+    ctx->gfx.planes = 1;
+
+    ops_invalidate_code(ctx, 0, MEMORY_SIZE);
+
+    // The mode's own quirks, compiled programs keep the ones they were
+    // built with
+    if (ctx->aot != NULL) {
+        return chip8_set_quirks(ctx, ctx->aot->program->quirks);
+    }
+
+    return chip8_set_quirks(ctx, chip8_quirks_for_mode(mode));
 }
 
-void chip8_emulate_cycle(void)
+bool chip8_set_quirks(chip8_ctx *ctx, enum chip8_quirks_profile quirks)
 {
-    em.opcode = em.memory[em.PC] << 8 | em.memory[em.PC + 1];
+    if (quirks >= CHIP8_QUIRKS_COUNT ||
+        (ctx->aot != NULL && quirks != ctx->aot->program->quirks)) {
+        return false;
+    }
 
-    switch (em.opcode & 0xF000) {
-        case 0x0000:
-            process_leading_0();
-            break;
-        case 0x1000:
-            process_leading_1();
-            break;
-        case 0x2000:
-            process_leading_2();
-            break;
-        case 0x3000:
-            process_leading_3();
-            break;
-        case 0x4000:
-            process_leading_4();
-            break;
-        case 0x5000:
-            process_leading_5();
-            break;
-        case 0x6000:
-            process_leading_6();
-            break;
-        case 0x7000:
-            process_leading_7();
-            break;
-        case 0x8000:
-            process_leading_8();
-            break;
-        case 0x9000:
-            process_leading_9();
-            break;
-        case 0xA000:
-            process_leading_A();
-            break;
-        case 0xB000:
-            process_leading_B();
-            break;
-        case 0xC000:
-            process_leading_C();
-            break;
-        case 0xD000:
-            process_leading_D();
-            break;
-        case 0xE000:
-            process_leading_E();
-            break;
-        case 0xF000:
-            process_leading_F();
+    ctx->em.quirks = quirks;
+    ctx->gfx.clip  = chip8_quirks[quirks].clip;
+
+    // JIT translations have the old profile baked in
+    ops_invalidate_code(ctx, 0, MEMORY_SIZE);
+
+    return true;
+}
+
+enum chip8_quirks_profile chip8_quirks_for_mode(enum chip8_mode mode)
+{
+    switch (mode) {
+        case CHIP8_MODE_SCHIP:
+            return CHIP8_QUIRKS_SCHIP;
+        case CHIP8_MODE_XOCHIP:
+            return CHIP8_QUIRKS_XOCHIP;
+        default:
+            return CHIP8_QUIRKS_VIP;
+    }
+}
+
+enum chip8_mode chip8_mode_for_rom(const char *filename)
+{
+    const char *ext = strrchr(filename, '.');
+
+    if (ext != NULL && strcmp(ext, ".sc8") == 0) {
+        return CHIP8_MODE_SCHIP;
+    } else if (ext != NULL && strcmp(ext, ".xo8") == 0) {
+        return CHIP8_MODE_XOCHIP;
+    }
+
+    return CHIP8_MODE_CHIP8;
+}
+
+uint64_t chip8_rom_hash(chip8_ctx *ctx)
+{
+    // Everything a ROM of this mode could have loaded
+    size_t size = ctx->em.mode == CHIP8_MODE_XOCHIP ? XO_PROG_SIZE : PROG_SIZE;
+
+    return util_hash(&ctx->em.memory[PROG_START], size, UTIL_HASH_SEED);
+}
+
+bool chip8_set_engine(chip8_ctx *ctx, enum chip8_engine engine)
+{
+    if (engine == CHIP8_ENGINE_AOT && ctx->aot == NULL) {
+        // Only binaries built by chip8_add_aot_rom() have compiled code
+        return false;
+    }
+
+    if (engine == CHIP8_ENGINE_JIT && ctx->jit == NULL) {
+        // Not every host can run generated code
+        ctx->jit = jit_create();
+        if (ctx->jit == NULL) {
+            return false;
+        }
+    }
+
+    ctx->engine = engine;
+
+    return true;
+}
+
+void chip8_seed_random(chip8_ctx *ctx, uint32_t seed)
+{
+    // Spread nearby seeds apart, xorshift takes a while to mix small ones
+    uint64_t hash = util_hash(&seed, sizeof(seed), UTIL_HASH_SEED);
+
+    ctx->rng_state = (uint32_t)(hash ^ (hash >> 32));
+    if (ctx->rng_state == 0) {
+        ctx->rng_state = 1;
+    }
+}
+
+void chip8_display_program_status(chip8_ctx *ctx)
+{
+    graphics_draw_program_state(&ctx->gfx, &ctx->em);
+}
+
+void chip8_clear_program_status(chip8_ctx *ctx)
+{
+    graphics_clear_program_state(&ctx->gfx);
+}
+
+void chip8_emulate_cycle(chip8_ctx *ctx)
+{
+    chip8_emulate_cycles(ctx, 1);
+}
+
+uint32_t chip8_emulate_cycles(chip8_ctx *ctx, uint32_t num_cycles)
+{
+    struct emulator *em = &ctx->em;
+
+    uint32_t executed = 0;
+
+    // Idle loops are looked for where the batch starts, and again only while
+    // one is settling. The reference interpreter steps one instruction per
+    // pass below, looking before each would cost more than it saves.
+    bool idle_look = ctx->idle_skip && num_cycles >= IDLE_MIN_BUDGET &&
+                     ctx->profile == NULL && ctx->trace == NULL;
+
+    if (em->emulation_end_flag) {
+        return 0;
+    }
+
+    // Both index tables in every engine, only chip8_set_mode(),
+    // chip8_set_quirks() and restores (which check) should ever set them
+    if (em->mode > CHIP8_MODE_XOCHIP || em->quirks >= CHIP8_QUIRKS_COUNT) {
+        printf("ERROR: Emulator mode or quirks profile out of range!\n");
+        em->emulation_end_flag = true;
+        return 0;
+    }
+
+    while (executed < num_cycles) {
+        uint32_t budget = num_cycles - executed;
+        uint32_t ran = 0;
+
+        // Profiling and tracing step every engine one instruction at a time
+        uint16_t pc = em->PC;
+        uint16_t opcode = 0;
+        uint8_t V_before[NUM_REGS];
+        uint64_t profile_begun = 0;
+
+        if (ctx->profile != NULL || ctx->trace != NULL) {
+            budget = 1;
+
+            if (pc < MEMORY_SIZE - 1) {
+                opcode = em->memory[pc] << 8 | em->memory[pc + 1];
+            }
+            memcpy(V_before, em->V, sizeof(V_before));
+
+            if (ctx->profile != NULL) {
+                profile_begun = profile_begin(ctx->profile, em, pc);
+            }
+        }
+
+        // Timers tick and input gets polled between batches, never in one,
+        // so an idle loop can't leave before the batch ends. The rest of the
+        // batch is counted instead of run.
+        struct idle_loop loop;
+
+        if (idle_look) {
+            idle_look = idle_loop_find(em, &loop);
+        }
+
+        if (idle_look) {
+            if (loop.settled) {
+                idle_loop_skip(em, &loop, budget);
+                executed += budget;
+
+                if (ctx->stats != NULL) {
+                    ctx->stats->idle_skipped += budget;
+                }
+
+                continue;
+            }
+
+            // One pass settles it or leaves the loop, look again after
+            budget = budget < loop.length ? budget : loop.length;
+        }
+
+        if (ctx->engine == CHIP8_ENGINE_CACHED) {
+            ran = cache_run(ctx, budget);
+        } else if (ctx->engine == CHIP8_ENGINE_JIT) {
+            ran = jit_run(ctx, budget);
+        } else if (ctx->engine == CHIP8_ENGINE_AOT) {
+            ran = aot_run(ctx, budget);
+        }
+
+        // Reference interpreter, also covers whatever an engine can't run
+        if (ran == 0) {
+            interpret_cycle(ctx);
+            ran = 1;
+        }
+
+        if (ctx->profile != NULL) {
+            profile_end(ctx->profile, em, pc, profile_begun);
+        }
+
+        if (ctx->trace != NULL) {
+            trace_add(ctx->trace, em, pc, opcode, V_before);
+        }
+
+        executed += ran;
+
+        // FX0A always ends the batch, same as in every engine: whatever
+        // happened while waiting for a key is for the frontend to handle.
+        // Suspended, it waits out the rest of the batch, the key can't come
+        // before the next frame's input.
+        if ((em->opcode & 0xF0FF) == 0xF00A) {
+            if (ctx->waiting_for_key) {
+                executed = num_cycles;
+            }
             break;
+        }
     }
 
-    if (em.draw_flag) {
-        em.draw_flag = 0;
-        graphics_refresh_screen();
+    if (em->draw_flag) {
+        uint64_t start = ctx->stats != NULL ? util_time_ns() : 0;
+
+        em->draw_flag = 0;
+        graphics_refresh_screen(&ctx->gfx);
+
+        if (ctx->stats != NULL) {
+            ctx->stats->draw_ns += util_time_ns() - start;
+            ctx->stats->draws++;
+        }
     }
 
-    update_key_input();
+    return executed;
 }
 
-void chip8_update_timers(void)
+void chip8_poll_input(chip8_ctx *ctx)
 {
-    if (em.delay > 0) {
-        em.delay--;
+    struct emulator *em = &ctx->em;
+
+    uint16_t pressed = ctx->backend->poll_hex_keys();
+
+    if (ctx->input_log != NULL) {
+        pressed = input_log_frame_keys(ctx->input_log, pressed);
     }
 
-    if (em.sound > 0) {
-        em.sound--;
+    for (uint8_t i = 0; i < NUM_KEYS; i++) {
+        uint16_t bit = 1 << i;
+
+        if (pressed & bit) {
+            em->keypad |= bit;
+            ctx->key_hold[i] = KEY_HOLD_FRAMES;
+
+            util_key_ring_push(&em->key_presses, i);
+        } else if (ctx->key_hold[i] > 0 && --ctx->key_hold[i] == 0) {
+            em->keypad &= ~bit;
+        }
+    }
+}
+
+void chip8_update_timers(chip8_ctx *ctx)
+{
+    struct emulator *em = &ctx->em;
+
+    if (em->delay > 0) {
+        em->delay--;
+    }
+
+    if (em->sound > 0) {
+        em->sound--;
     }
 }
 
-bool chip8_emulation_end_detected(void)
+bool chip8_emulation_end_detected(chip8_ctx *ctx)
 {
-    return em.emulation_end_flag;
+    struct emulator *em = &ctx->em;
+
+    return em->emulation_end_flag;
 }
 
-bool chip8_single_step_detected(void)
+bool chip8_single_step_detected(chip8_ctx *ctx)
 {
+    struct emulator *em = &ctx->em;
+
     // Rather than write a separate function to manually clear this flag, 
     // *always* clear it after reading its state
-    bool latched_value = em.single_step_flag;
+    bool latched_value = em->single_step_flag;
 
-    em.single_step_flag = false;
+    em->single_step_flag = false;
 
     return latched_value;
 }
 
-void chip8_deinit(void)
+void chip8_destroy(chip8_ctx *ctx)
 {
-    graphics_deinit();
+    graphics_deinit(&ctx->gfx);
+    jit_destroy(ctx->jit);
+    aot_destroy(ctx->aot);
+    free(ctx->cache);
+    free(ctx);
 }
 
-static void setup_sprite_memory(void)
+static void setup_sprite_memory(struct emulator *em)
 {
     // Ripped from
     // https://multigesture.net/articles/how-to-write-an-emulator-chip-8-interpreter/
-    uint8_t chip8_fontset[80] =
+    static const uint8_t chip8_fontset[80] =
     { 
         0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
         0x20, 0x60, 0x20, 0x20, 0x70, // 1
@@ -224,211 +510,325 @@ static void setup_sprite_memory(void)
         0xF0, 0x80, 0xF0, 0x80, 0x80  // F
     };
 
-    // Sprite memory ends at 0x50 = address 80
-    memcpy(em.memory, chip8_fontset, sizeof(chip8_fontset));
-}
-
-static uint16_t get_sprite_for(uint8_t sprite_val)
-{
-    if (sprite_val >= 0x10) {
-        printf("ERROR: Cannot access built in sprites for non-hex characters!\n");
-        return (uint16_t) -1;
-    }
+    // SUPER-CHIP's 8x10 digits, with Octo's A-F since the original only
+    // had 0-9
+    static const uint8_t large_fontset[160] =
+    {
+        0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0
+        0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1
+        0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2
+        0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3
+        0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6
+        0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7
+        0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8
+        0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9
+        0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+        0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+        0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+        0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+    };
 
-    return sprite_val * 5;
+    // Small sprites end at 0x50 = address 80, large ones at 0xF0
+    memcpy(em->memory, chip8_fontset, sizeof(chip8_fontset));
+    memcpy(&em->memory[sizeof(chip8_fontset)], large_fontset, sizeof(large_fontset));
 }
 
-static void update_key_input(void)
+static void interpret_cycle(chip8_ctx *ctx)
 {
-    // 16 possible keys
-    for (uint8_t i = 0; i < NUM_KEYS; i++) {
-        if (util_is_hex_key_pressed(i, false)) {
-            em.key[i] = 1;
+    struct emulator *em = &ctx->em;
 
-            // Also consume key
-            util_get_char();
+    em->opcode = em->memory[em->PC] << 8 | em->memory[(uint16_t)(em->PC + 1)];
 
-            em.key_fifo[em.key_fifo_write_ptr++] = i;
-            em.key_fifo_write_ptr = util_constrain(em.key_fifo_write_ptr,
-                                                   NUM_KEYS);
-        }
+    switch (em->opcode & 0xF000) {
+        case 0x0000:
+            process_leading_0(ctx);
+            break;
+        case 0x1000:
+            process_leading_1(ctx);
+            break;
+        case 0x2000:
+            process_leading_2(ctx);
+            break;
+        case 0x3000:
+            process_leading_3(ctx);
+            break;
+        case 0x4000:
+            process_leading_4(ctx);
+            break;
+        case 0x5000:
+            process_leading_5(ctx);
+            break;
+        case 0x6000:
+            process_leading_6(ctx);
+            break;
+        case 0x7000:
+            process_leading_7(ctx);
+            break;
+        case 0x8000:
+            process_leading_8(ctx);
+            break;
+        case 0x9000:
+            process_leading_9(ctx);
+            break;
+        case 0xA000:
+            process_leading_A(ctx);
+            break;
+        case 0xB000:
+            process_leading_B(ctx);
+            break;
+        case 0xC000:
+            process_leading_C(ctx);
+            break;
+        case 0xD000:
+            process_leading_D(ctx);
+            break;
+        case 0xE000:
+            process_leading_E(ctx);
+            break;
+        case 0xF000:
+            process_leading_F(ctx);
+            break;
     }
 }
 
-static uint8_t get_next_hex_key(void)
+static void process_leading_0(chip8_ctx *ctx)
 {
-    uint8_t key;
+    struct emulator *em = &ctx->em;
 
-    if (em.key_fifo_read_ptr != em.key_fifo_write_ptr) {
-        key = em.key_fifo[em.key_fifo_read_ptr++];
-        em.key_fifo_read_ptr = util_constrain(em.key_fifo_read_ptr, NUM_KEYS);
-    } else {
-        do {
-            key = util_get_hex_key();
-            if (key == (uint8_t)-1) {
-                em.emulation_end_flag = 1;
-                break;
-            } else if (key == (uint8_t)-2) {
-                em.single_step_flag = !em.single_step_flag;
-            }
-        } while (key >= NUM_KEYS);
+    // Everything but 00E0 and 00EE came with SUPER-CHIP
+    if (em->mode == CHIP8_MODE_CHIP8 && (em->opcode & 0x00FF) != 0x00E0 &&
+        (em->opcode & 0x00FF) != 0x00EE) {
+        printf("ERROR: Unrecognized opcode!\n");
+        return;
     }
 
-    return key;
-}
-
-static void process_leading_0(void)
-{
-    switch(em.opcode & 0x00FF) {
+    switch(em->opcode & 0x00FF) {
         case 0x00E0:
             // 0x00E0 -> clear screen
-            graphics_clear_screen();
-            em.draw_flag = 1;
-            em.PC += 2;
+            graphics_clear_screen(&ctx->gfx);
+            em->draw_flag = 1;
+            em->PC += 2;
             break;
         case 0x00EE:
             // 0x00EE -> return from subroutine
-            em.PC = em.stack[--em.SP];
+            em->SP = (em->SP - 1) & OPS_STACK_MASK;
+            em->PC = em->stack[em->SP];
+            break;
+        case 0x00FB:
+            // 0x00FB -> scroll right by 4 pixels
+            graphics_scroll_right(&ctx->gfx, 4);
+            em->draw_flag = 1;
+            em->PC += 2;
+            break;
+        case 0x00FC:
+            // 0x00FC -> scroll left by 4 pixels
+            graphics_scroll_left(&ctx->gfx, 4);
+            em->draw_flag = 1;
+            em->PC += 2;
+            break;
+        case 0x00FD:
+            // 0x00FD -> exit the interpreter
+            em->emulation_end_flag = 1;
+            em->PC += 2;
+            break;
+        case 0x00FE:
+            // 0x00FE -> lo-res
+            graphics_set_hires(&ctx->gfx, false);
+            em->draw_flag = 1;
+            em->PC += 2;
+            break;
+        case 0x00FF:
+            // 0x00FF -> hi-res
+            graphics_set_hires(&ctx->gfx, true);
+            em->draw_flag = 1;
+            em->PC += 2;
             break;
         default:
-            printf("ERROR: Unrecognized opcode!\n");
+            if ((em->opcode & 0x00F0) == 0x00C0) {
+                // 0x00CN -> scroll down by N pixels
+                graphics_scroll_down(&ctx->gfx, em->opcode & 0x000F);
+            } else if ((em->opcode & 0x00F0) == 0x00D0 && em->mode >= CHIP8_MODE_XOCHIP) {
+                // 0x00DN -> scroll up by N pixels
+                graphics_scroll_up(&ctx->gfx, em->opcode & 0x000F);
+            } else {
+                printf("ERROR: Unrecognized opcode!\n");
+                break;
+            }
+            em->draw_flag = 1;
+            em->PC += 2;
             break;
     }
 }
 
-static void process_leading_1(void)
+static void process_leading_1(chip8_ctx *ctx)
 {
-    em.PC = em.opcode & 0x0FFF;
+    struct emulator *em = &ctx->em;
+
+    em->PC = em->opcode & 0x0FFF;
 }
 
-static void process_leading_2(void)
+static void process_leading_2(chip8_ctx *ctx)
 {
-    em.stack[em.SP++] = em.PC + 2;
-    em.PC = em.opcode & 0x0FFF;
+    struct emulator *em = &ctx->em;
+
+    em->stack[em->SP & OPS_STACK_MASK] = em->PC + 2;
+    em->SP = (em->SP + 1) & OPS_STACK_MASK;
+    em->PC = em->opcode & 0x0FFF;
 }
 
-static void process_leading_3(void)
+static void process_leading_3(chip8_ctx *ctx)
 {
-    uint8_t reg = (em.opcode & 0x0F00) >> 8;
-    if (em.V[reg] == (em.opcode & 0x00FF)) {
-        em.PC += 4;
+    struct emulator *em = &ctx->em;
+
+    uint8_t reg = (em->opcode & 0x0F00) >> 8;
+    if (em->V[reg] == (em->opcode & 0x00FF)) {
+        em->PC = OPS_SKIP_TARGET(em, em->PC);
     } else {
-        em.PC += 2;
+        em->PC += 2;
     }
 }
 
-static void process_leading_4(void)
+static void process_leading_4(chip8_ctx *ctx)
 {
-    uint8_t reg = (em.opcode & 0x0F00) >> 8;
-    if (em.V[reg] != (em.opcode & 0x00FF)) {
-        em.PC += 4;
+    struct emulator *em = &ctx->em;
+
+    uint8_t reg = (em->opcode & 0x0F00) >> 8;
+    if (em->V[reg] != (em->opcode & 0x00FF)) {
+        em->PC = OPS_SKIP_TARGET(em, em->PC);
     } else {
-        em.PC += 2;
+        em->PC += 2;
     }
 }
 
-static void process_leading_5(void)
+static void process_leading_5(chip8_ctx *ctx)
 {
-    if (em.opcode & 0x000F != 0) {
+    struct emulator *em = &ctx->em;
+
+    uint8_t reg1 = (em->opcode & 0x0F00) >> 8;
+    uint8_t reg2 = (em->opcode & 0x00F0) >> 4;
+
+    if ((em->opcode & 0x000F) == 0x0002 && em->mode >= CHIP8_MODE_XOCHIP) {
+        // 0x5XY2 -> store VX..VY at I
+        ops_store_reg_range(ctx, reg1, reg2);
+        em->PC += 2;
+        return;
+    } else if ((em->opcode & 0x000F) == 0x0003 && em->mode >= CHIP8_MODE_XOCHIP) {
+        // 0x5XY3 -> load VX..VY from I
+        ops_load_reg_range(ctx, reg1, reg2);
+        em->PC += 2;
+        return;
+    } else if ((em->opcode & 0x000F) != 0) {
         printf("ERROR: Unrecognized opcode!\n");
         return;
     }
 
-    uint8_t reg1 = (em.opcode & 0x0F00) >> 8;
-    uint8_t reg2 = (em.opcode & 0x00F0) >> 4;
-    if (em.V[reg1] == em.V[reg2]) {
-        em.PC += 4;
+    if (em->V[reg1] == em->V[reg2]) {
+        em->PC = OPS_SKIP_TARGET(em, em->PC);
     } else {
-        em.PC += 2;
+        em->PC += 2;
     }
 }
 
-static void process_leading_6(void)
+static void process_leading_6(chip8_ctx *ctx)
 {
-    uint8_t reg = (em.opcode & 0x0F00) >> 8;
-    em.V[reg] = em.opcode & 0x00FF;
-    em.PC += 2;
+    struct emulator *em = &ctx->em;
+
+    uint8_t reg = (em->opcode & 0x0F00) >> 8;
+    em->V[reg] = em->opcode & 0x00FF;
+    em->PC += 2;
 }
 
-static void process_leading_7(void)
+static void process_leading_7(chip8_ctx *ctx)
 {
-    uint8_t reg = (em.opcode & 0x0F00) >> 8;
-    em.V[reg] += em.opcode & 0x00FF;
-    em.PC += 2;
+    struct emulator *em = &ctx->em;
+
+    uint8_t reg = (em->opcode & 0x0F00) >> 8;
+    em->V[reg] += em->opcode & 0x00FF;
+    em->PC += 2;
 }
 
-static void process_leading_8(void)
+static void process_leading_8(chip8_ctx *ctx)
 {
-    uint8_t reg1 = (em.opcode & 0x0F00) >> 8;
-    uint8_t reg2 = (em.opcode & 0x00F0) >> 4;
+    struct emulator *em = &ctx->em;
+
+    uint8_t reg1 = (em->opcode & 0x0F00) >> 8;
+    uint8_t reg2 = (em->opcode & 0x00F0) >> 4;
     uint8_t vf_value;
 
-    switch (em.opcode & 0x000F) {
+    // The reference checks quirks as it goes, the other engines are built
+    // per profile
+    const struct chip8_quirks *quirks = &chip8_quirks[em->quirks];
+    uint8_t shift_src = quirks->shift_vx ? reg1 : reg2;
+
+    switch (em->opcode & 0x000F) {
         case 0x0000:
-            em.V[reg1] = em.V[reg2];
-            em.PC += 2;
+            em->V[reg1] = em->V[reg2];
+            em->PC += 2;
             break;
         case 0x0001:
-            em.V[reg1] = em.V[reg1] | em.V[reg2];
-            em.PC += 2;
+            em->V[reg1] = em->V[reg1] | em->V[reg2];
+            if (quirks->vf_reset) {
+                em->V[0xF] = 0;
+            }
+            em->PC += 2;
             break;
         case 0x0002:
-            em.V[reg1] = em.V[reg1] & em.V[reg2];
-            em.PC += 2;
+            em->V[reg1] = em->V[reg1] & em->V[reg2];
+            if (quirks->vf_reset) {
+                em->V[0xF] = 0;
+            }
+            em->PC += 2;
             break;
         case 0x0003:
-            em.V[reg1] = em.V[reg1] ^ em.V[reg2];
-            em.PC += 2;
+            em->V[reg1] = em->V[reg1] ^ em->V[reg2];
+            if (quirks->vf_reset) {
+                em->V[0xF] = 0;
+            }
+            em->PC += 2;
             break;
         case 0x0004:
-            if (em.V[reg1] + em.V[reg2] < em.V[reg1]) {
+            if (em->V[reg1] + em->V[reg2] > 0xFF) {
                 vf_value = 1;
             } else {
                 vf_value = 0;
             }
-            em.V[reg1] = em.V[reg1] + em.V[reg2];
-            em.V[0xF] = vf_value;
-            em.PC += 2;
+            em->V[reg1] = em->V[reg1] + em->V[reg2];
+            em->V[0xF] = vf_value;
+            em->PC += 2;
             break;
         case 0x0005:
-            if (em.V[reg1] >= em.V[reg2]) {
+            if (em->V[reg1] >= em->V[reg2]) {
                 vf_value = 1;
             } else {
                 vf_value = 0;
             }
-            em.V[reg1] = em.V[reg1] - em.V[reg2];
-            em.V[0xF] = vf_value;
-            em.PC += 2;
+            em->V[reg1] = em->V[reg1] - em->V[reg2];
+            em->V[0xF] = vf_value;
+            em->PC += 2;
             break;
         case 0x0006:
-#if 0
-            em.V[0xF] = em.V[reg1] & 0x01;
-            em.V[reg1] >>= 1;
-#else
-            em.V[0xF] = em.V[reg2] & 0x01;
-            em.V[reg1] = em.V[reg2] >> 1;
-#endif
-            em.PC += 2;
+            em->V[0xF] = em->V[shift_src] & 0x01;
+            em->V[reg1] = em->V[shift_src] >> 1;
+            em->PC += 2;
             break;
         case 0x0007:
-            if (em.V[reg2] >= em.V[reg1]) {
+            if (em->V[reg2] >= em->V[reg1]) {
                 vf_value = 1;
             } else {
                 vf_value = 0;
             }
-            em.V[reg1] = em.V[reg2] - em.V[reg1];
-            em.V[0xF] = vf_value;
-            em.PC += 2;
+            em->V[reg1] = em->V[reg2] - em->V[reg1];
+            em->V[0xF] = vf_value;
+            em->PC += 2;
             break;
         case 0x000E:
-#if 0
-            em.V[0xF] = em.V[reg1] & 0x80;
-            em.V[reg1] <<= 1;
-#else
-            em.V[0xF] = em.V[reg2] & 0x80;
-            em.V[reg1] = em.V[reg2] << 1;
-#endif
-            em.PC += 2;
+            em->V[0xF] = em->V[shift_src] >> 7;
+            em->V[reg1] = em->V[shift_src] << 1;
+            em->PC += 2;
             break;
         default:
             printf("ERROR: Unrecognized opcode!\n");
@@ -436,69 +836,81 @@ static void process_leading_8(void)
     }
 }
 
-static void process_leading_9(void)
+static void process_leading_9(chip8_ctx *ctx)
 {
-    if ((em.opcode & 0x000F) != 0) {
+    struct emulator *em = &ctx->em;
+
+    if ((em->opcode & 0x000F) != 0) {
         printf("ERROR: Unrecognized opcode!\n");
         return;
     }
 
-    uint8_t reg1 = (em.opcode & 0x0F00) >> 8;
-    uint8_t reg2 = (em.opcode & 0x00F0) >> 4;
-    if (em.V[reg1] != em.V[reg2]) {
-        em.PC += 4;
+    uint8_t reg1 = (em->opcode & 0x0F00) >> 8;
+    uint8_t reg2 = (em->opcode & 0x00F0) >> 4;
+    if (em->V[reg1] != em->V[reg2]) {
+        em->PC = OPS_SKIP_TARGET(em, em->PC);
     } else {
-        em.PC += 2;
+        em->PC += 2;
     }
 }
 
-static void process_leading_A(void)
+static void process_leading_A(chip8_ctx *ctx)
 {
-    em.I = em.opcode & 0x0FFF;
-    em.PC += 2;
+    struct emulator *em = &ctx->em;
+
+    em->I = em->opcode & 0x0FFF;
+    em->PC += 2;
 }
 
-static void process_leading_B(void)
+static void process_leading_B(chip8_ctx *ctx)
 {
-    em.PC = em.V[0] + (em.opcode & 0x0FFF);
+    struct emulator *em = &ctx->em;
+
+    // BXNN adds VX instead of V0 on CHIP-48 and SUPER-CHIP
+    uint8_t reg = chip8_quirks[em->quirks].jump_vx ? (em->opcode & 0x0F00) >> 8 : 0;
+
+    em->PC = em->V[reg] + (em->opcode & 0x0FFF);
 }
 
-static void process_leading_C(void)
+static void process_leading_C(chip8_ctx *ctx)
 {
-    uint8_t reg = (em.opcode & 0x0F00) >> 8;
-    em.V[reg] = rand() & (em.opcode & 0x00FF);
-    em.PC += 2;
+    struct emulator *em = &ctx->em;
+
+    uint8_t reg = (em->opcode & 0x0F00) >> 8;
+    em->V[reg] = util_random_byte(&ctx->rng_state) & (em->opcode & 0x00FF);
+    em->PC += 2;
 }
 
-static void process_leading_D(void)
+static void process_leading_D(chip8_ctx *ctx)
 {
-    uint8_t reg1 = (em.opcode & 0x0F00) >> 8;
-    uint8_t reg2 = (em.opcode & 0x00F0) >> 4;
-    uint8_t n    = (em.opcode & 0x000F);
-    // em.V[F] set if pixels flipped, which is return value of draw_sprite
-    em.V[0xF] = graphics_draw_sprite(em.V[reg2], em.V[reg1], &em.memory[em.I], n);
-    em.draw_flag = 1;
-    em.PC += 2;
+    struct emulator *em = &ctx->em;
+
+    uint8_t reg1 = (em->opcode & 0x0F00) >> 8;
+    uint8_t reg2 = (em->opcode & 0x00F0) >> 4;
+    uint8_t n    = (em->opcode & 0x000F);
+    ops_draw_sprite(ctx, reg1, reg2, n);
+    em->PC += 2;
 }
 
-static void process_leading_E(void)
+static void process_leading_E(chip8_ctx *ctx)
 {
-    uint8_t reg = (em.opcode & 0x0F00) >> 8;
+    struct emulator *em = &ctx->em;
+
+    uint8_t reg = (em->opcode & 0x0F00) >> 8;
 
-    switch (em.opcode & 0x00FF) {
+    switch (em->opcode & 0x00FF) {
         case 0x009E:
-            em.PC += 2;
-            if (em.key[em.V[reg]]) {
-                em.PC += 2;
-                em.key[em.V[reg]] = 0;
+            if (em->keypad & (1 << (em->V[reg] & 0x0F))) {
+                em->PC = OPS_SKIP_TARGET(em, em->PC);
+            } else {
+                em->PC += 2;
             }
             break;
         case 0x00A1:
-            em.PC += 2;
-            if (!em.key[em.V[reg]]) {
-                em.PC += 2;
+            if (!(em->keypad & (1 << (em->V[reg] & 0x0F)))) {
+                em->PC = OPS_SKIP_TARGET(em, em->PC);
             } else {
-                em.key[em.V[reg]] = 0;
+                em->PC += 2;
             }
             break;
         default:
@@ -507,48 +919,96 @@ static void process_leading_E(void)
     }
 }
 
-static void process_leading_F(void)
+static void process_leading_F(chip8_ctx *ctx)
 {
-    uint8_t reg = (em.opcode & 0x0F00) >> 8;
+    struct emulator *em = &ctx->em;
+
+    uint8_t reg = (em->opcode & 0x0F00) >> 8;
+
+    if (em->mode >= CHIP8_MODE_XOCHIP) {
+        if (em->opcode == 0xF000) {
+            // 0xF000 NNNN -> I = NNNN, the only four byte instruction
+            em->I = em->memory[(uint16_t)(em->PC + 2)] << 8 |
+                    em->memory[(uint16_t)(em->PC + 3)];
+            em->PC += 4;
+            return;
+        } else if (em->opcode == 0xF002) {
+            // 0xF002 -> audio pattern from I
+            ops_load_audio_pattern(ctx);
+            em->PC += 2;
+            return;
+        } else if ((em->opcode & 0x00FF) == 0x0001) {
+            // 0xFN01 -> select bitplanes N
+            ctx->gfx.planes = reg & 0x03;
+            em->PC += 2;
+            return;
+        } else if ((em->opcode & 0x00FF) == 0x003A) {
+            // 0xFX3A -> pitch = VX
+            em->pitch = em->V[reg];
+            em->PC += 2;
+            return;
+        }
+    }
 
-    switch (em.opcode & 0x00FF) {
+    if (em->mode >= CHIP8_MODE_SCHIP) {
+        switch (em->opcode & 0x00FF) {
+            case 0x0030:
+                // 0xFX30 -> I = large digit VX
+                em->I = ops_large_sprite_addr(em->V[reg]);
+                em->PC += 2;
+                return;
+            case 0x0075:
+                // 0xFX75 -> save V0..VX to the user flags
+                memcpy(em->user_flags, em->V, reg + 1);
+                em->PC += 2;
+                return;
+            case 0x0085:
+                // 0xFX85 -> restore V0..VX from the user flags
+                memcpy(em->V, em->user_flags, reg + 1);
+                em->PC += 2;
+                return;
+        }
+    }
+
+    switch (em->opcode & 0x00FF) {
         case 0x0007:
-            em.V[reg] = em.delay;
-            em.PC += 2;
+            em->V[reg] = em->delay;
+            em->PC += 2;
             break;
         case 0x000A:
-            em.V[reg] = get_next_hex_key();
-            em.PC += 2;
+            if (ops_next_hex_key(ctx, &em->V[reg])) {
+                em->PC += 2;
+            }
             break;
         case 0x0015:
-            em.delay = em.V[reg];
-            em.PC += 2;
+            em->delay = em->V[reg];
+            em->PC += 2;
             break;
         case 0x0018:
-            em.sound = em.V[reg];
-            em.PC += 2;
+            em->sound = em->V[reg];
+            em->PC += 2;
             break;
         case 0x001E:
-            em.I += em.V[reg];
-            em.PC += 2;
+            em->I += em->V[reg];
+            em->PC += 2;
             break;
         case 0x0029:
-            em.I = get_sprite_for(em.V[reg]);
-            em.PC += 2;
+            em->I = ops_sprite_addr(em->V[reg]);
+            em->PC += 2;
             break;
         case 0x0033:
-            em.memory[em.I + 2] =   em.V[reg] % 10;
-            em.memory[em.I + 1] = ((em.V[reg] % 100) - (em.V[reg] % 10)) / 10;
-            em.memory[em.I]     =  (em.V[reg]        - (em.V[reg] % 100)) / 100;
-            em.PC += 2;
+            ops_store_bcd(ctx, reg);
+            em->PC += 2;
             break;
         case 0x0055:
-            memcpy(&em.memory[em.I], &em.V[0], reg + 1);
-            em.PC += 2;
+            ops_store_regs(ctx, reg);
+            em->I += CHIP8_I_INC_AMOUNT(chip8_quirks[em->quirks].i_inc, reg);
+            em->PC += 2;
             break;
         case 0x0065:
-            memcpy(&em.V[0], &em.memory[em.I], reg + 1);
-            em.PC += 2;
+            ops_load_regs(ctx, reg);
+            em->I += CHIP8_I_INC_AMOUNT(chip8_quirks[em->quirks].i_inc, reg);
+            em->PC += 2;
             break;
         default:
             printf("ERROR: Unrecognized opcode!\n");
@@ -2,15 +2,156 @@
 #define CHIP8_EMULATOR_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
-void chip8_init(void);
-void chip8_load(const char *filename);
-void chip8_display_program_status(void);
-void chip8_clear_program_status(void);
-void chip8_emulate_cycle(void);
-void chip8_update_timers(void);
-bool chip8_emulation_end_detected(void);
-bool chip8_single_step_detected(void);
-void chip8_deinit(void);
+#include "chip8_backend.h"
+#include "chip8_decode.h"
+#include "chip8_graphics.h"
+#include "chip8_quirks.h"
+#include "chip8_rom.h"
+#include "chip8_util.h"
+
+// CXNN seed unless chip8_seed_random() says otherwise
+#define CHIP8_DEFAULT_SEED 1
+
+// Terminals only report presses (plus autorepeat), a key counts as released
+// once it hasn't been seen for this many frames
+#define KEY_HOLD_FRAMES 8
+
+// How instructions get executed, all of them behave identically
+enum chip8_engine {
+    CHIP8_ENGINE_INTERPRETER,   // process_leading_X switch, the reference
+    CHIP8_ENGINE_CACHED,        // pre-decoded per address + threaded dispatch
+    CHIP8_ENGINE_JIT,           // basic blocks translated to x86-64
+    CHIP8_ENGINE_AOT,           // C generated ahead of time by chip8_aotc
+};
+
+// Where the time goes, only collected while ctx->stats is set. Each sample
+// includes the cost of reading the clock twice.
+struct chip8_stats {
+    uint64_t draw_ns;           // DXYN and screen refreshes
+    uint64_t draws;
+    uint64_t decode_ns;         // filling the decode cache, JIT translation
+    uint64_t decodes;
+    uint64_t idle_skipped;      // instructions of idle loops not run
+};
+
+struct aot;
+struct chip8_aot_program;
+struct input_log;
+struct jit;
+struct profile;
+struct trace;
+
+// Everything one emulated machine owns. Nothing in the core is global, so any
+// number of these can run side by side (one per thread is fine) as long as
+// they don't share an interactive backend like ncurses.
+typedef struct chip8_ctx {
+    struct emulator em;
+    struct graphics gfx;
+
+    const struct chip8_backend *backend;
+
+    // CXNN generator, per instance so runs are reproducible. Set through
+    // chip8_seed_random().
+    uint32_t rng_state;
+
+    enum chip8_engine engine;
+
+    // Skip the rest of a batch spent in a busy-wait loop instead of running
+    // it, see chip8_idle.h. On by default, the resulting state is the same.
+    bool idle_skip;
+
+    // FX0A with no key queued leaves PC on itself and ends the batch instead
+    // of blocking in the backend, so timers and the screen keep going. The
+    // key then comes with a later frame's input. Always the case in replays.
+    bool key_wait_suspends;
+
+    // Set while FX0A is suspended that way
+    bool waiting_for_key;
+
+    // Frames left until each held key counts as released
+    uint8_t key_hold[NUM_KEYS];
+
+    // Decoded instruction starting at each address the mode can reach,
+    // OP_UNDECODED until first executed and again after a store hits its
+    // bytes. Sized by chip8_set_mode().
+    struct chip8_instr *cache;
+    uint32_t cache_size;
+
+    // Translated blocks, only allocated once the JIT engine is selected
+    struct jit *jit;
+
+    // Compiled-in program, only set by chip8_load_aot()
+    struct aot *aot;
+
+    // Keypad input being recorded or replayed, not owned
+    struct input_log *input_log;
+
+    // Timing breakdown, NULL (the default) skips the clock reads, not owned
+    struct chip8_stats *stats;
+
+    // Per instruction counts, see chip8_profile.h, not owned
+    struct profile *profile;
+
+    // Instruction trace, see chip8_trace.h, not owned
+    struct trace *trace;
+} chip8_ctx;
+
+// Everything that makes up a running machine as plain memory, the payload of
+// save states and rewind history. Only the first chip8_snapshot_size() bytes
+// are captured and restored: em comes last, and the memory at its end is
+// cut off where the mode stops addressing it.
+struct chip8_snapshot {
+    graphics_row_t screen[GRAPHICS_PLANES][HIRES_ROW_COUNT][ROW_WORDS];
+    bool hires;
+    uint8_t planes;
+    uint32_t rng_state;
+    uint8_t key_hold[NUM_KEYS];
+    struct emulator em;
+};
+
+chip8_ctx *chip8_create(const struct chip8_backend *backend);
+// Copies the ROM to PROG_START, ROM_OK or what kept it from loading
+enum rom_error chip8_load(chip8_ctx *ctx, const char *filename);
+// Same from an image already open, see chip8_rom.h
+enum rom_error chip8_load_image(chip8_ctx *ctx, const struct rom_image *image);
+// Swaps old, the image loaded now, for new but only touches the bytes that
+// differ between the two. Registers, timers, the screen and whatever the
+// program wrote elsewhere stay as they are. old has to be a copy of what was
+// loaded: the mapping of a ROM file rewritten in place already shows the
+// new contents.
+enum rom_error chip8_reload_image(chip8_ctx *ctx, const struct rom_image *old,
+                                  const struct rom_image *new);
+bool chip8_load_aot(chip8_ctx *ctx, const struct chip8_aot_program *program);
+// Call before loading, the mode decides how large a ROM may be
+bool chip8_set_mode(chip8_ctx *ctx, enum chip8_mode mode);
+enum chip8_mode chip8_mode_for_rom(const char *filename);
+// After chip8_set_mode(), which picks the mode's own profile
+bool chip8_set_quirks(chip8_ctx *ctx, enum chip8_quirks_profile quirks);
+enum chip8_quirks_profile chip8_quirks_for_mode(enum chip8_mode mode);
+uint64_t chip8_rom_hash(chip8_ctx *ctx);
+bool chip8_set_engine(chip8_ctx *ctx, enum chip8_engine engine);
+void chip8_seed_random(chip8_ctx *ctx, uint32_t seed);
+void chip8_display_program_status(chip8_ctx *ctx);
+void chip8_clear_program_status(chip8_ctx *ctx);
+void chip8_emulate_cycle(chip8_ctx *ctx);
+uint32_t chip8_emulate_cycles(chip8_ctx *ctx, uint32_t num_cycles);
+void chip8_poll_input(chip8_ctx *ctx);
+void chip8_capture_snapshot(chip8_ctx *ctx, struct chip8_snapshot *snap);
+// False, leaving ctx as it was, if the snapshot is out of range (or doesn't
+// suit a compiled program) or the mode's decode cache can't be had
+bool chip8_restore_snapshot(chip8_ctx *ctx, const struct chip8_snapshot *snap);
+size_t chip8_snapshot_size(const struct chip8_snapshot *snap);
+bool chip8_save_state(chip8_ctx *ctx, const char *filename);
+bool chip8_load_state(chip8_ctx *ctx, const char *filename);
+uint64_t chip8_state_hash(chip8_ctx *ctx);
+bool chip8_save_flags(chip8_ctx *ctx, const char *filename);
+bool chip8_load_flags(chip8_ctx *ctx, const char *filename);
+void chip8_update_timers(chip8_ctx *ctx);
+bool chip8_emulation_end_detected(chip8_ctx *ctx);
+bool chip8_single_step_detected(chip8_ctx *ctx);
+void chip8_destroy(chip8_ctx *ctx);
 
 #endif
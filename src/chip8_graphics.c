@@ -1,96 +1,160 @@
-#include <ncurses.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "chip8_backend.h"
 #include "chip8_graphics.h"
 #include "chip8_util.h"
 
-#define ROW_COUNT        32
-#define COL_COUNT        64
-#define SPACES_PER_PIXEL 2
-
-static uint8_t screen[ROW_COUNT][COL_COUNT];
-
-static void init_colors(void);
-static void set_pixel(bool pixel_on);
-static void draw_word_sprite(uint8_t row, uint8_t col,
+static void draw_word_sprite(struct graphics *gfx, uint8_t row, uint8_t col,
                              uint8_t *sprite, uint8_t num_letters);
-static void clear_debug_row(uint8_t row, uint8_t num_rows);
+static bool draw_rows(struct graphics *gfx, uint8_t row, uint8_t col,
+                      const uint8_t *sprite, uint8_t num_rows,
+                      uint8_t bytes_per_row);
+static graphics_row_t rotate_right(graphics_row_t bits, uint8_t count);
 
-void graphics_init(void)
+void graphics_init(struct graphics *gfx, const struct chip8_backend *backend)
 {
-    initscr();
-    init_colors();
-    raw();
-    keypad(stdscr, TRUE);
-    noecho();
-    curs_set(0);
-
-    memset(screen, 0, sizeof(screen));
+    gfx->backend = backend;
+    gfx->backend->init();
+
+    memset(gfx->screen, 0, sizeof(gfx->screen));
+    gfx->hires  = false;
+    gfx->planes = 1;
+    gfx->clip   = false;
+    gfx->render = NULL;
 }
 
-void graphics_toggle_pixel(uint8_t row, uint8_t col)
+void graphics_toggle_pixel(struct graphics *gfx, uint8_t row, uint8_t col)
 {
-    screen[row][col] ^= 1;
+    gfx->screen[0][row][col / 64] ^= (graphics_row_t)1 << (63 - col % 64);
 }
 
-void graphics_refresh_screen(void)
+void graphics_refresh_screen(struct graphics *gfx)
 {
-    for (int row = 0; row < ROW_COUNT; row++) {
-        move(row, 0);
+    // The backend is the render thread's now, it gets the frame at vblank
+    if (gfx->render == NULL) {
+        gfx->backend->refresh_screen(gfx);
+    }
+}
 
-        for (int col = 0; col < COL_COUNT; col++) {
-            set_pixel(screen[row][col]);
+void graphics_clear_screen(struct graphics *gfx)
+{
+    for (int plane = 0; plane < GRAPHICS_PLANES; plane++) {
+        if (gfx->planes & (1 << plane)) {
+            memset(gfx->screen[plane], 0, sizeof(gfx->screen[plane]));
         }
     }
+}
 
-    refresh();
+bool graphics_draw_sprite(struct graphics *gfx, uint8_t row, uint8_t col,
+                          uint8_t *sprite, uint8_t num_bytes)
+{
+    return draw_rows(gfx, row, col, sprite, num_bytes, 1);
 }
 
-void graphics_clear_screen(void)
+bool graphics_draw_large_sprite(struct graphics *gfx, uint8_t row, uint8_t col,
+                                uint8_t *sprite)
 {
-    memset(screen, 0, sizeof(screen));
+    return draw_rows(gfx, row, col, sprite, 16, 2);
 }
 
-bool graphics_draw_sprite(uint8_t row, uint8_t col,
-                          uint8_t *sprite, uint8_t num_bytes)
+void graphics_set_hires(struct graphics *gfx, bool hires)
 {
-    bool pixels_flipped = false;
-    row = util_constrain(row, ROW_COUNT);
-    col = util_constrain(col, COL_COUNT);
+    gfx->hires = hires;
 
-    for (int r = 0; r < num_bytes; r++) {
-        if (sprite[r] == 0x00) {
-            // No pixels to draw, can skip
-            continue;
+    memset(gfx->screen, 0, sizeof(gfx->screen));
+}
+
+void graphics_scroll_down(struct graphics *gfx, uint8_t num_rows)
+{
+    int rows = gfx->hires ? HIRES_ROW_COUNT : ROW_COUNT;
+    int moved = num_rows < rows ? rows - num_rows : 0;
+    int cleared = rows - moved;
+
+    for (int plane = 0; plane < GRAPHICS_PLANES; plane++) {
+        if (gfx->planes & (1 << plane)) {
+            graphics_row_t (*lines)[ROW_WORDS] = gfx->screen[plane];
+
+            memmove(&lines[cleared], &lines[0], moved * sizeof(lines[0]));
+            memset(&lines[0], 0, cleared * sizeof(lines[0]));
         }
+    }
+}
 
-        // 8 bits per row
-        for (int c = 0; c < 8; c++) {
-            // Check bits from left to right (high to low)
-            if (sprite[r] & (1 << (7 - c))) {
-                uint8_t r_const = util_constrain(row + r, ROW_COUNT);
-                uint8_t c_const = util_constrain(col + c, COL_COUNT);
-                graphics_toggle_pixel(r_const, c_const);
+void graphics_scroll_up(struct graphics *gfx, uint8_t num_rows)
+{
+    int rows = gfx->hires ? HIRES_ROW_COUNT : ROW_COUNT;
+    int moved = num_rows < rows ? rows - num_rows : 0;
+    int cleared = rows - moved;
 
-                if (screen[r_const][c_const] == 0) {
-                    pixels_flipped = true;
-                }
+    for (int plane = 0; plane < GRAPHICS_PLANES; plane++) {
+        if (gfx->planes & (1 << plane)) {
+            graphics_row_t (*lines)[ROW_WORDS] = gfx->screen[plane];
 
-#if defined(SPRITE_DEBUG)
-                graphics_refresh_screen();
-#endif
+            memmove(&lines[0], &lines[cleared], moved * sizeof(lines[0]));
+            memset(&lines[moved], 0, cleared * sizeof(lines[0]));
+        }
+    }
+}
+
+void graphics_scroll_right(struct graphics *gfx, uint8_t num_cols)
+{
+    int rows = gfx->hires ? HIRES_ROW_COUNT : ROW_COUNT;
+
+    // Scrolls are a nibble or so, never a whole word
+    num_cols %= 64;
+    if (num_cols == 0) {
+        return;
+    }
+
+    for (int plane = 0; plane < GRAPHICS_PLANES; plane++) {
+        if (!(gfx->planes & (1 << plane))) {
+            continue;
+        }
+
+        for (int row = 0; row < rows; row++) {
+            graphics_row_t *line = gfx->screen[plane][row];
+
+            // Lo-res rows end with the first word, pixels pushed past the
+            // edge are dropped
+            if (gfx->hires) {
+                line[1] = (line[1] >> num_cols) | (line[0] << (64 - num_cols));
             }
+            line[0] >>= num_cols;
         }
     }
+}
+
+void graphics_scroll_left(struct graphics *gfx, uint8_t num_cols)
+{
+    int rows = gfx->hires ? HIRES_ROW_COUNT : ROW_COUNT;
+
+    num_cols %= 64;
+    if (num_cols == 0) {
+        return;
+    }
+
+    for (int plane = 0; plane < GRAPHICS_PLANES; plane++) {
+        if (!(gfx->planes & (1 << plane))) {
+            continue;
+        }
 
-    return pixels_flipped;
+        for (int row = 0; row < rows; row++) {
+            graphics_row_t *line = gfx->screen[plane][row];
+
+            line[0] <<= num_cols;
+            if (gfx->hires) {
+                line[0] |= line[1] >> (64 - num_cols);
+                line[1] <<= num_cols;
+            }
+        }
+    }
 }
 
-void graphics_draw_startup(void)
+void graphics_draw_startup(struct graphics *gfx)
 {
     uint8_t chip8_sprite[15] = {
         0x6A, 0x8A, 0x8E, 0x8A, 0x6A, 0xEE, 0x4A, 0x4E,
@@ -116,187 +180,138 @@ void graphics_draw_startup(void)
     uint8_t col = 20;
 
     // CHIP8
-    draw_word_sprite(row, col, chip8_sprite, 5);
+    draw_word_sprite(gfx, row, col, chip8_sprite, 5);
 
     // PRESS
     row += 8;
     col = 5;
-    draw_word_sprite(row, col, press_sprite, 5);
+    draw_word_sprite(gfx, row, col, press_sprite, 5);
 
     // ANY
     col += 21;
-    draw_word_sprite(row, col, any_sprite, 3);
+    draw_word_sprite(gfx, row, col, any_sprite, 3);
 
     // KEY
     col += 16;
-    draw_word_sprite(row, col, key_sprite, 3);
+    draw_word_sprite(gfx, row, col, key_sprite, 3);
 
     // Top and bottom border
     for (row = 0; row < 32; row += 31) {
         for (col = 0; col < 64; col++) {
-            graphics_toggle_pixel(row, col);
+            graphics_toggle_pixel(gfx, row, col);
         }
     }
 
     // Side border
     for (col = 0; col < 64; col += 63) {
         for (row = 1; row < 31; row++) {
-            graphics_toggle_pixel(row, col);
-        }
-    }
-
-    graphics_refresh_screen();
-}
-
-void graphics_draw_program_state(struct emulator *em)
-{
-    // Clear any previous debug text in debug window
-    clear_debug_row(ROW_COUNT, 32);
-
-    // Move below output window
-    move(ROW_COUNT, 0);
-
-    attrset(COLOR_PAIR(3));
-
-    // PC, opcode, memory register, delay, sound, SP
-    printw("PC: 0x%03X\tI: 0x%03X\t"
-           "Delay: %d\tSound: %d\tSP: 0x%X\n",
-           em->PC, em->I, em->delay, em->sound, em->SP);
-
-    // Program registers
-    for (int i = 0; i < NUM_REGS; i++) {
-        printw("V[%X]: 0x%02X\t", i, em->V[i]);
-
-        // Add a newline every 8 registers
-        if ((i + 1) % 8 == 0) {
-            addch('\n');
-        }
-    }
-
-    // Memory
-    printw("Memory:\n");
-    for (uint16_t addr = em->PC - 4; addr < em->PC + 10; addr += 2) {
-        // Print next instruction in bold
-        if (addr == em->PC) {
-            attrset(A_BOLD);
-        }
-
-        // Don't print if beyond edge of memory
-        if (addr > 0 && addr < MEMORY_SIZE) {
-            printw("0x%03X: %02X %02X\t",
-                   addr, em->memory[addr], em->memory[addr + 1]);
-        }
-
-        // Disable bold printing
-        if (addr == em->PC) {
-            attroff(A_BOLD);
-        }
-    }
-
-    addch('\n');
-
-    // Stack trace
-    for (int i = 0; i < em->SP; i++) {
-        // Don't print if beyond stack's end
-        if (i < STACK_SIZE) {
-            printw("Stack[0x%X]: 0x%03X\t", i, em->stack[i]);
-        }
-
-        if ((i + 1) % 4 == 0) {
-            addch('\n');
+            graphics_toggle_pixel(gfx, row, col);
         }
     }
 
-    addch('\n');
-
-    attroff(COLOR_PAIR(3));
+    graphics_refresh_screen(gfx);
 }
 
-void graphics_clear_program_state(void)
+void graphics_draw_program_state(struct graphics *gfx, struct emulator *em)
 {
-    // Clear all debug info
-    clear_debug_row(ROW_COUNT, 32);
-
-    // Move outside output window
-    move(ROW_COUNT, 0);
-
-    // Print resuming then overwrite other info
-    attrset(COLOR_PAIR(3));
-
-    printw("Resuming...");
-
-    attroff(COLOR_PAIR(3));
-}
-
-void graphics_deinit(void)
-{
-    endwin();
+    gfx->backend->draw_program_state(em);
 }
 
-static void init_colors(void)
+void graphics_clear_program_state(struct graphics *gfx)
 {
-    if (has_colors()) {
-        if (start_color() == OK) {
-            // Pixel = 1
-            init_pair(1, COLOR_WHITE, COLOR_WHITE);
-            // Pixel = 0
-            init_pair(2, COLOR_BLUE, COLOR_BLUE);
-            // Debug info
-            init_pair(3, COLOR_WHITE, COLOR_BLACK);
-            // Cleared info
-            init_pair(4, COLOR_BLACK, COLOR_BLACK);
-        }
-    } else {
-        printf("ERROR: need colors atm!\n");
-        exit(-1);
-    }
+    gfx->backend->clear_program_state();
 }
 
-static void set_pixel(bool pixel_on)
+void graphics_deinit(struct graphics *gfx)
 {
-    // Set right color
-    if (pixel_on) {
-        attrset(COLOR_PAIR(1));
-    } else {
-        attrset(COLOR_PAIR(2));
-    }
-
-    // Two spaces -> more square-like
-    for (int i = 0; i < SPACES_PER_PIXEL; i++) {
-        addch(' ');
-    }
-
-    // Clear for setting next pixels
-    if (pixel_on) {
-        attroff(COLOR_PAIR(1));
-    } else {
-        attroff(COLOR_PAIR(2));
-    }
+    gfx->backend->deinit();
 }
 
-static void draw_word_sprite(uint8_t row, uint8_t col,
+static void draw_word_sprite(struct graphics *gfx, uint8_t row, uint8_t col,
                              uint8_t *sprite, uint8_t num_letters)
 {
     // 8 cols per letter pair, #rows = (#letters + 1) / 2
     for (int c = 0, r = 0; c < 8 * (num_letters + 1) / 2; c += 8, r += 5) {
         // c -> move forward columns,
         // r -> move forward rows in sprite bytes to get next letter
-        graphics_draw_sprite(row, col + c, sprite + r, 5);
+        graphics_draw_sprite(gfx, row, col + c, sprite + r, 5);
     }
 }
 
-static void clear_debug_row(uint8_t row, uint8_t num_rows)
+static bool draw_rows(struct graphics *gfx, uint8_t row, uint8_t col,
+                      const uint8_t *sprite, uint8_t num_rows,
+                      uint8_t bytes_per_row)
 {
-    attrset(COLOR_PAIR(4));
+    graphics_row_t collisions = 0;
+    uint8_t rows = gfx->hires ? HIRES_ROW_COUNT : ROW_COUNT;
+    uint8_t cols = gfx->hires ? HIRES_COL_COUNT : COL_COUNT;
+
+    row = util_constrain(row, rows);
+    col = util_constrain(col, cols);
+
+    // XO-CHIP: with both planes selected, the second plane's rows follow
+    // the first's
+    for (int plane = 0; plane < GRAPHICS_PLANES; plane++) {
+        if (!(gfx->planes & (1 << plane))) {
+            continue;
+        }
+
+        for (int r = 0; r < num_rows; r++, sprite += bytes_per_row) {
+            if (row + r >= rows && gfx->clip) {
+                sprite += (num_rows - r) * bytes_per_row;
+                break;
+            }
+
+            graphics_row_t *line = gfx->screen[plane][(row + r) % rows];
 
-    for (int r = row; r < row + num_rows; r++) {
-        move(r, 0);
+            // Sprite row at the left edge of the first word
+            graphics_row_t first = (graphics_row_t)sprite[0] << 56;
+            if (bytes_per_row == 2) {
+                first |= (graphics_row_t)sprite[1] << 48;
+            }
+
+            if (!gfx->hires) {
+                // Rotated into place so anything past the right edge wraps
+                // around to the left, or shifted out when clipping
+                graphics_row_t bits = gfx->clip ? first >> col : rotate_right(first, col);
+
+                collisions |= line[0] & bits;
+                line[0] ^= bits;
+            } else {
+                // Same across the two words of a hi-res row, a rotate by 64
+                // or more swaps them
+                graphics_row_t second = 0;
+                uint8_t shift = col % 64;
+
+                if (col >= 64) {
+                    second = first;
+                    first = 0;
+                }
+
+                if (shift != 0) {
+                    graphics_row_t spill_first = first << (64 - shift);
+                    graphics_row_t spill_second = gfx->clip ? 0 : second << (64 - shift);
 
-        // Overwrite debug text with black spaces
-        for (int c = 0; c < COL_COUNT * SPACES_PER_PIXEL; c++) {
-            addch(' ');
+                    first  = (first >> shift) | spill_second;
+                    second = (second >> shift) | spill_first;
+                }
+
+                collisions |= (line[0] & first) | (line[1] & second);
+                line[0] ^= first;
+                line[1] ^= second;
+            }
+
+#if defined(SPRITE_DEBUG)
+            graphics_refresh_screen(gfx);
+#endif
         }
     }
 
-    attroff(COLOR_PAIR(4));
+    return collisions != 0;
+}
+
+static graphics_row_t rotate_right(graphics_row_t bits, uint8_t count)
+{
+    // Compilers turn this into a single rotate, count 0 included
+    return (bits >> count) | (bits << ((COL_COUNT - count) % COL_COUNT));
 }
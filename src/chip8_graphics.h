@@ -6,15 +6,67 @@
 
 #include "chip8_util.h"
 
-void graphics_init(void);
-void graphics_toggle_pixel(uint8_t row, uint8_t col);
-void graphics_refresh_screen(void);
-void graphics_clear_screen(void);
-bool graphics_draw_sprite(uint8_t row, uint8_t col,
+// Lo-res, the only resolution plain CHIP-8 has
+#define ROW_COUNT 32
+#define COL_COUNT 64
+
+// SUPER-CHIP / XO-CHIP hi-res
+#define HIRES_ROW_COUNT 64
+#define HIRES_COL_COUNT 128
+
+// XO-CHIP bitplanes, everything else only ever draws to the first
+#define GRAPHICS_PLANES 2
+
+// One bit per pixel, words of 64 pixels: column 0 is the most significant bit
+// of a row's first word so a sprite byte lines up with the left edge before
+// shifting into place
+typedef uint64_t graphics_row_t;
+
+#define ROW_WORDS (HIRES_COL_COUNT / 64)
+
+#define GRAPHICS_PIXEL(gfx, plane, row, col) \
+    (((gfx)->screen[plane][row][(col) / 64] >> (63 - (col) % 64)) & 1)
+
+struct chip8_backend;
+struct render;
+
+// Framebuffer of one emulator instance + where it gets presented. Lo-res
+// uses the top left 64x32 of each plane (rows 0-31, first word), so plain
+// CHIP-8 drawing touches one word per sprite row.
+struct graphics {
+    graphics_row_t screen[GRAPHICS_PLANES][HIRES_ROW_COUNT][ROW_WORDS];
+
+    bool hires;
+    uint8_t planes;             // bit per plane drawing, clearing and scrolling apply to
+    bool clip;                  // sprites stop at the edges instead of wrapping
+
+    const struct chip8_backend *backend;
+
+    // Frames go to a render thread at vblank instead, refreshes do nothing
+    // meanwhile. See chip8_render.h, not owned.
+    struct render *render;
+};
+
+void graphics_init(struct graphics *gfx, const struct chip8_backend *backend);
+void graphics_toggle_pixel(struct graphics *gfx, uint8_t row, uint8_t col);
+// Presents the screen right away, unless a render thread does that
+void graphics_refresh_screen(struct graphics *gfx);
+void graphics_clear_screen(struct graphics *gfx);
+bool graphics_draw_sprite(struct graphics *gfx, uint8_t row, uint8_t col,
                           uint8_t *sprite, uint8_t num_bytes);
-void graphics_draw_startup(void);
-void graphics_draw_program_state(struct emulator *em);
-void graphics_clear_program_state(void);
-void graphics_deinit(void);
+// SUPER-CHIP DXY0: 16x16, two bytes per row
+bool graphics_draw_large_sprite(struct graphics *gfx, uint8_t row, uint8_t col,
+                                uint8_t *sprite);
+// Switches resolution, which clears every plane
+void graphics_set_hires(struct graphics *gfx, bool hires);
+// Whole rows / words at a time, on the selected planes only
+void graphics_scroll_down(struct graphics *gfx, uint8_t num_rows);
+void graphics_scroll_up(struct graphics *gfx, uint8_t num_rows);
+void graphics_scroll_right(struct graphics *gfx, uint8_t num_cols);
+void graphics_scroll_left(struct graphics *gfx, uint8_t num_cols);
+void graphics_draw_startup(struct graphics *gfx);
+void graphics_draw_program_state(struct graphics *gfx, struct emulator *em);
+void graphics_clear_program_state(struct graphics *gfx);
+void graphics_deinit(struct graphics *gfx);
 
 #endif
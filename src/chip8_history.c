@@ -0,0 +1,231 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8_emulator.h"
+#include "chip8_history.h"
+#include "chip8_util.h"
+
+// Entries kept at most, whatever max_bytes allows (10 min at 60 fps)
+#define HISTORY_MAX_ENTRIES (60 * 60 * 10)
+
+struct history_entry {
+    uint64_t cycle;
+    bool keyframe;
+
+    // util_delta_encode() against the entry before it, all zero for
+    // keyframes
+    uint8_t *data;
+    size_t size;
+};
+
+struct history {
+    struct history_entry *entries;     // ring, oldest at head
+    uint32_t head;
+    uint32_t count;
+
+    size_t bytes;
+    size_t max_bytes;
+
+    // State of the newest entry, what the next delta is taken against
+    struct chip8_snapshot last;
+    uint32_t since_keyframe;
+
+    // UTIL_DELTA_MAX_SIZE of one snapshot
+    uint8_t *scratch;
+};
+
+static struct history_entry *entry_at(struct history *history, uint32_t index);
+static void drop_oldest_group(struct history *history);
+static void drop_newer_than(struct history *history, uint32_t index);
+static void reconstruct(struct history *history, uint32_t index,
+                        struct chip8_snapshot *snap);
+
+struct history *history_create(size_t max_bytes)
+{
+    struct history *history = calloc(1, sizeof(*history));
+    if (history == NULL) {
+        return NULL;
+    }
+
+    history->entries = calloc(HISTORY_MAX_ENTRIES, sizeof(*history->entries));
+
+    history->scratch = malloc(UTIL_DELTA_MAX_SIZE(sizeof(struct chip8_snapshot)));
+
+    if (history->entries == NULL || history->scratch == NULL) {
+        history_destroy(history);
+        return NULL;
+    }
+
+    history->max_bytes = max_bytes;
+
+    return history;
+}
+
+void history_destroy(struct history *history)
+{
+    if (history == NULL) {
+        return;
+    }
+
+    while (history->entries != NULL && history->count > 0) {
+        drop_oldest_group(history);
+    }
+
+    free(history->entries);
+    free(history->scratch);
+    free(history);
+}
+
+void history_record(struct history *history, chip8_ctx *ctx, uint64_t cycle)
+{
+    static const struct chip8_snapshot zero;
+    struct chip8_snapshot snap;
+
+    chip8_capture_snapshot(ctx, &snap);
+
+    // Deltas only cover the memory of the snapshot's mode, a new mode
+    // starts a new group
+    bool keyframe = history->count == 0 ||
+                    history->since_keyframe == HISTORY_KEYFRAME_INTERVAL ||
+                    snap.em.mode != history->last.em.mode;
+
+    size_t snap_size = chip8_snapshot_size(&snap);
+    const struct chip8_snapshot *base = keyframe ? &zero : &history->last;
+    size_t size = util_delta_encode(&snap, base, snap_size, history->scratch);
+
+    uint8_t *data = malloc(size);
+    if (data == NULL) {
+        return;
+    }
+    memcpy(data, history->scratch, size);
+
+    // Make room, but never throw away the group this entry belongs to
+    while (history->count > 0 &&
+           (history->count == HISTORY_MAX_ENTRIES ||
+            history->bytes + size > history->max_bytes)) {
+        if (!keyframe && entry_at(history, 0)->keyframe &&
+            history->count <= history->since_keyframe) {
+            break;
+        }
+        drop_oldest_group(history);
+    }
+
+    if (history->count == HISTORY_MAX_ENTRIES) {
+        free(data);
+        return;
+    }
+
+    struct history_entry *entry = entry_at(history, history->count);
+    entry->cycle    = cycle;
+    entry->keyframe = keyframe;
+    entry->data     = data;
+    entry->size     = size;
+
+    history->count++;
+    history->bytes += size;
+
+    memcpy(&history->last, &snap, snap_size);
+    history->since_keyframe = keyframe ? 1 : history->since_keyframe + 1;
+}
+
+bool history_seek(struct history *history, chip8_ctx *ctx,
+                  uint64_t target_cycle, uint64_t *restored_cycle)
+{
+    // Newest entry not past the target
+    uint32_t index = history->count;
+    while (index > 0 && entry_at(history, index - 1)->cycle > target_cycle) {
+        index--;
+    }
+
+    if (index == 0) {
+        return false;
+    }
+
+    return history_rewind(history, ctx, history->count - index, restored_cycle);
+}
+
+bool history_rewind(struct history *history, chip8_ctx *ctx,
+                    uint32_t num_entries, uint64_t *restored_cycle)
+{
+    if (history->count == 0) {
+        return false;
+    }
+
+    // As far back as is kept
+    if (num_entries >= history->count) {
+        num_entries = history->count - 1;
+    }
+
+    uint32_t index = history->count - 1 - num_entries;
+
+    reconstruct(history, index, &history->last);
+    drop_newer_than(history, index);
+
+    // Deltas since the keyframe, so the next record knows when a new one is due
+    uint32_t keyframe = index;
+    while (!entry_at(history, keyframe)->keyframe) {
+        keyframe--;
+    }
+    history->since_keyframe = index - keyframe + 1;
+
+    *restored_cycle = entry_at(history, index)->cycle;
+
+    return chip8_restore_snapshot(ctx, &history->last);
+}
+
+size_t history_bytes_used(const struct history *history)
+{
+    return history->bytes;
+}
+
+static struct history_entry *entry_at(struct history *history, uint32_t index)
+{
+    return &history->entries[(history->head + index) % HISTORY_MAX_ENTRIES];
+}
+
+static void drop_oldest_group(struct history *history)
+{
+    // A keyframe and every delta that depends on it go together
+    do {
+        struct history_entry *entry = entry_at(history, 0);
+
+        history->bytes -= entry->size;
+        free(entry->data);
+        entry->data = NULL;
+
+        history->head = (history->head + 1) % HISTORY_MAX_ENTRIES;
+        history->count--;
+    } while (history->count > 0 && !entry_at(history, 0)->keyframe);
+}
+
+static void drop_newer_than(struct history *history, uint32_t index)
+{
+    while (history->count > index + 1) {
+        struct history_entry *entry = entry_at(history, history->count - 1);
+
+        history->bytes -= entry->size;
+        free(entry->data);
+        entry->data = NULL;
+
+        history->count--;
+    }
+}
+
+static void reconstruct(struct history *history, uint32_t index,
+                        struct chip8_snapshot *snap)
+{
+    uint32_t keyframe = index;
+    while (!entry_at(history, keyframe)->keyframe) {
+        keyframe--;
+    }
+
+    memset(snap, 0, sizeof(*snap));
+
+    for (uint32_t i = keyframe; i <= index; i++) {
+        struct history_entry *entry = entry_at(history, i);
+        util_delta_apply(snap, sizeof(*snap), entry->data, entry->size);
+    }
+}
@@ -0,0 +1,36 @@
+#ifndef CHIP8_HISTORY_H
+#define CHIP8_HISTORY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chip8_emulator.h"
+
+// Full snapshot every this many entries, deltas against the previous entry
+// in between. Reconstructing an entry replays at most this many deltas.
+#define HISTORY_KEYFRAME_INTERVAL 60
+
+struct history;
+
+// Keeps as many recent entries as fit in max_bytes of encoded data
+struct history *history_create(size_t max_bytes);
+void history_destroy(struct history *history);
+
+// Records the machine as it is after cycle instructions, meant to be called
+// once per frame. Cycles must only grow until the next seek.
+void history_record(struct history *history, chip8_ctx *ctx, uint64_t cycle);
+
+// Restores the newest entry recorded at or before target_cycle and forgets
+// everything after it. Returns false when nothing that old is kept.
+bool history_seek(struct history *history, chip8_ctx *ctx,
+                  uint64_t target_cycle, uint64_t *restored_cycle);
+
+// Restores the entry num_entries before the newest one (or the oldest kept),
+// forgetting everything after it like a seek does
+bool history_rewind(struct history *history, chip8_ctx *ctx,
+                    uint32_t num_entries, uint64_t *restored_cycle);
+
+size_t history_bytes_used(const struct history *history);
+
+#endif
@@ -0,0 +1,171 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "chip8_decode.h"
+#include "chip8_idle.h"
+#include "chip8_util.h"
+
+static uint8_t loop_at(const struct emulator *em, uint16_t head,
+                       struct chip8_instr instrs[IDLE_MAX_LOOP]);
+static bool jump_back_near(const struct emulator *em, uint16_t *head);
+static bool is_skip(const struct chip8_instr *instr);
+static bool skip_taken(const struct emulator *em,
+                       const struct chip8_instr *instr, uint8_t vx);
+
+bool idle_loop_find(const struct emulator *em, struct idle_loop *loop)
+{
+    struct chip8_instr instrs[IDLE_MAX_LOOP];
+
+    // Every loop ends in a 1NNN back to at most PC, at most two instructions
+    // on from PC. Looking at the raw bytes rules out almost everything else.
+    uint16_t head;
+
+    if (!jump_back_near(em, &head)) {
+        return false;
+    }
+
+    uint8_t pos = (em->PC - head) / 2;
+    uint8_t length = loop_at(em, head, instrs);
+
+    if (length <= pos) {
+        return false;
+    }
+
+    const struct chip8_instr *skip = length > 1 ? &instrs[length - 2] : NULL;
+
+    loop->head   = head;
+    loop->length = length;
+    loop->pos    = pos;
+    loop->reload = length == 3;
+    loop->x      = instrs[0].x;
+
+    for (uint8_t i = 0; i < length; i++) {
+        loop->opcodes[i] = instrs[i].opcode;
+    }
+
+    // After FX07 the skip sees the timer, which holds still until the
+    // batch ends. Only when PC is on the skip itself does it see VX first.
+    uint8_t vx = loop->reload ? em->delay : em->V[loop->x];
+
+    loop->settled = skip == NULL ||
+                    (!skip_taken(em, skip, vx) &&
+                     (!loop->reload || pos != 1 ||
+                      !skip_taken(em, skip, em->V[loop->x])));
+
+    return true;
+}
+
+void idle_loop_skip(struct emulator *em, const struct idle_loop *loop,
+                    uint32_t count)
+{
+    if (count == 0) {
+        return;
+    }
+
+    uint8_t end = (loop->pos + count % loop->length) % loop->length;
+
+    // FX07 ran if the count got PC back around to the head at least once
+    if (loop->reload && count > (uint32_t)(loop->length - loop->pos) % loop->length) {
+        em->V[loop->x] = em->delay;
+    }
+
+    em->PC     = loop->head + end * 2;
+    em->opcode = loop->opcodes[(end + loop->length - 1) % loop->length];
+}
+
+static uint8_t loop_at(const struct emulator *em, uint16_t head,
+                       struct chip8_instr instrs[IDLE_MAX_LOOP])
+{
+    uint8_t length = 0;
+
+    for (uint32_t pc = head; length < IDLE_MAX_LOOP && pc < MEMORY_SIZE - 1; pc += 2) {
+        struct chip8_instr *instr = &instrs[length++];
+
+        decode_instr(em->memory[pc] << 8 | em->memory[pc + 1], em->mode, instr);
+
+        if (instr->op == OP_JP) {
+            break;
+        }
+    }
+
+    if (length == 0) {
+        return 0;
+    }
+
+    struct chip8_instr *jump = &instrs[length - 1];
+
+    if (jump->op != OP_JP || jump->nnn != head) {
+        return 0;
+    }
+
+    switch (length) {
+        case 1:
+            // 1NNN to itself
+            return 1;
+        case 2:
+            // Skip, jump back
+            return is_skip(&instrs[0]) ? 2 : 0;
+        case 3:
+            // FX07, skip on that register, jump back
+            return instrs[0].op == OP_LD_VX_DT && is_skip(&instrs[1]) &&
+                   instrs[1].x == instrs[0].x ? 3 : 0;
+        default:
+            return 0;
+    }
+}
+
+static bool jump_back_near(const struct emulator *em, uint16_t *head)
+{
+    for (uint32_t pc = em->PC; pc < (uint32_t)em->PC + IDLE_MAX_LOOP * 2 &&
+                               pc < MEMORY_SIZE - 1; pc += 2) {
+        uint16_t nnn = (em->memory[pc] & 0x0F) << 8 | em->memory[pc + 1];
+
+        if ((em->memory[pc] & 0xF0) == 0x10 && nnn <= em->PC &&
+            (uint16_t)(em->PC - nnn) % 2 == 0 &&
+            (uint32_t)nnn + (IDLE_MAX_LOOP - 1) * 2 >= pc) {
+            *head = nnn;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool is_skip(const struct chip8_instr *instr)
+{
+    switch (instr->op) {
+        case OP_SE_IMM:
+        case OP_SNE_IMM:
+        case OP_SE_REG:
+        case OP_SNE_REG:
+        case OP_SKP:
+        case OP_SKNP:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool skip_taken(const struct emulator *em,
+                       const struct chip8_instr *instr, uint8_t vx)
+{
+    uint8_t vy = instr->y == instr->x ? vx : em->V[instr->y];
+    bool key = em->keypad & (1 << (vx & 0x0F));
+
+    switch (instr->op) {
+        case OP_SE_IMM:
+            return vx == instr->nn;
+        case OP_SNE_IMM:
+            return vx != instr->nn;
+        case OP_SE_REG:
+            return vx == vy;
+        case OP_SNE_REG:
+            return vx != vy;
+        case OP_SKP:
+            return key;
+        case OP_SKNP:
+            return !key;
+        default:
+            return false;
+    }
+}
@@ -0,0 +1,42 @@
+#ifndef CHIP8_IDLE_H
+#define CHIP8_IDLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "chip8_util.h"
+
+// Longest loop recognized, FX07 / skip / jump back
+#define IDLE_MAX_LOOP 3u
+
+// Shorter batches run the loop out, the cached and JIT engines get through
+// that many instructions in about the time it takes to look for one
+#define IDLE_MIN_BUDGET 32
+
+// A busy-wait loop: a jump to itself, or a skip that isn't taken followed by a
+// jump back, optionally reloading the skip's register from the delay timer
+// first (FX07 / 3XNN / 1NNN). Nothing it reads changes before the next timer
+// tick or keypad poll, so once settled, running it only moves PC around.
+struct idle_loop {
+    uint16_t head;
+    uint8_t length;             // instructions per pass
+    uint8_t pos;                // index of the instruction at PC
+
+    // Running it from here changes nothing but PC, and VX once FX07 has
+    // loaded the timer into it. Not when the skip is about to leave the loop.
+    bool settled;
+
+    bool reload;                // starts with FX07
+    uint8_t x;                  // register FX07 loads
+
+    uint16_t opcodes[IDLE_MAX_LOOP];
+};
+
+// Whether PC is inside an idle loop, described in *loop if so
+bool idle_loop_find(const struct emulator *em, struct idle_loop *loop);
+
+// Leaves em as running count instructions of a settled loop would
+void idle_loop_skip(struct emulator *em, const struct idle_loop *loop,
+                    uint32_t count);
+
+#endif
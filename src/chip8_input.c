@@ -0,0 +1,331 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8_input.h"
+
+#define INPUT_MAGIC   "CH8INPUT"
+#define INPUT_VERSION 2
+
+// Every event starts with a LEB128 varint of (frames since the previous
+// event << 1 | type), followed by its payload
+enum event_type {
+    EVENT_KEYS,         // u16 little endian: keys newly pressed this frame
+    EVENT_WAIT_KEY,     // u8: key FX0A got
+};
+
+struct input_log_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t seed;
+    uint32_t ipf;
+    uint32_t mode;          // enum chip8_mode
+    uint32_t quirks;        // enum chip8_quirks_profile
+    uint32_t reserved;
+    uint64_t rom_hash;
+    uint64_t cycles;        // filled in on close, 0 if that never happened
+};
+
+struct event {
+    enum event_type type;
+    uint64_t frame;
+    uint16_t value;
+};
+
+struct input_log {
+    FILE *file;
+    struct input_log_header header;
+    bool replaying;
+    bool write_failed;
+
+    // Frames seen so far, the current one when between polls
+    uint64_t frame;
+    uint64_t last_event_frame;
+
+    // Replay only: next event not handed out yet, and where it starts
+    struct event next;
+    bool have_next;
+    struct input_log_mark next_mark;
+};
+
+static void write_event(struct input_log *log, enum event_type type,
+                        uint16_t value);
+static void write_varint(struct input_log *log, uint64_t value);
+static bool read_event(struct input_log *log, struct event *event);
+static bool read_varint(FILE *file, uint64_t *value);
+static void advance(struct input_log *log);
+static struct input_log *open_log(const char *filename, const char *mode);
+
+struct input_log *input_log_record(const char *filename,
+                                   const struct input_log_info *info)
+{
+    struct input_log *log = open_log(filename, "wb");
+    if (log == NULL) {
+        return NULL;
+    }
+
+    struct input_log_header *header = &log->header;
+
+    memcpy(header->magic, INPUT_MAGIC, sizeof(header->magic));
+    header->version  = INPUT_VERSION;
+    header->seed     = info->seed;
+    header->ipf      = info->ipf;
+    header->mode     = info->mode;
+    header->quirks   = info->quirks;
+    header->rom_hash = info->rom_hash;
+
+    if (fwrite(header, sizeof(*header), 1, log->file) != 1) {
+        fclose(log->file);
+        free(log);
+        return NULL;
+    }
+
+    return log;
+}
+
+struct input_log *input_log_replay(const char *filename,
+                                   struct input_log_info *info)
+{
+    struct input_log *log = open_log(filename, "rb");
+    if (log == NULL) {
+        return NULL;
+    }
+
+    struct input_log_header *header = &log->header;
+
+    if (fread(header, sizeof(*header), 1, log->file) != 1 ||
+        memcmp(header->magic, INPUT_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != INPUT_VERSION) {
+        fclose(log->file);
+        free(log);
+        return NULL;
+    }
+
+    info->seed     = header->seed;
+    info->ipf      = header->ipf;
+    info->mode     = header->mode;
+    info->quirks   = header->quirks;
+    info->rom_hash = header->rom_hash;
+
+    log->replaying = true;
+    advance(log);
+
+    return log;
+}
+
+bool input_log_close(struct input_log *log, uint64_t cycles)
+{
+    if (log == NULL) {
+        return true;
+    }
+
+    // Events run to the end of the file, the total goes up front
+    if (!log->replaying) {
+        log->header.cycles = cycles;
+
+        if (fseek(log->file, 0, SEEK_SET) != 0 ||
+            fwrite(&log->header, sizeof(log->header), 1, log->file) != 1) {
+            log->write_failed = true;
+        }
+    }
+
+    bool ok = !log->write_failed;
+    ok = (fclose(log->file) == 0) && ok;
+
+    free(log);
+
+    return ok;
+}
+
+bool input_log_replaying(const struct input_log *log)
+{
+    return log->replaying;
+}
+
+bool input_log_at_end(const struct input_log *log)
+{
+    return log->replaying && !log->have_next;
+}
+
+uint64_t input_log_end_cycles(const struct input_log *log)
+{
+    return log->header.cycles;
+}
+
+uint16_t input_log_frame_keys(struct input_log *log, uint16_t live)
+{
+    uint16_t keys = live;
+
+    if (!log->replaying) {
+        if (live != 0) {
+            write_event(log, EVENT_KEYS, live);
+        }
+    } else {
+        keys = 0;
+
+        // A wait key left over from this frame means the run went another
+        // way than the recording, drop it rather than stall forever
+        while (log->have_next && log->next.frame <= log->frame) {
+            if (log->next.type == EVENT_KEYS) {
+                keys |= (uint16_t)log->next.value;
+            }
+            advance(log);
+        }
+    }
+
+    log->frame++;
+
+    return keys;
+}
+
+void input_log_mark(const struct input_log *log, struct input_log_mark *mark)
+{
+    *mark = log->next_mark;
+    mark->frame = log->frame;
+}
+
+bool input_log_rewind(struct input_log *log, const struct input_log_mark *mark)
+{
+    if (!log->replaying || fseek(log->file, mark->offset, SEEK_SET) != 0) {
+        return false;
+    }
+
+    log->frame = mark->frame;
+    log->last_event_frame = mark->last_event_frame;
+    advance(log);
+
+    return true;
+}
+
+void input_log_add_wait_key(struct input_log *log, uint8_t key)
+{
+    write_event(log, EVENT_WAIT_KEY, key);
+}
+
+bool input_log_next_wait_key(struct input_log *log, uint8_t *key)
+{
+    if (!log->have_next || log->next.type != EVENT_WAIT_KEY ||
+        log->next.frame != log->frame) {
+        return false;
+    }
+
+    *key = (uint8_t)log->next.value;
+    advance(log);
+
+    return true;
+}
+
+static void write_event(struct input_log *log, enum event_type type,
+                        uint16_t value)
+{
+    write_varint(log, (log->frame - log->last_event_frame) << 1 | type);
+    log->last_event_frame = log->frame;
+
+    switch (type) {
+        case EVENT_KEYS:
+            if (fputc(value & 0xFF, log->file) == EOF ||
+                fputc(value >> 8, log->file) == EOF) {
+                log->write_failed = true;
+            }
+            break;
+        case EVENT_WAIT_KEY:
+            if (fputc(value, log->file) == EOF) {
+                log->write_failed = true;
+            }
+            break;
+    }
+}
+
+static void write_varint(struct input_log *log, uint64_t value)
+{
+    do {
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+
+        if (fputc(value != 0 ? byte | 0x80 : byte, log->file) == EOF) {
+            log->write_failed = true;
+        }
+    } while (value != 0);
+}
+
+static bool read_event(struct input_log *log, struct event *event)
+{
+    uint64_t head;
+    if (!read_varint(log->file, &head)) {
+        return false;
+    }
+
+    event->type  = head & 0x01;
+    event->frame = log->last_event_frame + (head >> 1);
+
+    int lo, hi;
+
+    switch (event->type) {
+        case EVENT_KEYS:
+            lo = fgetc(log->file);
+            hi = fgetc(log->file);
+            if (lo == EOF || hi == EOF) {
+                return false;
+            }
+            event->value = (uint16_t)(hi << 8 | lo);
+            break;
+        case EVENT_WAIT_KEY:
+            lo = fgetc(log->file);
+            if (lo == EOF) {
+                return false;
+            }
+            event->value = (uint8_t)lo;
+            break;
+    }
+
+    log->last_event_frame = event->frame;
+
+    return true;
+}
+
+static bool read_varint(FILE *file, uint64_t *value)
+{
+    *value = 0;
+
+    for (int shift = 0; shift < 64; shift += 7) {
+        int byte = fgetc(file);
+        if (byte == EOF) {
+            return false;
+        }
+
+        *value |= (uint64_t)(byte & 0x7F) << shift;
+
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void advance(struct input_log *log)
+{
+    log->next_mark.offset = ftell(log->file);
+    log->next_mark.last_event_frame = log->last_event_frame;
+
+    // A truncated log (recorder killed) just ends after its last event
+    log->have_next = read_event(log, &log->next);
+}
+
+static struct input_log *open_log(const char *filename, const char *mode)
+{
+    struct input_log *log = calloc(1, sizeof(*log));
+    if (log == NULL) {
+        return NULL;
+    }
+
+    log->file = fopen(filename, mode);
+    if (log->file == NULL) {
+        free(log);
+        return NULL;
+    }
+
+    return log;
+}
@@ -0,0 +1,58 @@
+#ifndef CHIP8_INPUT_H
+#define CHIP8_INPUT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Everything besides the keys a replay needs to come out the same
+struct input_log_info {
+    uint32_t seed;          // chip8_seed_random()
+    uint32_t ipf;           // instructions per frame
+    uint32_t mode;          // enum chip8_mode
+    uint32_t quirks;        // enum chip8_quirks_profile
+    uint64_t rom_hash;      // chip8_rom_hash()
+};
+
+// Position in a replay, see input_log_mark()
+struct input_log_mark {
+    long offset;
+    uint64_t frame;
+    uint64_t last_event_frame;
+};
+
+struct input_log;
+
+// Recording writes every frame's new key presses and every key FX0A waited
+// on, keyed by frame number. Replaying hands them back at the same points.
+struct input_log *input_log_record(const char *filename,
+                                   const struct input_log_info *info);
+struct input_log *input_log_replay(const char *filename,
+                                   struct input_log_info *info);
+
+// Writes the end of the recording (cycles = how many ran in total) and
+// closes the file. Returns false if any write failed.
+bool input_log_close(struct input_log *log, uint64_t cycles);
+
+bool input_log_replaying(const struct input_log *log);
+
+// Replay only: whether every recorded event has been handed out
+bool input_log_at_end(const struct input_log *log);
+
+// Cycle count the recording ended at, 0 when it was cut short
+uint64_t input_log_end_cycles(const struct input_log *log);
+
+// Once per frame: records the live presses, or ignores them and returns the
+// recorded ones
+uint16_t input_log_frame_keys(struct input_log *log, uint16_t live);
+
+// Replay only: remember where playback is / go back there, for rerunning a
+// stretch of a session from a snapshot
+void input_log_mark(const struct input_log *log, struct input_log_mark *mark);
+bool input_log_rewind(struct input_log *log, const struct input_log_mark *mark);
+
+// FX0A waiting with nothing queued. Recording notes the key it got,
+// replaying gives the recorded one back or false when there is none.
+void input_log_add_wait_key(struct input_log *log, uint8_t key);
+bool input_log_next_wait_key(struct input_log *log, uint8_t *key);
+
+#endif
@@ -0,0 +1,1141 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8_cache.h"
+#include "chip8_decode.h"
+#include "chip8_emulator.h"
+#include "chip8_jit.h"
+#include "chip8_ops.h"
+#include "chip8_quirks.h"
+#include "chip8_util.h"
+
+#if defined(__x86_64__)
+
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define JIT_CODE_SIZE       (1024 * 1024)
+#define JIT_MAX_BLOCK_LEN   64
+
+// Longest block at the largest instruction (FX65 loading all 16 registers)
+// in both copies of its body, see translate()
+#define JIT_MAX_BLOCK_CODE  (64 * 1024)
+
+// x86-64 register numbers
+#define RAX 0
+#define RCX 1
+#define RDX 2
+#define RBX 3
+#define RSP 4
+#define RBP 5
+#define RSI 6
+#define RDI 7
+#define R8  8
+#define R12 12
+#define R13 13
+#define R14 14
+#define R15 15
+
+// RDI holds the struct emulator pointer, RAX/RCX/RDX are scratch, the rest
+// can hold guest registers for the duration of a block
+static const uint8_t host_regs[] = {
+    RBX, RBP, RSI, R8, R8 + 1, R8 + 2, R8 + 3, R12, R13, R14, R15
+};
+
+#define NUM_HOST_REGS ((int)sizeof(host_regs))
+#define GUEST_I       NUM_REGS
+#define NUM_GUESTS    (NUM_REGS + 1)
+#define NO_REG        0xFF
+
+// Instruction budget shared with generated code, a block that jumps back to
+// its own start keeps looping (registers stay in host registers) for as long
+// as another pass still fits under the limit
+struct jit_budget {
+    uint32_t executed;
+    uint32_t limit;
+};
+
+// Generated code: returns the next PC and bumps budget->executed
+typedef uint32_t (*jit_block_fn)(struct emulator *em, struct jit_budget *budget);
+
+// Entered with less budget than length, a block runs only as many
+// instructions of its body as fit and returns the PC it stopped at
+struct jit_block {
+    jit_block_fn code;
+    uint16_t start;
+    uint16_t length;        // longest path in instructions, 0 -> no block
+};
+
+struct jit {
+    // Read / execute, blocks are emitted into scratch and copied in with
+    // only the pages they land on writable meanwhile. Every jump in a
+    // block is relative and stays inside it, so the copy runs as is.
+    uint8_t *code;
+    size_t   code_used;
+    uint8_t  scratch[JIT_MAX_BLOCK_CODE];
+
+    struct jit_block  blocks[MEMORY_SIZE];
+    uint32_t          num_blocks;
+    struct jit_block  no_block;
+    struct jit_block *lookup[MEMORY_SIZE];
+
+    // Guest bytes some block was translated from, all below covered_end
+    uint8_t covered[MEMORY_SIZE];
+    uint32_t covered_end;
+};
+
+struct emitter {
+    uint8_t *p;
+    uint16_t memory_mask;       // OPS_MEMORY_MASK() of the machine
+};
+
+// Per block mapping of guest registers (V0-VF, I) to host registers
+struct reg_alloc {
+    uint8_t host[NUM_GUESTS];
+    bool    dirty[NUM_GUESTS];
+    int     used;
+};
+
+static FILE *perf_map;
+static pthread_mutex_t perf_map_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct jit_block *translate(struct jit *jit, struct emulator *em,
+                                   uint16_t start);
+static bool is_translatable(const struct chip8_instr *instr);
+static bool is_callee_saved(uint8_t r);
+static bool is_terminator(const struct chip8_instr *instr);
+static bool alloc_for(struct reg_alloc *ra, const struct chip8_instr *instr,
+                      const struct chip8_quirks *quirks);
+static bool alloc_guest(struct reg_alloc *ra, uint8_t guest);
+static void emit_instr(struct emitter *e, struct reg_alloc *ra,
+                       const struct chip8_instr *instr, uint16_t pc,
+                       const struct chip8_quirks *quirks);
+static void emit_skip(struct emitter *e, struct reg_alloc *ra,
+                      const struct chip8_instr *skip,
+                      const struct chip8_instr *jump, uint16_t pc,
+                      uint16_t count);
+static bool is_skip(const struct chip8_instr *instr);
+static void flush(struct jit *jit);
+static bool protect(struct jit *jit, size_t offset, size_t size, int prot);
+
+// Instruction encoding
+static void emit8(struct emitter *e, uint8_t byte);
+static void emit16(struct emitter *e, uint16_t val);
+static void emit32(struct emitter *e, uint32_t val);
+static uint8_t *emit_jcc(struct emitter *e, uint8_t cc);
+static void patch_rel32(uint8_t *rel, uint8_t *target);
+static void emit_rex(struct emitter *e, bool force, uint8_t reg,
+                     uint8_t index, uint8_t rm);
+static void emit_push(struct emitter *e, uint8_t r);
+static void emit_pop(struct emitter *e, uint8_t r);
+static void emit_mov_ri(struct emitter *e, uint8_t dst, uint32_t imm);
+static void emit_op_rr(struct emitter *e, uint8_t opcode,
+                       uint8_t dst, uint8_t src);
+static void emit_alu_ri(struct emitter *e, uint8_t digit,
+                        uint8_t dst, uint32_t imm);
+static void emit_shift_ri(struct emitter *e, uint8_t digit,
+                          uint8_t dst, uint8_t imm);
+static void emit_load8(struct emitter *e, uint8_t dst, int32_t disp);
+static void emit_load16(struct emitter *e, uint8_t dst, int32_t disp);
+static void emit_store8(struct emitter *e, uint8_t src, int32_t disp);
+static void emit_store16(struct emitter *e, uint8_t src, int32_t disp);
+static void emit_load8_indexed(struct emitter *e, uint8_t dst,
+                               uint8_t index, int32_t disp);
+
+#define X86_MOV 0x89
+#define X86_ADD 0x01
+#define X86_OR  0x09
+#define X86_AND 0x21
+#define X86_SUB 0x29
+#define X86_XOR 0x31
+#define X86_CMP 0x39
+
+#define ALU_ADD 0
+#define ALU_AND 4
+#define ALU_SUB 5
+#define ALU_XOR 6
+#define ALU_CMP 7
+
+#define SHIFT_SHL 4
+#define SHIFT_SHR 5
+
+#define OFFSET_V(reg)  ((int32_t)(offsetof(struct emulator, V) + (reg)))
+#define OFFSET_I       ((int32_t)offsetof(struct emulator, I))
+#define OFFSET_SP      ((int32_t)offsetof(struct emulator, SP))
+#define OFFSET_DELAY   ((int32_t)offsetof(struct emulator, delay))
+#define OFFSET_SOUND   ((int32_t)offsetof(struct emulator, sound))
+#define OFFSET_STACK   ((int32_t)offsetof(struct emulator, stack))
+#define OFFSET_MEMORY  ((int32_t)offsetof(struct emulator, memory))
+#define OFFSET_OPCODE  ((int32_t)offsetof(struct emulator, opcode))
+
+#define CC_B  0x2
+#define CC_E  0x4
+#define CC_NE 0x5
+#define CC_BE 0x6
+#define CC_A  0x7
+
+struct jit *jit_create(void)
+{
+    struct jit *jit = calloc(1, sizeof(*jit));
+    if (jit == NULL) {
+        return NULL;
+    }
+
+    // Never writable and executable at once, translate() switches pages
+    jit->code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_EXEC,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (jit->code == MAP_FAILED) {
+        free(jit);
+        return NULL;
+    }
+
+    return jit;
+}
+
+void jit_destroy(struct jit *jit)
+{
+    if (jit == NULL) {
+        return;
+    }
+
+    munmap(jit->code, JIT_CODE_SIZE);
+    free(jit);
+}
+
+uint32_t jit_run(chip8_ctx *ctx, uint32_t num_cycles)
+{
+    struct jit *jit = ctx->jit;
+    struct emulator *em = &ctx->em;
+
+    uint32_t executed = 0;
+
+    while (executed < num_cycles && em->PC < MEMORY_SIZE - 1) {
+        struct jit_block *block = jit->lookup[em->PC];
+        if (block == NULL) {
+            uint64_t start = ctx->stats != NULL ? util_time_ns() : 0;
+
+            block = translate(jit, em, em->PC);
+
+            if (ctx->stats != NULL) {
+                ctx->stats->decode_ns += util_time_ns() - start;
+                ctx->stats->decodes++;
+            }
+        }
+
+        if (block->length > 0) {
+            struct jit_budget budget = {
+                .executed = 0,
+                .limit    = num_cycles - executed
+            };
+
+            em->PC = block->code(em, &budget);
+            executed += budget.executed;
+
+            // Nothing ran only when the budget ends before a terminator
+            if (budget.executed > 0) {
+                continue;
+            }
+        }
+
+        // I/O, stores and a terminator the budget ends on go through the
+        // decode cache one instruction at a time
+        uint32_t ran = cache_run(ctx, 1);
+        if (ran == 0) {
+            break;
+        }
+
+        executed += ran;
+
+        // Same as every other engine, FX0A ends the batch
+        if ((em->opcode & 0xF0FF) == 0xF00A) {
+            break;
+        }
+    }
+
+    return executed;
+}
+
+void jit_invalidate(struct jit *jit, uint16_t addr, uint32_t len)
+{
+    for (uint32_t i = addr; i < (uint32_t)addr + len && i < MEMORY_SIZE; i++) {
+        if (jit->covered[i]) {
+            // Self-modifying code is rare enough to just start over
+            flush(jit);
+            return;
+        }
+    }
+}
+
+bool jit_open_perf_map(void)
+{
+    char path[64];
+
+    pthread_mutex_lock(&perf_map_lock);
+
+    if (perf_map == NULL) {
+        snprintf(path, sizeof(path), "/tmp/perf-%d.map", (int)getpid());
+        perf_map = fopen(path, "w");
+    }
+
+    pthread_mutex_unlock(&perf_map_lock);
+
+    return perf_map != NULL;
+}
+
+void jit_close_perf_map(void)
+{
+    pthread_mutex_lock(&perf_map_lock);
+
+    if (perf_map != NULL) {
+        fclose(perf_map);
+        perf_map = NULL;
+    }
+
+    pthread_mutex_unlock(&perf_map_lock);
+}
+
+static struct jit_block *translate(struct jit *jit, struct emulator *em,
+                                   uint16_t start)
+{
+    struct chip8_instr instrs[JIT_MAX_BLOCK_LEN];
+    struct reg_alloc ra;
+    int length = 0;
+
+    // Quirks are fixed per translation, a profile change flushes everything
+    const struct chip8_quirks *quirks = &chip8_quirks[em->quirks];
+
+    memset(ra.host, NO_REG, sizeof(ra.host));
+    memset(ra.dirty, 0, sizeof(ra.dirty));
+    ra.used = 0;
+
+    // Pass 1: find where the block ends and which registers it touches
+    for (uint32_t pc = start; length < JIT_MAX_BLOCK_LEN &&
+                              pc < MEMORY_SIZE - 1; pc += 2) {
+        struct chip8_instr *instr = &instrs[length];
+
+        decode_instr(em->memory[pc] << 8 | em->memory[pc + 1], em->mode, instr);
+
+        // I/O and stores stay with the interpreter, as does anything that
+        // would need more host registers than we have. So do XO-CHIP skips,
+        // how far they go depends on the instruction they skip.
+        if (!is_translatable(instr) ||
+            (em->mode == CHIP8_MODE_XOCHIP && is_skip(instr)) ||
+            !alloc_for(&ra, instr, quirks)) {
+            break;
+        }
+
+        length++;
+
+        if (is_terminator(instr)) {
+            break;
+        }
+    }
+
+    if (length == 0) {
+        jit->lookup[start] = &jit->no_block;
+        return &jit->no_block;
+    }
+
+    // "skip; jump" is how CHIP-8 spells a conditional branch, take the jump
+    // into the block so loops end up as a single block
+    struct chip8_instr *last = &instrs[length - 1];
+    uint32_t after = start + 2u * length;
+    bool fused = false;
+
+    if (is_skip(last) && length < JIT_MAX_BLOCK_LEN && after < MEMORY_SIZE - 1) {
+        decode_instr(em->memory[after] << 8 | em->memory[after + 1], em->mode,
+                     &instrs[length]);
+        if (instrs[length].op == OP_JP) {
+            fused = true;
+            length++;
+        }
+    }
+
+    if (JIT_CODE_SIZE - jit->code_used < JIT_MAX_BLOCK_CODE ||
+        jit->num_blocks == MEMORY_SIZE) {
+        flush(jit);
+    }
+
+    // Pass 2: generate code
+    struct emitter e = { .p = jit->scratch, .memory_mask = OPS_MEMORY_MASK(em) };
+
+    // Only the callee-saved registers the block actually uses
+    for (int i = 0; i < ra.used; i++) {
+        if (is_callee_saved(host_regs[i])) {
+            emit_push(&e, host_regs[i]);
+        }
+    }
+
+    // mov rdx, rsi -> budget, RSI may hold a guest register
+    emit8(&e, 0x48); emit8(&e, 0x89); emit8(&e, 0xF2);
+
+    for (int guest = 0; guest < NUM_GUESTS; guest++) {
+        if (ra.host[guest] == NO_REG) {
+            continue;
+        }
+
+        if (guest == GUEST_I) {
+            emit_load16(&e, ra.host[guest], OFFSET_I);
+        } else {
+            emit_load8(&e, ra.host[guest], OFFSET_V(guest));
+        }
+    }
+
+    // instrs[body] is the terminator (the skip when fused), if there is one
+    bool terminated = fused || is_terminator(&instrs[length - 1]);
+    int body = length - (fused ? 2 : terminated ? 1 : 0);
+
+    // Less budget than the longest path takes the partial copy of the body
+    // below: cmp dword [rdx + 4], length / jb partial
+    emit8(&e, 0x81); emit8(&e, 0x7A); emit8(&e, 0x04);
+    emit32(&e, length);
+    uint8_t *to_partial = emit_jcc(&e, CC_B);
+
+    uint8_t *top = e.p;
+
+    for (int i = 0; i < body; i++) {
+        emit_instr(&e, &ra, &instrs[i], start + 2 * i, quirks);
+    }
+
+    if (terminated && is_skip(&instrs[body])) {
+        emit_skip(&e, &ra, &instrs[body], fused ? &instrs[body + 1] : NULL,
+                  start + 2 * body, body);
+    } else {
+        if (terminated) {
+            emit_instr(&e, &ra, &instrs[body], start + 2 * body, quirks);
+        } else {
+            // Fell off the end before an I/O op, continue after the block
+            emit_mov_ri(&e, RAX, start + 2 * length);
+        }
+
+        // mov word [rdi + opcode], imm16
+        emit8(&e, 0x66); emit8(&e, 0xC7); emit8(&e, 0x87);
+        emit32(&e, OFFSET_OPCODE);
+        emit16(&e, instrs[length - 1].opcode);
+
+        // add dword [rdx], length
+        emit8(&e, 0x81); emit8(&e, 0x02);
+        emit32(&e, length);
+    }
+
+    uint8_t *to_exit[2] = { NULL, NULL };
+
+    if (terminated) {
+        // cmp eax, start / jne exit
+        emit_alu_ri(&e, ALU_CMP, RAX, start);
+        to_exit[0] = emit_jcc(&e, CC_NE);
+
+        // Another full pass has to fit: mov ecx, [rdx] / add ecx, length /
+        // cmp ecx, [rdx + 4] / ja exit
+        emit8(&e, 0x8B); emit8(&e, 0x0A);
+        emit_alu_ri(&e, ALU_ADD, RCX, length);
+        emit8(&e, 0x3B); emit8(&e, 0x4A); emit8(&e, 0x04);
+        to_exit[1] = emit_jcc(&e, CC_A);
+
+        // jmp top
+        emit8(&e, 0xE9);
+        emit32(&e, 0);
+        patch_rel32(e.p - 4, top);
+    }
+
+    uint8_t *exit = e.p;
+
+    for (int i = 0; i < 2; i++) {
+        if (to_exit[i] != NULL) {
+            patch_rel32(to_exit[i], exit);
+        }
+    }
+
+    for (int guest = 0; guest < NUM_GUESTS; guest++) {
+        if (ra.host[guest] == NO_REG || !ra.dirty[guest]) {
+            continue;
+        }
+
+        if (guest == GUEST_I) {
+            emit_store16(&e, ra.host[guest], OFFSET_I);
+        } else {
+            emit_store8(&e, ra.host[guest], OFFSET_V(guest));
+        }
+    }
+
+    for (int i = ra.used - 1; i >= 0; i--) {
+        if (is_callee_saved(host_regs[i])) {
+            emit_pop(&e, host_regs[i]);
+        }
+    }
+
+    emit8(&e, 0xC3);
+
+    // Partial: the body again, stopping before the first instruction past
+    // the budget (executed is 0 on entry, so that's limit). The terminator
+    // is left to the decode cache, a pass through it would not fit.
+    patch_rel32(to_partial, e.p);
+
+    uint8_t *to_stop[JIT_MAX_BLOCK_LEN];
+
+    for (int i = 0; i < body; i++) {
+        // The first one always fits, jit_run() has budget left
+        if (i > 0) {
+            // cmp dword [rdx + 4], i / jbe stop i
+            emit8(&e, 0x81); emit8(&e, 0x7A); emit8(&e, 0x04);
+            emit32(&e, i);
+            to_stop[i] = emit_jcc(&e, CC_BE);
+        }
+
+        emit_instr(&e, &ra, &instrs[i], start + 2 * i, quirks);
+    }
+
+    // Stopping before instruction i: it's the next PC, i of them ran.
+    // Before the first only happens when there's no body.
+    int first_stop = body > 0 ? 1 : 0;
+
+    for (int i = body; i >= first_stop; i--) {
+        if (i > 0 && i < body) {
+            patch_rel32(to_stop[i], e.p);
+        }
+
+        emit_mov_ri(&e, RAX, start + 2 * i);
+
+        if (i > 0) {
+            // mov word [rdi + opcode], imm16 / add dword [rdx], i
+            emit8(&e, 0x66); emit8(&e, 0xC7); emit8(&e, 0x87);
+            emit32(&e, OFFSET_OPCODE);
+            emit16(&e, instrs[i - 1].opcode);
+
+            emit8(&e, 0x81); emit8(&e, 0x02);
+            emit32(&e, i);
+        }
+
+        // jmp exit
+        emit8(&e, 0xE9);
+        emit32(&e, 0);
+        patch_rel32(e.p - 4, exit);
+    }
+
+    size_t size = e.p - jit->scratch;
+    uint8_t *entry = jit->code + jit->code_used;
+
+    // Leaves this start to the decode cache, but tries again later
+    if (!protect(jit, jit->code_used, size, PROT_READ | PROT_WRITE)) {
+        return &jit->no_block;
+    }
+
+    memcpy(entry, jit->scratch, size);
+
+    if (!protect(jit, jit->code_used, size, PROT_READ | PROT_EXEC)) {
+        // Nothing can run from the buffer, forget what's in it
+        flush(jit);
+        return &jit->no_block;
+    }
+
+    jit->code_used += size;
+
+    struct jit_block *block = &jit->blocks[jit->num_blocks++];
+    *(void **)&block->code = entry;
+    block->start  = start;
+    block->length = length;
+
+    memset(&jit->covered[start], 1, 2 * length);
+    jit->lookup[start] = block;
+
+    if (start + 2u * length > jit->covered_end) {
+        jit->covered_end = start + 2u * length;
+    }
+
+    pthread_mutex_lock(&perf_map_lock);
+    if (perf_map != NULL) {
+        fprintf(perf_map, "%lx %lx chip8_block_%03X_len%d\n",
+                (unsigned long)(uintptr_t)entry, (unsigned long)size,
+                start, length);
+        fflush(perf_map);
+    }
+    pthread_mutex_unlock(&perf_map_lock);
+
+    return block;
+}
+
+static bool is_translatable(const struct chip8_instr *instr)
+{
+    switch (instr->op) {
+        case OP_RET:
+        case OP_JP:
+        case OP_CALL:
+        case OP_SE_IMM:
+        case OP_SNE_IMM:
+        case OP_SE_REG:
+        case OP_LD_IMM:
+        case OP_ADD_IMM:
+        case OP_LD_REG:
+        case OP_OR:
+        case OP_AND:
+        case OP_XOR:
+        case OP_ADD_REG:
+        case OP_SUB:
+        case OP_SHR:
+        case OP_SUBN:
+        case OP_SHL:
+        case OP_SNE_REG:
+        case OP_LD_I:
+        case OP_JP_V0:
+        case OP_LD_VX_DT:
+        case OP_LD_DT_VX:
+        case OP_LD_ST_VX:
+        case OP_ADD_I:
+        case OP_LD_VX_MEM:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool is_callee_saved(uint8_t r)
+{
+    return r == RBX || r == RBP || r >= R12;
+}
+
+static bool is_terminator(const struct chip8_instr *instr)
+{
+    switch (instr->op) {
+        case OP_RET:
+        case OP_JP:
+        case OP_CALL:
+        case OP_SE_IMM:
+        case OP_SNE_IMM:
+        case OP_SE_REG:
+        case OP_SNE_REG:
+        case OP_JP_V0:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool alloc_for(struct reg_alloc *ra, const struct chip8_instr *instr,
+                      const struct chip8_quirks *quirks)
+{
+    // Work on a copy so a block that runs out of registers stays untouched
+    struct reg_alloc trial = *ra;
+    bool ok = true;
+
+    switch (instr->op) {
+        case OP_SE_IMM:
+        case OP_SNE_IMM:
+        case OP_LD_IMM:
+        case OP_ADD_IMM:
+        case OP_LD_VX_DT:
+        case OP_LD_DT_VX:
+        case OP_LD_ST_VX:
+            ok = alloc_guest(&trial, instr->x);
+            break;
+        case OP_SE_REG:
+        case OP_SNE_REG:
+        case OP_LD_REG:
+            ok = alloc_guest(&trial, instr->x) &&
+                 alloc_guest(&trial, instr->y);
+            break;
+        case OP_OR:
+        case OP_AND:
+        case OP_XOR:
+            ok = alloc_guest(&trial, instr->x) &&
+                 alloc_guest(&trial, instr->y) &&
+                 (!quirks->vf_reset || alloc_guest(&trial, 0xF));
+            break;
+        case OP_ADD_REG:
+        case OP_SUB:
+        case OP_SHR:
+        case OP_SUBN:
+        case OP_SHL:
+            ok = alloc_guest(&trial, instr->x) &&
+                 alloc_guest(&trial, instr->y) &&
+                 alloc_guest(&trial, 0xF);
+            break;
+        case OP_LD_I:
+            ok = alloc_guest(&trial, GUEST_I);
+            break;
+        case OP_ADD_I:
+            ok = alloc_guest(&trial, GUEST_I) &&
+                 alloc_guest(&trial, instr->x);
+            break;
+        case OP_JP_V0:
+            ok = alloc_guest(&trial, quirks->jump_vx ? instr->x : 0);
+            break;
+        case OP_LD_VX_MEM:
+            // Targets without a host register are written straight to em.V
+            ok = alloc_guest(&trial, GUEST_I);
+            break;
+        default:
+            break;
+    }
+
+    if (ok) {
+        *ra = trial;
+    }
+
+    return ok;
+}
+
+static bool alloc_guest(struct reg_alloc *ra, uint8_t guest)
+{
+    if (ra->host[guest] != NO_REG) {
+        return true;
+    }
+
+    if (ra->used == NUM_HOST_REGS) {
+        return false;
+    }
+
+    ra->host[guest] = host_regs[ra->used++];
+
+    return true;
+}
+
+static void emit_instr(struct emitter *e, struct reg_alloc *ra,
+                       const struct chip8_instr *instr, uint16_t pc,
+                       const struct chip8_quirks *quirks)
+{
+    uint8_t hx = ra->host[instr->x];
+    uint8_t hy = ra->host[instr->y];
+    uint8_t hf = ra->host[0xF];
+    uint8_t hi = ra->host[GUEST_I];
+
+    // Shift source, VX in place or VY
+    uint8_t hs = quirks->shift_vx ? hx : hy;
+    uint8_t i_inc = CHIP8_I_INC_AMOUNT(quirks->i_inc, instr->x);
+
+    // Guest values are kept zero extended in 32-bit host registers
+    switch (instr->op) {
+        case OP_RET:
+            // SP wraps within the stack, see OPS_STACK_MASK
+            emit_load8(e, RAX, OFFSET_SP);
+            emit_alu_ri(e, ALU_SUB, RAX, 1);
+            emit_alu_ri(e, ALU_AND, RAX, OPS_STACK_MASK);
+            emit_store8(e, RAX, OFFSET_SP);
+            // movzx eax, word [rdi + rax*2 + stack]
+            emit8(e, 0x0F); emit8(e, 0xB7); emit8(e, 0x84); emit8(e, 0x47);
+            emit32(e, OFFSET_STACK);
+            break;
+        case OP_JP:
+            emit_mov_ri(e, RAX, instr->nnn);
+            break;
+        case OP_CALL:
+            emit_load8(e, RAX, OFFSET_SP);
+            emit_alu_ri(e, ALU_AND, RAX, OPS_STACK_MASK);
+            // mov word [rdi + rax*2 + stack], pc + 2
+            emit8(e, 0x66); emit8(e, 0xC7); emit8(e, 0x84); emit8(e, 0x47);
+            emit32(e, OFFSET_STACK);
+            emit16(e, pc + 2);
+            emit_alu_ri(e, ALU_ADD, RAX, 1);
+            emit_alu_ri(e, ALU_AND, RAX, OPS_STACK_MASK);
+            emit_store8(e, RAX, OFFSET_SP);
+            emit_mov_ri(e, RAX, instr->nnn);
+            break;
+        case OP_LD_IMM:
+            emit_mov_ri(e, hx, instr->nn);
+            ra->dirty[instr->x] = true;
+            break;
+        case OP_ADD_IMM:
+            emit_alu_ri(e, ALU_ADD, hx, instr->nn);
+            emit_alu_ri(e, ALU_AND, hx, 0xFF);
+            ra->dirty[instr->x] = true;
+            break;
+        case OP_LD_REG:
+            emit_op_rr(e, X86_MOV, hx, hy);
+            ra->dirty[instr->x] = true;
+            break;
+        case OP_OR:
+            emit_op_rr(e, X86_OR, hx, hy);
+            ra->dirty[instr->x] = true;
+            if (quirks->vf_reset) {
+                emit_mov_ri(e, hf, 0);
+                ra->dirty[0xF] = true;
+            }
+            break;
+        case OP_AND:
+            emit_op_rr(e, X86_AND, hx, hy);
+            ra->dirty[instr->x] = true;
+            if (quirks->vf_reset) {
+                emit_mov_ri(e, hf, 0);
+                ra->dirty[0xF] = true;
+            }
+            break;
+        case OP_XOR:
+            emit_op_rr(e, X86_XOR, hx, hy);
+            ra->dirty[instr->x] = true;
+            if (quirks->vf_reset) {
+                emit_mov_ri(e, hf, 0);
+                ra->dirty[0xF] = true;
+            }
+            break;
+        case OP_ADD_REG:
+            emit_op_rr(e, X86_MOV, RAX, hx);
+            emit_op_rr(e, X86_ADD, RAX, hy);
+            emit_op_rr(e, X86_MOV, hx, RAX);
+            emit_alu_ri(e, ALU_AND, hx, 0xFF);
+            emit_shift_ri(e, SHIFT_SHR, RAX, 8);
+            emit_op_rr(e, X86_MOV, hf, RAX);
+            ra->dirty[instr->x] = true;
+            ra->dirty[0xF] = true;
+            break;
+        case OP_SUB:
+        case OP_SUBN: {
+            uint8_t lhs = instr->op == OP_SUB ? hx : hy;
+            uint8_t rhs = instr->op == OP_SUB ? hy : hx;
+
+            // ecx = lhs >= rhs, zeroed before the compare since xor
+            // clobbers the flags
+            emit_op_rr(e, X86_XOR, RCX, RCX);
+            emit_op_rr(e, X86_CMP, lhs, rhs);
+            emit8(e, 0x0F); emit8(e, 0x93); emit8(e, 0xC1);
+            emit_op_rr(e, X86_MOV, RAX, lhs);
+            emit_op_rr(e, X86_SUB, RAX, rhs);
+            emit_alu_ri(e, ALU_AND, RAX, 0xFF);
+            emit_op_rr(e, X86_MOV, hx, RAX);
+            emit_op_rr(e, X86_MOV, hf, RCX);
+            ra->dirty[instr->x] = true;
+            ra->dirty[0xF] = true;
+            break;
+        }
+        case OP_SHR:
+            // VF is written first, re-read the source afterwards in case it
+            // is VF
+            emit_op_rr(e, X86_MOV, RAX, hs);
+            emit_alu_ri(e, ALU_AND, RAX, 0x01);
+            emit_op_rr(e, X86_MOV, hf, RAX);
+            emit_op_rr(e, X86_MOV, RAX, hs);
+            emit_shift_ri(e, SHIFT_SHR, RAX, 1);
+            emit_op_rr(e, X86_MOV, hx, RAX);
+            ra->dirty[instr->x] = true;
+            ra->dirty[0xF] = true;
+            break;
+        case OP_SHL:
+            emit_op_rr(e, X86_MOV, RAX, hs);
+            emit_shift_ri(e, SHIFT_SHR, RAX, 7);
+            emit_op_rr(e, X86_MOV, hf, RAX);
+            emit_op_rr(e, X86_MOV, RAX, hs);
+            emit_shift_ri(e, SHIFT_SHL, RAX, 1);
+            emit_alu_ri(e, ALU_AND, RAX, 0xFF);
+            emit_op_rr(e, X86_MOV, hx, RAX);
+            ra->dirty[instr->x] = true;
+            ra->dirty[0xF] = true;
+            break;
+        case OP_LD_I:
+            emit_mov_ri(e, hi, instr->nnn);
+            ra->dirty[GUEST_I] = true;
+            break;
+        case OP_JP_V0:
+            emit_op_rr(e, X86_MOV, RAX, ra->host[quirks->jump_vx ? instr->x : 0]);
+            emit_alu_ri(e, ALU_ADD, RAX, instr->nnn);
+            emit_alu_ri(e, ALU_AND, RAX, 0xFFFF);
+            break;
+        case OP_LD_VX_DT:
+            emit_load8(e, hx, OFFSET_DELAY);
+            ra->dirty[instr->x] = true;
+            break;
+        case OP_LD_DT_VX:
+            emit_store8(e, hx, OFFSET_DELAY);
+            break;
+        case OP_LD_ST_VX:
+            emit_store8(e, hx, OFFSET_SOUND);
+            break;
+        case OP_ADD_I:
+            emit_op_rr(e, X86_ADD, hi, hx);
+            emit_alu_ri(e, ALU_AND, hi, 0xFFFF);
+            ra->dirty[GUEST_I] = true;
+            break;
+        case OP_LD_VX_MEM:
+            // ecx walks from I, wrapping at the end of the mode's memory
+            emit_op_rr(e, X86_MOV, RCX, hi);
+            emit_alu_ri(e, ALU_AND, RCX, e->memory_mask);
+            for (uint8_t reg = 0; reg <= instr->x; reg++) {
+                if (reg > 0) {
+                    // inc ecx
+                    emit8(e, 0xFF); emit8(e, 0xC1);
+                    emit_alu_ri(e, ALU_AND, RCX, e->memory_mask);
+                }
+
+                if (ra->host[reg] != NO_REG) {
+                    emit_load8_indexed(e, ra->host[reg], RCX, OFFSET_MEMORY);
+                    ra->dirty[reg] = true;
+                } else {
+                    emit_load8_indexed(e, RAX, RCX, OFFSET_MEMORY);
+                    emit_store8(e, RAX, OFFSET_V(reg));
+                }
+            }
+            if (i_inc != 0) {
+                emit_alu_ri(e, ALU_ADD, hi, i_inc);
+                emit_alu_ri(e, ALU_AND, hi, 0xFFFF);
+                ra->dirty[GUEST_I] = true;
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+static void emit_skip(struct emitter *e, struct reg_alloc *ra,
+                      const struct chip8_instr *skip,
+                      const struct chip8_instr *jump, uint16_t pc,
+                      uint16_t count)
+{
+    uint8_t hx = ra->host[skip->x];
+
+    // Not skipping lands on the next instruction, or wherever the fused
+    // jump goes (executing one more instruction on the way)
+    uint16_t not_taken        = jump != NULL ? jump->nnn : pc + 2;
+    uint16_t not_taken_opcode = jump != NULL ? jump->opcode : skip->opcode;
+    uint16_t not_taken_count  = count + (jump != NULL ? 2 : 1);
+
+    // ecx = skip taken (0 / 1), zeroed before the compare
+    emit_op_rr(e, X86_XOR, RCX, RCX);
+    if (skip->op == OP_SE_IMM || skip->op == OP_SNE_IMM) {
+        emit_alu_ri(e, ALU_CMP, hx, skip->nn);
+    } else {
+        emit_op_rr(e, X86_CMP, hx, ra->host[skip->y]);
+    }
+    emit8(e, 0x0F);
+    emit8(e, (skip->op == OP_SE_IMM || skip->op == OP_SE_REG) ? 0x94 : 0x95);
+    emit8(e, 0xC1);
+
+    // Everything below picks between the two outcomes without branching:
+    // value = not_taken ^ (-taken & (not_taken ^ taken_value))
+
+    // em.opcode = last instruction executed
+    emit_op_rr(e, X86_MOV, RAX, RCX);
+    emit8(e, 0xF7); emit8(e, 0xD8);                      // neg eax
+    emit_alu_ri(e, ALU_AND, RAX, not_taken_opcode ^ skip->opcode);
+    emit_alu_ri(e, ALU_XOR, RAX, not_taken_opcode);
+    emit8(e, 0x66); emit8(e, 0x89); emit8(e, 0x87);      // mov [rdi + opcode], ax
+    emit32(e, OFFSET_OPCODE);
+
+    // Next PC
+    emit_op_rr(e, X86_MOV, RAX, RCX);
+    emit8(e, 0xF7); emit8(e, 0xD8);
+    emit_alu_ri(e, ALU_AND, RAX, not_taken ^ (uint16_t)(pc + 4));
+    emit_alu_ri(e, ALU_XOR, RAX, not_taken);
+
+    // Instructions executed = not_taken_count - taken when fused
+    emit8(e, 0xF7); emit8(e, 0xD9);                      // neg ecx
+    if (jump != NULL) {
+        emit_alu_ri(e, ALU_ADD, RCX, not_taken_count);
+    } else {
+        emit_mov_ri(e, RCX, not_taken_count);
+    }
+
+    // add dword [rdx], ecx
+    emit8(e, 0x01); emit8(e, 0x0A);
+}
+
+static bool is_skip(const struct chip8_instr *instr)
+{
+    return instr->op == OP_SE_IMM  || instr->op == OP_SNE_IMM ||
+           instr->op == OP_SE_REG  || instr->op == OP_SNE_REG;
+}
+
+static void flush(struct jit *jit)
+{
+    jit->code_used  = 0;
+    jit->num_blocks = 0;
+
+    // Programs sit at the bottom of 64 KB, no need to wipe all of it
+    memset(jit->lookup, 0, jit->covered_end * sizeof(jit->lookup[0]));
+    memset(jit->covered, 0, jit->covered_end);
+    jit->covered_end = 0;
+}
+
+// Only the pages [offset, offset + size) of the buffer is on, the fewer the
+// cheaper the switch
+static bool protect(struct jit *jit, size_t offset, size_t size, int prot)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t begin = offset & ~(page - 1);
+    size_t end = (offset + size + page - 1) & ~(page - 1);
+
+    return mprotect(jit->code + begin, end - begin, prot) == 0;
+}
+
+static void emit8(struct emitter *e, uint8_t byte)
+{
+    *e->p++ = byte;
+}
+
+static void emit16(struct emitter *e, uint16_t val)
+{
+    memcpy(e->p, &val, sizeof(val));
+    e->p += sizeof(val);
+}
+
+static void emit32(struct emitter *e, uint32_t val)
+{
+    memcpy(e->p, &val, sizeof(val));
+    e->p += sizeof(val);
+}
+
+static uint8_t *emit_jcc(struct emitter *e, uint8_t cc)
+{
+    // jcc rel32, returns where the displacement goes for patch_rel32()
+    emit8(e, 0x0F);
+    emit8(e, 0x80 | cc);
+    emit32(e, 0);
+
+    return e->p - 4;
+}
+
+static void patch_rel32(uint8_t *rel, uint8_t *target)
+{
+    int32_t disp = (int32_t)(target - (rel + 4));
+
+    memcpy(rel, &disp, sizeof(disp));
+}
+
+static void emit_rex(struct emitter *e, bool force, uint8_t reg,
+                     uint8_t index, uint8_t rm)
+{
+    uint8_t rex = 0x40 | ((reg & 8) >> 1) | ((index & 8) >> 2) | ((rm & 8) >> 3);
+
+    // Byte access to SIL / BPL needs a REX prefix even when it is empty
+    if (force || rex != 0x40) {
+        emit8(e, rex);
+    }
+}
+
+static void emit_push(struct emitter *e, uint8_t r)
+{
+    emit_rex(e, false, 0, 0, r);
+    emit8(e, 0x50 + (r & 7));
+}
+
+static void emit_pop(struct emitter *e, uint8_t r)
+{
+    emit_rex(e, false, 0, 0, r);
+    emit8(e, 0x58 + (r & 7));
+}
+
+static void emit_mov_ri(struct emitter *e, uint8_t dst, uint32_t imm)
+{
+    emit_rex(e, false, 0, 0, dst);
+    emit8(e, 0xB8 + (dst & 7));
+    emit32(e, imm);
+}
+
+static void emit_op_rr(struct emitter *e, uint8_t opcode,
+                       uint8_t dst, uint8_t src)
+{
+    emit_rex(e, false, src, 0, dst);
+    emit8(e, opcode);
+    emit8(e, 0xC0 | ((src & 7) << 3) | (dst & 7));
+}
+
+static void emit_alu_ri(struct emitter *e, uint8_t digit,
+                        uint8_t dst, uint32_t imm)
+{
+    emit_rex(e, false, 0, 0, dst);
+    emit8(e, 0x81);
+    emit8(e, 0xC0 | (digit << 3) | (dst & 7));
+    emit32(e, imm);
+}
+
+static void emit_shift_ri(struct emitter *e, uint8_t digit,
+                          uint8_t dst, uint8_t imm)
+{
+    emit_rex(e, false, 0, 0, dst);
+    emit8(e, 0xC1);
+    emit8(e, 0xC0 | (digit << 3) | (dst & 7));
+    emit8(e, imm);
+}
+
+static void emit_load8(struct emitter *e, uint8_t dst, int32_t disp)
+{
+    // movzx r32, byte [rdi + disp32]
+    emit_rex(e, false, dst, 0, RDI);
+    emit8(e, 0x0F);
+    emit8(e, 0xB6);
+    emit8(e, 0x80 | ((dst & 7) << 3) | RDI);
+    emit32(e, disp);
+}
+
+static void emit_load16(struct emitter *e, uint8_t dst, int32_t disp)
+{
+    // movzx r32, word [rdi + disp32]
+    emit_rex(e, false, dst, 0, RDI);
+    emit8(e, 0x0F);
+    emit8(e, 0xB7);
+    emit8(e, 0x80 | ((dst & 7) << 3) | RDI);
+    emit32(e, disp);
+}
+
+static void emit_store8(struct emitter *e, uint8_t src, int32_t disp)
+{
+    // mov byte [rdi + disp32], r8
+    emit_rex(e, true, src, 0, RDI);
+    emit8(e, 0x88);
+    emit8(e, 0x80 | ((src & 7) << 3) | RDI);
+    emit32(e, disp);
+}
+
+static void emit_store16(struct emitter *e, uint8_t src, int32_t disp)
+{
+    // mov word [rdi + disp32], r16
+    emit8(e, 0x66);
+    emit_rex(e, false, src, 0, RDI);
+    emit8(e, 0x89);
+    emit8(e, 0x80 | ((src & 7) << 3) | RDI);
+    emit32(e, disp);
+}
+
+static void emit_load8_indexed(struct emitter *e, uint8_t dst,
+                               uint8_t index, int32_t disp)
+{
+    // movzx r32, byte [rdi + index + disp32]
+    emit_rex(e, false, dst, index, RDI);
+    emit8(e, 0x0F);
+    emit8(e, 0xB6);
+    emit8(e, 0x80 | ((dst & 7) << 3) | RSP);
+    emit8(e, ((index & 7) << 3) | RDI);
+    emit32(e, disp);
+}
+
+#else
+
+// No code generator for this host, chip8_set_engine() reports the JIT as
+// unavailable and the other engines keep working
+
+struct jit *jit_create(void)
+{
+    return NULL;
+}
+
+void jit_destroy(struct jit *jit)
+{
+    (void)jit;
+}
+
+uint32_t jit_run(chip8_ctx *ctx, uint32_t num_cycles)
+{
+    (void)ctx;
+    (void)num_cycles;
+
+    return 0;
+}
+
+void jit_invalidate(struct jit *jit, uint16_t addr, uint32_t len)
+{
+    (void)jit;
+    (void)addr;
+    (void)len;
+}
+
+bool jit_open_perf_map(void)
+{
+    return false;
+}
+
+void jit_close_perf_map(void)
+{
+}
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef CHIP8_JIT_H
+#define CHIP8_JIT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "chip8_emulator.h"
+
+struct jit;
+
+// NULL when the host can't run generated code (only x86-64 is supported)
+struct jit *jit_create(void);
+void jit_destroy(struct jit *jit);
+
+// Runs translated basic blocks starting at em.PC for up to num_cycles
+// instructions, stopping early right after an FX0A. Anything without a
+// translation (I/O opcodes, stores into memory) is stepped through the decode
+// cache in between. Returns how many instructions ran.
+uint32_t jit_run(chip8_ctx *ctx, uint32_t num_cycles);
+
+// Drops every block if [addr, addr + len) overlaps translated code
+void jit_invalidate(struct jit *jit, uint16_t addr, uint32_t len);
+
+// Appends every block translated from now on to /tmp/perf-<pid>.map so perf
+// can symbolize the generated code. Process wide, shared by all instances.
+bool jit_open_perf_map(void);
+void jit_close_perf_map(void);
+
+#endif
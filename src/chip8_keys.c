@@ -0,0 +1,112 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "chip8_keys.h"
+
+#define KEY_INTERRUPT 0x03      // ^C
+
+static void remove_char(struct key_queue *queue, uint8_t index);
+
+void key_queue_set_keymap(struct key_queue *queue, const char keys[NUM_KEYS])
+{
+    memcpy(queue->keymap, keys, sizeof(queue->keymap));
+}
+
+int key_queue_hex_key(const struct key_queue *queue, int ch)
+{
+    for (int i = 0; i < NUM_KEYS; i++) {
+        if (ch == queue->keymap[i]) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+uint8_t key_queue_translate(int ch)
+{
+    return ch == KEY_INTERRUPT ? 'k' : (uint8_t)ch;
+}
+
+void key_queue_add(struct key_queue *queue, int ch)
+{
+    int key = key_queue_hex_key(queue, ch);
+
+    if (key >= 0) {
+        queue->hex_keys |= 1 << key;
+        return;
+    }
+
+    // Arrow keys and the like come from ncurses as values above a byte
+    if (ch < 0 || ch > UINT8_MAX) {
+        return;
+    }
+
+    ch = key_queue_translate(ch);
+
+    if (ch == '\0' || strchr(KEY_QUEUE_HOTKEYS, ch) == NULL) {
+        return;
+    }
+
+    if (queue->num_chars == KEY_QUEUE_SIZE) {
+        remove_char(queue, 0);
+    }
+
+    queue->chars[queue->num_chars++] = (uint8_t)ch;
+}
+
+bool key_queue_pop_char(struct key_queue *queue, uint8_t *ch)
+{
+    if (queue->num_chars == 0) {
+        return false;
+    }
+
+    *ch = queue->chars[0];
+    remove_char(queue, 0);
+
+    return true;
+}
+
+bool key_queue_find(struct key_queue *queue, uint8_t key, bool consume_key)
+{
+    for (uint8_t i = 0; i < queue->num_chars; i++) {
+        if (queue->chars[i] == key) {
+            if (consume_key) {
+                remove_char(queue, i);
+            }
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool key_queue_pop_hex_key(struct key_queue *queue, uint8_t *key)
+{
+    if (queue->hex_keys == 0) {
+        return false;
+    }
+
+    *key = __builtin_ctz(queue->hex_keys);
+    queue->hex_keys &= queue->hex_keys - 1;
+
+    return true;
+}
+
+uint16_t key_queue_take_hex_keys(struct key_queue *queue)
+{
+    uint16_t pressed = queue->hex_keys;
+
+    queue->hex_keys = 0;
+
+    return pressed;
+}
+
+static void remove_char(struct key_queue *queue, uint8_t index)
+{
+    queue->num_chars--;
+    memmove(&queue->chars[index], &queue->chars[index + 1],
+            queue->num_chars - index);
+}
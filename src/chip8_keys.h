@@ -0,0 +1,71 @@
+#ifndef CHIP8_KEYS_H
+#define CHIP8_KEYS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "chip8_util.h"
+
+// Keys besides the hex ones that chip8_main asks for: end (k), pause (p),
+// save (o), load (l), rewind (b) and, while single-stepping, step (i) /
+// step back (u). Anything else typed is dropped, nothing would ever take
+// it out of the queue.
+#define KEY_QUEUE_HOTKEYS "kpolbiu"
+
+// Room for every hotkey a few times over. When it's full the oldest key
+// makes room, so the last one typed always gets through.
+#define KEY_QUEUE_SIZE 16
+
+/* Chip-8 Key  Keyboard
+ * ----------  ---------
+ *    1 2 3 C    1 2 3 4
+ *    4 5 6 D    q w e r
+ *    7 8 9 E    a s d f
+ *    A 0 B F    z x c v
+ *
+ * unless key_queue_set_keymap() says otherwise
+ * */
+#define KEY_QUEUE_INIT {                        \
+    .keymap = {                                 \
+        'x', '1', '2', '3',                     \
+        'q', 'w', 'e', 'a',                     \
+        's', 'd', 'z', 'c',                     \
+        '4', 'r', 'f', 'v'                      \
+    },                                          \
+}
+
+// Keyboard input a terminal backend read but nobody asked for yet: a bit
+// per hex key pressed, hotkeys in the order they came
+struct key_queue {
+    uint8_t keymap[NUM_KEYS];
+
+    uint16_t hex_keys;
+    uint8_t chars[KEY_QUEUE_SIZE];
+    uint8_t num_chars;
+};
+
+void key_queue_set_keymap(struct key_queue *queue, const char keys[NUM_KEYS]);
+
+// Hex key for a keyboard key, -1 when it isn't one
+int key_queue_hex_key(const struct key_queue *queue, int ch);
+
+// Raw terminals hand ^C over as a byte instead of raising SIGINT, it ends
+// the run like k. Everything else stays as it is.
+uint8_t key_queue_translate(int ch);
+
+// A key read from the terminal
+void key_queue_add(struct key_queue *queue, int ch);
+
+// Oldest hotkey queued, false when there's none
+bool key_queue_pop_char(struct key_queue *queue, uint8_t *ch);
+
+// Whether key is queued, taking it out if consume_key
+bool key_queue_find(struct key_queue *queue, uint8_t key, bool consume_key);
+
+// Lowest hex key pressed, taking it out. False when there's none.
+bool key_queue_pop_hex_key(struct key_queue *queue, uint8_t *key);
+
+// Every hex key pressed since the last call
+uint16_t key_queue_take_hex_keys(struct key_queue *queue);
+
+#endif
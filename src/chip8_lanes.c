@@ -0,0 +1,1159 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8_emulator.h"
+#include "chip8_input.h"
+#include "chip8_lanes.h"
+#include "chip8_ops.h"
+#include "chip8_quirks.h"
+#include "chip8_util.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define LANES_X86 1
+#include <immintrin.h>
+#else
+#define LANES_X86 0
+#endif
+
+// Lowest PC when no lane is running. Above anything a lane can jump to
+// (BNNN reaches 0x10FE), and positive as a signed 16 bit number.
+#define LANES_NO_PC 0x7FFF
+
+// What only one lane at a time needs
+struct lane {
+    uint16_t stack[STACK_SIZE];
+    uint8_t SP;
+    uint8_t status;             // enum lanes_status
+
+    uint16_t keypad;
+    uint8_t key_hold[NUM_KEYS];
+    struct key_ring key_presses;
+
+    uint32_t rng_state;
+    struct input_log *input_log;
+
+    uint64_t cycles;
+};
+
+// Every row is width entries long, one per lane, padding lanes never run
+struct lanes {
+    uint32_t count;
+    uint32_t width;
+    uint32_t ipf;
+    uint8_t quirks;             // enum chip8_quirks_profile
+    enum lanes_isa isa;
+    const struct lanes_kernels *kernels;
+
+    // Every lane is at the same point of the same frame
+    uint32_t frame_cycles;
+    uint64_t frames;
+
+    // Instructions the current run_slice() gives each lane, and the total
+    // run so far across all of them
+    uint32_t slice;
+    uint64_t executed;
+    uint32_t live_count;
+
+    // Registers, V is NUM_REGS rows
+    uint8_t  *V;
+    uint16_t *PC;
+    uint16_t *I;
+    uint16_t *opcode;
+    uint8_t  *delay;
+    uint8_t  *sound;
+
+    // LANES_MEMORY_SIZE rows, address major: the bytes every lane has at
+    // one address are next to each other, so checking that they all hold
+    // the same instruction is two compares per register
+    uint8_t  *memory;
+
+    // ROW_COUNT rows of lo-res screen lines
+    graphics_row_t *screen;
+
+    // 0xFF / 0 per lane: not ended or faulted, has instructions left in the
+    // current slice, runs the current step
+    uint8_t  *live;
+    uint8_t  *run;
+    uint8_t  *mask;
+    uint16_t *left;
+
+    struct lane *lanes;
+};
+
+// One step's work across every lane set in l->mask (l->live for tick),
+// SIMD or not
+struct lanes_kernels {
+    // Lowest PC of any running lane, LANES_NO_PC if there is none
+    uint16_t (*lowest_pc)(const struct lanes *l);
+
+    // Masks in the running lanes at pc that have opcode there
+    void (*select)(struct lanes *l, uint16_t pc, uint16_t opcode);
+
+    void (*set)(struct lanes *l, uint8_t *row, uint8_t value);
+    void (*add)(struct lanes *l, uint8_t *row, uint8_t value);
+    void (*copy)(struct lanes *l, uint8_t *dst, const uint8_t *src);
+
+    // 8XY1-8XY5 and 8XY7, VF reset left to the caller
+    void (*arith)(struct lanes *l, uint8_t x, uint8_t y, uint8_t op);
+
+    // 8XY6 / 8XYE, src being X or Y as the quirks say
+    void (*shift)(struct lanes *l, uint8_t x, uint8_t src, bool left);
+
+    // Skips when a equals b (nn if b is NULL), or doesn't with !equal
+    void (*skip)(struct lanes *l, const uint8_t *a, const uint8_t *b,
+                 uint8_t nn, bool equal, uint16_t pc);
+
+    void (*set_wide)(struct lanes *l, uint16_t *row, uint16_t value);
+    void (*add_wide)(struct lanes *l, uint16_t *row, const uint8_t *src);
+
+    // Latches opcode, moves PC to next_pc unless that's LANES_NO_PC, and
+    // counts the instruction off each lane's slice
+    void (*retire)(struct lanes *l, uint16_t opcode, uint16_t next_pc);
+
+    void (*tick)(struct lanes *l);
+};
+
+enum key_result {
+    KEY_READY,
+    KEY_SUSPEND,
+    KEY_END,
+};
+
+static inline uint8_t *lanes_v(const struct lanes *l, uint8_t reg)
+{
+    return &l->V[reg * l->width];
+}
+
+static inline uint8_t *lanes_mem(const struct lanes *l, uint32_t addr)
+{
+    return &l->memory[addr * l->width];
+}
+
+static uint16_t lowest_pc_scalar(const struct lanes *l);
+static void select_scalar(struct lanes *l, uint16_t pc, uint16_t opcode);
+static void set_scalar(struct lanes *l, uint8_t *row, uint8_t value);
+static void add_scalar(struct lanes *l, uint8_t *row, uint8_t value);
+static void copy_scalar(struct lanes *l, uint8_t *dst, const uint8_t *src);
+static void arith_scalar(struct lanes *l, uint8_t x, uint8_t y, uint8_t op);
+static void shift_scalar(struct lanes *l, uint8_t x, uint8_t src, bool left);
+static void skip_scalar(struct lanes *l, const uint8_t *a, const uint8_t *b,
+                        uint8_t nn, bool equal, uint16_t pc);
+static void set_wide_scalar(struct lanes *l, uint16_t *row, uint16_t value);
+static void add_wide_scalar(struct lanes *l, uint16_t *row, const uint8_t *src);
+static void retire_scalar(struct lanes *l, uint16_t opcode, uint16_t next_pc);
+static void tick_scalar(struct lanes *l);
+
+static void *alloc_rows(size_t size);
+static void run_slice(struct lanes *l, uint32_t slice);
+static void execute(struct lanes *l, uint16_t pc, uint16_t opcode);
+static void step_lanes(struct lanes *l, uint16_t pc, uint16_t opcode);
+static bool step_lane(struct lanes *l, uint32_t i, uint16_t pc, uint16_t opcode);
+static void wait_keys(struct lanes *l, uint8_t x, uint16_t opcode);
+static enum key_result next_key(struct lane *lane, uint8_t *key);
+static bool draw_lane(struct lanes *l, uint32_t i, uint8_t x, uint8_t y,
+                      uint8_t height);
+static void stop_lane(struct lanes *l, uint32_t i, enum lanes_status status);
+static void fault_selected(struct lanes *l);
+static void end_frame(struct lanes *l);
+static void poll_lane(struct lanes *l, uint32_t i);
+
+static const struct lanes_kernels lanes_kernels_scalar = {
+    .lowest_pc = lowest_pc_scalar,
+    .select    = select_scalar,
+    .set       = set_scalar,
+    .add       = add_scalar,
+    .copy      = copy_scalar,
+    .arith     = arith_scalar,
+    .shift     = shift_scalar,
+    .skip      = skip_scalar,
+    .set_wide  = set_wide_scalar,
+    .add_wide  = add_wide_scalar,
+    .retire    = retire_scalar,
+    .tick      = tick_scalar,
+};
+
+#if LANES_X86
+
+// AVX2 kernels are compiled for it whatever the target, lanes_create()
+// only picks them when the CPU has it
+#pragma GCC push_options
+#pragma GCC target("avx2")
+
+#define LANES_ISA          avx2
+#define VEC_T              __m256i
+#define VEC_W              32
+#define VEC_LOAD(p)        _mm256_loadu_si256((const __m256i *)(const void *)(p))
+#define VEC_STORE(p, v)    _mm256_storeu_si256((__m256i *)(void *)(p), v)
+#define VEC_SET8(x)        _mm256_set1_epi8((char)(x))
+#define VEC_SET16(x)       _mm256_set1_epi16((short)(x))
+#define VEC_AND(a, b)      _mm256_and_si256(a, b)
+#define VEC_OR(a, b)       _mm256_or_si256(a, b)
+#define VEC_XOR(a, b)      _mm256_xor_si256(a, b)
+#define VEC_ANDNOT(a, b)   _mm256_andnot_si256(a, b)
+#define VEC_EQ8(a, b)      _mm256_cmpeq_epi8(a, b)
+#define VEC_EQ16(a, b)     _mm256_cmpeq_epi16(a, b)
+#define VEC_ADD8(a, b)     _mm256_add_epi8(a, b)
+#define VEC_SUB8(a, b)     _mm256_sub_epi8(a, b)
+#define VEC_ADD16(a, b)    _mm256_add_epi16(a, b)
+#define VEC_ADDS_U8(a, b)  _mm256_adds_epu8(a, b)
+#define VEC_SUBS_U8(a, b)  _mm256_subs_epu8(a, b)
+#define VEC_MAX_U8(a, b)   _mm256_max_epu8(a, b)
+#define VEC_MIN_I16(a, b)  _mm256_min_epi16(a, b)
+#define VEC_SRL16(a, n)    _mm256_srli_epi16(a, n)
+#define VEC_WIDEN_LO(m)    _mm256_cvtepi8_epi16(_mm256_castsi256_si128(m))
+#define VEC_WIDEN_HI(m)    _mm256_cvtepi8_epi16(_mm256_extracti128_si256(m, 1))
+#define VEC_ZEXT_LO(v)     _mm256_cvtepu8_epi16(_mm256_castsi256_si128(v))
+#define VEC_ZEXT_HI(v)     _mm256_cvtepu8_epi16(_mm256_extracti128_si256(v, 1))
+// packs works on each 128 bit half, the permute puts the halves back in order
+#define VEC_NARROW(a, b)   _mm256_permute4x64_epi64(_mm256_packs_epi16(a, b), 0xD8)
+
+#include "chip8_lanes_simd.h"
+
+#undef LANES_ISA
+#undef VEC_WIDEN_LO
+#undef VEC_WIDEN_HI
+#undef VEC_ZEXT_LO
+#undef VEC_ZEXT_HI
+#undef VEC_NARROW
+
+#pragma GCC pop_options
+
+// The rest is the same intrinsic a size down, SSE2 being part of x86-64
+#define LANES_ISA          sse2
+#undef  VEC_T
+#undef  VEC_W
+#undef  VEC_LOAD
+#undef  VEC_STORE
+#undef  VEC_SET8
+#undef  VEC_SET16
+#undef  VEC_AND
+#undef  VEC_OR
+#undef  VEC_XOR
+#undef  VEC_ANDNOT
+#undef  VEC_EQ8
+#undef  VEC_EQ16
+#undef  VEC_ADD8
+#undef  VEC_SUB8
+#undef  VEC_ADD16
+#undef  VEC_ADDS_U8
+#undef  VEC_SUBS_U8
+#undef  VEC_MAX_U8
+#undef  VEC_MIN_I16
+#undef  VEC_SRL16
+#define VEC_T              __m128i
+#define VEC_W              16
+#define VEC_LOAD(p)        _mm_loadu_si128((const __m128i *)(const void *)(p))
+#define VEC_STORE(p, v)    _mm_storeu_si128((__m128i *)(void *)(p), v)
+#define VEC_SET8(x)        _mm_set1_epi8((char)(x))
+#define VEC_SET16(x)       _mm_set1_epi16((short)(x))
+#define VEC_AND(a, b)      _mm_and_si128(a, b)
+#define VEC_OR(a, b)       _mm_or_si128(a, b)
+#define VEC_XOR(a, b)      _mm_xor_si128(a, b)
+#define VEC_ANDNOT(a, b)   _mm_andnot_si128(a, b)
+#define VEC_EQ8(a, b)      _mm_cmpeq_epi8(a, b)
+#define VEC_EQ16(a, b)     _mm_cmpeq_epi16(a, b)
+#define VEC_ADD8(a, b)     _mm_add_epi8(a, b)
+#define VEC_SUB8(a, b)     _mm_sub_epi8(a, b)
+#define VEC_ADD16(a, b)    _mm_add_epi16(a, b)
+#define VEC_ADDS_U8(a, b)  _mm_adds_epu8(a, b)
+#define VEC_SUBS_U8(a, b)  _mm_subs_epu8(a, b)
+#define VEC_MAX_U8(a, b)   _mm_max_epu8(a, b)
+#define VEC_MIN_I16(a, b)  _mm_min_epi16(a, b)
+#define VEC_SRL16(a, n)    _mm_srli_epi16(a, n)
+#define VEC_WIDEN_LO(m)    _mm_unpacklo_epi8(m, m)
+#define VEC_WIDEN_HI(m)    _mm_unpackhi_epi8(m, m)
+#define VEC_ZEXT_LO(v)     _mm_unpacklo_epi8(v, _mm_setzero_si128())
+#define VEC_ZEXT_HI(v)     _mm_unpackhi_epi8(v, _mm_setzero_si128())
+#define VEC_NARROW(a, b)   _mm_packs_epi16(a, b)
+
+#include "chip8_lanes_simd.h"
+
+#endif
+
+// Indexed by enum lanes_isa, NULL where this build has none
+static const struct lanes_kernels *const lanes_kernels[LANES_ISA_COUNT] = {
+#if LANES_X86
+    [LANES_ISA_AVX2]   = &lanes_kernels_avx2,
+    [LANES_ISA_SSE2]   = &lanes_kernels_sse2,
+#endif
+    [LANES_ISA_SCALAR] = &lanes_kernels_scalar,
+};
+
+static const char *const lanes_isa_names[LANES_ISA_COUNT] = {
+    [LANES_ISA_AVX2]   = "avx2",
+    [LANES_ISA_SSE2]   = "sse2",
+    [LANES_ISA_SCALAR] = "scalar",
+};
+
+struct lanes *lanes_create(const chip8_ctx *image, uint32_t count,
+                           uint32_t ipf, enum lanes_isa isa)
+{
+    const struct emulator *em = &image->em;
+
+    if (em->mode != CHIP8_MODE_CHIP8 || count == 0 || ipf == 0 ||
+        !lanes_isa_supported(isa)) {
+        return NULL;
+    }
+
+    struct lanes *l = calloc(1, sizeof(*l));
+    if (l == NULL) {
+        return NULL;
+    }
+
+    uint32_t width = (count + LANES_ALIGN - 1) / LANES_ALIGN * LANES_ALIGN;
+
+    l->count   = count;
+    l->width   = width;
+    l->ipf     = ipf;
+    l->quirks  = em->quirks;
+    l->isa     = isa;
+    l->kernels = lanes_kernels[isa];
+
+    l->V      = alloc_rows((size_t)NUM_REGS * width);
+    l->PC     = alloc_rows(width * sizeof(uint16_t));
+    l->I      = alloc_rows(width * sizeof(uint16_t));
+    l->opcode = alloc_rows(width * sizeof(uint16_t));
+    l->delay  = alloc_rows(width);
+    l->sound  = alloc_rows(width);
+    l->memory = alloc_rows((size_t)LANES_MEMORY_SIZE * width);
+    l->screen = alloc_rows((size_t)ROW_COUNT * width * sizeof(graphics_row_t));
+    l->live   = alloc_rows(width);
+    l->run    = alloc_rows(width);
+    l->mask   = alloc_rows(width);
+    l->left   = alloc_rows(width * sizeof(uint16_t));
+    l->lanes  = calloc(count, sizeof(*l->lanes));
+
+    if (l->V == NULL || l->PC == NULL || l->I == NULL || l->opcode == NULL ||
+        l->delay == NULL || l->sound == NULL || l->memory == NULL ||
+        l->screen == NULL || l->live == NULL || l->run == NULL ||
+        l->mask == NULL || l->left == NULL || l->lanes == NULL) {
+        lanes_destroy(l);
+        return NULL;
+    }
+
+    for (uint32_t reg = 0; reg < NUM_REGS; reg++) {
+        memset(lanes_v(l, reg), em->V[reg], width);
+    }
+
+    for (uint32_t addr = 0; addr < LANES_MEMORY_SIZE; addr++) {
+        memset(lanes_mem(l, addr), em->memory[addr], width);
+    }
+
+    memset(l->delay, em->delay, width);
+    memset(l->sound, em->sound, width);
+
+    for (uint32_t i = 0; i < width; i++) {
+        l->PC[i]     = em->PC;
+        l->I[i]      = em->I;
+        l->opcode[i] = em->opcode;
+
+        for (uint32_t row = 0; row < ROW_COUNT; row++) {
+            l->screen[row * width + i] = image->gfx.screen[0][row][0];
+        }
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        struct lane *lane = &l->lanes[i];
+
+        memcpy(lane->stack, em->stack, sizeof(lane->stack));
+        memcpy(lane->key_hold, image->key_hold, sizeof(lane->key_hold));
+        memcpy(&lane->key_presses, &em->key_presses, sizeof(lane->key_presses));
+        lane->SP        = em->SP;
+        lane->keypad    = em->keypad;
+        lane->rng_state = image->rng_state;
+
+        if (em->emulation_end_flag) {
+            lane->status = LANES_ENDED;
+        } else {
+            lane->status = LANES_RUNNING;
+            l->live[i] = 0xFF;
+            l->live_count++;
+        }
+    }
+
+    return l;
+}
+
+void lanes_destroy(struct lanes *l)
+{
+    if (l == NULL) {
+        return;
+    }
+
+    free(l->V);
+    free(l->PC);
+    free(l->I);
+    free(l->opcode);
+    free(l->delay);
+    free(l->sound);
+    free(l->memory);
+    free(l->screen);
+    free(l->live);
+    free(l->run);
+    free(l->mask);
+    free(l->left);
+    free(l->lanes);
+    free(l);
+}
+
+enum lanes_isa lanes_best_isa(void)
+{
+    for (int isa = 0; isa < LANES_ISA_COUNT; isa++) {
+        if (lanes_isa_supported(isa)) {
+            return isa;
+        }
+    }
+
+    return LANES_ISA_SCALAR;
+}
+
+bool lanes_isa_supported(enum lanes_isa isa)
+{
+    switch (isa) {
+#if LANES_X86
+        case LANES_ISA_AVX2:
+            return __builtin_cpu_supports("avx2");
+        case LANES_ISA_SSE2:
+            return __builtin_cpu_supports("sse2");
+#endif
+        case LANES_ISA_SCALAR:
+            return true;
+        default:
+            return false;
+    }
+}
+
+const char *lanes_isa_name(enum lanes_isa isa)
+{
+    return isa < LANES_ISA_COUNT ? lanes_isa_names[isa] : "unknown";
+}
+
+bool lanes_isa_parse(const char *name, enum lanes_isa *isa)
+{
+    if (strcmp(name, "lanes") == 0) {
+        *isa = lanes_best_isa();
+        return true;
+    }
+
+    if (strncmp(name, "lanes-", 6) != 0) {
+        return false;
+    }
+
+    for (int i = 0; i < LANES_ISA_COUNT; i++) {
+        if (strcmp(&name[6], lanes_isa_names[i]) == 0) {
+            *isa = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void lanes_seed_random(struct lanes *l, uint32_t lane, uint32_t seed)
+{
+    // Whatever chip8_seed_random() makes of it
+    uint64_t hash = util_hash(&seed, sizeof(seed), UTIL_HASH_SEED);
+    uint32_t state = (uint32_t)(hash ^ (hash >> 32));
+
+    l->lanes[lane].rng_state = state != 0 ? state : 1;
+}
+
+void lanes_set_input_log(struct lanes *l, uint32_t lane, struct input_log *log)
+{
+    l->lanes[lane].input_log = log;
+}
+
+uint64_t lanes_run(struct lanes *l, uint64_t cycles)
+{
+    uint64_t before = l->executed;
+
+    // Slices end with the frame, or where the caller wants to look, the
+    // per-lane count of what's left being 16 bit
+    while (cycles > 0 && l->live_count > 0) {
+        uint32_t slice = l->ipf - l->frame_cycles;
+
+        if (slice > cycles) {
+            slice = cycles;
+        }
+        if (slice > UINT16_MAX) {
+            slice = UINT16_MAX;
+        }
+
+        run_slice(l, slice);
+
+        cycles -= slice;
+        l->frame_cycles += slice;
+
+        if (l->frame_cycles == l->ipf) {
+            end_frame(l);
+        }
+    }
+
+    return l->executed - before;
+}
+
+enum lanes_status lanes_lane_status(const struct lanes *l, uint32_t lane)
+{
+    return l->lanes[lane].status;
+}
+
+uint64_t lanes_lane_cycles(const struct lanes *l, uint32_t lane)
+{
+    return l->lanes[lane].cycles;
+}
+
+uint64_t lanes_frames(const struct lanes *l)
+{
+    return l->frames;
+}
+
+void lanes_export(const struct lanes *l, uint32_t lane, chip8_ctx *ctx)
+{
+    struct emulator *em = &ctx->em;
+    const struct lane *from = &l->lanes[lane];
+
+    for (uint32_t addr = 0; addr < LANES_MEMORY_SIZE; addr++) {
+        em->memory[addr] = lanes_mem(l, addr)[lane];
+    }
+    memset(&em->memory[LANES_MEMORY_SIZE], 0, MEMORY_SIZE - LANES_MEMORY_SIZE);
+
+    for (uint32_t reg = 0; reg < NUM_REGS; reg++) {
+        em->V[reg] = lanes_v(l, reg)[lane];
+    }
+
+    memcpy(em->stack, from->stack, sizeof(em->stack));
+    memcpy(ctx->key_hold, from->key_hold, sizeof(ctx->key_hold));
+    memcpy(&em->key_presses, &from->key_presses, sizeof(em->key_presses));
+
+    em->PC     = l->PC[lane];
+    em->opcode = l->opcode[lane];
+    em->I      = l->I[lane];
+    em->delay  = l->delay[lane];
+    em->sound  = l->sound[lane];
+    em->SP     = from->SP;
+    em->keypad = from->keypad;
+
+    em->draw_flag          = false;
+    em->emulation_end_flag = from->status == LANES_ENDED;
+    em->single_step_flag   = false;
+
+    ctx->rng_state = from->rng_state;
+
+    memset(ctx->gfx.screen, 0, sizeof(ctx->gfx.screen));
+    for (uint32_t row = 0; row < ROW_COUNT; row++) {
+        ctx->gfx.screen[0][row][0] = l->screen[row * l->width + lane];
+    }
+    ctx->gfx.hires  = false;
+    ctx->gfx.planes = 1;
+
+    ops_invalidate_code(ctx, 0, MEMORY_SIZE);
+}
+
+static uint16_t lowest_pc_scalar(const struct lanes *l)
+{
+    uint16_t pc = LANES_NO_PC;
+
+    for (uint32_t i = 0; i < l->width; i++) {
+        if (l->run[i] && l->PC[i] < pc) {
+            pc = l->PC[i];
+        }
+    }
+
+    return pc;
+}
+
+static void select_scalar(struct lanes *l, uint16_t pc, uint16_t opcode)
+{
+    const uint8_t *high = lanes_mem(l, pc);
+    const uint8_t *low = lanes_mem(l, pc + 1);
+
+    for (uint32_t i = 0; i < l->width; i++) {
+        l->mask[i] = l->run[i] && l->PC[i] == pc && high[i] == opcode >> 8 &&
+                     low[i] == (opcode & 0xFF) ? 0xFF : 0;
+    }
+}
+
+static void set_scalar(struct lanes *l, uint8_t *row, uint8_t value)
+{
+    for (uint32_t i = 0; i < l->width; i++) {
+        if (l->mask[i]) {
+            row[i] = value;
+        }
+    }
+}
+
+static void add_scalar(struct lanes *l, uint8_t *row, uint8_t value)
+{
+    for (uint32_t i = 0; i < l->width; i++) {
+        if (l->mask[i]) {
+            row[i] += value;
+        }
+    }
+}
+
+static void copy_scalar(struct lanes *l, uint8_t *dst, const uint8_t *src)
+{
+    for (uint32_t i = 0; i < l->width; i++) {
+        if (l->mask[i]) {
+            dst[i] = src[i];
+        }
+    }
+}
+
+static void arith_scalar(struct lanes *l, uint8_t x, uint8_t y, uint8_t op)
+{
+    uint8_t *vx = lanes_v(l, x);
+    const uint8_t *vy = lanes_v(l, y);
+    uint8_t *vf = lanes_v(l, 0xF);
+
+    for (uint32_t i = 0; i < l->width; i++) {
+        if (!l->mask[i]) {
+            continue;
+        }
+
+        uint8_t a = vx[i];
+        uint8_t b = vy[i];
+        uint8_t flag = 0;
+
+        switch (op) {
+            case 0x1:
+                vx[i] = a | b;
+                continue;
+            case 0x2:
+                vx[i] = a & b;
+                continue;
+            case 0x3:
+                vx[i] = a ^ b;
+                continue;
+            case 0x4:
+                flag = a + b > 0xFF;
+                vx[i] = a + b;
+                break;
+            case 0x5:
+                flag = a >= b;
+                vx[i] = a - b;
+                break;
+            default:
+                flag = b >= a;
+                vx[i] = b - a;
+                break;
+        }
+
+        vf[i] = flag;
+    }
+}
+
+static void shift_scalar(struct lanes *l, uint8_t x, uint8_t src, bool left)
+{
+    uint8_t *vx = lanes_v(l, x);
+    const uint8_t *vs = lanes_v(l, src);
+    uint8_t *vf = lanes_v(l, 0xF);
+
+    for (uint32_t i = 0; i < l->width; i++) {
+        if (l->mask[i]) {
+            vf[i] = left ? vs[i] >> 7 : vs[i] & 0x01;
+            vx[i] = left ? vs[i] << 1 : vs[i] >> 1;
+        }
+    }
+}
+
+static void skip_scalar(struct lanes *l, const uint8_t *a, const uint8_t *b,
+                        uint8_t nn, bool equal, uint16_t pc)
+{
+    for (uint32_t i = 0; i < l->width; i++) {
+        if (l->mask[i]) {
+            bool taken = (a[i] == (b != NULL ? b[i] : nn)) == equal;
+
+            l->PC[i] = taken ? pc + 4 : pc + 2;
+        }
+    }
+}
+
+static void set_wide_scalar(struct lanes *l, uint16_t *row, uint16_t value)
+{
+    for (uint32_t i = 0; i < l->width; i++) {
+        if (l->mask[i]) {
+            row[i] = value;
+        }
+    }
+}
+
+static void add_wide_scalar(struct lanes *l, uint16_t *row, const uint8_t *src)
+{
+    for (uint32_t i = 0; i < l->width; i++) {
+        if (l->mask[i]) {
+            row[i] += src[i];
+        }
+    }
+}
+
+static void retire_scalar(struct lanes *l, uint16_t opcode, uint16_t next_pc)
+{
+    for (uint32_t i = 0; i < l->width; i++) {
+        if (!l->mask[i]) {
+            continue;
+        }
+
+        l->opcode[i] = opcode;
+
+        if (next_pc != LANES_NO_PC) {
+            l->PC[i] = next_pc;
+        }
+
+        if (--l->left[i] == 0) {
+            l->run[i] = 0;
+        }
+    }
+}
+
+static void tick_scalar(struct lanes *l)
+{
+    for (uint32_t i = 0; i < l->width; i++) {
+        if (!l->live[i]) {
+            continue;
+        }
+
+        if (l->delay[i] > 0) {
+            l->delay[i]--;
+        }
+
+        if (l->sound[i] > 0) {
+            l->sound[i]--;
+        }
+    }
+}
+
+static void *alloc_rows(size_t size)
+{
+    // aligned_alloc() wants a multiple of the alignment
+    size_t padded = (size + LANES_ALIGN - 1) / LANES_ALIGN * LANES_ALIGN;
+    void *rows = aligned_alloc(LANES_ALIGN, padded);
+
+    if (rows != NULL) {
+        memset(rows, 0, padded);
+    }
+
+    return rows;
+}
+
+// Runs slice instructions on every live lane, fewer on those that end or
+// fault. Each step takes the lowest PC any running lane is at and runs the
+// instruction there on every lane it's also next for.
+static void run_slice(struct lanes *l, uint32_t slice)
+{
+    l->slice = slice;
+
+    memcpy(l->run, l->live, l->width);
+    for (uint32_t i = 0; i < l->width; i++) {
+        l->left[i] = l->live[i] ? slice : 0;
+    }
+
+    for (;;) {
+        uint16_t pc = l->kernels->lowest_pc(l);
+
+        if (pc == LANES_NO_PC) {
+            break;
+        }
+
+        // First lane there supplies the instruction. Self-modifying code
+        // can leave others with something else at pc, select() leaves them
+        // for a later step, where one of them goes first.
+        uint32_t first = 0;
+
+        while (!l->run[first] || l->PC[first] != pc) {
+            first++;
+        }
+
+        if (pc >= LANES_MEMORY_SIZE - 1) {
+            memset(l->mask, 0, l->width);
+            l->mask[first] = 0xFF;
+            fault_selected(l);
+            continue;
+        }
+
+        uint16_t opcode = lanes_mem(l, pc)[first] << 8 | lanes_mem(l, pc + 1)[first];
+
+        l->kernels->select(l, pc, opcode);
+        execute(l, pc, opcode);
+    }
+
+    for (uint32_t i = 0; i < l->count; i++) {
+        if (l->live[i]) {
+            l->lanes[i].cycles += slice;
+        }
+    }
+    l->executed += (uint64_t)l->live_count * slice;
+}
+
+// The selected lanes all run opcode at pc, same as process_leading_X() does
+static void execute(struct lanes *l, uint16_t pc, uint16_t opcode)
+{
+    const struct lanes_kernels *k = l->kernels;
+    const struct chip8_quirks *quirks = &chip8_quirks[l->quirks];
+
+    uint8_t x  = (opcode & 0x0F00) >> 8;
+    uint8_t y  = (opcode & 0x00F0) >> 4;
+    uint8_t n  =  opcode & 0x000F;
+    uint8_t nn =  opcode & 0x00FF;
+    uint16_t next = pc + 2;
+
+    switch (opcode & 0xF000) {
+        case 0x1000:
+            next = opcode & 0x0FFF;
+            break;
+        case 0x3000:
+        case 0x4000:
+            k->skip(l, lanes_v(l, x), NULL, nn, (opcode & 0xF000) == 0x3000, pc);
+            next = LANES_NO_PC;
+            break;
+        case 0x5000:
+        case 0x9000:
+            if (n != 0) {
+                fault_selected(l);
+                return;
+            }
+            k->skip(l, lanes_v(l, x), lanes_v(l, y), 0, (opcode & 0xF000) == 0x5000, pc);
+            next = LANES_NO_PC;
+            break;
+        case 0x6000:
+            k->set(l, lanes_v(l, x), nn);
+            break;
+        case 0x7000:
+            k->add(l, lanes_v(l, x), nn);
+            break;
+        case 0x8000:
+            switch (n) {
+                case 0x0:
+                    k->copy(l, lanes_v(l, x), lanes_v(l, y));
+                    break;
+                case 0x1:
+                case 0x2:
+                case 0x3:
+                    k->arith(l, x, y, n);
+                    if (quirks->vf_reset) {
+                        k->set(l, lanes_v(l, 0xF), 0);
+                    }
+                    break;
+                case 0x4:
+                case 0x5:
+                case 0x7:
+                    k->arith(l, x, y, n);
+                    break;
+                case 0x6:
+                case 0xE:
+                    k->shift(l, x, quirks->shift_vx ? x : y, n == 0xE);
+                    break;
+                default:
+                    fault_selected(l);
+                    return;
+            }
+            break;
+        case 0xA000:
+            k->set_wide(l, l->I, opcode & 0x0FFF);
+            break;
+        case 0xF000:
+            switch (nn) {
+                case 0x07:
+                    k->copy(l, lanes_v(l, x), l->delay);
+                    break;
+                case 0x0A:
+                    wait_keys(l, x, opcode);
+                    return;
+                case 0x15:
+                    k->copy(l, l->delay, lanes_v(l, x));
+                    break;
+                case 0x18:
+                    k->copy(l, l->sound, lanes_v(l, x));
+                    break;
+                case 0x1E:
+                    k->add_wide(l, l->I, lanes_v(l, x));
+                    break;
+                default:
+                    step_lanes(l, pc, opcode);
+                    next = LANES_NO_PC;
+                    break;
+            }
+            break;
+        default:
+            // Calls, draws, CXNN and the like go a lane at a time
+            step_lanes(l, pc, opcode);
+            next = LANES_NO_PC;
+            break;
+    }
+
+    k->retire(l, opcode, next);
+}
+
+static void step_lanes(struct lanes *l, uint16_t pc, uint16_t opcode)
+{
+    for (uint32_t i = 0; i < l->count; i++) {
+        if (l->mask[i] && !step_lane(l, i, pc, opcode)) {
+            stop_lane(l, i, LANES_FAULT);
+        }
+    }
+}
+
+// One lane's share of an instruction the kernels don't cover, PC included.
+// False if it needs more than a lane has.
+static bool step_lane(struct lanes *l, uint32_t i, uint16_t pc, uint16_t opcode)
+{
+    struct lane *lane = &l->lanes[i];
+    const struct chip8_quirks *quirks = &chip8_quirks[l->quirks];
+
+    uint8_t x  = (opcode & 0x0F00) >> 8;
+    uint8_t y  = (opcode & 0x00F0) >> 4;
+    uint8_t nn =  opcode & 0x00FF;
+    uint16_t nnn = opcode & 0x0FFF;
+    uint8_t *vx = &lanes_v(l, x)[i];
+    uint16_t I = l->I[i];
+
+    switch (opcode & 0xF000) {
+        case 0x0000:
+            if (opcode == 0x00E0) {
+                for (uint32_t row = 0; row < ROW_COUNT; row++) {
+                    l->screen[row * l->width + i] = 0;
+                }
+                l->PC[i] = pc + 2;
+                return true;
+            }
+
+            if (opcode != 0x00EE) {
+                return false;
+            }
+
+            // Same ring as the scalar engines, see OPS_STACK_MASK
+            lane->SP = (lane->SP - 1) & OPS_STACK_MASK;
+            l->PC[i] = lane->stack[lane->SP];
+            return true;
+        case 0x2000:
+            lane->stack[lane->SP & OPS_STACK_MASK] = pc + 2;
+            lane->SP = (lane->SP + 1) & OPS_STACK_MASK;
+            l->PC[i] = nnn;
+            return true;
+        case 0xB000:
+            l->PC[i] = lanes_v(l, quirks->jump_vx ? x : 0)[i] + nnn;
+            return true;
+        case 0xC000:
+            *vx = util_random_byte(&lane->rng_state) & nn;
+            l->PC[i] = pc + 2;
+            return true;
+        case 0xD000:
+            if (!draw_lane(l, i, x, y, opcode & 0x000F)) {
+                return false;
+            }
+            l->PC[i] = pc + 2;
+            return true;
+        case 0xE000:
+            if (nn != 0x9E && nn != 0xA1) {
+                return false;
+            }
+
+            bool held = lane->keypad & (1 << (*vx & 0x0F));
+
+            l->PC[i] = held == (nn == 0x9E) ? pc + 4 : pc + 2;
+            return true;
+        case 0xF000:
+            break;
+        default:
+            return false;
+    }
+
+    switch (nn) {
+        case 0x29:
+            // Out of range digits land I where any use of it faults, the
+            // scalar engines complain and carry on
+            l->I[i] = *vx < 0x10 ? *vx * 5 : (uint16_t)-1;
+            break;
+        case 0x33:
+            if (I + 3 > LANES_MEMORY_SIZE) {
+                return false;
+            }
+            lanes_mem(l, I)[i]     = *vx / 100;
+            lanes_mem(l, I + 1)[i] = *vx / 10 % 10;
+            lanes_mem(l, I + 2)[i] = *vx % 10;
+            break;
+        case 0x55:
+        case 0x65:
+            if (I + x + 1 > LANES_MEMORY_SIZE) {
+                return false;
+            }
+
+            for (uint8_t reg = 0; reg <= x; reg++) {
+                uint8_t *mem = &lanes_mem(l, I + reg)[i];
+                uint8_t *v = &lanes_v(l, reg)[i];
+
+                if (nn == 0x55) {
+                    *mem = *v;
+                } else {
+                    *v = *mem;
+                }
+            }
+
+            l->I[i] += CHIP8_I_INC_AMOUNT(quirks->i_inc, x);
+            break;
+        default:
+            return false;
+    }
+
+    l->PC[i] = pc + 2;
+    return true;
+}
+
+// FX0A a lane at a time, bookkeeping included since a suspended lane is done
+// with its slice
+static void wait_keys(struct lanes *l, uint8_t x, uint16_t opcode)
+{
+    for (uint32_t i = 0; i < l->count; i++) {
+        if (!l->mask[i]) {
+            continue;
+        }
+
+        uint8_t key;
+
+        l->opcode[i] = opcode;
+        l->left[i]--;
+
+        switch (next_key(&l->lanes[i], &key)) {
+            case KEY_READY:
+                lanes_v(l, x)[i] = key;
+                l->PC[i] += 2;
+                if (l->left[i] == 0) {
+                    l->run[i] = 0;
+                }
+                break;
+            case KEY_SUSPEND:
+                // The rest of the slice waits, as chip8_emulate_cycles() does
+                l->left[i] = 0;
+                l->run[i] = 0;
+                break;
+            case KEY_END:
+                lanes_v(l, x)[i] = (uint8_t)-1;
+                l->PC[i] += 2;
+                stop_lane(l, i, LANES_ENDED);
+                break;
+        }
+    }
+}
+
+// ops_next_hex_key() on the null backend
+static enum key_result next_key(struct lane *lane, uint8_t *key)
+{
+    if (util_key_ring_pop(&lane->key_presses, key)) {
+        return KEY_READY;
+    }
+
+    struct input_log *log = lane->input_log;
+
+    if (log != NULL && input_log_replaying(log)) {
+        if (input_log_next_wait_key(log, key)) {
+            return KEY_READY;
+        }
+
+        if (!input_log_at_end(log) || input_log_end_cycles(log) != 0) {
+            return KEY_SUSPEND;
+        }
+    }
+
+    return KEY_END;
+}
+
+// graphics_draw_sprite() in lo-res on the first plane
+static bool draw_lane(struct lanes *l, uint32_t i, uint8_t x, uint8_t y,
+                      uint8_t height)
+{
+    const struct chip8_quirks *quirks = &chip8_quirks[l->quirks];
+    uint16_t I = l->I[i];
+
+    if (I + height > LANES_MEMORY_SIZE) {
+        return false;
+    }
+
+    uint8_t row = util_constrain(lanes_v(l, y)[i], ROW_COUNT);
+    uint8_t col = util_constrain(lanes_v(l, x)[i], COL_COUNT);
+    graphics_row_t collisions = 0;
+
+    for (uint8_t r = 0; r < height; r++) {
+        if (row + r >= ROW_COUNT && quirks->clip) {
+            break;
+        }
+
+        graphics_row_t *line = &l->screen[(row + r) % ROW_COUNT * l->width + i];
+        graphics_row_t first = (graphics_row_t)lanes_mem(l, I + r)[i] << 56;
+        graphics_row_t bits = quirks->clip ? first >> col :
+                              (first >> col) | (first << ((COL_COUNT - col) % COL_COUNT));
+
+        collisions |= *line & bits;
+        *line ^= bits;
+    }
+
+    lanes_v(l, 0xF)[i] = collisions != 0;
+
+    return true;
+}
+
+// Takes a lane out for good. It's run what it was given of the slice minus
+// what's left, an instruction that faulted not counting.
+static void stop_lane(struct lanes *l, uint32_t i, enum lanes_status status)
+{
+    uint32_t ran = l->slice - l->left[i];
+
+    l->lanes[i].status = status;
+    l->lanes[i].cycles += ran;
+    l->executed += ran;
+
+    l->live[i] = 0;
+    l->run[i] = 0;
+    l->mask[i] = 0;
+    l->live_count--;
+}
+
+static void fault_selected(struct lanes *l)
+{
+    for (uint32_t i = 0; i < l->count; i++) {
+        if (l->mask[i]) {
+            stop_lane(l, i, LANES_FAULT);
+        }
+    }
+}
+
+// sched_end_frame() on every live lane
+static void end_frame(struct lanes *l)
+{
+    l->kernels->tick(l);
+
+    // Without a log and nothing held, polling the null backend does nothing
+    for (uint32_t i = 0; i < l->count; i++) {
+        if (l->live[i] && (l->lanes[i].input_log != NULL || l->lanes[i].keypad != 0)) {
+            poll_lane(l, i);
+        }
+    }
+
+    l->frame_cycles = 0;
+    l->frames++;
+}
+
+// chip8_poll_input() with nothing pressed live
+static void poll_lane(struct lanes *l, uint32_t i)
+{
+    struct lane *lane = &l->lanes[i];
+    uint16_t pressed = 0;
+
+    if (lane->input_log != NULL) {
+        pressed = input_log_frame_keys(lane->input_log, pressed);
+    }
+
+    for (uint8_t key = 0; key < NUM_KEYS; key++) {
+        uint16_t bit = 1 << key;
+
+        if (pressed & bit) {
+            lane->keypad |= bit;
+            lane->key_hold[key] = KEY_HOLD_FRAMES;
+
+            util_key_ring_push(&lane->key_presses, key);
+        } else if (lane->key_hold[key] > 0 && --lane->key_hold[key] == 0) {
+            lane->keypad &= ~bit;
+        }
+    }
+}
@@ -0,0 +1,81 @@
+#ifndef CHIP8_LANES_H
+#define CHIP8_LANES_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "chip8_emulator.h"
+
+// Many instances of one plain CHIP-8 program in lockstep, for sweeps over
+// seeds or input logs. State is kept as struct-of-arrays, one row of every
+// register across all instances (lanes), and each step runs one instruction
+// on every lane whose PC is the lowest still pending, with SIMD where the
+// instruction allows. Lanes that branch elsewhere are masked off until the
+// lowest PC is theirs again, which is usually where the others come back to.
+//
+// Results are the same as running each lane through chip8_emulate_cycles()
+// and sched_end_frame() headless, see lanes_export(). Only 4 KB of memory,
+// so a lane that reads or writes past that, overflows its stack or hits
+// anything CHIP-8 doesn't have faults and stops instead.
+
+// SoA rows are padded to this many lanes, one AVX2 register of bytes
+#define LANES_ALIGN 32
+
+#define LANES_MEMORY_SIZE 4096
+
+// Widest first, lanes_best_isa() picks the widest the CPU has
+enum lanes_isa {
+    LANES_ISA_AVX2,
+    LANES_ISA_SSE2,
+    LANES_ISA_SCALAR,
+    LANES_ISA_COUNT
+};
+
+enum lanes_status {
+    LANES_RUNNING,
+    LANES_ENDED,                // FX0A ran out of input
+    LANES_FAULT,                // did something only a scalar engine can
+};
+
+struct input_log;
+struct lanes;
+
+// count copies of image, which has its ROM loaded in CHIP-8 mode. Every lane
+// starts with its registers, memory, screen and seed. NULL if image isn't
+// plain CHIP-8 or the ISA isn't available.
+struct lanes *lanes_create(const chip8_ctx *image, uint32_t count,
+                           uint32_t ipf, enum lanes_isa isa);
+void lanes_destroy(struct lanes *lanes);
+
+enum lanes_isa lanes_best_isa(void);
+bool lanes_isa_supported(enum lanes_isa isa);
+const char *lanes_isa_name(enum lanes_isa isa);
+
+// Engine names as the frontends take them: "lanes" for the best ISA there
+// is, "lanes-sse2" etc. for one in particular. False for anything else.
+bool lanes_isa_parse(const char *name, enum lanes_isa *isa);
+
+// Same as chip8_seed_random() on the lane
+void lanes_seed_random(struct lanes *lanes, uint32_t lane, uint32_t seed);
+
+// Replays log on the lane, which must have been opened for it alone. Not
+// owned.
+void lanes_set_input_log(struct lanes *lanes, uint32_t lane,
+                         struct input_log *log);
+
+// Runs every lane cycles more instructions, ending frames every ipf of them.
+// Returns how many ran across all lanes.
+uint64_t lanes_run(struct lanes *lanes, uint64_t cycles);
+
+enum lanes_status lanes_lane_status(const struct lanes *lanes, uint32_t lane);
+
+// Instructions the lane has run
+uint64_t lanes_lane_cycles(const struct lanes *lanes, uint32_t lane);
+
+uint64_t lanes_frames(const struct lanes *lanes);
+
+// Writes the lane's machine into ctx, which must be in CHIP-8 mode, as
+// if it had run there all along
+void lanes_export(const struct lanes *lanes, uint32_t lane, chip8_ctx *ctx);
+
+#endif
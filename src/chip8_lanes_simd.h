@@ -0,0 +1,271 @@
+// SIMD kernels of chip8_lanes.c, included once per instruction set with
+// LANES_ISA set to its name and VEC_* defined as its intrinsics. VEC_W lanes
+// of bytes make one register, rows of uint16_t take two. Masks are 0xFF /
+// 0xFFFF per lane, so selecting is and / andnot / or.
+
+#define LANES_CAT3_(a, b, c) a##b##c
+#define LANES_CAT3(a, b, c)  LANES_CAT3_(a, b, c)
+#define LANES_FN(name)       LANES_CAT3(name, _, LANES_ISA)
+#define LANES_KERNELS        LANES_CAT3(lanes_kernels, _, LANES_ISA)
+
+// mask ? a : b
+#define VEC_BLEND(mask, a, b) VEC_OR(VEC_AND(mask, a), VEC_ANDNOT(mask, b))
+
+static uint16_t LANES_FN(lowest_pc)(const struct lanes *l)
+{
+    VEC_T none = VEC_SET16(LANES_NO_PC);
+    VEC_T lowest = none;
+
+    // PCs stay below 0x8000, a signed minimum does
+    for (uint32_t i = 0; i < l->width; i += VEC_W) {
+        VEC_T run = VEC_LOAD(&l->run[i]);
+
+        lowest = VEC_MIN_I16(lowest, VEC_BLEND(VEC_WIDEN_LO(run), VEC_LOAD(&l->PC[i]), none));
+        lowest = VEC_MIN_I16(lowest, VEC_BLEND(VEC_WIDEN_HI(run), VEC_LOAD(&l->PC[i + VEC_W / 2]), none));
+    }
+
+    uint16_t pcs[VEC_W / 2];
+    uint16_t pc = LANES_NO_PC;
+
+    VEC_STORE(pcs, lowest);
+    for (int i = 0; i < VEC_W / 2; i++) {
+        pc = pcs[i] < pc ? pcs[i] : pc;
+    }
+
+    return pc;
+}
+
+static void LANES_FN(select)(struct lanes *l, uint16_t pc, uint16_t opcode)
+{
+    const uint8_t *high = &l->memory[pc * l->width];
+    const uint8_t *low = &l->memory[(pc + 1) * l->width];
+    VEC_T at = VEC_SET16(pc);
+    VEC_T high_byte = VEC_SET8(opcode >> 8);
+    VEC_T low_byte = VEC_SET8(opcode & 0xFF);
+
+    for (uint32_t i = 0; i < l->width; i += VEC_W) {
+        VEC_T here = VEC_NARROW(VEC_EQ16(VEC_LOAD(&l->PC[i]), at),
+                                VEC_EQ16(VEC_LOAD(&l->PC[i + VEC_W / 2]), at));
+        VEC_T same = VEC_AND(VEC_EQ8(VEC_LOAD(&high[i]), high_byte),
+                             VEC_EQ8(VEC_LOAD(&low[i]), low_byte));
+
+        VEC_STORE(&l->mask[i], VEC_AND(VEC_AND(here, same), VEC_LOAD(&l->run[i])));
+    }
+}
+
+static void LANES_FN(set)(struct lanes *l, uint8_t *row, uint8_t value)
+{
+    VEC_T v = VEC_SET8(value);
+
+    for (uint32_t i = 0; i < l->width; i += VEC_W) {
+        VEC_STORE(&row[i], VEC_BLEND(VEC_LOAD(&l->mask[i]), v, VEC_LOAD(&row[i])));
+    }
+}
+
+static void LANES_FN(add)(struct lanes *l, uint8_t *row, uint8_t value)
+{
+    VEC_T v = VEC_SET8(value);
+
+    for (uint32_t i = 0; i < l->width; i += VEC_W) {
+        VEC_T old = VEC_LOAD(&row[i]);
+
+        VEC_STORE(&row[i], VEC_BLEND(VEC_LOAD(&l->mask[i]), VEC_ADD8(old, v), old));
+    }
+}
+
+static void LANES_FN(copy)(struct lanes *l, uint8_t *dst, const uint8_t *src)
+{
+    for (uint32_t i = 0; i < l->width; i += VEC_W) {
+        VEC_STORE(&dst[i], VEC_BLEND(VEC_LOAD(&l->mask[i]), VEC_LOAD(&src[i]),
+                                     VEC_LOAD(&dst[i])));
+    }
+}
+
+static void LANES_FN(arith)(struct lanes *l, uint8_t x, uint8_t y, uint8_t op)
+{
+    uint8_t *vx = lanes_v(l, x);
+    const uint8_t *vy = lanes_v(l, y);
+    uint8_t *vf = lanes_v(l, 0xF);
+    VEC_T one = VEC_SET8(1);
+
+    for (uint32_t i = 0; i < l->width; i += VEC_W) {
+        VEC_T mask = VEC_LOAD(&l->mask[i]);
+        VEC_T a = VEC_LOAD(&vx[i]);
+        VEC_T b = VEC_LOAD(&vy[i]);
+        VEC_T result;
+        VEC_T flag = one;
+
+        switch (op) {
+            case 0x1:
+                result = VEC_OR(a, b);
+                break;
+            case 0x2:
+                result = VEC_AND(a, b);
+                break;
+            case 0x3:
+                result = VEC_XOR(a, b);
+                break;
+            case 0x4:
+                // Carried out if saturating gives something else
+                result = VEC_ADD8(a, b);
+                flag = VEC_ANDNOT(VEC_EQ8(VEC_ADDS_U8(a, b), result), one);
+                break;
+            case 0x5:
+                result = VEC_SUB8(a, b);
+                flag = VEC_AND(VEC_EQ8(VEC_MAX_U8(a, b), a), one);
+                break;
+            default:
+                result = VEC_SUB8(b, a);
+                flag = VEC_AND(VEC_EQ8(VEC_MAX_U8(a, b), b), one);
+                break;
+        }
+
+        // VX first, VF last, so 8FYN leaves the flag in VF
+        VEC_STORE(&vx[i], VEC_BLEND(mask, result, a));
+
+        if (op >= 0x4) {
+            VEC_STORE(&vf[i], VEC_BLEND(mask, flag, VEC_LOAD(&vf[i])));
+        }
+    }
+}
+
+static void LANES_FN(shift)(struct lanes *l, uint8_t x, uint8_t src, bool left)
+{
+    uint8_t *vx = lanes_v(l, x);
+    const uint8_t *vs = lanes_v(l, src);
+    uint8_t *vf = lanes_v(l, 0xF);
+    VEC_T one = VEC_SET8(1);
+
+    for (uint32_t i = 0; i < l->width; i += VEC_W) {
+        VEC_T mask = VEC_LOAD(&l->mask[i]);
+        VEC_T s = VEC_LOAD(&vs[i]);
+
+        // No byte shifts, 16 bit ones and the bits from the neighbour masked
+        // off. VF goes first and the source is read again, like the reference.
+        VEC_T flag = left ? VEC_AND(VEC_SRL16(s, 7), one) : VEC_AND(s, one);
+
+        VEC_STORE(&vf[i], VEC_BLEND(mask, flag, VEC_LOAD(&vf[i])));
+
+        s = VEC_LOAD(&vs[i]);
+
+        VEC_T result = left ? VEC_ADD8(s, s) : VEC_AND(VEC_SRL16(s, 1), VEC_SET8(0x7F));
+
+        VEC_STORE(&vx[i], VEC_BLEND(mask, result, VEC_LOAD(&vx[i])));
+    }
+}
+
+static void LANES_FN(skip)(struct lanes *l, const uint8_t *a, const uint8_t *b,
+                           uint8_t nn, bool equal, uint16_t pc)
+{
+    VEC_T imm = VEC_SET8(nn);
+    VEC_T flip = equal ? VEC_SET8(0) : VEC_SET8(0xFF);
+    VEC_T taken_pc = VEC_SET16(pc + 4);
+    VEC_T next_pc = VEC_SET16(pc + 2);
+
+    for (uint32_t i = 0; i < l->width; i += VEC_W) {
+        VEC_T mask = VEC_LOAD(&l->mask[i]);
+        VEC_T taken = VEC_XOR(VEC_EQ8(VEC_LOAD(&a[i]), b != NULL ? VEC_LOAD(&b[i]) : imm), flip);
+        VEC_T pc_lo = VEC_BLEND(VEC_WIDEN_LO(taken), taken_pc, next_pc);
+        VEC_T pc_hi = VEC_BLEND(VEC_WIDEN_HI(taken), taken_pc, next_pc);
+
+        VEC_STORE(&l->PC[i], VEC_BLEND(VEC_WIDEN_LO(mask), pc_lo, VEC_LOAD(&l->PC[i])));
+        VEC_STORE(&l->PC[i + VEC_W / 2],
+                  VEC_BLEND(VEC_WIDEN_HI(mask), pc_hi, VEC_LOAD(&l->PC[i + VEC_W / 2])));
+    }
+}
+
+static void LANES_FN(set_wide)(struct lanes *l, uint16_t *row, uint16_t value)
+{
+    VEC_T v = VEC_SET16(value);
+
+    for (uint32_t i = 0; i < l->width; i += VEC_W) {
+        VEC_T mask = VEC_LOAD(&l->mask[i]);
+
+        VEC_STORE(&row[i], VEC_BLEND(VEC_WIDEN_LO(mask), v, VEC_LOAD(&row[i])));
+        VEC_STORE(&row[i + VEC_W / 2],
+                  VEC_BLEND(VEC_WIDEN_HI(mask), v, VEC_LOAD(&row[i + VEC_W / 2])));
+    }
+}
+
+static void LANES_FN(add_wide)(struct lanes *l, uint16_t *row, const uint8_t *src)
+{
+    for (uint32_t i = 0; i < l->width; i += VEC_W) {
+        VEC_T mask = VEC_LOAD(&l->mask[i]);
+        VEC_T s = VEC_LOAD(&src[i]);
+        VEC_T lo = VEC_LOAD(&row[i]);
+        VEC_T hi = VEC_LOAD(&row[i + VEC_W / 2]);
+
+        VEC_STORE(&row[i], VEC_BLEND(VEC_WIDEN_LO(mask), VEC_ADD16(lo, VEC_ZEXT_LO(s)), lo));
+        VEC_STORE(&row[i + VEC_W / 2],
+                  VEC_BLEND(VEC_WIDEN_HI(mask), VEC_ADD16(hi, VEC_ZEXT_HI(s)), hi));
+    }
+}
+
+static void LANES_FN(retire)(struct lanes *l, uint16_t opcode, uint16_t next_pc)
+{
+    VEC_T op = VEC_SET16(opcode);
+    VEC_T pc = VEC_SET16(next_pc);
+    VEC_T zero = VEC_SET16(0);
+
+    for (uint32_t i = 0; i < l->width; i += VEC_W) {
+        VEC_T mask = VEC_LOAD(&l->mask[i]);
+        VEC_T mask_lo = VEC_WIDEN_LO(mask);
+        VEC_T mask_hi = VEC_WIDEN_HI(mask);
+        uint32_t j = i + VEC_W / 2;
+
+        VEC_STORE(&l->opcode[i], VEC_BLEND(mask_lo, op, VEC_LOAD(&l->opcode[i])));
+        VEC_STORE(&l->opcode[j], VEC_BLEND(mask_hi, op, VEC_LOAD(&l->opcode[j])));
+
+        if (next_pc != LANES_NO_PC) {
+            VEC_STORE(&l->PC[i], VEC_BLEND(mask_lo, pc, VEC_LOAD(&l->PC[i])));
+            VEC_STORE(&l->PC[j], VEC_BLEND(mask_hi, pc, VEC_LOAD(&l->PC[j])));
+        }
+
+        // Adding the all-ones mask takes one off
+        VEC_T left_lo = VEC_ADD16(VEC_LOAD(&l->left[i]), mask_lo);
+        VEC_T left_hi = VEC_ADD16(VEC_LOAD(&l->left[j]), mask_hi);
+
+        VEC_STORE(&l->left[i], left_lo);
+        VEC_STORE(&l->left[j], left_hi);
+
+        VEC_T done = VEC_NARROW(VEC_EQ16(left_lo, zero), VEC_EQ16(left_hi, zero));
+
+        VEC_STORE(&l->run[i], VEC_ANDNOT(done, VEC_LOAD(&l->run[i])));
+    }
+}
+
+static void LANES_FN(tick)(struct lanes *l)
+{
+    VEC_T one = VEC_SET8(1);
+
+    for (uint32_t i = 0; i < l->width; i += VEC_W) {
+        VEC_T live = VEC_LOAD(&l->live[i]);
+        VEC_T delay = VEC_LOAD(&l->delay[i]);
+        VEC_T sound = VEC_LOAD(&l->sound[i]);
+
+        // Saturating, so a timer at 0 stays there
+        VEC_STORE(&l->delay[i], VEC_BLEND(live, VEC_SUBS_U8(delay, one), delay));
+        VEC_STORE(&l->sound[i], VEC_BLEND(live, VEC_SUBS_U8(sound, one), sound));
+    }
+}
+
+static const struct lanes_kernels LANES_KERNELS = {
+    .lowest_pc = LANES_FN(lowest_pc),
+    .select    = LANES_FN(select),
+    .set       = LANES_FN(set),
+    .add       = LANES_FN(add),
+    .copy      = LANES_FN(copy),
+    .arith     = LANES_FN(arith),
+    .shift     = LANES_FN(shift),
+    .skip      = LANES_FN(skip),
+    .set_wide  = LANES_FN(set_wide),
+    .add_wide  = LANES_FN(add_wide),
+    .retire    = LANES_FN(retire),
+    .tick      = LANES_FN(tick),
+};
+
+#undef VEC_BLEND
+#undef LANES_KERNELS
+#undef LANES_FN
+#undef LANES_CAT3
+#undef LANES_CAT3_
@@ -1,57 +1,1012 @@
+#include <getopt.h>
+#include <inttypes.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
+#ifdef CHIP8_AOT
+#include "chip8_aot.h"
+#endif
+#include "chip8_backend.h"
 #include "chip8_emulator.h"
+#include "chip8_history.h"
+#include "chip8_input.h"
+#include "chip8_jit.h"
+#include "chip8_keys.h"
+#include "chip8_profile.h"
+#include "chip8_render.h"
+#include "chip8_rom.h"
+#include "chip8_sched.h"
+#include "chip8_trace.h"
 #include "chip8_util.h"
+#include "chip8_watch.h"
+
+// Where the save / load hotkeys put the state when --save-state isn't given
+#define DEFAULT_STATE_FILE "chip8.state"
+
+// Rewind history kept by default when someone is watching, in MB
+#define DEFAULT_REWIND_MB 4
+
+// How far back the rewind hotkey (b) goes while running, in frames
+#define REWIND_FRAMES SCHED_FRAME_RATE
+
+// How often --watch looks for a save when nothing wakes it, in frames.
+// Turbo runs through these in a few milliseconds.
+#define WATCH_POLL_FRAMES 256
+
+static void print_usage(const char *prog_name);
+static bool parse_engine(const char *name, enum chip8_engine *engine);
+static bool parse_mode(const char *name, enum chip8_mode *mode);
+static bool parse_display(const char *name, const struct chip8_backend **display);
+static bool write_profile(struct profile *profile, const char *filename);
+static bool apply_rom_index(const char *index_file, uint64_t rom_hash,
+                            const char *rom_name, bool remember,
+                            struct rom_settings *settings);
+static bool copy_image(const struct rom_image *image, struct rom_image *copy);
+static void reload_rom(chip8_ctx *ctx, const char *rom_name,
+                       struct rom_image *loaded, char *reload_error,
+                       size_t error_size);
+static void step_back(struct history *history, struct sched *sched,
+                      chip8_ctx *ctx, uint64_t *cycle);
+static void rewind_frames(struct history *history, struct sched *sched,
+                          chip8_ctx *ctx, uint32_t num_frames, uint64_t *cycle);
 
 int main(int argc, char *argv[])
 {
-    chip8_init();
-    util_get_char();
+    static const struct option long_options[] = {
+        { "headless",   no_argument,       NULL, 'H' },
+        { "display",    required_argument, NULL, 'd' },
+        { "cycles",     required_argument, NULL, 'c' },
+        { "engine",     required_argument, NULL, 'e' },
+        { "mode",       required_argument, NULL, 'm' },
+        { "flags",      required_argument, NULL, 'F' },
+        { "quirks",     required_argument, NULL, 'q' },
+        { "no-idle-skip", no_argument,     NULL, 'I' },
+        { "perf-map",   no_argument,       NULL, 'P' },
+        { "ipf",        required_argument, NULL, 'i' },
+        { "speed",      required_argument, NULL, 's' },
+        { "turbo",      no_argument,       NULL, 't' },
+        { "save-state", required_argument, NULL, 'o' },
+        { "load-state", required_argument, NULL, 'l' },
+        { "rewind-mb",  required_argument, NULL, 'r' },
+        { "seed",       required_argument, NULL, 'S' },
+        { "record",     required_argument, NULL, 'R' },
+        { "replay",     required_argument, NULL, 'p' },
+        { "profile",    required_argument, NULL, 'f' },
+        { "trace",      required_argument, NULL, 'T' },
+        { "compress",   no_argument,       NULL, 'z' },
+        { "index",      required_argument, NULL, 'x' },
+        { "keys",       required_argument, NULL, 'k' },
+        { "remember",   no_argument,       NULL, 'M' },
+        { "watch",      no_argument,       NULL, 'w' },
+        { "help",       no_argument,       NULL, 'h' },
+        { NULL,         0,                 NULL, 0   }
+    };
+
+    const struct chip8_backend *display = &chip8_backend_ncurses;
+    bool headless = false;
+    uint32_t max_cycles = 0;
+    uint32_t ipf = SCHED_DEFAULT_IPF;
+    bool ipf_given = false;
+    uint32_t speed = 1;
+    bool turbo = false;
+    const char *save_state = NULL;
+    const char *load_state = NULL;
+    int rewind_mb = -1;
+    uint32_t seed = CHIP8_DEFAULT_SEED;
+    const char *record = NULL;
+    const char *replay = NULL;
+    const char *profile_file = NULL;
+    const char *trace_file = NULL;
+    bool compress_trace = false;
+    const char *index_file = NULL;
+    const char *keys = NULL;
+    bool remember = false;
+    bool watch_rom = false;
+    const char *flags_file = NULL;
+    bool mode_given = false;
+    enum chip8_mode mode = CHIP8_MODE_CHIP8;
+    bool quirks_given = false;
+    bool idle_skip = true;
+    enum chip8_quirks_profile quirks = CHIP8_QUIRKS_VIP;
+#ifdef CHIP8_AOT
+    enum chip8_engine engine = CHIP8_ENGINE_AOT;
+#else
+    enum chip8_engine engine = CHIP8_ENGINE_CACHED;
+#endif
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "Hd:c:e:m:F:q:IPi:s:to:l:r:S:R:p:f:T:zx:k:Mwh", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'H':
+                headless = true;
+                break;
+            case 'd':
+                if (!parse_display(optarg, &display)) {
+                    printf("ERROR: Unknown display '%s'!\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'c':
+                max_cycles = strtoul(optarg, NULL, 0);
+                break;
+            case 'e':
+                if (!parse_engine(optarg, &engine)) {
+                    printf("ERROR: Unknown engine '%s'!\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'm':
+                if (!parse_mode(optarg, &mode)) {
+                    printf("ERROR: Unknown mode '%s'!\n", optarg);
+                    return -1;
+                }
+                mode_given = true;
+                break;
+            case 'F':
+                flags_file = optarg;
+                break;
+            case 'q':
+                if (!chip8_quirks_parse(optarg, &quirks)) {
+                    printf("ERROR: Unknown quirk profile '%s'!\n", optarg);
+                    return -1;
+                }
+                quirks_given = true;
+                break;
+            case 'I':
+                idle_skip = false;
+                break;
+            case 'P':
+                if (!jit_open_perf_map()) {
+                    printf("ERROR: Unable to create perf map file!\n");
+                    return -1;
+                }
+                break;
+            case 'i':
+                ipf = strtoul(optarg, NULL, 0);
+                ipf_given = true;
+                break;
+            case 's':
+                speed = strtoul(optarg, NULL, 0);
+                break;
+            case 't':
+                turbo = true;
+                break;
+            case 'o':
+                save_state = optarg;
+                break;
+            case 'l':
+                load_state = optarg;
+                break;
+            case 'r':
+                rewind_mb = strtol(optarg, NULL, 0);
+                break;
+            case 'S':
+                seed = strtoul(optarg, NULL, 0);
+                break;
+            case 'R':
+                record = optarg;
+                break;
+            case 'p':
+                replay = optarg;
+                break;
+            case 'f':
+                profile_file = optarg;
+                break;
+            case 'T':
+                trace_file = optarg;
+                break;
+            case 'z':
+                compress_trace = true;
+                break;
+            case 'x':
+                index_file = optarg;
+                break;
+            case 'k':
+                if (!rom_keys_valid(optarg)) {
+                    // A hotkey in the layout would make its action unreachable
+                    printf("ERROR: Key layout '%s' isn't 16 different keys, none of them "
+                           "a hotkey (" KEY_QUEUE_HOTKEYS ")!\n", optarg);
+                    return -1;
+                }
+                keys = optarg;
+                break;
+            case 'M':
+                remember = true;
+                break;
+            case 'w':
+                watch_rom = true;
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                return 0;
+            default:
+                print_usage(argv[0]);
+                return -1;
+        }
+    }
+
+    const struct chip8_backend *backend = headless ? &chip8_backend_null : display;
+
+    if (remember && index_file == NULL) {
+        printf("ERROR: --remember needs an --index to store settings in!\n");
+        return -1;
+    }
+
+#ifdef CHIP8_AOT
+    if (watch_rom) {
+        printf("ERROR: Compiled programs have no ROM file to --watch!\n");
+        return -1;
+    }
+#endif
+
+    // Logs belong to the one ROM their header hashes
+    if (watch_rom && (record != NULL || replay != NULL)) {
+        printf("ERROR: --watch can't record or replay input!\n");
+        return -1;
+    }
+
+    chip8_ctx *ctx = chip8_create(backend);
+    if (ctx == NULL) {
+        printf("ERROR: Unable to allocate emulator! Aborting...\n");
+        return -1;
+    }
+
+    // Splash screen waits for a key, but only if someone can press one
+    if (!headless) {
+        backend->get_char();
+    }
+
+    char log_summary[80] = "";
+    bool log_ok = true;
+    bool profile_ok = true;
+    bool trace_ok = true;
+    bool flags_ok = true;
+    uint64_t trace_dropped = 0;
+    uint64_t frames_skipped = 0;
+    char reload_error[128] = "";
+
+#ifdef CHIP8_AOT
+    // The ROM is built into this binary, a path on the command line is ignored
+    bool have_rom = true;
+#else
+    bool have_rom = optind < argc;
+#endif
+
+    if (have_rom) {
+        // With --watch, a copy of the bytes loaded: reloads only write what
+        // changed since
+        struct rom_image watched = { 0 };
+
+#ifdef CHIP8_AOT
+        if (!chip8_load_aot(ctx, &chip8_aot_program)) {
+            chip8_destroy(ctx);
+            printf("ERROR: Unable to allocate emulator! Aborting...\n");
+            return -1;
+        }
+
+        if (mode_given && !chip8_set_mode(ctx, mode)) {
+            chip8_destroy(ctx);
+            printf("ERROR: Compiled programs only run as plain CHIP-8!\n");
+            return -1;
+        }
+
+        const char *rom_name = chip8_aot_program.name;
+        uint64_t rom_hash = util_hash(chip8_aot_program.rom, chip8_aot_program.rom_size,
+                                      UTIL_HASH_SEED);
+#else
+        // The file extension decides unless told otherwise
+        chip8_set_mode(ctx, mode_given ? mode : chip8_mode_for_rom(argv[optind]));
+
+        const char *rom_name = argv[optind];
+        const struct rom_image *image;
+        struct asm_error asm_error;
+        enum rom_error error = rom_open(rom_name, &image, &asm_error);
+
+        if (error == ROM_OK) {
+            error = chip8_load_image(ctx, image);
+        }
+
+        if (error == ROM_OK && watch_rom && !copy_image(image, &watched)) {
+            error = ROM_ERROR_MEMORY;
+        }
+
+        if (error != ROM_OK) {
+            rom_release(image);
+            chip8_destroy(ctx);
+            if (error == ROM_ERROR_ASSEMBLE) {
+                printf("ERROR: Unable to assemble %s, line %" PRIu32 ": %s!\n",
+                       rom_name, asm_error.line, asm_error.message);
+            } else {
+                printf("ERROR: Unable to load %s: %s!\n", rom_name, rom_error_string(error));
+            }
+            return -1;
+        }
 
-    if (argc > 1) {
-        chip8_load(argv[1]);
+        uint64_t rom_hash = image->hash;
+
+        rom_release(image);
+#endif
+
+        // What the command line leaves open comes from the ROM's entry in
+        // the index
+        if (index_file != NULL) {
+            struct rom_settings settings = {
+                .has_quirks = quirks_given,
+                .quirks     = quirks,
+                .ipf        = ipf_given ? ipf : 0,
+            };
+
+            if (keys != NULL) {
+                memcpy(settings.keys, keys, sizeof(settings.keys));
+            }
+
+            if (!apply_rom_index(index_file, rom_hash, rom_name, remember, &settings)) {
+                free((void *)watched.data);
+                chip8_destroy(ctx);
+                printf("ERROR: Unable to read or update ROM index %s!\n", index_file);
+                return -1;
+            }
+
+#ifndef CHIP8_AOT
+            // Compiled programs keep the quirks they were built for
+            quirks_given = settings.has_quirks;
+            quirks       = settings.quirks;
+#endif
+            ipf = settings.ipf != 0 ? settings.ipf : ipf;
+
+            if (keys == NULL && settings.keys[0] != '\0') {
+                backend->set_keymap(settings.keys);
+            }
+        }
+
+        if (keys != NULL) {
+            backend->set_keymap(keys);
+        }
+
+        if (quirks_given && !chip8_set_quirks(ctx, quirks)) {
+            free((void *)watched.data);
+            chip8_destroy(ctx);
+            printf("ERROR: Compiled programs only run with the quirks they were built for!\n");
+            return -1;
+        }
+
+        if (!chip8_set_engine(ctx, engine)) {
+            free((void *)watched.data);
+            chip8_destroy(ctx);
+            printf("ERROR: Selected engine isn't available on this host!\n");
+            return -1;
+        }
+
+        // Identifies the program a recording belongs to
+        struct input_log_info log_info = {
+            .seed     = seed,
+            .ipf      = ipf,
+            .mode     = ctx->em.mode,
+            .quirks   = ctx->em.quirks,
+            .rom_hash = chip8_rom_hash(ctx),
+        };
+
+        struct input_log *input_log = NULL;
+
+        if (replay != NULL) {
+            input_log = input_log_replay(replay, &log_info);
+            if (input_log == NULL) {
+                free((void *)watched.data);
+                chip8_destroy(ctx);
+                printf("ERROR: Unable to read input log %s!\n", replay);
+                return -1;
+            }
+
+            // Replays run in the mode they were recorded in, which also
+            // decides how much of memory the ROM hash covers
+            if (log_info.mode > CHIP8_MODE_XOCHIP ||
+                !chip8_set_mode(ctx, log_info.mode) ||
+                log_info.rom_hash != chip8_rom_hash(ctx)) {
+                input_log_close(input_log, 0);
+                free((void *)watched.data);
+                chip8_destroy(ctx);
+                printf("ERROR: Input log %s was recorded with another ROM!\n", replay);
+                return -1;
+            }
+
+            if (!chip8_set_quirks(ctx, log_info.quirks)) {
+                input_log_close(input_log, 0);
+                free((void *)watched.data);
+                chip8_destroy(ctx);
+                printf("ERROR: Input log %s was recorded with other quirks!\n", replay);
+                return -1;
+            }
+
+            // Replays run exactly like the recording did
+            seed = log_info.seed;
+            ipf  = log_info.ipf;
+
+            uint64_t end = input_log_end_cycles(input_log);
+            if (end != 0 && (max_cycles == 0 || end < max_cycles)) {
+                max_cycles = end;
+            }
+        }
+
+        chip8_seed_random(ctx, seed);
+
+        // Flags from earlier runs, none yet is fine. Recordings and replays
+        // always start from zeroed flags so they play back the same.
+        if (flags_file != NULL && input_log == NULL && record == NULL) {
+            chip8_load_flags(ctx, flags_file);
+        }
+
+        if (load_state != NULL && !chip8_load_state(ctx, load_state)) {
+            input_log_close(input_log, 0);
+            free((void *)watched.data);
+            chip8_destroy(ctx);
+            printf("ERROR: Unable to load state from %s!\n", load_state);
+            return -1;
+        }
+
+        if (record != NULL) {
+            input_log = input_log_record(record, &log_info);
+            if (input_log == NULL) {
+                free((void *)watched.data);
+                chip8_destroy(ctx);
+                printf("ERROR: Unable to create input log %s!\n", record);
+                return -1;
+            }
+        }
+
+        ctx->input_log = input_log;
+        ctx->idle_skip = idle_skip;
+
+        // Someone at the terminal presses FX0A's key in their own time,
+        // the frames (and timers) go on meanwhile
+        ctx->key_wait_suspends = !headless;
+
+        struct profile *profile = NULL;
+        if (profile_file != NULL) {
+            profile = profile_create();
+            if (profile == NULL) {
+                input_log_close(input_log, 0);
+                free((void *)watched.data);
+                chip8_destroy(ctx);
+                printf("ERROR: Unable to allocate profiler! Aborting...\n");
+                return -1;
+            }
+        }
+
+        ctx->profile = profile;
+
+        struct trace *trace = NULL;
+        if (trace_file != NULL) {
+            trace = trace_open(trace_file, compress_trace);
+            if (trace == NULL) {
+                profile_destroy(profile);
+                input_log_close(input_log, 0);
+                free((void *)watched.data);
+                chip8_destroy(ctx);
+                printf("ERROR: Unable to create trace %s!\n", trace_file);
+                return -1;
+            }
+        }
+
+        ctx->trace = trace;
+
+        // Hotkeys save to / load from the same file
+        const char *state_file = save_state != NULL ? save_state :
+                                 load_state != NULL ? load_state :
+                                 DEFAULT_STATE_FILE;
 
         bool in_single_step = false;
 
-        for (uint32_t cycle = 0; ; cycle++) {
+        // Batch runs want throughput, nobody is watching the clock
+        struct sched sched;
+        sched_init(&sched, ipf, speed, turbo || headless);
+
+        // Batch runs go without unless asked, nobody can rewind them.
+        // Neither can recordings or replays, the log only goes forward.
+        if (rewind_mb < 0 || input_log != NULL) {
+            rewind_mb = headless || input_log != NULL ? 0 : DEFAULT_REWIND_MB;
+        }
+
+        struct history *history = NULL;
+        if (rewind_mb > 0) {
+            history = history_create((size_t)rewind_mb << 20);
+            if (history == NULL) {
+                trace_close(trace, &trace_dropped);
+                profile_destroy(profile);
+                input_log_close(input_log, 0);
+                free((void *)watched.data);
+                chip8_destroy(ctx);
+                printf("ERROR: Unable to allocate rewind history! Aborting...\n");
+                return -1;
+            }
+        }
+
+        // Sleep in epoll on a 60 Hz timerfd and the terminal, so keys get
+        // handled the moment they arrive. Plain sleeping if that fails.
+        if (!sched.turbo) {
+            sched_watch_input(&sched, backend->input_fd());
+        }
+
+        // Saves wake the epoll like keys do. Without it, or if the watch
+        // can't join it, the loop looks every WATCH_POLL_FRAMES.
+        struct watch *watch = NULL;
+        bool poll_watch = false;
+        uint64_t watch_polled = 0;
+
+        if (watch_rom) {
+            watch = watch_open(rom_name);
+            if (watch == NULL) {
+                history_destroy(history);
+                sched_deinit(&sched);
+                trace_close(trace, &trace_dropped);
+                profile_destroy(profile);
+                free((void *)watched.data);
+                chip8_destroy(ctx);
+                printf("ERROR: Unable to watch %s for changes!\n", rom_name);
+                return -1;
+            }
+
+            poll_watch = sched.epoll_fd < 0 || !sched_watch_input(&sched, watch_fd(watch));
+        }
+
+        // Terminal output on a thread of its own where the backend allows,
+        // a slow terminal then skips frames instead of slowing the game.
+        // Drawn right away as before if it can't start.
+        struct render *render = NULL;
+        if (!headless && backend->threaded_display) {
+            render = render_start(backend);
+            ctx->gfx.render = render;
+        }
+
+        uint64_t cycle = 0;
+
+        if (history != NULL) {
+            history_record(history, ctx, cycle);
+        }
+
+        while (max_cycles == 0 || cycle < max_cycles) {
             if (in_single_step) {
-                chip8_display_program_status();
+                // No vblank while stepping, every step is shown
+                if (render != NULL) {
+                    render_publish(render, &ctx->gfx);
+                }
 
-                // Wait until step (i) / resume (p) / end (k)
-                // pressed before continuing
+                chip8_display_program_status(ctx);
+
+                // Wait until step (i) / back (u) / frame back (b) /
+                // resume (p) / end (k) pressed before continuing
                 uint8_t key;
                 do {
-                    key = util_get_char();
-                } while (key != 'k' && key != 'p' && key != 'i');
+                    key = backend->get_char();
+                } while (key != 'k' && key != 'p' && key != 'i' &&
+                         key != 'u' && key != 'b');
 
                 if (key == 'k') {
                     break;
                 } else if (key == 'p') {
                     in_single_step = false;
-                    chip8_clear_program_status();
+                    chip8_clear_program_status(ctx);
+                } else if (key == 'u' || key == 'b') {
+                    if (key == 'u') {
+                        step_back(history, &sched, ctx, &cycle);
+                    } else {
+                        rewind_frames(history, &sched, ctx, 1, &cycle);
+                    }
+                    continue;
                 } // else key == i -> single step continue
             }
 
-            chip8_emulate_cycle();
+            // The next frame runs once its time has come, keys arriving
+            // before that go straight to the hotkeys below
+            bool frame_ready = sched_wait(&sched);
+
+            if (frame_ready) {
+                uint64_t budget = in_single_step ? 1 : UINT32_MAX;
+                if (max_cycles != 0 && budget > max_cycles - cycle) {
+                    budget = max_cycles - cycle;
+                }
+
+                cycle += sched_run(&sched, ctx, budget);
+
+                if (sched_frame_done(&sched)) {
+                    sched_end_frame(&sched, ctx);
+
+                    if (history != NULL) {
+                        history_record(history, ctx, cycle);
+                    }
+                }
+            }
+
+            bool poll_due = poll_watch && sched.frames - watch_polled >= WATCH_POLL_FRAMES;
 
-            util_delay_ms(1);
+            if (watch != NULL && (!frame_ready || poll_due)) {
+                watch_polled = sched.frames;
 
-            if ((cycle + 1) % 17 == 0) {
-                chip8_update_timers();
+                if (watch_changed(watch)) {
+                    reload_rom(ctx, rom_name, &watched, reload_error,
+                               sizeof(reload_error));
+                }
             }
 
-            if (util_is_key_pressed('k', false) ||
-                chip8_emulation_end_detected()) {
+            if (backend->is_key_pressed('k', false) ||
+                chip8_emulation_end_detected(ctx)) {
                 break;
-            } else if (util_is_key_pressed('p', true) ||
-                       chip8_single_step_detected()) {
+            } else if (backend->is_key_pressed('p', true) ||
+                       chip8_single_step_detected(ctx)) {
                 in_single_step = true;
             }
+
+            // Save (o) / restore (l), a failed restore leaves things as is
+            if (backend->is_key_pressed('o', true)) {
+                chip8_save_state(ctx, state_file);
+            } else if (input_log == NULL &&
+                       backend->is_key_pressed('l', true)) {
+                chip8_load_state(ctx, state_file);
+            } else if (backend->is_key_pressed('b', true)) {
+                rewind_frames(history, &sched, ctx, REWIND_FRAMES, &cycle);
+            }
+        }
+
+        watch_close(watch);
+        free((void *)watched.data);
+
+        if (render != NULL) {
+            ctx->gfx.render = NULL;
+            render_stop(render, &frames_skipped);
+
+            // Turbo skips most of them by design
+            frames_skipped = sched.turbo ? 0 : frames_skipped;
+        }
+
+        // Batch jobs checkpoint where they stopped
+        if (headless && save_state != NULL &&
+            !chip8_save_state(ctx, save_state)) {
+            input_log_close(input_log, cycle);
+            profile_destroy(profile);
+            trace_close(trace, &trace_dropped);
+            sched_deinit(&sched);
+            history_destroy(history);
+            chip8_destroy(ctx);
+            printf("ERROR: Unable to save state to %s!\n", save_state);
+            return -1;
+        }
+
+        sched_deinit(&sched);
+        history_destroy(history);
+
+        if (flags_file != NULL && input_log == NULL) {
+            flags_ok = chip8_save_flags(ctx, flags_file);
+        }
+
+        if (trace != NULL) {
+            ctx->trace = NULL;
+            trace_ok = trace_close(trace, &trace_dropped);
+        }
+
+        if (profile != NULL) {
+            ctx->profile = NULL;
+            profile_ok = write_profile(profile, profile_file);
+            profile_destroy(profile);
+        }
+
+        if (input_log != NULL) {
+            ctx->input_log = NULL;
+            log_ok = input_log_close(input_log, cycle);
+
+            // A replay printing the same line as its recording behaved
+            // identically
+            snprintf(log_summary, sizeof(log_summary),
+                     "%s: %" PRIu64 " cycles, state %016" PRIx64 "\n",
+                     replay != NULL ? "Replayed" : "Recorded", cycle,
+                     chip8_state_hash(ctx));
         }
     }
 
-    chip8_deinit();
+    chip8_destroy(ctx);
+    jit_close_perf_map();
+
+    // Only once the terminal is given back
+    printf("%s", log_summary);
+
+    if (reload_error[0] != '\0') {
+        printf("WARNING: Kept the ROM from before the last save, %s!\n", reload_error);
+    }
+
+    if (frames_skipped > 0) {
+        printf("%" PRIu64 " frames skipped, the terminal couldn't keep up\n",
+               frames_skipped);
+    }
+
+    if (trace_dropped > 0) {
+        printf("WARNING: %" PRIu64 " trace records dropped, the disk couldn't keep up!\n",
+               trace_dropped);
+    }
+
+    if (!trace_ok) {
+        printf("ERROR: Unable to write trace %s!\n", trace_file);
+        return -1;
+    }
+
+    if (!profile_ok) {
+        printf("ERROR: Unable to write profile %s!\n", profile_file);
+        return -1;
+    }
+
+    if (!log_ok) {
+        printf("ERROR: Unable to write input log %s!\n", record);
+        return -1;
+    }
+
+    if (!flags_ok) {
+        printf("ERROR: Unable to write user flags %s!\n", flags_file);
+        return -1;
+    }
 
     return 0;
 }
 
+static void print_usage(const char *prog_name)
+{
+    printf("Usage: %s [options] path_to_ROM.ch8\n"
+           "  -H, --headless      run without a terminal (null backend, no delay)\n"
+           "  -d, --display D     ncurses (default), half (half blocks, 128x32) or\n"
+           "                      braille (64x16), the last two redraw only what\n"
+           "                      changed and need a UTF-8 terminal\n"
+           "  -c, --cycles N      stop after N emulated cycles (0 = run forever)\n"
+           "  -e, --engine E      interp (reference switch), cached (default), jit or\n"
+           "                      aot (binaries built by chip8_add_aot_rom(), their default)\n"
+           "  -m, --mode M        chip8, schip or xochip (default: from the ROM's\n"
+           "                      extension, .sc8 / .xo8, chip8 otherwise)\n"
+           "  -q, --quirks P      vip, chip48, schip or xochip (default: the mode's own,\n"
+           "                      vip for chip8)\n"
+           "  -F, --flags F       keep SUPER-CHIP user flags (FX75 / FX85) in F\n"
+           "                      across runs, not while recording or replaying\n"
+           "  -I, --no-idle-skip  run busy-wait loops out instead of skipping to the\n"
+           "                      next timer tick\n"
+           "  -P, --perf-map      write /tmp/perf-<pid>.map for JIT generated code\n"
+           "  -i, --ipf N         instructions per 60 Hz frame (default %d)\n"
+           "  -s, --speed N       run N times faster than real time\n"
+           "  -t, --turbo         don't throttle at all (implied by --headless)\n"
+           "  -o, --save-state F  file for the save hotkey (o), headless runs save\n"
+           "                      there on exit (default " DEFAULT_STATE_FILE ")\n"
+           "  -l, --load-state F  start from a saved state, also used by the load\n"
+           "                      hotkey (l)\n"
+           "  -r, --rewind-mb N   memory for rewind history (default %d, 0 when\n"
+           "                      headless, recording or replaying, 0 = off)\n"
+           "  -S, --seed N        CXNN random seed (default %d)\n"
+           "  -R, --record F      write the keypad input of this run to F\n"
+           "  -p, --replay F      play back the input recorded in F instead of\n"
+           "                      reading the terminal\n"
+           "  -f, --profile F     count executions per opcode and address, write a\n"
+           "                      report to F and a per-address histogram to F.hist\n"
+           "                      on exit\n"
+           "  -T, --trace F       write every executed instruction to F, read it\n"
+           "                      back with chip8_tracedump\n"
+           "  -z, --compress      delta compress the --trace output\n"
+           "  -x, --index F       per-ROM quirks, ipf and key layout, by content\n"
+           "                      hash, for whatever isn't given here\n"
+           "  -k, --keys K        keyboard keys for hex keys 0-F (default x123qweasdzc4rfv)\n"
+           "  -M, --remember      store --quirks, --ipf and --keys in the --index\n"
+           "                      for this ROM\n"
+           "  -w, --watch         reassemble / reload the ROM whenever it's saved,\n"
+           "                      keeping registers, timers and screen\n"
+           "  -h, --help          show this message\n",
+           prog_name, SCHED_DEFAULT_IPF, DEFAULT_REWIND_MB, CHIP8_DEFAULT_SEED);
+}
+
+// Fills in the settings not given from the ROM's entry in the index, after
+// storing those that were given there with --remember
+static bool apply_rom_index(const char *index_file, uint64_t rom_hash,
+                            const char *rom_name, bool remember,
+                            struct rom_settings *settings)
+{
+    struct rom_index *index = rom_index_load(index_file);
+    if (index == NULL) {
+        return false;
+    }
+
+    struct rom_settings stored = { 0 };
+    rom_index_find(index, rom_hash, &stored);
+
+    if (!settings->has_quirks && stored.has_quirks) {
+        settings->has_quirks = true;
+        settings->quirks = stored.quirks;
+    }
+    if (settings->ipf == 0) {
+        settings->ipf = stored.ipf;
+    }
+    if (settings->keys[0] == '\0') {
+        memcpy(settings->keys, stored.keys, sizeof(settings->keys));
+    }
+
+    // Named after the file only, the index may move elsewhere
+    const char *slash = strrchr(rom_name, '/');
+    bool ok = !remember ||
+              (rom_index_set(index, rom_hash, slash != NULL ? slash + 1 : rom_name,
+                             settings) &&
+               rom_index_save(index, index_file));
+
+    rom_index_destroy(index);
+
+    return ok;
+}
+
+static bool parse_engine(const char *name, enum chip8_engine *engine)
+{
+    if (strcmp(name, "interp") == 0) {
+        *engine = CHIP8_ENGINE_INTERPRETER;
+    } else if (strcmp(name, "cached") == 0) {
+        *engine = CHIP8_ENGINE_CACHED;
+    } else if (strcmp(name, "jit") == 0) {
+        *engine = CHIP8_ENGINE_JIT;
+    } else if (strcmp(name, "aot") == 0) {
+        *engine = CHIP8_ENGINE_AOT;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+static bool parse_mode(const char *name, enum chip8_mode *mode)
+{
+    if (strcmp(name, "chip8") == 0) {
+        *mode = CHIP8_MODE_CHIP8;
+    } else if (strcmp(name, "schip") == 0) {
+        *mode = CHIP8_MODE_SCHIP;
+    } else if (strcmp(name, "xochip") == 0) {
+        *mode = CHIP8_MODE_XOCHIP;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+static bool parse_display(const char *name, const struct chip8_backend **display)
+{
+    if (strcmp(name, "ncurses") == 0) {
+        *display = &chip8_backend_ncurses;
+    } else if (strcmp(name, "half") == 0) {
+        *display = &chip8_backend_half_block;
+    } else if (strcmp(name, "braille") == 0) {
+        *display = &chip8_backend_braille;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+static bool write_profile(struct profile *profile, const char *filename)
+{
+    // Histogram next to the report, FILE.hist
+    size_t hist_len = strlen(filename) + sizeof(".hist");
+    char *hist_name = malloc(hist_len);
+    if (hist_name == NULL) {
+        return false;
+    }
+    snprintf(hist_name, hist_len, "%s.hist", filename);
+
+    bool ok = false;
+
+    FILE *report = fopen(filename, "w");
+    FILE *hist = fopen(hist_name, "w");
+
+    if (report != NULL && hist != NULL) {
+        profile_write_report(profile, report);
+        profile_write_histogram(profile, hist);
+        ok = true;
+    }
+
+    ok = (report == NULL || fclose(report) == 0) && ok;
+    ok = (hist == NULL || fclose(hist) == 0) && ok;
+
+    free(hist_name);
+
+    return ok;
+}
+
+// Private copy of an image, NULL data for an empty one
+static bool copy_image(const struct rom_image *image, struct rom_image *copy)
+{
+    *copy = *image;
+    copy->data = NULL;
+
+    if (image->size > 0) {
+        uint8_t *data = malloc(image->size);
+        if (data == NULL) {
+            return false;
+        }
+
+        memcpy(data, image->data, image->size);
+        copy->data = data;
+    }
+
+    return true;
+}
+
+// Loads the saved ROM over the one running. Failing, the old one keeps
+// running and reload_error says why until a later save loads.
+//
+// The diff is against loaded, a copy of what went into memory last time.
+// Tools writing the file in place (cp, >) change what a mapping of it shows
+// right away, diffing against the old image would find nothing to reload.
+static void reload_rom(chip8_ctx *ctx, const char *rom_name,
+                       struct rom_image *loaded, char *reload_error,
+                       size_t error_size)
+{
+    const struct rom_image *new_image;
+    struct rom_image new_loaded = { 0 };
+    struct asm_error asm_error;
+    enum rom_error error = rom_open(rom_name, &new_image, &asm_error);
+
+    if (error == ROM_OK && !copy_image(new_image, &new_loaded)) {
+        error = ROM_ERROR_MEMORY;
+    }
+
+    rom_release(new_image);
+
+    if (error == ROM_OK) {
+        error = chip8_reload_image(ctx, loaded, &new_loaded);
+    }
+
+    if (error == ROM_ERROR_ASSEMBLE) {
+        snprintf(reload_error, error_size, "line %" PRIu32 ": %s",
+                 asm_error.line, asm_error.message);
+    } else if (error != ROM_OK) {
+        snprintf(reload_error, error_size, "%s", rom_error_string(error));
+    }
+
+    if (error != ROM_OK) {
+        free((void *)new_loaded.data);
+        return;
+    }
+
+    reload_error[0] = '\0';
+
+    free((void *)loaded->data);
+    *loaded = new_loaded;
+}
+
+static void step_back(struct history *history, struct sched *sched,
+                      chip8_ctx *ctx, uint64_t *cycle)
+{
+    uint64_t restored;
+
+    if (history == NULL || *cycle == 0 ||
+        !history_seek(history, ctx, *cycle - 1, &restored)) {
+        return;
+    }
+
+    // Entries are taken at frame ends, timers and input only change there,
+    // so running the rest of the frame again ends up in the same place
+    uint64_t target = *cycle - 1;
+    *cycle = restored;
+
+    while (*cycle < target) {
+        uint32_t executed = chip8_emulate_cycles(ctx, target - *cycle);
+        if (executed == 0) {
+            break;
+        }
+        *cycle += executed;
+    }
+
+    sched->frame_cycles = *cycle - restored;
+}
+
+static void rewind_frames(struct history *history, struct sched *sched,
+                          chip8_ctx *ctx, uint32_t num_frames, uint64_t *cycle)
+{
+    if (history == NULL) {
+        return;
+    }
+
+    // The newest entry is the start of the current frame, one more back
+    // from there is the frame before
+    history_rewind(history, ctx, num_frames, cycle);
+
+    sched->frame_cycles = 0;
+}
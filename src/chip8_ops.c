@@ -0,0 +1,286 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8_aot.h"
+#include "chip8_decode.h"
+#include "chip8_emulator.h"
+#include "chip8_graphics.h"
+#include "chip8_input.h"
+#include "chip8_jit.h"
+#include "chip8_ops.h"
+#include "chip8_util.h"
+
+// A 16x16 sprite on both XO-CHIP planes
+#define SPRITE_MAX_BYTES (2 * 32)
+
+static void invalidate_at_I(chip8_ctx *ctx, uint32_t len);
+
+bool ops_next_hex_key(chip8_ctx *ctx, uint8_t *key)
+{
+    struct emulator *em = &ctx->em;
+
+    ctx->waiting_for_key = false;
+
+    if (util_key_ring_pop(&em->key_presses, key)) {
+        return true;
+    }
+
+    // A replay never waits on the terminal. Recordings made while FX0A
+    // blocked have the key right here, ones made while it was suspended
+    // bring it with a later frame. Running out of log ends it, unless the
+    // recording says it went on longer.
+    if (ctx->input_log != NULL && input_log_replaying(ctx->input_log)) {
+        if (input_log_next_wait_key(ctx->input_log, key)) {
+            return true;
+        }
+
+        if (!input_log_at_end(ctx->input_log) ||
+            input_log_end_cycles(ctx->input_log) != 0) {
+            ctx->waiting_for_key = true;
+            return false;
+        }
+
+        em->emulation_end_flag = 1;
+        *key = (uint8_t)-1;
+        return true;
+    }
+
+    if (ctx->key_wait_suspends) {
+        ctx->waiting_for_key = true;
+        return false;
+    }
+
+    do {
+        *key = ctx->backend->get_hex_key();
+        if (*key == (uint8_t)-1) {
+            em->emulation_end_flag = 1;
+            return true;
+        } else if (*key == (uint8_t)-2) {
+            em->single_step_flag = !em->single_step_flag;
+        }
+    } while (*key >= NUM_KEYS);
+
+    if (ctx->input_log != NULL) {
+        input_log_add_wait_key(ctx->input_log, *key);
+    }
+
+    return true;
+}
+
+uint16_t ops_sprite_addr(uint8_t sprite_val)
+{
+    if (sprite_val >= 0x10) {
+        printf("ERROR: Cannot access built in sprites for non-hex characters!\n");
+        return (uint16_t) -1;
+    }
+
+    return sprite_val * 5;
+}
+
+uint16_t ops_large_sprite_addr(uint8_t sprite_val)
+{
+    if (sprite_val >= 0x10) {
+        printf("ERROR: Cannot access built in sprites for non-hex characters!\n");
+        return (uint16_t) -1;
+    }
+
+    // 10 byte digits right after the 5 byte ones
+    return 16 * 5 + sprite_val * 10;
+}
+
+void ops_store_bcd(chip8_ctx *ctx, uint8_t reg)
+{
+    struct emulator *em = &ctx->em;
+    uint16_t mask = OPS_MEMORY_MASK(em);
+
+    em->memory[(em->I + 2) & mask] =   em->V[reg] % 10;
+    em->memory[(em->I + 1) & mask] = ((em->V[reg] % 100) - (em->V[reg] % 10)) / 10;
+    em->memory[em->I & mask]       =  (em->V[reg]        - (em->V[reg] % 100)) / 100;
+
+    invalidate_at_I(ctx, 3);
+}
+
+void ops_store_regs(chip8_ctx *ctx, uint8_t reg)
+{
+    struct emulator *em = &ctx->em;
+    uint16_t addr = em->I & OPS_MEMORY_MASK(em);
+
+    // The last few registers may wrap around to 0
+    if (addr + reg + 1 > UTIL_MEMORY_SIZE(em->mode)) {
+        ops_store_reg_range(ctx, 0, reg);
+        return;
+    }
+
+    memcpy(&em->memory[addr], &em->V[0], reg + 1);
+
+    ops_invalidate_code(ctx, addr, reg + 1);
+}
+
+void ops_load_regs(chip8_ctx *ctx, uint8_t reg)
+{
+    struct emulator *em = &ctx->em;
+    uint16_t addr = em->I & OPS_MEMORY_MASK(em);
+
+    if (addr + reg + 1 > UTIL_MEMORY_SIZE(em->mode)) {
+        ops_load_reg_range(ctx, 0, reg);
+        return;
+    }
+
+    memcpy(&em->V[0], &em->memory[addr], reg + 1);
+}
+
+void ops_load_audio_pattern(chip8_ctx *ctx)
+{
+    struct emulator *em = &ctx->em;
+    uint16_t mask = OPS_MEMORY_MASK(em);
+
+    for (uint8_t i = 0; i < sizeof(em->audio_pattern); i++) {
+        em->audio_pattern[i] = em->memory[(em->I + i) & mask];
+    }
+}
+
+void ops_store_reg_range(chip8_ctx *ctx, uint8_t reg_x, uint8_t reg_y)
+{
+    struct emulator *em = &ctx->em;
+    uint16_t mask = OPS_MEMORY_MASK(em);
+
+    // Either direction, X goes to I
+    int step = reg_x <= reg_y ? 1 : -1;
+    int count = (reg_x <= reg_y ? reg_y - reg_x : reg_x - reg_y) + 1;
+
+    for (int i = 0; i < count; i++) {
+        em->memory[(em->I + i) & mask] = em->V[reg_x + i * step];
+    }
+
+    invalidate_at_I(ctx, count);
+}
+
+void ops_load_reg_range(chip8_ctx *ctx, uint8_t reg_x, uint8_t reg_y)
+{
+    struct emulator *em = &ctx->em;
+    uint16_t mask = OPS_MEMORY_MASK(em);
+
+    int step = reg_x <= reg_y ? 1 : -1;
+    int count = (reg_x <= reg_y ? reg_y - reg_x : reg_x - reg_y) + 1;
+
+    for (int i = 0; i < count; i++) {
+        em->V[reg_x + i * step] = em->memory[(em->I + i) & mask];
+    }
+}
+
+void ops_draw_sprite(chip8_ctx *ctx, uint8_t reg_x, uint8_t reg_y,
+                     uint8_t height)
+{
+    struct emulator *em = &ctx->em;
+
+    uint64_t start = ctx->stats != NULL ? util_time_ns() : 0;
+
+    bool large = height == 0 && em->mode >= CHIP8_MODE_SCHIP;
+
+    // Rows past the end of memory come from its start. With both XO-CHIP
+    // planes selected the second plane's rows follow the first's.
+    uint8_t wrapped[SPRITE_MAX_BYTES];
+    uint16_t mask = OPS_MEMORY_MASK(em);
+    uint8_t *sprite = &em->memory[em->I & mask];
+    uint32_t size = (large ? 32 : height) * __builtin_popcount(ctx->gfx.planes & 0x03);
+
+    if ((em->I & mask) + size > UTIL_MEMORY_SIZE(em->mode)) {
+        for (uint32_t i = 0; i < size; i++) {
+            wrapped[i] = em->memory[(em->I + i) & mask];
+        }
+        sprite = wrapped;
+    }
+
+    // V[F] set if pixels flipped. DXY0 is a 16x16 sprite from SUPER-CHIP
+    // on, an empty one before.
+    if (large) {
+        em->V[0xF] = graphics_draw_large_sprite(&ctx->gfx, em->V[reg_y], em->V[reg_x],
+                                                sprite);
+    } else {
+        em->V[0xF] = graphics_draw_sprite(&ctx->gfx, em->V[reg_y], em->V[reg_x],
+                                          sprite, height);
+    }
+    em->draw_flag = 1;
+
+    if (ctx->stats != NULL) {
+        ctx->stats->draw_ns += util_time_ns() - start;
+        ctx->stats->draws++;
+    }
+}
+
+void ops_decode(chip8_ctx *ctx, uint16_t pc, struct chip8_instr *instr)
+{
+    struct emulator *em = &ctx->em;
+
+    uint64_t start = ctx->stats != NULL ? util_time_ns() : 0;
+
+    decode_instr(em->memory[pc] << 8 | em->memory[pc + 1], em->mode, instr);
+
+    if (ctx->stats != NULL) {
+        ctx->stats->decode_ns += util_time_ns() - start;
+        ctx->stats->decodes++;
+    }
+}
+
+void ops_invalidate_code(chip8_ctx *ctx, uint16_t addr, uint32_t len)
+{
+    // An instruction starting one byte before the store reads it as its
+    // low byte, so that entry is stale too
+    uint32_t start = addr > 0 ? addr - 1u : 0;
+    uint32_t end   = (uint32_t)addr + len;
+
+    if (end > ctx->cache_size) {
+        end = ctx->cache_size;
+    }
+
+    for (uint32_t i = start; i < end; i++) {
+        ctx->cache[i].op = OP_UNDECODED;
+    }
+
+    if (ctx->jit != NULL) {
+        jit_invalidate(ctx->jit, addr, len);
+    }
+
+    if (ctx->aot != NULL) {
+        aot_invalidate(ctx->aot, addr, len);
+    }
+}
+
+bool ops_size_cache(chip8_ctx *ctx, enum chip8_mode mode)
+{
+    uint32_t size = UTIL_MEMORY_SIZE(mode);
+
+    if (size != ctx->cache_size) {
+        struct chip8_instr *cache = malloc(size * sizeof(*cache));
+        if (cache == NULL) {
+            return false;
+        }
+
+        for (uint32_t i = 0; i < size; i++) {
+            cache[i].op = OP_UNDECODED;
+        }
+
+        free(ctx->cache);
+        ctx->cache = cache;
+        ctx->cache_size = size;
+    }
+
+    return true;
+}
+
+static void invalidate_at_I(chip8_ctx *ctx, uint32_t len)
+{
+    uint32_t size = UTIL_MEMORY_SIZE(ctx->em.mode);
+    uint32_t addr = ctx->em.I & (size - 1);
+
+    // Whatever went past the end landed at the start
+    if (addr + len > size) {
+        ops_invalidate_code(ctx, 0, addr + len - size);
+        len = size - addr;
+    }
+
+    ops_invalidate_code(ctx, addr, len);
+}
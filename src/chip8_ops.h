@@ -0,0 +1,53 @@
+#ifndef CHIP8_OPS_H
+#define CHIP8_OPS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "chip8_emulator.h"
+
+// Opcode bodies that are too involved to duplicate in every execution engine.
+// Each one does exactly what the reference interpreter does, minus the PC
+// update which stays with the caller. Memory behind I wraps around at the
+// end of what the mode addresses, see OPS_MEMORY_MASK(). ops_next_hex_key()
+// returns false when FX0A suspends, VX and PC stay as they are then.
+bool     ops_next_hex_key(chip8_ctx *ctx, uint8_t *key);
+uint16_t ops_sprite_addr(uint8_t sprite_val);
+uint16_t ops_large_sprite_addr(uint8_t sprite_val);
+void     ops_store_bcd(chip8_ctx *ctx, uint8_t reg);
+void     ops_store_regs(chip8_ctx *ctx, uint8_t reg);
+void     ops_store_reg_range(chip8_ctx *ctx, uint8_t reg_x, uint8_t reg_y);
+void     ops_load_reg_range(chip8_ctx *ctx, uint8_t reg_x, uint8_t reg_y);
+void     ops_load_regs(chip8_ctx *ctx, uint8_t reg);
+void     ops_load_audio_pattern(chip8_ctx *ctx);
+void     ops_draw_sprite(chip8_ctx *ctx, uint8_t reg_x, uint8_t reg_y,
+                         uint8_t height);
+
+// The stack is a ring: a call past its depth overwrites the oldest return
+// address and a return with nothing on it takes the top one, SP never
+// leaves stack[]
+#define OPS_STACK_MASK (STACK_SIZE - 1)
+
+// Addresses through I, which can count past the end of a 4 KB machine
+#define OPS_MEMORY_MASK(em) ((uint16_t)(UTIL_MEMORY_SIZE((em)->mode) - 1))
+
+// Where a taken skip at pc continues: past the next instruction, which is
+// four bytes long when it's XO-CHIP's F000 NNNN
+#define OPS_SKIP_TARGET(em, pc)                                 \
+    ((uint16_t)((pc) + 4 +                                      \
+                ((em)->mode == CHIP8_MODE_XOCHIP &&             \
+                 (em)->memory[(uint16_t)((pc) + 2)] == 0xF0 &&  \
+                 (em)->memory[(uint16_t)((pc) + 3)] == 0x00 ? 2 : 0)))
+
+// Decode cache entry for pc, timed into ctx->stats
+void     ops_decode(chip8_ctx *ctx, uint16_t pc, struct chip8_instr *instr);
+
+// Forget anything pre-decoded for [addr, addr + len), call after any store
+// into emulator memory that didn't go through the helpers above
+void     ops_invalidate_code(chip8_ctx *ctx, uint16_t addr, uint32_t len);
+
+// Decode cache for every address the mode can reach, a new one starts out
+// undecoded. False, keeping the old one, when there's no memory for it.
+bool     ops_size_cache(chip8_ctx *ctx, enum chip8_mode mode);
+
+#endif
@@ -0,0 +1,182 @@
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "chip8_decode.h"
+#include "chip8_emulator.h"
+#include "chip8_profile.h"
+#include "chip8_util.h"
+
+// Entries in each section of the report
+#define REPORT_TOP 20
+
+struct loop {
+    uint16_t target;            // where the last backward jump went
+    uint64_t iterations;
+};
+
+struct profile {
+    uint64_t total;
+    uint64_t op_counts[OP_COUNT];
+    uint64_t pc_counts[MEMORY_SIZE];
+
+    // Indexed by the address of the jump
+    struct loop loops[MEMORY_SIZE];
+
+    uint64_t draw_ns;
+
+    // Op of the instruction between begin and end
+    uint8_t op;
+
+    // Scratch for profile_write_report(), here rather than in static
+    // storage so profiles on different threads never share it
+    uint16_t order[MEMORY_SIZE];
+    uint64_t iterations[MEMORY_SIZE];
+};
+
+static void sort_by_count(uint16_t *order, uint32_t len, const uint64_t *counts);
+static double percent(uint64_t part, uint64_t total);
+
+struct profile *profile_create(void)
+{
+    return calloc(1, sizeof(struct profile));
+}
+
+void profile_destroy(struct profile *profile)
+{
+    free(profile);
+}
+
+uint64_t profile_begin(struct profile *profile, const struct emulator *em,
+                       uint16_t pc)
+{
+    struct chip8_instr instr;
+
+    if (pc >= MEMORY_SIZE - 1) {
+        profile->op = OP_INVALID;
+        return 0;
+    }
+
+    decode_instr(em->memory[pc] << 8 | em->memory[pc + 1], em->mode, &instr);
+
+    profile->op = instr.op;
+    profile->op_counts[instr.op]++;
+    profile->pc_counts[pc]++;
+    profile->total++;
+
+    return instr.op == OP_DRW ? util_time_ns() : 0;
+}
+
+void profile_end(struct profile *profile, const struct emulator *em,
+                 uint16_t pc, uint64_t begin)
+{
+    switch (profile->op) {
+        case OP_DRW:
+            profile->draw_ns += util_time_ns() - begin;
+            break;
+        case OP_JP:
+        case OP_JP_V0:
+            // Jumping back (or in place, busy waits) closes a loop. Calls
+            // and returns go backwards too but aren't loops.
+            if (em->PC <= pc) {
+                profile->loops[pc].target = em->PC;
+                profile->loops[pc].iterations++;
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+void profile_write_report(struct profile *profile, FILE *out)
+{
+    uint16_t *order = profile->order;
+    uint64_t *iterations = profile->iterations;
+
+    fprintf(out, "Profile: %" PRIu64 " instructions\n\n", profile->total);
+
+    fprintf(out, "Opcode       Count  Share\n");
+    for (uint32_t i = 0; i < OP_COUNT; i++) {
+        order[i] = i;
+    }
+    sort_by_count(order, OP_COUNT, profile->op_counts);
+
+    for (uint32_t i = 0; i < OP_COUNT && profile->op_counts[order[i]] > 0; i++) {
+        uint64_t count = profile->op_counts[order[i]];
+        fprintf(out, "%-6s %12" PRIu64 " %5.1f%%\n",
+                decode_op_patterns[order[i]], count, percent(count, profile->total));
+    }
+
+    uint64_t draws = profile->op_counts[OP_DRW];
+    fprintf(out, "\nDXYN: %" PRIu64 " draws, %.3f ms, %.0f ns each\n",
+            draws, profile->draw_ns / 1e6,
+            draws > 0 ? (double)profile->draw_ns / draws : 0.0);
+
+    // Loops: hottest backward jumps, with what their body costs per pass
+    for (uint32_t i = 0; i < MEMORY_SIZE; i++) {
+        iterations[i] = profile->loops[i].iterations;
+        order[i] = i;
+    }
+    sort_by_count(order, MEMORY_SIZE, iterations);
+
+    fprintf(out, "\nHot loops (backward jumps)\n");
+    for (uint32_t i = 0; i < REPORT_TOP && iterations[order[i]] > 0; i++) {
+        uint16_t from = order[i];
+        const struct loop *loop = &profile->loops[from];
+
+        uint64_t body = 0;
+        for (uint32_t addr = loop->target; addr <= from; addr++) {
+            body += profile->pc_counts[addr];
+        }
+
+        fprintf(out, "%04X -> %04X %12" PRIu64 " iterations, %5.1f%% of all"
+                     " instructions%s\n",
+                from, loop->target, loop->iterations, percent(body, profile->total),
+                from == loop->target ? " (spins in place)" : "");
+    }
+
+    for (uint32_t i = 0; i < MEMORY_SIZE; i++) {
+        order[i] = i;
+    }
+    sort_by_count(order, MEMORY_SIZE, profile->pc_counts);
+
+    fprintf(out, "\nHottest addresses\n");
+    for (uint32_t i = 0; i < REPORT_TOP && profile->pc_counts[order[i]] > 0; i++) {
+        uint64_t count = profile->pc_counts[order[i]];
+        fprintf(out, "%04X %12" PRIu64 " %5.1f%%\n",
+                order[i], count, percent(count, profile->total));
+    }
+}
+
+void profile_write_histogram(const struct profile *profile, FILE *out)
+{
+    for (uint32_t addr = 0; addr < MEMORY_SIZE; addr++) {
+        if (profile->pc_counts[addr] > 0) {
+            fprintf(out, "%04X: %" PRIu64 "\n", addr, profile->pc_counts[addr]);
+        }
+    }
+}
+
+static void sort_by_count(uint16_t *order, uint32_t len, const uint64_t *counts)
+{
+    // Insertion sort, stable so ties stay in address order. Only runs once
+    // at exit, and only entries with a count ever move, so 64 KB of mostly
+    // unused addresses stays cheap.
+    for (uint32_t i = 1; i < len; i++) {
+        uint16_t cur = order[i];
+        uint32_t j = i;
+
+        while (j > 0 && counts[order[j - 1]] < counts[cur]) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = cur;
+    }
+}
+
+static double percent(uint64_t part, uint64_t total)
+{
+    return total > 0 ? 100.0 * part / total : 0.0;
+}
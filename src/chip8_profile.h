@@ -0,0 +1,34 @@
+#ifndef CHIP8_PROFILE_H
+#define CHIP8_PROFILE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "chip8_decode.h"
+#include "chip8_emulator.h"
+
+// Where a ROM spends its instructions. While ctx->profile is set every
+// engine steps one instruction at a time, so counts are the same whichever
+// one is selected; with it NULL the only cost is a branch per batch.
+struct profile;
+
+struct profile *profile_create(void);
+void profile_destroy(struct profile *profile);
+
+// Around every instruction chip8_emulate_cycles() runs, pc is where it
+// started. Returns what profile_end() needs.
+uint64_t profile_begin(struct profile *profile, const struct emulator *em,
+                       uint16_t pc);
+void profile_end(struct profile *profile, const struct emulator *em,
+                 uint16_t pc, uint64_t begin);
+
+// Opcode classes and hottest addresses sorted by count, backward jumps
+// (loops) with their iterations, and DXYN time
+void profile_write_report(struct profile *profile, FILE *out);
+
+// One "ADDR: count" line per executed address in address order, the same
+// ADDR format as ch8_asm.py -pp listings so the two can be joined
+void profile_write_histogram(const struct profile *profile, FILE *out);
+
+#endif
@@ -0,0 +1,25 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "chip8_quirks.h"
+
+#define CHIP8_QUIRKS_ENTRY(name, label, shift_vx, i_inc, jump_vx, vf_reset, clip) \
+    [CHIP8_QUIRKS_##name] = { label, shift_vx, i_inc, jump_vx, vf_reset, clip },
+
+const struct chip8_quirks chip8_quirks[CHIP8_QUIRKS_COUNT] = {
+    CHIP8_QUIRKS_LIST(CHIP8_QUIRKS_ENTRY)
+};
+
+#undef CHIP8_QUIRKS_ENTRY
+
+bool chip8_quirks_parse(const char *label, enum chip8_quirks_profile *profile)
+{
+    for (int i = 0; i < CHIP8_QUIRKS_COUNT; i++) {
+        if (strcmp(label, chip8_quirks[i].label) == 0) {
+            *profile = i;
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,74 @@
+#ifndef CHIP8_QUIRKS_H
+#define CHIP8_QUIRKS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// How far FX55 / FX65 move I
+enum chip8_i_inc {
+    CHIP8_I_INC_NONE,
+    CHIP8_I_INC_X,              // CHIP-48 is off by one
+    CHIP8_I_INC_X1,             // the original: I += X + 1
+};
+
+// Behaviour that differs between CHIP-8 implementations, one row per profile.
+// X(name, label, shift_vx, i_inc, jump_vx, vf_reset, clip)
+//   shift_vx: 8XY6 / 8XYE shift VX in place instead of VY into VX
+//   i_inc:    enum chip8_i_inc
+//   jump_vx:  BXNN jumps to XNN + VX instead of BNNN to NNN + V0
+//   vf_reset: 8XY1 / 8XY2 / 8XY3 clear VF
+//   clip:     sprites stop at the edges instead of wrapping around
+#define CHIP8_QUIRKS_LIST(X)                                                   \
+    X(VIP,    "vip",    false, CHIP8_I_INC_X1,   false, true,  true)           \
+    X(CHIP48, "chip48", true,  CHIP8_I_INC_X,    true,  false, true)           \
+    X(SCHIP,  "schip",  true,  CHIP8_I_INC_NONE, true,  false, true)           \
+    X(XOCHIP, "xochip", false, CHIP8_I_INC_X1,   false, false, false)
+
+#define CHIP8_QUIRKS_ENUM(name, label, shift_vx, i_inc, jump_vx, vf_reset, clip) \
+    CHIP8_QUIRKS_##name,
+
+enum chip8_quirks_profile {
+    CHIP8_QUIRKS_LIST(CHIP8_QUIRKS_ENUM)
+    CHIP8_QUIRKS_COUNT
+};
+
+#undef CHIP8_QUIRKS_ENUM
+
+// The same rows as integer constants (QUIRKS_VIP_SHIFT_VX, ...), so code
+// generated per profile can fold them away at compile time
+#define CHIP8_QUIRKS_CONSTANTS(name, label, shift_vx, i_inc, jump_vx, vf_reset, clip) \
+    QUIRKS_##name##_SHIFT_VX = shift_vx,                                              \
+    QUIRKS_##name##_I_INC    = i_inc,                                                 \
+    QUIRKS_##name##_JUMP_VX  = jump_vx,                                               \
+    QUIRKS_##name##_VF_RESET = vf_reset,                                              \
+    QUIRKS_##name##_CLIP     = clip,
+
+enum {
+    CHIP8_QUIRKS_LIST(CHIP8_QUIRKS_CONSTANTS)
+};
+
+#undef CHIP8_QUIRKS_CONSTANTS
+
+// The same rows again for code that looks them up at run time
+struct chip8_quirks {
+    const char *label;
+    bool shift_vx;
+    uint8_t i_inc;              // enum chip8_i_inc
+    bool jump_vx;
+    bool vf_reset;
+    bool clip;
+};
+
+// Indexed by enum chip8_quirks_profile
+extern const struct chip8_quirks chip8_quirks[CHIP8_QUIRKS_COUNT];
+
+// "vip" etc. to a profile, false when there's no such profile
+bool chip8_quirks_parse(const char *label, enum chip8_quirks_profile *profile);
+
+// How far FX55 / FX65 move I for register X. i_inc is a struct field or a
+// QUIRKS_*_I_INC constant, so compare it as an enum chip8_i_inc.
+#define CHIP8_I_INC_AMOUNT(i_inc, x)                                    \
+    ((enum chip8_i_inc)(i_inc) == CHIP8_I_INC_X1 ? (x) + 1 :            \
+     (enum chip8_i_inc)(i_inc) == CHIP8_I_INC_X ? (x) : 0)
+
+#endif
@@ -0,0 +1,126 @@
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8_render.h"
+
+// Slot index in the low bits of shared, set with it while the slot holds a
+// frame the renderer hasn't taken yet
+#define RENDER_FRESH 0x4
+#define RENDER_SLOT  0x3
+
+struct render {
+    const struct chip8_backend *backend;
+
+    // One slot the emulator fills, one the renderer shows and one between
+    // them, handed over by swapping indexes
+    struct graphics frames[3];
+    _Atomic uint32_t shared;
+
+    // Emulator side
+    uint32_t back;
+    uint64_t published;
+
+    // Renderer side
+    pthread_t renderer;
+    sem_t published_sem;
+    _Atomic bool stopping;
+    uint32_t front;
+    uint64_t presented;
+};
+
+static void *renderer_main(void *arg);
+static bool take_frame(struct render *render);
+
+struct render *render_start(const struct chip8_backend *backend)
+{
+    struct render *render = calloc(1, sizeof(*render));
+    if (render == NULL) {
+        return NULL;
+    }
+
+    render->backend = backend;
+    render->back    = 0;
+    render->front   = 1;
+    atomic_init(&render->shared, 2);
+
+    if (sem_init(&render->published_sem, 0, 0) != 0) {
+        free(render);
+        return NULL;
+    }
+
+    if (pthread_create(&render->renderer, NULL, renderer_main, render) != 0) {
+        sem_destroy(&render->published_sem);
+        free(render);
+        return NULL;
+    }
+
+    return render;
+}
+
+void render_stop(struct render *render, uint64_t *skipped)
+{
+    atomic_store_explicit(&render->stopping, true, memory_order_release);
+    sem_post(&render->published_sem);
+    pthread_join(render->renderer, NULL);
+
+    *skipped = render->published - render->presented;
+
+    sem_destroy(&render->published_sem);
+    free(render);
+}
+
+void render_publish(struct render *render, const struct graphics *gfx)
+{
+    memcpy(&render->frames[render->back], gfx, sizeof(*gfx));
+
+    // Whatever was between is now ours to fill, shown or not
+    uint32_t previous = atomic_exchange_explicit(&render->shared,
+                                                 render->back | RENDER_FRESH,
+                                                 memory_order_acq_rel);
+    render->back = previous & RENDER_SLOT;
+    render->published++;
+
+    // Only a syscall when the renderer sleeps
+    sem_post(&render->published_sem);
+}
+
+static void *renderer_main(void *arg)
+{
+    struct render *render = arg;
+
+    for (;;) {
+        sem_wait(&render->published_sem);
+
+        // Read before taking, the last frame published before the stop
+        // gets shown
+        bool stopping = atomic_load_explicit(&render->stopping, memory_order_acquire);
+
+        // Posts for frames already skipped find nothing fresh
+        if (take_frame(render)) {
+            render->backend->refresh_screen(&render->frames[render->front]);
+            render->presented++;
+        }
+
+        if (stopping) {
+            return NULL;
+        }
+    }
+}
+
+static bool take_frame(struct render *render)
+{
+    if (!(atomic_load_explicit(&render->shared, memory_order_relaxed) & RENDER_FRESH)) {
+        return false;
+    }
+
+    uint32_t previous = atomic_exchange_explicit(&render->shared, render->front,
+                                                 memory_order_acq_rel);
+    render->front = previous & RENDER_SLOT;
+
+    return true;
+}
@@ -0,0 +1,27 @@
+#ifndef CHIP8_RENDER_H
+#define CHIP8_RENDER_H
+
+#include <stdint.h>
+
+#include "chip8_backend.h"
+#include "chip8_graphics.h"
+
+// Presents frames on a thread of its own, so a slow terminal never holds up
+// emulation. The emulator publishes a copy of the screen every vblank into
+// a triple buffer, the renderer always takes the newest one and frames
+// published while it was busy are skipped. Only for backends with
+// threaded_display set.
+struct render;
+
+// Starts the render thread, NULL if it can't. Once set as gfx->render,
+// graphics_refresh_screen() leaves presenting to it.
+struct render *render_start(const struct chip8_backend *backend);
+
+// Presents the last frame published and stops the thread. *skipped gets the
+// number of frames never shown.
+void render_stop(struct render *render, uint64_t *skipped);
+
+// Never blocks: copies the screen and swaps it in for the renderer
+void render_publish(struct render *render, const struct graphics *gfx);
+
+#endif
@@ -0,0 +1,455 @@
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "chip8_asm.h"
+#include "chip8_keys.h"
+#include "chip8_quirks.h"
+#include "chip8_rom.h"
+#include "chip8_util.h"
+
+#define MAX_LINE 256
+#define MAX_NAME 64
+
+// Comments make sources much larger than what they assemble to
+#define MAX_SOURCE_SIZE (1024 * 1024)
+
+// An open image and what tells its file apart from others
+struct rom_entry {
+    struct rom_image image;     // first, so images cast back to entries
+
+    dev_t dev;
+    ino_t ino;
+    off_t file_size;
+    struct timespec mtime;
+    bool assembled;             // data is malloc()ed, not mapped
+    uint32_t refs;
+
+    struct rom_entry *next;
+};
+
+struct rom_index_entry {
+    uint64_t hash;
+    char name[MAX_NAME];
+    struct rom_settings settings;
+};
+
+struct rom_index {
+    struct rom_index_entry *entries;
+    uint32_t count;
+    uint32_t capacity;
+};
+
+// Every image open in the process, few enough to go through one by one
+static struct rom_entry *open_roms;
+static pthread_mutex_t open_roms_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static enum rom_error map_rom(int fd, const struct stat *st,
+                              struct rom_entry **entry);
+static enum rom_error assemble_rom(int fd, const struct stat *st,
+                                   enum asm_syntax syntax,
+                                   struct rom_entry **entry,
+                                   struct asm_error *asm_error);
+static bool parse_line(char *line, struct rom_index_entry *entry);
+static struct rom_index_entry *find_entry(const struct rom_index *index,
+                                          uint64_t hash);
+
+enum rom_error rom_open(const char *filename, const struct rom_image **image,
+                        struct asm_error *asm_error)
+{
+    enum asm_syntax syntax = asm_syntax_for_file(filename);
+
+    *image = NULL;
+
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return ROM_ERROR_OPEN;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return ROM_ERROR_OPEN;
+    }
+
+    // Nothing can address more than XO-CHIP, whatever the mode
+    if (st.st_size > (syntax == ASM_SYNTAX_NONE ? XO_PROG_SIZE : MAX_SOURCE_SIZE)) {
+        close(fd);
+        return ROM_ERROR_TOO_LARGE;
+    }
+
+    pthread_mutex_lock(&open_roms_lock);
+
+    struct rom_entry *entry = open_roms;
+    while (entry != NULL &&
+           (entry->dev != st.st_dev || entry->ino != st.st_ino ||
+            entry->file_size != st.st_size ||
+            entry->mtime.tv_sec != st.st_mtim.tv_sec ||
+            entry->mtime.tv_nsec != st.st_mtim.tv_nsec)) {
+        entry = entry->next;
+    }
+
+    enum rom_error error = ROM_OK;
+
+    if (entry != NULL) {
+        entry->refs++;
+    } else {
+        error = syntax == ASM_SYNTAX_NONE ? map_rom(fd, &st, &entry) :
+                assemble_rom(fd, &st, syntax, &entry, asm_error);
+        if (error == ROM_OK) {
+            entry->next = open_roms;
+            open_roms = entry;
+        }
+    }
+
+    pthread_mutex_unlock(&open_roms_lock);
+    close(fd);
+
+    if (error == ROM_OK) {
+        *image = &entry->image;
+    }
+
+    return error;
+}
+
+void rom_release(const struct rom_image *image)
+{
+    if (image == NULL) {
+        return;
+    }
+
+    struct rom_entry *entry = (struct rom_entry *)image;
+
+    pthread_mutex_lock(&open_roms_lock);
+
+    bool last = --entry->refs == 0;
+
+    if (last) {
+        struct rom_entry **link = &open_roms;
+        while (*link != entry) {
+            link = &(*link)->next;
+        }
+        *link = entry->next;
+    }
+
+    pthread_mutex_unlock(&open_roms_lock);
+
+    if (last) {
+        if (entry->assembled) {
+            free((void *)entry->image.data);
+        } else if (entry->image.data != NULL) {
+            munmap((void *)entry->image.data, entry->image.size);
+        }
+        free(entry);
+    }
+}
+
+const char *rom_error_string(enum rom_error error)
+{
+    switch (error) {
+        case ROM_OK:
+            return "no error";
+        case ROM_ERROR_OPEN:
+            return "unable to open ROM file";
+        case ROM_ERROR_TOO_LARGE:
+            return "ROM is larger than the mode can address";
+        case ROM_ERROR_MAP:
+            return "unable to map ROM file";
+        case ROM_ERROR_MEMORY:
+            return "out of memory";
+        case ROM_ERROR_ASSEMBLE:
+            return "source doesn't assemble";
+    }
+
+    return "unknown error";
+}
+
+struct rom_index *rom_index_load(const char *filename)
+{
+    struct rom_index *index = calloc(1, sizeof(*index));
+    if (index == NULL) {
+        return NULL;
+    }
+
+    FILE *in = fopen(filename, "r");
+    if (in == NULL) {
+        return index;
+    }
+
+    char line[MAX_LINE];
+    bool ok = true;
+
+    while (ok && fgets(line, sizeof(line), in) != NULL) {
+        struct rom_index_entry entry = { 0 };
+        char *comment = strchr(line, '#');
+
+        // The comment is the name the line was written with
+        if (comment != NULL) {
+            *comment = '\0';
+            snprintf(entry.name, sizeof(entry.name), "%s",
+                     comment + 1 + strspn(comment + 1, " \t"));
+            entry.name[strcspn(entry.name, "\r\n")] = '\0';
+        }
+
+        if (line[strspn(line, " \t\r\n")] == '\0') {
+            continue;
+        }
+
+        ok = parse_line(line, &entry) &&
+             rom_index_set(index, entry.hash, entry.name, &entry.settings);
+    }
+
+    ok = ok && !ferror(in);
+    fclose(in);
+
+    if (!ok) {
+        rom_index_destroy(index);
+        return NULL;
+    }
+
+    return index;
+}
+
+void rom_index_destroy(struct rom_index *index)
+{
+    if (index != NULL) {
+        free(index->entries);
+        free(index);
+    }
+}
+
+bool rom_index_find(const struct rom_index *index, uint64_t hash,
+                    struct rom_settings *settings)
+{
+    const struct rom_index_entry *entry = find_entry(index, hash);
+
+    if (entry == NULL) {
+        return false;
+    }
+
+    *settings = entry->settings;
+
+    return true;
+}
+
+bool rom_index_set(struct rom_index *index, uint64_t hash, const char *name,
+                   const struct rom_settings *settings)
+{
+    struct rom_index_entry *entry = find_entry(index, hash);
+
+    if (entry == NULL) {
+        if (index->count == index->capacity) {
+            uint32_t capacity = index->capacity == 0 ? 16 : index->capacity * 2;
+            struct rom_index_entry *entries =
+                realloc(index->entries, capacity * sizeof(*entries));
+            if (entries == NULL) {
+                return false;
+            }
+            index->entries = entries;
+            index->capacity = capacity;
+        }
+
+        entry = &index->entries[index->count++];
+        entry->hash = hash;
+    }
+
+    snprintf(entry->name, sizeof(entry->name), "%s", name != NULL ? name : "");
+    entry->settings = *settings;
+
+    return true;
+}
+
+bool rom_index_save(const struct rom_index *index, const char *filename)
+{
+    char temp[MAX_LINE];
+    if (snprintf(temp, sizeof(temp), "%s.tmp", filename) >= (int)sizeof(temp)) {
+        return false;
+    }
+
+    FILE *out = fopen(temp, "w");
+    if (out == NULL) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < index->count; i++) {
+        const struct rom_index_entry *entry = &index->entries[i];
+        const struct rom_settings *settings = &entry->settings;
+
+        fprintf(out, "%016" PRIx64, entry->hash);
+
+        if (settings->has_quirks) {
+            fprintf(out, " quirks=%s", chip8_quirks[settings->quirks].label);
+        }
+        if (settings->ipf != 0) {
+            fprintf(out, " ipf=%" PRIu32, settings->ipf);
+        }
+        if (settings->keys[0] != '\0') {
+            fprintf(out, " keys=%s", settings->keys);
+        }
+        if (entry->name[0] != '\0') {
+            fprintf(out, " # %s", entry->name);
+        }
+
+        fprintf(out, "\n");
+    }
+
+    bool ok = !ferror(out);
+    ok = fclose(out) == 0 && ok;
+
+    // Whoever reads the index meanwhile sees the old one or the new one
+    if (!ok || rename(temp, filename) != 0) {
+        remove(temp);
+        return false;
+    }
+
+    return true;
+}
+
+bool rom_keys_valid(const char *keys)
+{
+    if (strlen(keys) != NUM_KEYS) {
+        return false;
+    }
+
+    for (int i = 0; i < NUM_KEYS; i++) {
+        // '#' would start a comment in the index, a hotkey would never
+        // reach the keypad and leave its action (quit, save...) unreachable
+        if (keys[i] <= ' ' || keys[i] > '~' || keys[i] == '#' ||
+            strchr(KEY_QUEUE_HOTKEYS, keys[i]) != NULL ||
+            strchr(&keys[i + 1], keys[i]) != NULL) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static enum rom_error map_rom(int fd, const struct stat *st,
+                              struct rom_entry **entry)
+{
+    struct rom_entry *new_entry = calloc(1, sizeof(*new_entry));
+    if (new_entry == NULL) {
+        return ROM_ERROR_MEMORY;
+    }
+
+    // mmap() won't map nothing, an empty ROM needs no mapping anyway
+    if (st->st_size > 0) {
+        void *data = mmap(NULL, st->st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            free(new_entry);
+            return ROM_ERROR_MAP;
+        }
+        new_entry->image.data = data;
+    }
+
+    new_entry->image.size = st->st_size;
+    new_entry->image.hash = util_hash(new_entry->image.data, new_entry->image.size,
+                                      UTIL_HASH_SEED);
+    new_entry->dev       = st->st_dev;
+    new_entry->ino       = st->st_ino;
+    new_entry->file_size = st->st_size;
+    new_entry->mtime     = st->st_mtim;
+    new_entry->refs      = 1;
+
+    *entry = new_entry;
+
+    return ROM_OK;
+}
+
+// Maps the source like a ROM, then swaps the mapping for what it
+// assembles to
+static enum rom_error assemble_rom(int fd, const struct stat *st,
+                                   enum asm_syntax syntax,
+                                   struct rom_entry **entry,
+                                   struct asm_error *asm_error)
+{
+    struct rom_entry *source;
+    enum rom_error error = map_rom(fd, st, &source);
+    if (error != ROM_OK) {
+        return error;
+    }
+
+    uint8_t *rom = malloc(XO_PROG_SIZE);
+    size_t size;
+
+    if (rom == NULL) {
+        error = ROM_ERROR_MEMORY;
+    } else if (!asm_assemble(syntax, (const char *)source->image.data,
+                             source->image.size, rom, XO_PROG_SIZE, &size,
+                             asm_error)) {
+        error = ROM_ERROR_ASSEMBLE;
+    }
+
+    if (source->image.data != NULL) {
+        munmap((void *)source->image.data, source->image.size);
+    }
+
+    if (error != ROM_OK) {
+        free(rom);
+        free(source);
+        return error;
+    }
+
+    source->image.data = rom;
+    source->image.size = size;
+    source->image.hash = util_hash(rom, size, UTIL_HASH_SEED);
+    source->assembled  = true;
+
+    *entry = source;
+
+    return ROM_OK;
+}
+
+static bool parse_line(char *line, struct rom_index_entry *entry)
+{
+    char *save;
+    char *field = strtok_r(line, " \t\r\n", &save);
+    char *end;
+
+    entry->hash = strtoull(field, &end, 16);
+    if (*end != '\0') {
+        return false;
+    }
+
+    while ((field = strtok_r(NULL, " \t\r\n", &save)) != NULL) {
+        struct rom_settings *settings = &entry->settings;
+
+        if (strncmp(field, "quirks=", 7) == 0) {
+            settings->has_quirks = chip8_quirks_parse(field + 7, &settings->quirks);
+            if (!settings->has_quirks) {
+                return false;
+            }
+        } else if (strncmp(field, "ipf=", 4) == 0) {
+            settings->ipf = strtoul(field + 4, &end, 0);
+            if (*end != '\0' || settings->ipf == 0) {
+                return false;
+            }
+        } else if (strncmp(field, "keys=", 5) == 0 && rom_keys_valid(field + 5)) {
+            memcpy(settings->keys, field + 5, sizeof(settings->keys));
+        } else {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static struct rom_index_entry *find_entry(const struct rom_index *index,
+                                          uint64_t hash)
+{
+    for (uint32_t i = 0; i < index->count; i++) {
+        if (index->entries[i].hash == hash) {
+            return &index->entries[i];
+        }
+    }
+
+    return NULL;
+}
@@ -0,0 +1,71 @@
+#ifndef CHIP8_ROM_H
+#define CHIP8_ROM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chip8_asm.h"
+#include "chip8_quirks.h"
+#include "chip8_util.h"
+
+// ROM files mapped read-only. Opening a file that is already open (same
+// file, size and modification time) hands out the same image, so any number
+// of machines on one ROM share a single mapping and each starts with one
+// memcpy of it, see chip8_load_image(). .8mct and .8o sources are assembled
+// on open, their image is the program they assemble to.
+
+enum rom_error {
+    ROM_OK,
+    ROM_ERROR_OPEN,             // missing, unreadable or not a regular file
+    ROM_ERROR_TOO_LARGE,        // more than the mode can address
+    ROM_ERROR_MAP,
+    ROM_ERROR_MEMORY,
+    ROM_ERROR_ASSEMBLE,         // source with a mistake, see the asm_error
+};
+
+struct rom_image {
+    const uint8_t *data;        // NULL for an empty file
+    size_t size;
+    uint64_t hash;              // util_hash() of the contents
+};
+
+// Safe to call from any thread. The image stays valid until released.
+// asm_error may be NULL, it says what's wrong on ROM_ERROR_ASSEMBLE.
+enum rom_error rom_open(const char *filename, const struct rom_image **image,
+                        struct asm_error *asm_error);
+void rom_release(const struct rom_image *image);
+
+const char *rom_error_string(enum rom_error error);
+
+// Per-ROM preferences keyed by content hash, kept in a text file with one
+// line per ROM: the hash in hex, then any of quirks=<profile>, ipf=<n> and
+// keys=<16 keyboard keys for hex keys 0-F>. '#' starts a comment, the name
+// of the ROM when the index wrote it.
+struct rom_settings {
+    bool has_quirks;
+    enum chip8_quirks_profile quirks;
+    uint32_t ipf;               // 0: not set
+    char keys[NUM_KEYS + 1];    // empty: not set
+};
+
+struct rom_index;
+
+// A missing file is an empty index, NULL only if it can't be read or parsed
+struct rom_index *rom_index_load(const char *filename);
+void rom_index_destroy(struct rom_index *index);
+
+bool rom_index_find(const struct rom_index *index, uint64_t hash,
+                    struct rom_settings *settings);
+
+// Adds or replaces the ROM's line, name goes in its comment
+bool rom_index_set(struct rom_index *index, uint64_t hash, const char *name,
+                   const struct rom_settings *settings);
+
+// Writes a new file and renames it over the old one
+bool rom_index_save(const struct rom_index *index, const char *filename);
+
+// A keys= value: 16 distinct printable characters, none of them a hotkey
+bool rom_keys_valid(const char *keys);
+
+#endif
@@ -0,0 +1,187 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "chip8_emulator.h"
+#include "chip8_render.h"
+#include "chip8_sched.h"
+
+#define NS_PER_SEC 1000000000ULL
+
+static uint64_t to_ns(const struct timespec *ts);
+static struct timespec from_ns(uint64_t ns);
+static void sleep_until_deadline(struct sched *sched);
+
+void sched_init(struct sched *sched, uint32_t ipf, uint32_t speed, bool turbo)
+{
+    sched->ipf      = ipf > 0 ? ipf : 1;
+    sched->turbo    = turbo;
+    sched->frame_ns = NS_PER_SEC / SCHED_FRAME_RATE / (speed > 0 ? speed : 1);
+
+    sched->frame_cycles = 0;
+    sched->frames       = 0;
+    sched->frame_ended  = false;
+
+    sched->timer_fd = -1;
+    sched->epoll_fd = -1;
+
+    clock_gettime(CLOCK_MONOTONIC, &sched->deadline);
+    sched->deadline = from_ns(to_ns(&sched->deadline) + sched->frame_ns);
+}
+
+uint32_t sched_run(struct sched *sched, chip8_ctx *ctx, uint32_t max_cycles)
+{
+    uint32_t budget = sched->ipf - sched->frame_cycles;
+    if (budget > max_cycles) {
+        budget = max_cycles;
+    }
+
+    uint32_t executed = chip8_emulate_cycles(ctx, budget);
+
+    sched->frame_cycles += executed;
+
+    return executed;
+}
+
+bool sched_frame_done(const struct sched *sched)
+{
+    return sched->frame_cycles >= sched->ipf;
+}
+
+void sched_end_frame(struct sched *sched, chip8_ctx *ctx)
+{
+    chip8_update_timers(ctx);
+    chip8_poll_input(ctx);
+
+    // Vblank, the frame as it ends is the one to show
+    if (ctx->gfx.render != NULL) {
+        render_publish(ctx->gfx.render, &ctx->gfx);
+    }
+
+    sched->frame_cycles = 0;
+    sched->frames++;
+    sched->frame_ended = !sched->turbo;
+}
+
+bool sched_wait(struct sched *sched)
+{
+    if (!sched->frame_ended) {
+        return true;
+    }
+
+    if (sched->timer_fd < 0) {
+        sleep_until_deadline(sched);
+        sched->frame_ended = false;
+        return true;
+    }
+
+    struct epoll_event events[SCHED_MAX_WATCHED + 1];
+    int num_events = epoll_wait(sched->epoll_fd, events, SCHED_MAX_WATCHED + 1, -1);
+
+    for (int i = 0; i < num_events; i++) {
+        if (events[i].data.fd != sched->timer_fd) {
+            continue;
+        }
+
+        // More than one expiration means frames were missed (blocked on
+        // single stepping, ...), they're dropped rather than raced through
+        uint64_t expirations;
+        if (read(sched->timer_fd, &expirations, sizeof(expirations)) > 0) {
+            sched->frame_ended = false;
+        }
+    }
+
+    // Woken by input (or a signal) alone, the frontend looks at it first
+    return !sched->frame_ended;
+}
+
+bool sched_watch_input(struct sched *sched, int input_fd)
+{
+    // Input is edge triggered: the frontend drains everything pending each
+    // time it looks, and a closed descriptor doesn't wake us forever
+    struct epoll_event input_event = { .events = EPOLLIN | EPOLLET, .data.fd = input_fd };
+
+    // Another descriptor next to those watched already
+    if (sched->epoll_fd >= 0) {
+        return input_fd >= 0 &&
+               epoll_ctl(sched->epoll_fd, EPOLL_CTL_ADD, input_fd, &input_event) == 0;
+    }
+
+    sched->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    sched->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+    // Same deadlines the sleeping would have used, every frame_ns from the
+    // end of the current frame on
+    struct itimerspec period = {
+        .it_interval = from_ns(sched->frame_ns),
+        .it_value    = sched->deadline,
+    };
+
+    struct epoll_event timer_event = { .events = EPOLLIN, .data.fd = sched->timer_fd };
+
+    if (sched->timer_fd < 0 || sched->epoll_fd < 0 ||
+        timerfd_settime(sched->timer_fd, TFD_TIMER_ABSTIME, &period, NULL) != 0 ||
+        epoll_ctl(sched->epoll_fd, EPOLL_CTL_ADD, sched->timer_fd, &timer_event) != 0 ||
+        (input_fd >= 0 &&
+         epoll_ctl(sched->epoll_fd, EPOLL_CTL_ADD, input_fd, &input_event) != 0)) {
+        sched_deinit(sched);
+        return false;
+    }
+
+    return true;
+}
+
+void sched_deinit(struct sched *sched)
+{
+    if (sched->timer_fd >= 0) {
+        close(sched->timer_fd);
+    }
+
+    if (sched->epoll_fd >= 0) {
+        close(sched->epoll_fd);
+    }
+
+    sched->timer_fd = -1;
+    sched->epoll_fd = -1;
+}
+
+static void sleep_until_deadline(struct sched *sched)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    uint64_t deadline = to_ns(&sched->deadline);
+    uint64_t now_ns   = to_ns(&now);
+
+    if (now_ns < deadline) {
+        // Absolute deadline, so oversleeping in one frame doesn't add up
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &sched->deadline, NULL);
+        deadline += sched->frame_ns;
+    } else if (now_ns - deadline > sched->frame_ns) {
+        // Way behind (single stepping, ...), start over from now rather
+        // than racing through the missed frames
+        deadline = now_ns + sched->frame_ns;
+    } else {
+        deadline += sched->frame_ns;
+    }
+
+    sched->deadline = from_ns(deadline);
+}
+
+static uint64_t to_ns(const struct timespec *ts)
+{
+    return (uint64_t)ts->tv_sec * NS_PER_SEC + ts->tv_nsec;
+}
+
+static struct timespec from_ns(uint64_t ns)
+{
+    struct timespec ts = {
+        .tv_sec  = ns / NS_PER_SEC,
+        .tv_nsec = ns % NS_PER_SEC
+    };
+
+    return ts;
+}
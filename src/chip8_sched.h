@@ -0,0 +1,66 @@
+#ifndef CHIP8_SCHED_H
+#define CHIP8_SCHED_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "chip8_emulator.h"
+
+// Delay / sound timers run at 60 Hz, everything is paced in frames of that
+#define SCHED_FRAME_RATE 60
+
+// Input descriptors sched_watch_input() can take, the terminal and a
+// --watch'ed ROM
+#define SCHED_MAX_WATCHED 2
+
+// About 1000 instructions per second, what chip8_main always aimed for
+#define SCHED_DEFAULT_IPF 17
+
+// Wall-clock pacing: ipf instructions per frame, timers ticked exactly once
+// per frame, and the rest of the frame slept away on CLOCK_MONOTONIC. Once
+// told about an input descriptor, the sleeping happens in epoll_wait() on a
+// 60 Hz timerfd and that descriptor instead, so keys wake it right away.
+struct sched {
+    uint32_t ipf;
+    bool turbo;                 // never sleep
+
+    uint64_t frame_ns;          // wall clock per frame, 1/60 s / speed
+    struct timespec deadline;   // end of the current frame
+
+    uint32_t frame_cycles;      // instructions run in the current frame
+    uint64_t frames;
+
+    bool frame_ended;           // the next frame waits for the deadline
+
+    int timer_fd;               // -1 until sched_watch_input()
+    int epoll_fd;
+};
+
+// speed multiplies the frame rate (and with it timers and instructions/sec)
+void sched_init(struct sched *sched, uint32_t ipf, uint32_t speed, bool turbo);
+
+// Runs the rest of the current frame, but no more than max_cycles
+// instructions. Returns how many ran (0 once the emulation has ended).
+uint32_t sched_run(struct sched *sched, chip8_ctx *ctx, uint32_t max_cycles);
+
+bool sched_frame_done(const struct sched *sched);
+
+// Ticks the timers and polls input. The next frame starts once sched_wait()
+// says so.
+void sched_end_frame(struct sched *sched, chip8_ctx *ctx);
+
+// Sleeps until the ended frame's deadline (not at all in turbo) and returns
+// true when the next frame may run. With an input descriptor being watched,
+// returns false as soon as that turns readable instead.
+bool sched_wait(struct sched *sched);
+
+// Switches sleeping over to a timerfd + epoll that also watch input_fd (a
+// terminal, say). False if either couldn't be set up, sleeping then stays
+// as it was. Once switched, further calls add another descriptor.
+bool sched_watch_input(struct sched *sched, int input_fd);
+
+// Closes whatever sched_watch_input() opened
+void sched_deinit(struct sched *sched);
+
+#endif
@@ -0,0 +1,254 @@
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "chip8_aot.h"
+#include "chip8_emulator.h"
+#include "chip8_graphics.h"
+#include "chip8_ops.h"
+#include "chip8_quirks.h"
+#include "chip8_util.h"
+
+#define STATE_MAGIC   "CH8STATE"
+
+// Bump whenever struct chip8_snapshot changes layout or meaning
+#define STATE_VERSION 5
+
+struct state_file {
+    char magic[8];
+    uint32_t version;
+    uint32_t payload_size;      // chip8_snapshot_size() of the payload
+    uint64_t checksum;          // FNV-1a over the payload
+    uint8_t payload[];
+};
+
+static bool snapshot_valid(const chip8_ctx *ctx,
+                           const struct chip8_snapshot *snap);
+
+void chip8_capture_snapshot(chip8_ctx *ctx, struct chip8_snapshot *snap)
+{
+    // Zeroed first so padding bytes (hashed, diffed) are always the same.
+    // Memory past the mode's end stays out, see chip8_snapshot_size().
+    memset(snap, 0, offsetof(struct chip8_snapshot, em));
+
+    memcpy(snap->screen, ctx->gfx.screen, sizeof(ctx->gfx.screen));
+    snap->hires = ctx->gfx.hires;
+    snap->planes = ctx->gfx.planes;
+    snap->rng_state = ctx->rng_state;
+    memcpy(snap->key_hold, ctx->key_hold, sizeof(ctx->key_hold));
+    memcpy(&snap->em, &ctx->em,
+           offsetof(struct emulator, memory) + UTIL_MEMORY_SIZE(ctx->em.mode));
+}
+
+bool chip8_restore_snapshot(chip8_ctx *ctx, const struct chip8_snapshot *snap)
+{
+    uint32_t size = UTIL_MEMORY_SIZE(snap->em.mode);
+
+    if (!snapshot_valid(ctx, snap) || !ops_size_cache(ctx, snap->em.mode)) {
+        return false;
+    }
+
+    // Past a smaller mode's end memory is always zero, what's there now
+    // may be a larger one's
+    if (snap->em.mode != ctx->em.mode) {
+        memset(&ctx->em.memory[size], 0, MEMORY_SIZE - size);
+    }
+
+    memcpy(&ctx->em, &snap->em, offsetof(struct emulator, memory) + size);
+    memcpy(ctx->gfx.screen, snap->screen, sizeof(ctx->gfx.screen));
+    ctx->gfx.hires = snap->hires;
+    ctx->gfx.planes = snap->planes;
+    ctx->gfx.clip = chip8_quirks[ctx->em.quirks].clip;
+    ctx->rng_state = snap->rng_state;
+    memcpy(ctx->key_hold, snap->key_hold, sizeof(ctx->key_hold));
+
+    // Memory changed wholesale, but compiled blocks that still match it
+    // remain usable
+    ops_invalidate_code(ctx, 0, MEMORY_SIZE);
+    if (ctx->aot != NULL) {
+        aot_revalidate(ctx->aot, ctx->em.memory);
+    }
+
+    graphics_refresh_screen(&ctx->gfx);
+
+    return true;
+}
+
+size_t chip8_snapshot_size(const struct chip8_snapshot *snap)
+{
+    return offsetof(struct chip8_snapshot, em.memory) +
+           UTIL_MEMORY_SIZE(snap->em.mode);
+}
+
+uint64_t chip8_state_hash(chip8_ctx *ctx)
+{
+    const struct emulator *em = &ctx->em;
+
+    // Only what a program can observe, so builds with a different struct
+    // layout still agree
+    uint64_t hash = UTIL_HASH_SEED;
+    hash = util_hash(em->memory, UTIL_MEMORY_SIZE(em->mode), hash);
+    hash = util_hash(em->stack, sizeof(em->stack), hash);
+    hash = util_hash(em->V, sizeof(em->V), hash);
+    hash = util_hash(&em->PC, sizeof(em->PC), hash);
+    hash = util_hash(&em->I, sizeof(em->I), hash);
+    hash = util_hash(&em->delay, sizeof(em->delay), hash);
+    hash = util_hash(&em->sound, sizeof(em->sound), hash);
+    hash = util_hash(&em->SP, sizeof(em->SP), hash);
+    hash = util_hash(em->user_flags, sizeof(em->user_flags), hash);
+    hash = util_hash(ctx->gfx.screen, sizeof(ctx->gfx.screen), hash);
+    hash = util_hash(&ctx->gfx.hires, sizeof(ctx->gfx.hires), hash);
+    hash = util_hash(&ctx->gfx.planes, sizeof(ctx->gfx.planes), hash);
+
+    return hash;
+}
+
+bool chip8_save_state(chip8_ctx *ctx, const char *filename)
+{
+    struct chip8_snapshot *snap = malloc(sizeof(*snap));
+    if (snap == NULL) {
+        return false;
+    }
+
+    chip8_capture_snapshot(ctx, snap);
+
+    struct state_file header = { .version = STATE_VERSION };
+    memcpy(header.magic, STATE_MAGIC, sizeof(header.magic));
+    header.payload_size = chip8_snapshot_size(snap);
+    header.checksum = util_hash(snap, header.payload_size, UTIL_HASH_SEED);
+
+    // Written next to the target and renamed over it, so a crash never
+    // leaves a half written state behind
+    size_t tmp_len = strlen(filename) + sizeof(".tmp");
+    char *tmp_name = malloc(tmp_len);
+    if (tmp_name == NULL) {
+        free(snap);
+        return false;
+    }
+    snprintf(tmp_name, tmp_len, "%s.tmp", filename);
+
+    bool ok = false;
+
+    FILE *out = fopen(tmp_name, "wb");
+    if (out != NULL) {
+        ok = fwrite(&header, sizeof(header), 1, out) == 1 &&
+             fwrite(snap, header.payload_size, 1, out) == 1;
+        ok = (fclose(out) == 0) && ok;
+        ok = ok && rename(tmp_name, filename) == 0;
+
+        if (!ok) {
+            remove(tmp_name);
+        }
+    }
+
+    free(tmp_name);
+    free(snap);
+
+    return ok;
+}
+
+bool chip8_load_state(chip8_ctx *ctx, const char *filename)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    // Never more than a snapshot of the largest mode
+    struct stat st;
+    if (fstat(fd, &st) != 0 ||
+        st.st_size < (off_t)sizeof(struct state_file) ||
+        st.st_size > (off_t)(sizeof(struct state_file) +
+                             sizeof(struct chip8_snapshot))) {
+        close(fd);
+        return false;
+    }
+
+    size_t file_size = st.st_size;
+    const struct state_file *file = mmap(NULL, file_size, PROT_READ,
+                                         MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (file == MAP_FAILED) {
+        return false;
+    }
+
+    size_t payload_size = file_size - sizeof(*file);
+    struct chip8_snapshot *snap = calloc(1, sizeof(*snap));
+
+    bool valid = snap != NULL &&
+                 memcmp(file->magic, STATE_MAGIC, sizeof(file->magic)) == 0 &&
+                 file->version == STATE_VERSION &&
+                 file->payload_size == payload_size &&
+                 file->checksum == util_hash(file->payload, payload_size,
+                                             UTIL_HASH_SEED);
+
+    // The mode says how much memory should have come with it
+    if (valid) {
+        memcpy(snap, file->payload, payload_size);
+        valid = payload_size == chip8_snapshot_size(snap) &&
+                chip8_restore_snapshot(ctx, snap);
+    }
+
+    free(snap);
+    munmap((void *)file, file_size);
+
+    return valid;
+}
+
+// SUPER-CHIP's user flags outlive the program, on the HP48 they survived
+// power cycles. Sixteen raw bytes, nothing else to version.
+bool chip8_save_flags(chip8_ctx *ctx, const char *filename)
+{
+    FILE *out = fopen(filename, "wb");
+    if (out == NULL) {
+        return false;
+    }
+
+    bool ok = fwrite(ctx->em.user_flags, sizeof(ctx->em.user_flags), 1, out) == 1;
+
+    return (fclose(out) == 0) && ok;
+}
+
+bool chip8_load_flags(chip8_ctx *ctx, const char *filename)
+{
+    FILE *in = fopen(filename, "rb");
+    if (in == NULL) {
+        return false;
+    }
+
+    bool ok = fread(ctx->em.user_flags, sizeof(ctx->em.user_flags), 1, in) == 1;
+
+    fclose(in);
+
+    return ok;
+}
+
+static bool snapshot_valid(const chip8_ctx *ctx,
+                           const struct chip8_snapshot *snap)
+{
+    const struct emulator *em = &snap->em;
+
+    // Indexes into tables and arrays, a state from a broken or hostile file
+    // must not point them anywhere else
+    if (em->mode > CHIP8_MODE_XOCHIP || em->quirks >= CHIP8_QUIRKS_COUNT ||
+        em->SP >= STACK_SIZE || snap->planes > 0x03) {
+        return false;
+    }
+
+    // What chip8_set_mode() and chip8_set_quirks() allow a compiled program
+    if (ctx->aot != NULL &&
+        (em->mode != CHIP8_MODE_CHIP8 ||
+         em->quirks != ctx->aot->program->quirks)) {
+        return false;
+    }
+
+    return true;
+}
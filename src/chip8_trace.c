@@ -0,0 +1,276 @@
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8_trace.h"
+#include "chip8_util.h"
+
+// 32K records (320 KB) per write, 8 of them queued before records drop
+#define TRACE_CHUNK_RECORDS 32768
+#define TRACE_NUM_CHUNKS    8
+
+#define TRACE_CHUNK_BYTES (TRACE_CHUNK_RECORDS * sizeof(struct trace_record))
+
+// Longest loop body (in instructions) compression looks for, and how many
+// records it looks at to find one
+#define TRACE_MAX_STRIDE    64
+#define TRACE_STRIDE_SAMPLE 512
+
+struct trace_chunk {
+    uint32_t count;
+    uint64_t dropped;
+    struct trace_record records[TRACE_CHUNK_RECORDS];
+};
+
+struct trace {
+    FILE *file;
+    bool compress;
+
+    // Ring of chunks: the emulator fills chunks[head % N] and publishes it
+    // by moving head, the writer empties chunks[tail % N] and moves tail
+    struct trace_chunk *chunks;
+    _Atomic uint32_t head;
+    _Atomic uint32_t tail;
+
+    // Emulator side: records lost since the last chunk started
+    uint64_t dropped;
+    uint64_t total_dropped;
+
+    // Writer side
+    pthread_t writer;
+    sem_t published;
+    _Atomic bool closing;
+    bool write_failed;
+    uint8_t *shifted;           // records moved stride down, the XOR base
+    uint8_t *packed;            // compressed chunk
+};
+
+static void *writer_main(void *arg);
+static void write_chunk(struct trace *trace, const struct trace_chunk *chunk);
+static uint32_t find_stride(const struct trace_chunk *chunk);
+
+struct trace *trace_open(const char *filename, bool compress)
+{
+    struct trace *trace = calloc(1, sizeof(*trace));
+    if (trace == NULL) {
+        return NULL;
+    }
+
+    trace->compress = compress;
+    trace->chunks   = calloc(TRACE_NUM_CHUNKS, sizeof(*trace->chunks));
+    trace->shifted  = malloc(TRACE_CHUNK_BYTES);
+    trace->packed   = malloc(UTIL_DELTA_MAX_SIZE(TRACE_CHUNK_BYTES));
+    trace->file     = fopen(filename, "wb");
+
+    struct trace_file_header header = {
+        .version     = TRACE_VERSION,
+        .record_size = sizeof(struct trace_record),
+        .compressed  = compress,
+    };
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+
+    if (trace->chunks == NULL || trace->shifted == NULL ||
+        trace->packed == NULL || trace->file == NULL ||
+        fwrite(&header, sizeof(header), 1, trace->file) != 1) {
+        goto fail;
+    }
+
+    if (sem_init(&trace->published, 0, 0) != 0) {
+        goto fail;
+    }
+
+    if (pthread_create(&trace->writer, NULL, writer_main, trace) != 0) {
+        sem_destroy(&trace->published);
+        goto fail;
+    }
+
+    return trace;
+
+fail:
+    if (trace->file != NULL) {
+        fclose(trace->file);
+    }
+    free(trace->chunks);
+    free(trace->shifted);
+    free(trace->packed);
+    free(trace);
+
+    return NULL;
+}
+
+bool trace_close(struct trace *trace, uint64_t *dropped)
+{
+    atomic_store_explicit(&trace->closing, true, memory_order_release);
+    sem_post(&trace->published);
+    pthread_join(trace->writer, NULL);
+
+    // Writer is gone and drained everything published, the partly filled
+    // chunk (and any drops after it) go out from here
+    struct trace_chunk *chunk = &trace->chunks[trace->head % TRACE_NUM_CHUNKS];
+    if (chunk->count == 0) {
+        chunk->dropped = trace->dropped;
+    }
+    if (chunk->count > 0 || chunk->dropped > 0) {
+        write_chunk(trace, chunk);
+    }
+
+    bool ok = !trace->write_failed;
+    ok = (fclose(trace->file) == 0) && ok;
+
+    *dropped = trace->total_dropped;
+
+    sem_destroy(&trace->published);
+    free(trace->chunks);
+    free(trace->shifted);
+    free(trace->packed);
+    free(trace);
+
+    return ok;
+}
+
+void trace_add(struct trace *trace, const struct emulator *em, uint16_t pc,
+               uint16_t opcode, const uint8_t V_before[NUM_REGS])
+{
+    uint32_t head = atomic_load_explicit(&trace->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&trace->tail, memory_order_acquire);
+
+    // Every chunk is queued for the writer, nowhere to put this
+    if (head - tail == TRACE_NUM_CHUNKS) {
+        trace->dropped++;
+        trace->total_dropped++;
+        return;
+    }
+
+    struct trace_chunk *chunk = &trace->chunks[head % TRACE_NUM_CHUNKS];
+
+    if (chunk->count == 0) {
+        chunk->dropped = trace->dropped;
+        trace->dropped = 0;
+    }
+
+    struct trace_record *record = &chunk->records[chunk->count++];
+
+    record->pc     = pc;
+    record->opcode = opcode;
+    record->I      = em->I;
+    record->reg    = TRACE_NO_REG;
+    record->value  = 0;
+    record->vf     = em->V[0xF];
+    record->flags  = 0;
+
+    for (uint8_t r = 0; r < 0xF; r++) {
+        if (em->V[r] == V_before[r]) {
+            continue;
+        }
+
+        if (record->reg == TRACE_NO_REG) {
+            record->reg   = r;
+            record->value = em->V[r];
+        } else {
+            record->flags |= TRACE_FLAG_MULTI;
+            break;
+        }
+    }
+
+    if (chunk->count == TRACE_CHUNK_RECORDS) {
+        atomic_store_explicit(&trace->head, head + 1, memory_order_release);
+        sem_post(&trace->published);
+    }
+}
+
+static void *writer_main(void *arg)
+{
+    struct trace *trace = arg;
+
+    for (;;) {
+        sem_wait(&trace->published);
+
+        // Read before draining, anything published before close is
+        // written before the thread goes away
+        bool closing = atomic_load_explicit(&trace->closing, memory_order_acquire);
+
+        uint32_t head = atomic_load_explicit(&trace->head, memory_order_acquire);
+        uint32_t tail = atomic_load_explicit(&trace->tail, memory_order_relaxed);
+
+        while (tail != head) {
+            struct trace_chunk *chunk = &trace->chunks[tail % TRACE_NUM_CHUNKS];
+
+            write_chunk(trace, chunk);
+            chunk->count = 0;
+
+            tail++;
+            atomic_store_explicit(&trace->tail, tail, memory_order_release);
+        }
+
+        if (closing) {
+            return NULL;
+        }
+    }
+}
+
+static void write_chunk(struct trace *trace, const struct trace_chunk *chunk)
+{
+    size_t bytes = chunk->count * sizeof(struct trace_record);
+    const void *payload = chunk->records;
+
+    uint32_t stride = 0;
+
+    if (trace->compress && bytes > 0) {
+        stride = find_stride(chunk);
+
+        size_t shift = stride * sizeof(struct trace_record);
+        if (shift > bytes) {
+            shift = bytes;
+        }
+
+        memset(trace->shifted, 0, shift);
+        memcpy(trace->shifted + shift, chunk->records, bytes - shift);
+
+        bytes = util_delta_encode(chunk->records, trace->shifted, bytes,
+                                  trace->packed);
+        payload = trace->packed;
+    }
+
+    struct trace_chunk_header header = {
+        .count   = chunk->count,
+        .size    = bytes,
+        .dropped = chunk->dropped,
+        .stride  = stride,
+    };
+
+    if (fwrite(&header, sizeof(header), 1, trace->file) != 1 ||
+        (bytes > 0 && fwrite(payload, bytes, 1, trace->file) != 1)) {
+        trace->write_failed = true;
+    }
+}
+
+static uint32_t find_stride(const struct trace_chunk *chunk)
+{
+    // The loop length that makes the most records repeat exactly, judged
+    // on the start of the chunk
+    uint32_t sample = chunk->count < TRACE_STRIDE_SAMPLE ?
+                      chunk->count : TRACE_STRIDE_SAMPLE;
+    uint32_t best = 1;
+    uint32_t best_matches = 0;
+
+    for (uint32_t stride = 1; stride <= TRACE_MAX_STRIDE && stride < sample; stride++) {
+        uint32_t matches = 0;
+
+        for (uint32_t i = stride; i < sample; i++) {
+            matches += memcmp(&chunk->records[i], &chunk->records[i - stride],
+                              sizeof(struct trace_record)) == 0;
+        }
+
+        if (matches > best_matches) {
+            best = stride;
+            best_matches = matches;
+        }
+    }
+
+    return best;
+}
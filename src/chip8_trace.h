@@ -0,0 +1,64 @@
+#ifndef CHIP8_TRACE_H
+#define CHIP8_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "chip8_util.h"
+
+#define TRACE_MAGIC   "CH8TRACE"
+#define TRACE_VERSION 1
+
+// No register besides VF changed
+#define TRACE_NO_REG      0xFF
+
+// More than one register changed (FX65, ...), reg / value is the first
+#define TRACE_FLAG_MULTI  0x01
+
+// One executed instruction, state after it ran
+struct trace_record {
+    uint16_t pc;
+    uint16_t opcode;
+    uint16_t I;
+    uint8_t  reg;               // V0-VE written, TRACE_NO_REG if none
+    uint8_t  value;
+    uint8_t  vf;
+    uint8_t  flags;
+};
+
+// File layout: header, then chunks of records each behind a chunk header
+struct trace_file_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t compressed;        // chunks are util_delta_encode()d
+    uint32_t reserved;
+};
+
+struct trace_chunk_header {
+    uint32_t count;             // records in the chunk
+    uint32_t size;              // payload bytes that follow
+    uint64_t dropped;           // records lost right before this chunk
+    uint32_t stride;            // compressed: records XORed this far back
+    uint32_t reserved;
+};
+
+struct trace;
+
+// Starts the writer thread. Compressed chunks hold every record XORed with
+// the one a loop iteration earlier, delta encoded: a loop that does the
+// same thing every time around shrinks to next to nothing.
+struct trace *trace_open(const char *filename, bool compress);
+
+// Writes whatever is left and stops the writer. Returns false if any write
+// failed; *dropped gets the number of records the writer couldn't keep up
+// with.
+bool trace_close(struct trace *trace, uint64_t *dropped);
+
+// Appends a record for the instruction that started at pc with registers
+// V_before. Never blocks: with every chunk waiting on the writer the record
+// is counted as dropped instead.
+void trace_add(struct trace *trace, const struct emulator *em, uint16_t pc,
+               uint16_t opcode, const uint8_t V_before[NUM_REGS]);
+
+#endif
@@ -0,0 +1,214 @@
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8_decode.h"
+#include "chip8_trace.h"
+#include "chip8_util.h"
+
+// Prints a trace written by chip8_main --trace, one instruction per line:
+// index, PC, opcode, instruction, I, VF and the register it wrote
+
+static void print_usage(const char *prog_name);
+static bool parse_range(const char *arg, uint16_t *start, uint16_t *end);
+static bool read_chunk(FILE *in, const struct trace_file_header *header,
+                       struct trace_chunk_header *chunk,
+                       struct trace_record *records, uint8_t *packed,
+                       size_t max_records);
+static void print_record(uint64_t index, const struct trace_record *record);
+
+int main(int argc, char *argv[])
+{
+    static const struct option long_options[] = {
+        { "addr", required_argument, NULL, 'a' },
+        { "help", no_argument,       NULL, 'h' },
+        { NULL,   0,                 NULL, 0   }
+    };
+
+    uint16_t start = 0;
+    uint16_t end = MEMORY_SIZE - 1;
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "a:h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'a':
+                if (!parse_range(optarg, &start, &end)) {
+                    printf("ERROR: Bad address range '%s'!\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                return 0;
+            default:
+                print_usage(argv[0]);
+                return -1;
+        }
+    }
+
+    if (optind != argc - 1) {
+        print_usage(argv[0]);
+        return -1;
+    }
+
+    FILE *in = fopen(argv[optind], "rb");
+    if (in == NULL) {
+        printf("ERROR: Unable to open trace %s!\n", argv[optind]);
+        return -1;
+    }
+
+    struct trace_file_header header;
+
+    if (fread(&header, sizeof(header), 1, in) != 1 ||
+        memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != TRACE_VERSION ||
+        header.record_size != sizeof(struct trace_record)) {
+        printf("ERROR: %s isn't a trace this build can read!\n", argv[optind]);
+        fclose(in);
+        return -1;
+    }
+
+    // Chunks never hold more than the writer's ring slots, but the file
+    // says how many, so grow to whatever it claims
+    size_t max_records = 0;
+    struct trace_record *records = NULL;
+    uint8_t *packed = NULL;
+
+    struct trace_chunk_header chunk;
+    uint64_t index = 0;
+    uint64_t dropped = 0;
+    int ret = 0;
+
+    while (fread(&chunk, sizeof(chunk), 1, in) == 1) {
+        if (chunk.count > max_records) {
+            max_records = chunk.count;
+            free(records);
+            free(packed);
+            records = malloc(max_records * sizeof(*records));
+            packed = malloc(UTIL_DELTA_MAX_SIZE(max_records * sizeof(*records)));
+            if (records == NULL || packed == NULL) {
+                printf("ERROR: Out of memory!\n");
+                ret = -1;
+                break;
+            }
+        }
+
+        if (!read_chunk(in, &header, &chunk, records, packed, max_records)) {
+            printf("ERROR: Trace is corrupt after record %" PRIu64 "!\n", index);
+            ret = -1;
+            break;
+        }
+
+        if (chunk.dropped > 0) {
+            printf("-- %" PRIu64 " records dropped --\n", chunk.dropped);
+            index += chunk.dropped;
+            dropped += chunk.dropped;
+        }
+
+        for (uint32_t i = 0; i < chunk.count; i++, index++) {
+            if (records[i].pc >= start && records[i].pc <= end) {
+                print_record(index, &records[i]);
+            }
+        }
+    }
+
+    if (dropped > 0) {
+        printf("-- %" PRIu64 " of %" PRIu64 " records dropped in total --\n",
+               dropped, index);
+    }
+
+    free(records);
+    free(packed);
+    fclose(in);
+
+    return ret;
+}
+
+static void print_usage(const char *prog_name)
+{
+    printf("Usage: %s [options] trace_file\n"
+           "  -a, --addr START-END  only instructions at these addresses (hex,\n"
+           "                        inclusive, e.g. 200-2FF)\n"
+           "  -h, --help            show this message\n",
+           prog_name);
+}
+
+static bool parse_range(const char *arg, uint16_t *start, uint16_t *end)
+{
+    char *rest;
+
+    unsigned long first = strtoul(arg, &rest, 16);
+    unsigned long last = first;
+
+    if (*rest == '-') {
+        last = strtoul(rest + 1, &rest, 16);
+    }
+
+    if (*rest != '\0' || rest == arg || first > last || last >= MEMORY_SIZE) {
+        return false;
+    }
+
+    *start = first;
+    *end = last;
+
+    return true;
+}
+
+static bool read_chunk(FILE *in, const struct trace_file_header *header,
+                       struct trace_chunk_header *chunk,
+                       struct trace_record *records, uint8_t *packed,
+                       size_t max_records)
+{
+    size_t bytes = chunk->count * sizeof(*records);
+
+    if (chunk->count > max_records) {
+        return false;
+    }
+
+    if (!header->compressed) {
+        return chunk->size == bytes &&
+               (bytes == 0 || fread(records, bytes, 1, in) == 1);
+    }
+
+    if (chunk->size > UTIL_DELTA_MAX_SIZE(bytes) ||
+        (chunk->size > 0 && fread(packed, chunk->size, 1, in) != 1)) {
+        return false;
+    }
+
+    // Each record was XORed with the one stride records before it
+    memset(records, 0, bytes);
+    if (!util_delta_apply(records, bytes, packed, chunk->size)) {
+        return false;
+    }
+
+    size_t shift = chunk->stride * sizeof(*records);
+    uint8_t *raw = (uint8_t *)records;
+
+    for (size_t i = shift; i < bytes; i++) {
+        raw[i] ^= raw[i - shift];
+    }
+
+    return true;
+}
+
+static void print_record(uint64_t index, const struct trace_record *record)
+{
+    // Records don't carry the mode, the widest instruction set names them all
+    struct chip8_instr instr;
+    decode_instr(record->opcode, CHIP8_MODE_XOCHIP, &instr);
+
+    printf("%10" PRIu64 "  %03X  %04X  %-4s  I=%03X  VF=%02X",
+           index, record->pc, record->opcode, decode_op_patterns[instr.op],
+           record->I, record->vf);
+
+    if (record->reg != TRACE_NO_REG) {
+        printf("  V%X=%02X%s", record->reg, record->value,
+               (record->flags & TRACE_FLAG_MULTI) ? " +more" : "");
+    }
+
+    printf("\n");
+}
@@ -1,27 +1,28 @@
-#include <ncurses.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <string.h>
+#include <time.h>
 
 #include "chip8_util.h"
 
-/* Chip-8 Key  Keyboard
- * ----------  ---------
- *    1 2 3 C    1 2 3 4
- *    4 5 6 D    q w e r
- *    7 8 9 E    a s d f
- *    A 0 B F    z x c v
- * */
-static const uint8_t chip8_valid_keys[16] = {
-    'x', '1', '2', '3',
-    'q', 'w', 'e', 'a',
-    's', 'd', 'z', 'c',
-    '4', 'r', 'f', 'v'
-};
+void util_delay_ms(uint8_t ms)
+{
+    struct timespec delay = {
+        .tv_sec  = ms / 1000,
+        .tv_nsec = (ms % 1000) * 1000000L
+    };
 
+    nanosleep(&delay, NULL);
+}
 
-void util_delay_ms(uint8_t ms)
+uint64_t util_time_ns(void)
 {
-    napms(ms);
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
 }
 
 uint8_t util_constrain(uint8_t val, uint8_t max)
@@ -29,55 +30,134 @@ uint8_t util_constrain(uint8_t val, uint8_t max)
     return (val % max);
 }
 
-uint8_t util_get_char(void)
+uint64_t util_hash(const void *data, size_t len, uint64_t seed)
+{
+    const uint8_t *bytes = data;
+    uint64_t hash = seed;
+
+    for (size_t i = 0; i < len; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001B3ULL;
+    }
+
+    return hash;
+}
+
+uint8_t util_random_byte(uint32_t *state)
 {
-    return (uint8_t)getch();
+    uint32_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+
+    *state = x;
+
+    return x >> 24;
 }
 
-bool util_is_key_pressed(uint8_t key, bool consume_key)
+size_t util_delta_encode(const void *cur_data, const void *base_data,
+                         size_t len, uint8_t *out)
 {
-    nodelay(stdscr, TRUE);
-    uint8_t pressed = (uint8_t)getch();
-    nodelay(stdscr, FALSE);
+    const uint8_t *cur = cur_data;
+    const uint8_t *base = base_data;
+
+    size_t pos = 0;
+    size_t i = 0;
+
+    while (i < len) {
+        uint16_t zeros = 0;
+
+        // Mostly unchanged, skip it a word at a time
+        while (i + 8 <= len && zeros <= UINT16_MAX - 8) {
+            uint64_t a, b;
+            memcpy(&a, &cur[i], sizeof(a));
+            memcpy(&b, &base[i], sizeof(b));
+            if (a != b) {
+                break;
+            }
+            zeros += 8;
+            i += 8;
+        }
+
+        while (i < len && zeros < UINT16_MAX && cur[i] == base[i]) {
+            zeros++;
+            i++;
+        }
 
-    if (pressed != ERR) {
-        if (!consume_key) {
-            ungetch(pressed);
+        uint16_t literals = 0;
+        while (i + literals < len && literals < UINT16_MAX &&
+               cur[i + literals] != base[i + literals]) {
+            literals++;
+        }
+
+        memcpy(&out[pos], &zeros, sizeof(zeros));
+        memcpy(&out[pos + 2], &literals, sizeof(literals));
+        pos += 4;
+
+        for (uint16_t j = 0; j < literals; j++, i++) {
+            out[pos++] = cur[i] ^ base[i];
         }
     }
 
-    return pressed != ERR && key == pressed;
+    return pos;
 }
 
-uint8_t util_get_hex_key(void)
+bool util_delta_apply(void *state_data, size_t len, const uint8_t *delta,
+                      size_t size)
 {
-    bool valid_key = false;
-    uint8_t pressed_key;
-
-    do {
-        pressed_key = util_get_char();
-
-        if (pressed_key == 'k') {
-            pressed_key = (uint8_t)-1;
-            break;
-        } else if (pressed_key == 'p') {
-            pressed_key = (uint8_t)-2;
-            break;
+    uint8_t *state = state_data;
+
+    size_t pos = 0;
+    size_t i = 0;
+
+    while (pos + 4 <= size) {
+        uint16_t zeros, literals;
+        memcpy(&zeros, &delta[pos], sizeof(zeros));
+        memcpy(&literals, &delta[pos + 2], sizeof(literals));
+        pos += 4;
+
+        i += zeros;
+
+        if (i + literals > len || pos + literals > size) {
+            return false;
         }
 
-        for (uint8_t i = 0; i < sizeof(chip8_valid_keys); i++) {
-            if (pressed_key == chip8_valid_keys[i]) {
-                valid_key = true;
-                pressed_key = i;
-                break;
-            }
+        for (uint16_t j = 0; j < literals; j++) {
+            state[i++] ^= delta[pos++];
         }
-    } while (!valid_key);
+    }
 
-    return pressed_key;
+    return pos == size;
 }
 
-bool util_is_hex_key_pressed(uint8_t key, bool consume_key)
+bool util_key_ring_push(struct key_ring *ring, uint8_t key)
 {
-    return util_is_key_pressed(chip8_valid_keys[key], false);
+    uint8_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint8_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+    // Full, the oldest presses win
+    if ((uint8_t)(head - tail) == KEY_RING_SIZE) {
+        return false;
+    }
+
+    ring->keys[head % KEY_RING_SIZE] = key;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+
+    return true;
+}
+
+bool util_key_ring_pop(struct key_ring *ring, uint8_t *key)
+{
+    uint8_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint8_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    if (head == tail) {
+        return false;
+    }
+
+    *key = ring->keys[tail % KEY_RING_SIZE];
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+
+    return true;
 }
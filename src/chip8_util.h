@@ -1,17 +1,46 @@
 #ifndef CHIP8_UTIL_H
 #define CHIP8_UTIL_H
 
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
-#define MEMORY_SIZE 4096
+// XO-CHIP's 64 KB. CHIP-8 and SUPER-CHIP have 4 KB, addresses through I
+// wrap around there and the rest of memory stays zero.
+#define MEMORY_SIZE  65536
+#define CHIP8_MEMORY_SIZE 4096
+#define PROG_START   512
+#define PROG_SIZE    (CHIP8_MEMORY_SIZE - PROG_START)
+#define XO_PROG_SIZE (MEMORY_SIZE - PROG_START)
 #define STACK_SIZE  16
 #define NUM_REGS    16
 #define NUM_KEYS    16
 
+// Instruction set a ROM was written for, each one a superset of the one
+// before. Chosen per ROM, see chip8_set_mode().
+enum chip8_mode {
+    CHIP8_MODE_CHIP8,
+    CHIP8_MODE_SCHIP,           // 128x64 hi-res, 16x16 sprites, scrolling
+    CHIP8_MODE_XOCHIP,          // + 64 KB memory, two bitplanes
+};
+
+// Memory a machine in mode can address, a power of two
+#define UTIL_MEMORY_SIZE(mode) \
+    ((mode) == CHIP8_MODE_XOCHIP ? MEMORY_SIZE : CHIP8_MEMORY_SIZE)
+
+// Power of two so head / tail can wrap freely
+#define KEY_RING_SIZE 16
+
+// Single producer (input stage) / single consumer (FX0A) queue of key
+// presses. Lock-free, so input may come from another thread.
+struct key_ring {
+    uint8_t keys[KEY_RING_SIZE];
+    _Atomic uint8_t head;   // next slot to write, only the producer moves it
+    _Atomic uint8_t tail;   // next slot to read, only the consumer moves it
+};
+
 struct emulator {
-    // RAM
-    uint8_t  memory[MEMORY_SIZE];
     uint16_t stack[STACK_SIZE];
 
     // Registers
@@ -22,24 +51,53 @@ struct emulator {
     uint8_t  delay;
     uint8_t  sound;
     uint8_t  SP;
+    uint8_t  mode;              // enum chip8_mode
+    uint8_t  quirks;            // enum chip8_quirks_profile
+
+    // SUPER-CHIP FX75 / FX85, kept across runs by the frontend
+    uint8_t  user_flags[NUM_REGS];
+
+    // XO-CHIP F002 / FX3A. There's no audio output, but programs can still
+    // set them.
+    uint8_t  audio_pattern[16];
+    uint8_t  pitch;
 
     // Flags
     bool draw_flag;
     bool emulation_end_flag;
     bool single_step_flag;
 
-    // Keyboard
-    bool    key[NUM_KEYS];
-    uint8_t key_fifo[NUM_KEYS];
-    uint8_t key_fifo_read_ptr;
-    uint8_t key_fifo_write_ptr;
+    // Keyboard: bit N set while hex key N is held, presses queued for FX0A
+    uint16_t keypad;
+    struct key_ring key_presses;
+
+    // RAM, last so snapshots can leave out what the mode can't address
+    uint8_t  memory[MEMORY_SIZE];
 };
 
 void    util_delay_ms(uint8_t ms);
+uint64_t util_time_ns(void);
 uint8_t util_constrain(uint8_t val, uint8_t max);
-uint8_t util_get_char(void);
-bool    util_is_key_pressed(uint8_t key, bool consume_key);
-uint8_t util_get_hex_key(void);
-bool    util_is_hex_key_pressed(uint8_t key, bool consume_key);
+// FNV-1a, 64 bit. Fast, not cryptographic: checksums and content hashes
+#define UTIL_HASH_SEED 0xCBF29CE484222325ULL
+uint64_t util_hash(const void *data, size_t len, uint64_t seed);
+
+// xorshift32, state must never be 0. Top byte returned, the low ones are
+// the weakest.
+uint8_t util_random_byte(uint32_t *state);
+
+// XOR of cur against base, run-length encoded as [unchanged bytes: u16]
+// [changed bytes: u16][their XOR] repeated. Small when the two mostly agree.
+// Every other byte changed is the worst case: 4 header bytes per 2 of data.
+#define UTIL_DELTA_MAX_SIZE(len) (3 * (len) + 4)
+size_t  util_delta_encode(const void *cur, const void *base, size_t len,
+                          uint8_t *out);
+
+// XORs a delta into state (base in, cur out). False if it doesn't fit len.
+bool    util_delta_apply(void *state, size_t len, const uint8_t *delta,
+                         size_t size);
+
+bool    util_key_ring_push(struct key_ring *ring, uint8_t key);
+bool    util_key_ring_pop(struct key_ring *ring, uint8_t *key);
 
 #endif
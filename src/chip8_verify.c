@@ -0,0 +1,652 @@
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8_backend.h"
+#include "chip8_decode.h"
+#include "chip8_emulator.h"
+#include "chip8_input.h"
+#include "chip8_lanes.h"
+#include "chip8_sched.h"
+#include "chip8_util.h"
+
+// Runs the same ROM and input on two engines side by side and stops at the
+// first instruction after which they disagree. Both machines are compared
+// every interval instructions; on a mismatch both go back to the last point
+// they agreed and the interval is bisected down to one instruction.
+//
+// The lanes engines run many machines at once instead, so those are checked
+// once at the end, each lane against a reference run of its own.
+
+#define DEFAULT_INTERVAL   1000
+#define DEFAULT_REFERENCE  "interp"
+#define DEFAULT_CANDIDATE  "jit"
+
+#define DEFAULT_LANES      64
+#define MAX_LISTED_DIFFS   16
+#define MAX_LISTED_LANES   4
+#define NS_PER_SEC         1000000000.0
+
+// One of the two machines, plus where it was when both last agreed
+struct side {
+    const char *name;
+    chip8_ctx *ctx;
+    struct input_log *input_log;
+    struct sched sched;
+
+    struct chip8_snapshot checkpoint;
+    struct sched checkpoint_sched;
+    struct input_log_mark checkpoint_input;
+};
+
+static void print_usage(const char *prog_name);
+static bool parse_engine(const char *name, enum chip8_engine *engine);
+static bool side_init(struct side *side, const char *engine_name,
+                      const char *rom, const char *replay, uint32_t seed,
+                      uint32_t ipf, const enum chip8_quirks_profile *quirks);
+static void side_destroy(struct side *side);
+static uint64_t side_run(struct side *side, uint64_t cycles);
+static void side_checkpoint(struct side *side);
+static void side_rollback(struct side *side);
+static bool states_match(const chip8_ctx *a, const chip8_ctx *b);
+static uint64_t find_divergence(struct side *ref, struct side *cand,
+                                uint64_t cycles);
+static void report_divergence(struct side *ref, struct side *cand,
+                              uint64_t cycles, uint64_t offset);
+static void dump_state(const struct side *side);
+static void dump_differences(const chip8_ctx *a, const chip8_ctx *b);
+static int verify_lanes(const char *reference, const char *candidate,
+                        const char *rom, const char *replay, uint32_t seed,
+                        uint32_t ipf, const enum chip8_quirks_profile *quirks,
+                        uint64_t max_cycles, uint32_t count);
+
+int main(int argc, char *argv[])
+{
+    static const struct option long_options[] = {
+        { "reference", required_argument, NULL, 'r' },
+        { "engine",    required_argument, NULL, 'e' },
+        { "cycles",    required_argument, NULL, 'c' },
+        { "interval",  required_argument, NULL, 'n' },
+        { "ipf",       required_argument, NULL, 'i' },
+        { "seed",      required_argument, NULL, 'S' },
+        { "replay",    required_argument, NULL, 'p' },
+        { "quirks",    required_argument, NULL, 'q' },
+        { "lanes",     required_argument, NULL, 'L' },
+        { "help",      no_argument,       NULL, 'h' },
+        { NULL,        0,                 NULL, 0   }
+    };
+
+    const char *reference = DEFAULT_REFERENCE;
+    const char *candidate = DEFAULT_CANDIDATE;
+    const char *replay = NULL;
+    uint64_t max_cycles = UINT64_MAX;
+    uint64_t interval = DEFAULT_INTERVAL;
+    uint32_t ipf = SCHED_DEFAULT_IPF;
+    uint32_t seed = CHIP8_DEFAULT_SEED;
+    enum chip8_quirks_profile quirks;
+    bool quirks_given = false;
+    uint32_t lanes = DEFAULT_LANES;
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "r:e:c:n:i:S:p:q:L:h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'r':
+                reference = optarg;
+                break;
+            case 'e':
+                candidate = optarg;
+                break;
+            case 'c':
+                max_cycles = strtoull(optarg, NULL, 0);
+                break;
+            case 'n':
+                interval = strtoull(optarg, NULL, 0);
+                break;
+            case 'i':
+                ipf = strtoul(optarg, NULL, 0);
+                break;
+            case 'S':
+                seed = strtoul(optarg, NULL, 0);
+                break;
+            case 'p':
+                replay = optarg;
+                break;
+            case 'q':
+                if (!chip8_quirks_parse(optarg, &quirks)) {
+                    printf("ERROR: Unknown quirk profile '%s'!\n", optarg);
+                    return -1;
+                }
+                quirks_given = true;
+                break;
+            case 'L':
+                lanes = strtoul(optarg, NULL, 0);
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                return 0;
+            default:
+                print_usage(argv[0]);
+                return -1;
+        }
+    }
+
+    if (optind != argc - 1 || interval == 0 || ipf == 0 || lanes == 0) {
+        print_usage(argv[0]);
+        return -1;
+    }
+
+    const char *rom = argv[optind];
+
+    if (strncmp(candidate, "lanes", 5) == 0) {
+        return verify_lanes(reference, candidate, rom, replay, seed, ipf,
+                            quirks_given ? &quirks : NULL, max_cycles, lanes);
+    }
+
+    struct side ref = { .name = reference };
+    struct side cand = { .name = candidate };
+
+    if (!side_init(&ref, reference, rom, replay, seed, ipf,
+                   quirks_given ? &quirks : NULL)) {
+        side_destroy(&ref);
+        return -1;
+    }
+    if (!side_init(&cand, candidate, rom, replay, seed, ipf,
+                   quirks_given ? &quirks : NULL)) {
+        side_destroy(&ref);
+        side_destroy(&cand);
+        return -1;
+    }
+
+    if (replay != NULL && input_log_end_cycles(ref.input_log) != 0 &&
+        input_log_end_cycles(ref.input_log) < max_cycles) {
+        max_cycles = input_log_end_cycles(ref.input_log);
+    }
+
+    side_checkpoint(&ref);
+    side_checkpoint(&cand);
+
+    uint64_t cycles = 0;
+    bool diverged = false;
+    uint64_t start = util_time_ns();
+
+    while (cycles < max_cycles && !chip8_emulation_end_detected(ref.ctx)) {
+        uint64_t budget = max_cycles - cycles < interval ? max_cycles - cycles : interval;
+
+        // The candidate runs exactly as far as the reference got, so a
+        // reference that stops early doesn't read as a divergence
+        uint64_t executed = side_run(&ref, budget);
+
+        if (side_run(&cand, executed) != executed || !states_match(ref.ctx, cand.ctx)) {
+            uint64_t offset = find_divergence(&ref, &cand, executed);
+
+            report_divergence(&ref, &cand, cycles, offset);
+            diverged = true;
+            break;
+        }
+
+        cycles += executed;
+
+        side_checkpoint(&ref);
+        side_checkpoint(&cand);
+
+        if (executed == 0) {
+            break;
+        }
+    }
+
+    double seconds = (util_time_ns() - start) / NS_PER_SEC;
+
+    if (!diverged) {
+        printf("%s and %s agree over %" PRIu64 " instructions, %" PRIu64
+               " frames, state %016" PRIx64 "\n",
+               ref.name, cand.name, cycles, ref.sched.frames,
+               chip8_state_hash(ref.ctx));
+        printf("%.1f Minstr/s\n", seconds > 0 ? cycles / seconds / 1e6 : 0);
+    }
+
+    side_destroy(&ref);
+    side_destroy(&cand);
+
+    return diverged ? 1 : 0;
+}
+
+static void print_usage(const char *prog_name)
+{
+    printf("Usage: %s [options] ROM.ch8\n"
+           "  -r, --reference E  engine trusted to be right (default " DEFAULT_REFERENCE ")\n"
+           "  -e, --engine E     engine being checked (default " DEFAULT_CANDIDATE ")\n"
+           "                     engines: interp, cached, jit, and as the\n"
+           "                     candidate lanes, lanes-avx2, lanes-sse2 or\n"
+           "                     lanes-scalar\n"
+           "  -c, --cycles N     stop after N instructions (default: until the ROM\n"
+           "                     or the replay ends)\n"
+           "  -n, --interval N   instructions between comparisons (default %d)\n"
+           "  -i, --ipf N        instructions per frame (default %d)\n"
+           "  -S, --seed N       CXNN seed (default %d)\n"
+           "  -p, --replay F     feed input recorded by chip8_main --record, its\n"
+           "                     seed, ipf and quirks win over -S, -i and -q\n"
+           "  -q, --quirks P     vip, chip48, schip or xochip (default: the ROM's\n"
+           "                     mode decides)\n"
+           "  -L, --lanes N      machines a lanes engine runs at once, seeds from\n"
+           "                     -S up, each checked against its own reference\n"
+           "                     run at the end (default %d). Needs -c unless the\n"
+           "                     replay says how long it ran.\n"
+           "  -h, --help         show this message\n"
+           "Exits with 1 when the engines diverge.\n",
+           prog_name, DEFAULT_INTERVAL, SCHED_DEFAULT_IPF, CHIP8_DEFAULT_SEED,
+           DEFAULT_LANES);
+}
+
+static bool parse_engine(const char *name, enum chip8_engine *engine)
+{
+    if (strcmp(name, "interp") == 0) {
+        *engine = CHIP8_ENGINE_INTERPRETER;
+    } else if (strcmp(name, "cached") == 0) {
+        *engine = CHIP8_ENGINE_CACHED;
+    } else if (strcmp(name, "jit") == 0) {
+        *engine = CHIP8_ENGINE_JIT;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+static bool side_init(struct side *side, const char *engine_name,
+                      const char *rom, const char *replay, uint32_t seed,
+                      uint32_t ipf, const enum chip8_quirks_profile *quirks)
+{
+    enum chip8_engine engine;
+
+    if (!parse_engine(engine_name, &engine)) {
+        printf("ERROR: Unknown engine '%s'!\n", engine_name);
+        return false;
+    }
+
+    side->ctx = chip8_create(&chip8_backend_null);
+    if (side->ctx == NULL) {
+        printf("ERROR: Unable to create the %s machine!\n", engine_name);
+        return false;
+    }
+
+    chip8_set_mode(side->ctx, chip8_mode_for_rom(rom));
+
+    enum rom_error error = chip8_load(side->ctx, rom);
+    if (error != ROM_OK) {
+        printf("ERROR: Unable to load %s: %s!\n", rom, rom_error_string(error));
+        return false;
+    }
+
+    if (quirks != NULL) {
+        chip8_set_quirks(side->ctx, *quirks);
+    }
+
+    if (!chip8_set_engine(side->ctx, engine)) {
+        printf("ERROR: Engine '%s' is not available!\n", engine_name);
+        return false;
+    }
+
+    // Each side reads the log on its own, so rolling one back doesn't
+    // disturb the other
+    if (replay != NULL) {
+        struct input_log_info info;
+
+        side->input_log = input_log_replay(replay, &info);
+        if (side->input_log == NULL) {
+            printf("ERROR: Unable to read input log %s!\n", replay);
+            return false;
+        }
+
+        if (info.mode > CHIP8_MODE_XOCHIP || !chip8_set_mode(side->ctx, info.mode) ||
+            info.rom_hash != chip8_rom_hash(side->ctx)) {
+            printf("ERROR: %s was recorded with a different ROM!\n", replay);
+            return false;
+        }
+
+        if (!chip8_set_quirks(side->ctx, info.quirks)) {
+            printf("ERROR: %s was recorded with unknown quirks!\n", replay);
+            return false;
+        }
+
+        seed = info.seed;
+        ipf = info.ipf;
+        side->ctx->input_log = side->input_log;
+    }
+
+    chip8_seed_random(side->ctx, seed);
+    sched_init(&side->sched, ipf, 1, true);
+
+    return true;
+}
+
+static void side_destroy(struct side *side)
+{
+    if (side->input_log != NULL) {
+        input_log_close(side->input_log, 0);
+    }
+    if (side->ctx != NULL) {
+        chip8_destroy(side->ctx);
+    }
+}
+
+// Same frame pacing as chip8_main, minus the sleeping
+static uint64_t side_run(struct side *side, uint64_t cycles)
+{
+    uint64_t executed = 0;
+
+    while (executed < cycles && !chip8_emulation_end_detected(side->ctx)) {
+        uint64_t budget = cycles - executed;
+
+        executed += sched_run(&side->sched, side->ctx,
+                              budget > UINT32_MAX ? UINT32_MAX : budget);
+
+        if (sched_frame_done(&side->sched)) {
+            sched_end_frame(&side->sched, side->ctx);
+        }
+    }
+
+    return executed;
+}
+
+static void side_checkpoint(struct side *side)
+{
+    chip8_capture_snapshot(side->ctx, &side->checkpoint);
+    side->checkpoint_sched = side->sched;
+
+    if (side->input_log != NULL) {
+        input_log_mark(side->input_log, &side->checkpoint_input);
+    }
+}
+
+static void side_rollback(struct side *side)
+{
+    chip8_restore_snapshot(side->ctx, &side->checkpoint);
+    side->sched = side->checkpoint_sched;
+
+    if (side->input_log != NULL) {
+        input_log_rewind(side->input_log, &side->checkpoint_input);
+    }
+}
+
+// Everything a program can observe. The opcode latch and draw_flag are
+// bookkeeping that engines are free to handle differently. Compared
+// directly rather than through chip8_state_hash(): a few memcmp()s are
+// cheaper than hashing both machines and say exactly what differs.
+static bool states_match(const chip8_ctx *a, const chip8_ctx *b)
+{
+    const struct emulator *x = &a->em;
+    const struct emulator *y = &b->em;
+
+    return x->PC == y->PC && x->I == y->I && x->SP == y->SP &&
+           x->delay == y->delay && x->sound == y->sound &&
+           x->keypad == y->keypad &&
+           x->emulation_end_flag == y->emulation_end_flag &&
+           x->pitch == y->pitch && a->rng_state == b->rng_state &&
+           a->gfx.hires == b->gfx.hires && a->gfx.planes == b->gfx.planes &&
+           memcmp(x->V, y->V, sizeof(x->V)) == 0 &&
+           memcmp(x->user_flags, y->user_flags, sizeof(x->user_flags)) == 0 &&
+           memcmp(x->audio_pattern, y->audio_pattern, sizeof(x->audio_pattern)) == 0 &&
+           memcmp(x->stack, y->stack, sizeof(x->stack)) == 0 &&
+           memcmp(a->gfx.screen, b->gfx.screen, sizeof(a->gfx.screen)) == 0 &&
+           memcmp(x->memory, y->memory, sizeof(x->memory)) == 0;
+}
+
+// Both sides agree at their checkpoint and disagree cycles instructions
+// later. Returns the smallest count after which they disagree.
+static uint64_t find_divergence(struct side *ref, struct side *cand,
+                                uint64_t cycles)
+{
+    uint64_t low = 1;
+    uint64_t high = cycles;
+
+    while (low < high) {
+        uint64_t mid = low + (high - low) / 2;
+
+        side_rollback(ref);
+        side_rollback(cand);
+
+        uint64_t executed = side_run(ref, mid);
+
+        if (side_run(cand, executed) != executed || !states_match(ref->ctx, cand->ctx)) {
+            high = mid;
+        } else {
+            low = mid + 1;
+        }
+    }
+
+    return low;
+}
+
+static void report_divergence(struct side *ref, struct side *cand,
+                              uint64_t cycles, uint64_t offset)
+{
+    // Back to the last instruction both got right, to see the next one
+    side_rollback(ref);
+    side_rollback(cand);
+    side_run(ref, offset - 1);
+    side_run(cand, offset - 1);
+
+    uint16_t pc = ref->ctx->em.PC;
+    uint16_t opcode = (ref->ctx->em.memory[pc % MEMORY_SIZE] << 8) |
+                      ref->ctx->em.memory[(pc + 1) % MEMORY_SIZE];
+    struct chip8_instr instr;
+
+    decode_instr(opcode, ref->ctx->em.mode, &instr);
+
+    side_run(ref, 1);
+    side_run(cand, 1);
+
+    printf("DIVERGED at instruction %" PRIu64 " (frame %" PRIu64 "): "
+           "%04X: %04X (%s)\n",
+           cycles + offset, ref->sched.frames, pc, opcode,
+           decode_op_patterns[instr.op]);
+
+    dump_state(ref);
+    dump_state(cand);
+    dump_differences(ref->ctx, cand->ctx);
+}
+
+static void dump_state(const struct side *side)
+{
+    const struct emulator *em = &side->ctx->em;
+
+    printf("%-8s PC %04X  I %04X  SP %02X  DT %02X  ST %02X  keys %04X  rng %08" PRIX32 "%s\n",
+           side->name, em->PC, em->I, em->SP, em->delay, em->sound, em->keypad,
+           side->ctx->rng_state, em->emulation_end_flag ? "  ended" : "");
+
+    printf("         V ");
+    for (int i = 0; i < NUM_REGS; i++) {
+        printf(" %02X", em->V[i]);
+    }
+
+    printf("\n         stack");
+    for (int i = 0; i < em->SP && i < STACK_SIZE; i++) {
+        printf(" %04X", em->stack[i]);
+    }
+    printf("\n");
+}
+
+static void dump_differences(const chip8_ctx *a, const chip8_ctx *b)
+{
+    int listed = 0;
+    int count = 0;
+
+    for (int addr = 0; addr < MEMORY_SIZE; addr++) {
+        if (a->em.memory[addr] == b->em.memory[addr]) {
+            continue;
+        }
+
+        if (listed < MAX_LISTED_DIFFS) {
+            printf("memory   %04X: %02X / %02X\n", addr, a->em.memory[addr],
+                   b->em.memory[addr]);
+            listed++;
+        }
+        count++;
+    }
+
+    if (count > listed) {
+        printf("memory   ... %d more bytes differ\n", count - listed);
+    }
+
+    if (a->gfx.hires != b->gfx.hires || a->gfx.planes != b->gfx.planes) {
+        printf("screen   %s planes %X / %s planes %X\n",
+               a->gfx.hires ? "hi-res" : "lo-res", a->gfx.planes,
+               b->gfx.hires ? "hi-res" : "lo-res", b->gfx.planes);
+    }
+
+    for (int plane = 0; plane < GRAPHICS_PLANES; plane++) {
+        for (int row = 0; row < HIRES_ROW_COUNT; row++) {
+            for (int word = 0; word < ROW_WORDS; word++) {
+                graphics_row_t x = a->gfx.screen[plane][row][word];
+                graphics_row_t y = b->gfx.screen[plane][row][word];
+
+                if (x != y) {
+                    printf("screen   plane %d row %2d cols %3d-%3d: %016" PRIX64
+                           " / %016" PRIX64 "\n", plane, row, word * 64,
+                           word * 64 + 63, (uint64_t)x, (uint64_t)y);
+                }
+            }
+        }
+    }
+}
+
+// count machines on the lockstep engine, then each one again on the
+// reference with the same seed (all the replay's with one) and the same
+// number of instructions
+static int verify_lanes(const char *reference, const char *candidate,
+                        const char *rom, const char *replay, uint32_t seed,
+                        uint32_t ipf, const enum chip8_quirks_profile *quirks,
+                        uint64_t max_cycles, uint32_t count)
+{
+    enum lanes_isa isa;
+
+    if (!lanes_isa_parse(candidate, &isa)) {
+        printf("ERROR: Unknown engine '%s'!\n", candidate);
+        return -1;
+    }
+
+    // Where every lane starts from, and later what each one is compared as
+    struct side image = { .name = candidate };
+
+    if (!side_init(&image, "interp", rom, replay, seed, ipf, quirks)) {
+        side_destroy(&image);
+        return -1;
+    }
+
+    if (replay != NULL && input_log_end_cycles(image.input_log) != 0 &&
+        input_log_end_cycles(image.input_log) < max_cycles) {
+        max_cycles = input_log_end_cycles(image.input_log);
+    }
+
+    if (max_cycles == UINT64_MAX) {
+        printf("ERROR: Lanes need --cycles, or a replay that says how long it ran!\n");
+        side_destroy(&image);
+        return -1;
+    }
+
+    struct lanes *lanes = lanes_create(image.ctx, count, image.sched.ipf, isa);
+    struct input_log **logs = calloc(count, sizeof(*logs));
+    int result = -1;
+
+    if (lanes == NULL || logs == NULL) {
+        printf("ERROR: %s needs a plain CHIP-8 ROM and a CPU with %s!\n",
+               candidate, lanes_isa_name(isa));
+        goto out;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (replay == NULL) {
+            lanes_seed_random(lanes, i, seed + i);
+            continue;
+        }
+
+        struct input_log_info info;
+
+        logs[i] = input_log_replay(replay, &info);
+        if (logs[i] == NULL) {
+            printf("ERROR: Unable to read input log %s!\n", replay);
+            goto out;
+        }
+        lanes_set_input_log(lanes, i, logs[i]);
+    }
+
+    uint64_t start = util_time_ns();
+    uint64_t lanes_cycles = lanes_run(lanes, max_cycles);
+    double lanes_seconds = (util_time_ns() - start) / NS_PER_SEC;
+
+    uint64_t ref_cycles = 0;
+    double ref_seconds = 0;
+    uint32_t mismatches = 0;
+    uint32_t faults = 0;
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t lane_seed = replay == NULL ? seed + i : seed;
+
+        if (lanes_lane_status(lanes, i) == LANES_FAULT) {
+            if (faults++ < MAX_LISTED_LANES) {
+                printf("lane %" PRIu32 " (seed %" PRIu32 ") faulted after %" PRIu64
+                       " instructions\n", i, lane_seed, lanes_lane_cycles(lanes, i));
+            }
+            continue;
+        }
+
+        struct side ref = { .name = reference };
+
+        if (!side_init(&ref, reference, rom, replay, lane_seed, ipf, quirks)) {
+            side_destroy(&ref);
+            goto out;
+        }
+
+        start = util_time_ns();
+        uint64_t executed = side_run(&ref, max_cycles);
+        ref_seconds += (util_time_ns() - start) / NS_PER_SEC;
+        ref_cycles += executed;
+
+        lanes_export(lanes, i, image.ctx);
+
+        if (executed != lanes_lane_cycles(lanes, i) || !states_match(ref.ctx, image.ctx)) {
+            if (mismatches++ < MAX_LISTED_LANES) {
+                printf("DIVERGED: lane %" PRIu32 " (seed %" PRIu32 ") after %" PRIu64
+                       " instructions, %s ran %" PRIu64 "\n", i, lane_seed,
+                       lanes_lane_cycles(lanes, i), ref.name, executed);
+                dump_state(&ref);
+                dump_state(&image);
+                dump_differences(ref.ctx, image.ctx);
+            }
+        }
+
+        side_destroy(&ref);
+    }
+
+    if (mismatches == 0 && faults == 0) {
+        printf("%s (%s) and %s agree on %" PRIu32 " machines over %" PRIu64
+               " instructions, %" PRIu64 " frames\n",
+               candidate, lanes_isa_name(isa), reference, count, lanes_cycles,
+               lanes_frames(lanes));
+    } else {
+        printf("%" PRIu32 " of %" PRIu32 " lanes diverged, %" PRIu32 " faulted\n",
+               mismatches, count, faults);
+    }
+
+    printf("%s %.1f Minstr/s, %s %.1f Minstr/s\n",
+           candidate, lanes_seconds > 0 ? lanes_cycles / lanes_seconds / 1e6 : 0,
+           reference, ref_seconds > 0 ? ref_cycles / ref_seconds / 1e6 : 0);
+
+    result = mismatches == 0 && faults == 0 ? 0 : 1;
+
+out:
+    for (uint32_t i = 0; logs != NULL && i < count; i++) {
+        if (logs[i] != NULL) {
+            input_log_close(logs[i], 0);
+        }
+    }
+    free(logs);
+    lanes_destroy(lanes);
+    side_destroy(&image);
+
+    return result;
+}
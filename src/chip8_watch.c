@@ -0,0 +1,89 @@
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "chip8_watch.h"
+
+struct watch {
+    int fd;
+    char name[NAME_MAX + 1];    // of the file, inotify names directory entries
+};
+
+struct watch *watch_open(const char *filename)
+{
+    const char *slash = strrchr(filename, '/');
+    const char *name = slash != NULL ? slash + 1 : filename;
+    char dir[PATH_MAX];
+
+    if (slash == NULL) {
+        snprintf(dir, sizeof(dir), ".");
+    } else if (slash == filename) {
+        snprintf(dir, sizeof(dir), "/");
+    } else if (snprintf(dir, sizeof(dir), "%.*s", (int)(slash - filename),
+                        filename) >= (int)sizeof(dir)) {
+        return NULL;
+    }
+
+    if (strlen(name) > NAME_MAX) {
+        return NULL;
+    }
+
+    struct watch *watch = calloc(1, sizeof(*watch));
+    if (watch == NULL) {
+        return NULL;
+    }
+
+    strcpy(watch->name, name);
+
+    // Written in place, or renamed over the file
+    watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watch->fd < 0 ||
+        inotify_add_watch(watch->fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        watch_close(watch);
+        return NULL;
+    }
+
+    return watch;
+}
+
+void watch_close(struct watch *watch)
+{
+    if (watch == NULL) {
+        return;
+    }
+
+    if (watch->fd >= 0) {
+        close(watch->fd);
+    }
+
+    free(watch);
+}
+
+int watch_fd(const struct watch *watch)
+{
+    return watch->fd;
+}
+
+bool watch_changed(struct watch *watch)
+{
+    // Big enough for at least one event with the longest name
+    _Alignas(struct inotify_event) char buffer[4096];
+    bool changed = false;
+    ssize_t length;
+
+    while ((length = read(watch->fd, buffer, sizeof(buffer))) > 0) {
+        for (ssize_t offset = 0; offset < length;) {
+            const struct inotify_event *event = (const void *)&buffer[offset];
+
+            changed |= event->len > 0 && strcmp(event->name, watch->name) == 0;
+            offset += sizeof(*event) + event->len;
+        }
+    }
+
+    return changed;
+}
@@ -0,0 +1,21 @@
+#ifndef CHIP8_WATCH_H
+#define CHIP8_WATCH_H
+
+#include <stdbool.h>
+
+// Notices a file being saved, through inotify on its directory. Editors
+// write in place or write a new file and rename it over the old one, the
+// directory sees both.
+struct watch;
+
+// NULL if inotify isn't available or the directory can't be watched
+struct watch *watch_open(const char *filename);
+void watch_close(struct watch *watch);
+
+// Non-blocking, readable whenever watch_changed() has something to say
+int watch_fd(const struct watch *watch);
+
+// Reads all pending events, true if any was about the file
+bool watch_changed(struct watch *watch);
+
+#endif
@@ -1,9 +1,12 @@
+#include "chip8_backend.h"
 #include "chip8_graphics.h"
 #include "chip8_util.h"
 
 int main()
 {
-    graphics_init();
+    struct graphics gfx;
+
+    graphics_init(&gfx, &chip8_backend_ncurses);
 
     uint8_t sprite[5] = {
         0x24, 0x00, 0x00, 0x81, 0x7E
@@ -12,23 +15,23 @@ int main()
     for (int row = 0; row < 32; row++) {
         for (int col = 0; col < 64; col++) {
             if ((row + col) % 2 == 0) {
-                graphics_toggle_pixel(row, col);
+                graphics_toggle_pixel(&gfx, row, col);
             }
 
             util_delay_ms(1);
 
-            graphics_refresh_screen();
+            graphics_refresh_screen(&gfx);
         }
     }
 
-    util_get_char();
+    chip8_backend_ncurses.get_char();
 
-    graphics_clear_screen();
-    graphics_draw_sprite(13, 28, sprite, sizeof(sprite));
-    graphics_refresh_screen();
-    util_get_char();
+    graphics_clear_screen(&gfx);
+    graphics_draw_sprite(&gfx, 13, 28, sprite, sizeof(sprite));
+    graphics_refresh_screen(&gfx);
+    chip8_backend_ncurses.get_char();
 
-    graphics_deinit();
+    graphics_deinit(&gfx);
 
     return 0;
 }
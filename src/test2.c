@@ -1,9 +1,12 @@
+#include "chip8_backend.h"
 #include "chip8_graphics.h"
 #include "chip8_util.h"
 
 int main()
 {
-    graphics_init();
+    struct graphics gfx;
+
+    graphics_init(&gfx, &chip8_backend_ncurses);
 
     uint8_t sprite[5] = {
         0x24, 0x00, 0x00, 0x81, 0x7E
@@ -12,19 +15,19 @@ int main()
     uint8_t row = 13;
     uint8_t col = 58;
 
-    graphics_clear_screen();
-    graphics_draw_sprite(row, col, sprite, sizeof(sprite));
-    graphics_refresh_screen();
-    util_get_char();
+    graphics_clear_screen(&gfx);
+    graphics_draw_sprite(&gfx, row, col, sprite, sizeof(sprite));
+    graphics_refresh_screen(&gfx);
+    chip8_backend_ncurses.get_char();
 
-    while (!util_is_key_pressed('q', true)) {
-        graphics_clear_screen();
-        graphics_draw_sprite(++row, ++col, sprite, sizeof(sprite));
-        graphics_refresh_screen();
+    while (!chip8_backend_ncurses.is_key_pressed('q', true)) {
+        graphics_clear_screen(&gfx);
+        graphics_draw_sprite(&gfx, ++row, ++col, sprite, sizeof(sprite));
+        graphics_refresh_screen(&gfx);
         util_delay_ms(100);
     }
 
-    graphics_deinit();
+    graphics_deinit(&gfx);
 
     return 0;
 }
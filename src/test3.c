@@ -1,11 +1,12 @@
+#include "chip8_backend.h"
 #include "chip8_emulator.h"
 #include "chip8_util.h"
 
 int main()
 {
-    chip8_init();
-    util_get_char();
-    chip8_deinit();
+    chip8_ctx *ctx = chip8_create(&chip8_backend_ncurses);
+    chip8_backend_ncurses.get_char();
+    chip8_destroy(ctx);
 
     return 0;
 }
@@ -1,16 +1,19 @@
+#include "chip8_backend.h"
 #include "chip8_emulator.h"
 #include "chip8_util.h"
 
 int main(int argc, char *argv[])
 {
-    chip8_init();
-    util_get_char();
+    chip8_ctx *ctx = chip8_create(&chip8_backend_ncurses);
 
-    if (argc > 1) {
-        chip8_load(argv[1]);
+    chip8_backend_ncurses.get_char();
+
+    if (argc > 1 && chip8_load(ctx, argv[1]) != ROM_OK) {
+        chip8_destroy(ctx);
+        return -1;
     }
 
-    chip8_deinit();
+    chip8_destroy(ctx);
 
     return 0;
 }